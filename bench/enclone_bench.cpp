@@ -0,0 +1,574 @@
+#include <encloned/Chunker.hpp>
+#include <encloned/Encryption.hpp>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <boost/program_options.hpp>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <new>
+#include <random>
+
+// enclone_bench - throughput of the crypto path (Encryption::encryptFile,
+// decryptFile, hashFile, hashPath, base64_encode/decode, deriveKey and content
+// defined chunking) over a range of file sizes, chunk sizes and page cache
+// states, so a change can be compared against the previous build before it is
+// deployed. Each result is the median of repeated runs, with allocations
+// (operator new) per operation. Use --format csv or jsonl for output that can
+// be diffed or plotted
+
+namespace fs = std::filesystem;
+namespace po = boost::program_options;
+
+// count every C++ allocation made by the code under test
+namespace {
+std::atomic<uint64_t> allocCount{0};
+std::atomic<uint64_t> allocBytes{0};
+
+void *countedAlloc(size_t size, size_t align = 0) {
+  allocCount.fetch_add(1, std::memory_order_relaxed);
+  allocBytes.fetch_add(size, std::memory_order_relaxed);
+  size = std::max<size_t>(size, 1);
+  void *p;
+  if (align != 0) {
+    // aligned_alloc needs a multiple of the alignment
+    p = std::aligned_alloc(align, (size + align - 1) / align * align);
+  } else {
+    p = std::malloc(size);
+  }
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+}  // namespace
+
+void *operator new(size_t size) { return countedAlloc(size); }
+void *operator new[](size_t size) { return countedAlloc(size); }
+void *operator new(size_t size, std::align_val_t align) {
+  return countedAlloc(size, (size_t)align);
+}
+void *operator new[](size_t size, std::align_val_t align) {
+  return countedAlloc(size, (size_t)align);
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+void operator delete[](void *p, size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+
+namespace {
+
+struct Settings {
+  std::vector<uint64_t> sizes;
+  std::vector<uint64_t> chunkSizes;
+  std::vector<uint64_t> base64Sizes;
+  std::vector<string> caches;
+  std::vector<string> ops;
+  uint64_t segmentSize;
+  uint64_t cdcAverageSize;
+  int compressionLevel;
+  uint8_t cipher;
+  unsigned int threads;
+  string data;
+  double minTime;
+  int minRuns;
+  int maxRuns;
+  fs::path dir;
+  string format;
+};
+
+struct Result {
+  string op;
+  uint64_t size = 0;  // bytes per operation, 0 if not applicable
+  uint64_t chunkSize = 0;
+  string cache = "-";
+  int ops = 0;  // operations timed
+  double seconds = 0;  // median per operation
+  double allocs = 0;   // per operation
+  double allocBytes = 0;
+};
+
+// "64K", "1M" etc. as used by encloned.conf
+uint64_t parseSize(const string &s) {
+  size_t pos;
+  uint64_t value = std::stoull(s, &pos);
+  if (pos < s.size()) {
+    switch (toupper(s[pos])) {
+      case 'K':
+        value <<= 10;
+        break;
+      case 'M':
+        value <<= 20;
+        break;
+      case 'G':
+        value <<= 30;
+        break;
+      default:
+        throw std::invalid_argument("invalid size: " + s);
+    }
+  }
+  return value;
+}
+
+std::vector<string> split(const string &s) {
+  std::vector<string> out;
+  std::stringstream ss(s);
+  string item;
+  while (std::getline(ss, item, ',')) {
+    if (!item.empty()) {
+      out.push_back(item);
+    }
+  }
+  return out;
+}
+
+std::vector<uint64_t> parseSizes(const string &s) {
+  std::vector<uint64_t> out;
+  for (const string &item : split(s)) {
+    out.push_back(parseSize(item));
+  }
+  return out;
+}
+
+string formatSize(uint64_t size) {
+  if (size == 0) {
+    return "-";
+  }
+  const char *suffix[] = {"", "K", "M", "G"};
+  int i = 0;
+  while (i < 3 && size % 1024 == 0) {
+    size /= 1024;
+    i++;
+  }
+  return std::to_string(size) + suffix[i];
+}
+
+bool wanted(const Settings &settings, const string &op) {
+  return std::find(settings.ops.begin(), settings.ops.end(), op) !=
+         settings.ops.end();
+}
+
+// test data - random bytes don't compress, text does
+void writeFile(const fs::path &path, uint64_t size, const string &data) {
+  static const char *words[] = {"the ",   "encrypted ", "file ",   "index ",
+                                "remote ", "segment ",  "chunk ",  "hash ",
+                                "watch ",  "upload\n",  "backup ", "key "};
+  std::vector<unsigned char> buf(1024 * 1024);
+  std::mt19937 rng(size);
+  FILE *fp = fopen(path.c_str(), "wb");
+  if (fp == NULL) {
+    throw std::runtime_error("can't write " + path.string());
+  }
+  for (uint64_t done = 0; done < size;) {
+    size_t n = std::min((uint64_t)buf.size(), size - done);
+    if (data == "text") {
+      for (size_t i = 0; i < n;) {
+        const char *w = words[rng() % 12];
+        for (; *w != '\0' && i < n; w++) {
+          buf[i++] = *w;
+        }
+      }
+    } else {
+      randombytes_buf(buf.data(), n);
+    }
+    fwrite(buf.data(), 1, n, fp);
+    done += n;
+  }
+  fclose(fp);
+}
+
+// put a file in the page cache, or take it out again
+void setCache(const fs::path &path, const string &cache) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  if (cache == "cold") {
+    fdatasync(fd);  // dirty pages can't be dropped
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  } else {
+    std::vector<char> buf(1024 * 1024);
+    while (read(fd, buf.data(), buf.size()) > 0) {
+    }
+  }
+  close(fd);
+}
+
+// time op until minTime has passed (within minRuns/maxRuns), calling prepare
+// untimed before each run. Fast operations are batched so each timed run is
+// at least 1ms
+Result measure(const Settings &settings, const std::function<void()> &op,
+               const std::function<void()> &prepare = nullptr) {
+  using clock = std::chrono::steady_clock;
+  Result result;
+  int batch = 1;
+  if (!prepare) {
+    for (;;) {
+      auto t1 = clock::now();
+      for (int i = 0; i < batch; i++) {
+        op();
+      }
+      if (clock::now() - t1 >= std::chrono::milliseconds(1) ||
+          batch >= (1 << 20)) {
+        break;
+      }
+      batch *= 2;
+    }
+  }
+
+  std::vector<double> runs;
+  double total = 0;
+  uint64_t allocs = 0, bytes = 0;
+  while ((int)runs.size() < settings.minRuns ||
+         (total < settings.minTime && (int)runs.size() < settings.maxRuns)) {
+    if (prepare) {
+      prepare();
+    }
+    uint64_t allocs0 = allocCount.load(), bytes0 = allocBytes.load();
+    auto t1 = clock::now();
+    for (int i = 0; i < batch; i++) {
+      op();
+    }
+    double secs = std::chrono::duration<double>(clock::now() - t1).count();
+    allocs += allocCount.load() - allocs0;
+    bytes += allocBytes.load() - bytes0;
+    runs.push_back(secs / batch);
+    total += secs;
+  }
+  std::sort(runs.begin(), runs.end());
+  uint64_t ops = runs.size() * (uint64_t)batch;
+  result.ops = ops;
+  result.seconds = runs[runs.size() / 2];
+  result.allocs = (double)allocs / ops;
+  result.allocBytes = (double)bytes / ops;
+  return result;
+}
+
+class Output {
+ public:
+  explicit Output(const string &format) : format(format) {
+    if (format == "csv") {
+      cout << "op,size,chunk_size,cache,ops,seconds,mb_per_s,ops_per_s,"
+              "allocs_per_op,alloc_bytes_per_op"
+           << endl;
+    } else if (format == "text") {
+      printf("%-14s %8s %8s %5s %8s %12s %12s %12s %10s\n", "op", "size",
+             "chunk", "cache", "ops", "MB/s", "ops/s", "allocs/op",
+             "KB/op");
+    }
+  }
+
+  void write(const Result &r) {
+    double mbs = r.size ? r.size / r.seconds / (1024 * 1024) : 0;
+    double opss = 1 / r.seconds;
+    if (format == "csv") {
+      printf("%s,%llu,%llu,%s,%d,%.9g,%.6g,%.6g,%.6g,%.6g\n", r.op.c_str(),
+             (unsigned long long)r.size, (unsigned long long)r.chunkSize,
+             r.cache.c_str(), r.ops, r.seconds, mbs, opss, r.allocs,
+             r.allocBytes);
+    } else if (format == "jsonl") {
+      printf(
+          "{\"op\":\"%s\",\"size\":%llu,\"chunk_size\":%llu,\"cache\":\"%s\","
+          "\"ops\":%d,\"seconds\":%.9g,\"mb_per_s\":%.6g,\"ops_per_s\":%.6g,"
+          "\"allocs_per_op\":%.6g,\"alloc_bytes_per_op\":%.6g}\n",
+          r.op.c_str(), (unsigned long long)r.size,
+          (unsigned long long)r.chunkSize, r.cache.c_str(), r.ops, r.seconds,
+          mbs, opss, r.allocs, r.allocBytes);
+    } else {
+      printf("%-14s %8s %8s %5s %8d %12.1f %12.1f %12.1f %10.1f\n",
+             r.op.c_str(), formatSize(r.size).c_str(),
+             formatSize(r.chunkSize).c_str(), r.cache.c_str(), r.ops, mbs,
+             opss, r.allocs, r.allocBytes / 1024);
+    }
+    fflush(stdout);
+  }
+
+ private:
+  string format;
+};
+
+void benchFiles(const Settings &settings, const unsigned char *key,
+                Output &out) {
+  fs::path plain = settings.dir / ("enclone_bench." +
+                                   std::to_string(getpid()) + ".plain");
+  fs::path enc = plain;
+  enc.replace_extension(".enc");
+  fs::path dec = plain;
+  dec.replace_extension(".dec");
+  if (!wanted(settings, "encryptFile") && !wanted(settings, "decryptFile") &&
+      !wanted(settings, "hashFile")) {
+    return;
+  }
+
+  for (uint64_t size : settings.sizes) {
+    writeFile(plain, size, settings.data);
+    for (const string &cache : settings.caches) {
+      for (uint64_t chunkSize : settings.chunkSizes) {
+        EncryptOptions options;
+        options.chunkSize = chunkSize;
+        options.cipher = settings.cipher;
+        options.segmentSize =
+            Segment::validSize(settings.segmentSize, chunkSize)
+                ? settings.segmentSize
+                : 0;
+        options.threads = settings.threads;
+        options.compressionLevel = settings.compressionLevel;
+
+        // decryptFile needs the object
+        if (wanted(settings, "decryptFile") &&
+            Encryption::encryptFile(enc.c_str(), plain.c_str(), key,
+                                    options) != 0) {
+          throw std::runtime_error("encryptFile failed");
+        }
+        if (wanted(settings, "encryptFile")) {
+          setCache(plain, cache);
+          Result r = measure(
+              settings,
+              [&]() {
+                Encryption::encryptFile(enc.c_str(), plain.c_str(), key,
+                                        options);
+              },
+              [&]() { setCache(plain, cache); });
+          r.op = "encryptFile";
+          r.size = size;
+          r.chunkSize = chunkSize;
+          r.cache = cache;
+          out.write(r);
+        }
+        if (wanted(settings, "decryptFile")) {
+          setCache(enc, cache);
+          Result r = measure(
+              settings,
+              [&]() {
+                if (Encryption::decryptFile(dec.c_str(), enc.c_str(), key,
+                                            settings.threads) != 0) {
+                  throw std::runtime_error("decryptFile failed");
+                }
+              },
+              [&]() { setCache(enc, cache); });
+          r.op = "decryptFile";
+          r.size = size;
+          r.chunkSize = chunkSize;
+          r.cache = cache;
+          out.write(r);
+        }
+      }
+      if (wanted(settings, "hashFile")) {
+        setCache(plain, cache);
+        Result r = measure(
+            settings,
+            [&]() {
+              Encryption::hashFile(plain.string(),
+                                   FileHasher::DEFAULT_ALGORITHM,
+                                   settings.threads);
+            },
+            [&]() { setCache(plain, cache); });
+        r.op = "hashFile";
+        r.size = size;
+        r.cache = cache;
+        out.write(r);
+      }
+    }
+  }
+  fs::remove(plain);
+  fs::remove(enc);
+  fs::remove(dec);
+}
+
+void benchMemory(const Settings &settings, Output &out) {
+  if (wanted(settings, "hashPath")) {
+    Result r = measure(settings, []() { Encryption::hashPath("/a/b/c"); });
+    r.op = "hashPath";
+    out.write(r);
+  }
+  for (uint64_t size : settings.base64Sizes) {
+    std::vector<unsigned char> in(size);
+    randombytes_buf(in.data(), in.size());
+    string encoded = Encryption::base64_encode(in.data(), in.size());
+    if (wanted(settings, "base64_encode")) {
+      Result r = measure(settings, [&]() {
+        Encryption::base64_encode(in.data(), in.size());
+      });
+      r.op = "base64_encode";
+      r.size = size;
+      out.write(r);
+    }
+    if (wanted(settings, "base64_decode")) {
+      Result r =
+          measure(settings, [&]() { Encryption::base64_decode(encoded); });
+      r.op = "base64_decode";
+      r.size = size;
+      out.write(r);
+    }
+  }
+  if (wanted(settings, "cdc")) {
+    // finding chunk boundaries only - chunks are hashed and encrypted after
+    Chunker chunker(settings.cdcAverageSize);
+    for (uint64_t size : settings.sizes) {
+      std::vector<unsigned char> in(size);
+      randombytes_buf(in.data(), in.size());
+      Result r = measure(settings, [&]() {
+        size_t pos = 0;
+        while (pos < in.size()) {
+          pos += chunker.cut(in.data() + pos, in.size() - pos);
+        }
+      });
+      r.op = "cdc";
+      r.size = size;
+      r.chunkSize = settings.cdcAverageSize;
+      out.write(r);
+    }
+  }
+  if (wanted(settings, "deriveKey")) {
+    // Argon2 - the cost of finding an index backup by its legacy name
+    Result r = measure(settings, []() { Encryption::deriveKey("password"); });
+    r.op = "deriveKey";
+    out.write(r);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  Settings settings;
+  string sizes, chunkSizes, base64Sizes, caches, ops, segmentSize, cipher,
+      cdcAverageSize;
+  unsigned int defaultThreads =
+      std::min(4u, std::max(1u, std::thread::hardware_concurrency()));
+
+  po::options_description desc("enclone_bench options");
+  desc.add_options()("help,h", "display this help message")(
+      "sizes", po::value<string>(&sizes)->default_value("1K,64K,1M,16M,256M"),
+      "file sizes, up to 4G")(
+      "chunk-sizes",
+      po::value<string>(&chunkSizes)->default_value("64K"),
+      "encryption chunk sizes (chunk_size), 4K - 4M")(
+      "segment-size",
+      po::value<string>(&segmentSize)->default_value("8M"),
+      "segment_size, 0 to disable segmenting")(
+      "cdc-average-size",
+      po::value<string>(&cdcAverageSize)->default_value("1M"),
+      "cdc_average_size, reported as the chunk size of cdc")(
+      "base64-sizes",
+      po::value<string>(&base64Sizes)->default_value("66,1K,64K,1M"),
+      "base64 input sizes - object names are 66 bytes")(
+      "cache", po::value<string>(&caches)->default_value("warm"),
+      "page cache state of input files: warm, cold or warm,cold")(
+      "ops",
+      po::value<string>(&ops)->default_value(
+          "encryptFile,decryptFile,hashFile,hashPath,base64_encode,"
+          "base64_decode,deriveKey,cdc"),
+      "operations to measure")(
+      "threads", po::value<unsigned int>(&settings.threads)
+                     ->default_value(defaultThreads),
+      "encryption_threads, also used for decryptFile and hashFile")(
+      "compression-level",
+      po::value<int>(&settings.compressionLevel)->default_value(0),
+      "zstd level, 0 to not compress")(
+      "cipher",
+      po::value<string>(&cipher)->default_value("xchacha20poly1305"),
+      "xchacha20poly1305 or aes256gcm")(
+      "data", po::value<string>(&settings.data)->default_value("random"),
+      "file contents: random (incompressible) or text")(
+      "min-time", po::value<double>(&settings.minTime)->default_value(1.0),
+      "seconds to repeat each measurement for")(
+      "min-runs", po::value<int>(&settings.minRuns)->default_value(3),
+      "fewest runs of each measurement")(
+      "max-runs", po::value<int>(&settings.maxRuns)->default_value(1000),
+      "most runs of each measurement")(
+      "dir",
+      po::value<string>()->default_value(fs::temp_directory_path().string()),
+      "directory for test files - needs twice the largest size free")(
+      "format", po::value<string>(&settings.format)->default_value("text"),
+      "text, csv or jsonl");
+
+  try {
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+    if (vm.count("help")) {
+      cout << desc << endl;
+      return 0;
+    }
+    settings.sizes = parseSizes(sizes);
+    settings.chunkSizes = parseSizes(chunkSizes);
+    settings.base64Sizes = parseSizes(base64Sizes);
+    settings.segmentSize = parseSize(segmentSize);
+    settings.cdcAverageSize = parseSize(cdcAverageSize);
+    if (!Chunker::validSize(settings.cdcAverageSize)) {
+      throw std::invalid_argument(
+          "cdc average size must be a power of two, 64K - 1M");
+    }
+    settings.caches = split(caches);
+    settings.ops = split(ops);
+    settings.dir = vm["dir"].as<string>();
+    settings.threads = std::max(settings.threads, 1u);
+    settings.minRuns = std::max(settings.minRuns, 1);
+    for (uint64_t chunkSize : settings.chunkSizes) {
+      if (chunkSize < ObjectHeader::MIN_CHUNK_SIZE ||
+          chunkSize > ObjectHeader::MAX_CHUNK_SIZE) {
+        throw std::invalid_argument("chunk sizes must be 4K - 4M");
+      }
+    }
+    for (const string &cache : settings.caches) {
+      if (cache != "warm" && cache != "cold") {
+        throw std::invalid_argument("--cache must be warm and/or cold");
+      }
+    }
+    if (settings.format != "text" && settings.format != "csv" &&
+        settings.format != "jsonl") {
+      throw std::invalid_argument("--format must be text, csv or jsonl");
+    }
+    if (cipher == "aes256gcm") {
+      settings.cipher = ChunkCipher::AES256GCM;
+    } else if (cipher == "xchacha20poly1305") {
+      settings.cipher = ChunkCipher::XCHACHA20POLY1305;
+    } else {
+      throw std::invalid_argument("unknown --cipher " + cipher);
+    }
+  } catch (std::exception &e) {
+    std::cerr << "error: " << e.what() << endl;
+    return 1;
+  }
+
+  if (sodium_init() != 0) {
+    std::cerr << "error: can't initialise libsodium" << endl;
+    return 1;
+  }
+  if (!ChunkCipher::available(settings.cipher)) {
+    std::cerr << "error: " << cipher << " is not supported on this CPU" << endl;
+    return 1;
+  }
+  if (settings.format == "text") {
+    cout << "cipher " << cipher << ", segment size "
+         << formatSize(settings.segmentSize) << ", " << settings.threads
+         << " threads, " << settings.data << " data, compression level "
+         << settings.compressionLevel << endl;
+  }
+
+  unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES];
+  crypto_secretstream_xchacha20poly1305_keygen(key);
+  Output out(settings.format);
+  try {
+    benchFiles(settings, key, out);
+    benchMemory(settings, out);
+  } catch (std::exception &e) {
+    std::cerr << "error: " << e.what() << endl;
+    return 1;
+  }
+  return 0;
+}
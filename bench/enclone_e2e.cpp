@@ -0,0 +1,644 @@
+#include <encloned/ChunkCipher.hpp>
+#include <fcntl.h>
+#include <signal.h>
+#include <sodium.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <boost/program_options.hpp>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// enclone_e2e - throughput of the whole pipeline: encloned is started in a
+// scratch directory, a synthetic tree is watched (scanned, hashed, encrypted
+// and uploaded) and then restored (downloaded, decrypted and verified). Runs
+// against a local S3-compatible store (e.g. MinIO, with --endpoint) or the
+// local backend, so it needs no AWS account. Reports files/s and MB/s of
+// each phase, the latency of each stage per file from the daemon's stats
+// command, and the daemon's peak RSS. Use --format csv or jsonl for output
+// that can be diffed between builds
+
+namespace fs = std::filesystem;
+namespace asio = boost::asio;
+namespace po = boost::program_options;
+using boost::asio::local::stream_protocol;
+using std::cout;
+using std::endl;
+using std::string;
+
+namespace {
+
+const char *SOCKET_FILE = "/tmp/encloned";  // as Socket::SOCKET_FILE
+
+struct Settings {
+  uint64_t files;
+  std::vector<std::pair<uint64_t, unsigned int>> mix;  // size, weight
+  uint64_t filesPerDir;
+  string data;
+  fs::path tree;  // existing tree, or where to generate one
+  bool generate;
+  fs::path workDir;
+  fs::path encloned;
+  std::vector<string> conf;  // encloned.conf lines
+  string cipher;
+  double poll;
+  double stallTimeout;
+  bool verify;
+  bool keep;
+  string format;
+};
+
+struct Stage {
+  uint64_t count = 0;
+  uint64_t bytes = 0;
+  long long p50 = 0, p90 = 0, p99 = 0, max = 0;  // microseconds
+};
+
+struct Result {
+  string name;
+  uint64_t files = 0;
+  uint64_t bytes = 0;
+  double seconds = 0;  // 0 for a stage
+  Stage latency;
+  long long peakRssKB = 0;  // 0 if not measured
+};
+
+// "64K", "1M" etc. as used by encloned.conf
+uint64_t parseSize(const string &s) {
+  size_t pos;
+  uint64_t value = std::stoull(s, &pos);
+  if (pos < s.size()) {
+    switch (toupper(s[pos])) {
+      case 'K':
+        value <<= 10;
+        break;
+      case 'M':
+        value <<= 20;
+        break;
+      case 'G':
+        value <<= 30;
+        break;
+      default:
+        throw std::invalid_argument("invalid size: " + s);
+    }
+  }
+  return value;
+}
+
+std::vector<string> split(const string &s, char delim = ',') {
+  std::vector<string> out;
+  std::stringstream ss(s);
+  string item;
+  while (std::getline(ss, item, delim)) {
+    if (!item.empty()) {
+      out.push_back(item);
+    }
+  }
+  return out;
+}
+
+// "4K:60,64K:30,1M:9,32M:1" - sizes and how many files in every 100 (or in
+// every sum of the weights) have around that size
+std::vector<std::pair<uint64_t, unsigned int>> parseMix(const string &s) {
+  std::vector<std::pair<uint64_t, unsigned int>> mix;
+  for (const string &item : split(s)) {
+    auto parts = split(item, ':');
+    if (parts.size() != 2 || std::stoul(parts[1]) == 0) {
+      throw std::invalid_argument("invalid --mix entry: " + item);
+    }
+    mix.emplace_back(parseSize(parts[0]), std::stoul(parts[1]));
+  }
+  if (mix.empty()) {
+    throw std::invalid_argument("--mix is empty");
+  }
+  return mix;
+}
+
+void writeFile(const fs::path &path, uint64_t size, const string &data,
+               std::mt19937_64 &rng, std::vector<unsigned char> &buf) {
+  static const char *words[] = {"the ",   "encrypted ", "file ",   "index ",
+                                "remote ", "segment ",  "chunk ",  "hash ",
+                                "watch ",  "upload\n",  "backup ", "key "};
+  FILE *fp = fopen(path.c_str(), "wb");
+  if (fp == NULL) {
+    throw std::runtime_error("can't write " + path.string());
+  }
+  for (uint64_t done = 0; done < size;) {
+    size_t n = std::min((uint64_t)buf.size(), size - done);
+    if (data == "text") {
+      for (size_t i = 0; i < n;) {
+        const char *w = words[rng() % 12];
+        for (; *w != '\0' && i < n; w++) {
+          buf[i++] = *w;
+        }
+      }
+    } else {
+      randombytes_buf(buf.data(), n);  // every file unique, nothing dedups
+    }
+    fwrite(buf.data(), 1, n, fp);
+    done += n;
+  }
+  fclose(fp);
+}
+
+// files spread over directories of filesPerDir, sizes drawn from the mix with
+// +-50% so they don't all fall on the same part and pack boundaries
+void generateTree(const Settings &settings) {
+  std::mt19937_64 rng(settings.files);
+  std::vector<unsigned int> weights;
+  for (const auto &[size, weight] : settings.mix) {
+    weights.push_back(weight);
+  }
+  std::discrete_distribution<size_t> pick(weights.begin(), weights.end());
+  std::vector<unsigned char> buf(1024 * 1024);
+  char name[32];
+  for (uint64_t i = 0; i < settings.files; i++) {
+    fs::path dir = settings.tree;
+    snprintf(name, sizeof name, "d%06llu",
+             (unsigned long long)(i / settings.filesPerDir));
+    dir /= name;
+    if (i % settings.filesPerDir == 0) {
+      fs::create_directories(dir);
+    }
+    uint64_t size = settings.mix[pick(rng)].first;
+    size = std::max<uint64_t>(1, size / 2 + rng() % (size + 1));
+    snprintf(name, sizeof name, "f%09llu", (unsigned long long)i);
+    writeFile(dir / name, size, settings.data, rng, buf);
+    if (settings.format == "text" && (i + 1) % 100000 == 0) {
+      std::cerr << "generated " << i + 1 << " files" << endl;
+    }
+  }
+}
+
+std::pair<uint64_t, uint64_t> treeSize(const fs::path &tree) {
+  uint64_t files = 0, bytes = 0;
+  for (const auto &entry : fs::recursive_directory_iterator(tree)) {
+    if (entry.is_regular_file()) {
+      files++;
+      bytes += entry.file_size();
+    }
+  }
+  return {files, bytes};
+}
+
+// as enclone::sendRequest - responses end with ";"
+string request(const string &req) {
+  asio::io_service io_service;
+  stream_protocol::socket socket(io_service);
+  socket.connect(stream_protocol::endpoint(SOCKET_FILE));
+  asio::write(socket, asio::buffer(req));
+  asio::streambuf response;
+  asio::read_until(socket, response, ";");
+  return string(asio::buffers_begin(response.data()),
+                asio::buffers_end(response.data()) - 1);
+}
+
+bool socketOpen() {
+  try {
+    asio::io_service io_service;
+    stream_protocol::socket socket(io_service);
+    socket.connect(stream_protocol::endpoint(SOCKET_FILE));
+    return true;
+  } catch (const std::exception &e) {
+    return false;
+  }
+}
+
+std::map<string, Stage> stats(bool reset) {
+  std::map<string, Stage> stages;
+  std::istringstream report(request(reset ? "stats|reset" : "stats|"));
+  string line;
+  std::getline(report, line);  // header
+  while (std::getline(report, line)) {
+    std::istringstream fields(line);
+    string name;
+    Stage stage;
+    if (fields >> name >> stage.count >> stage.bytes >> stage.p50 >>
+        stage.p90 >> stage.p99 >> stage.max) {
+      stages[name] = stage;
+    }
+  }
+  return stages;
+}
+
+// VmHWM - the peak resident set size since start, or since clearPeakRss
+long long peakRssKB(pid_t pid) {
+  std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+  string line;
+  while (std::getline(status, line)) {
+    if (line.rfind("VmHWM:", 0) == 0) {
+      return std::stoll(line.substr(6));
+    }
+  }
+  return 0;
+}
+
+void clearPeakRss(pid_t pid) {
+  std::ofstream clearRefs("/proc/" + std::to_string(pid) + "/clear_refs");
+  clearRefs << "5";
+}
+
+void writeKey(const fs::path &path, const string &cipher) {
+  unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES];
+  crypto_secretstream_xchacha20poly1305_keygen(key);
+  std::ofstream file(path, std::ios::out | std::ios::trunc | std::ios::binary);
+  file.write((char *)key, sizeof key);
+  // as enclone --generate-key
+  if (cipher == "aes256gcm") {
+    file.put((char)ChunkCipher::AES256GCM);
+  }
+  sodium_memzero(key, sizeof key);
+  fs::permissions(path, fs::perms::owner_read | fs::perms::owner_write);
+}
+
+pid_t startDaemon(const Settings &settings) {
+  fs::create_directories(settings.workDir / "log");
+  writeKey(settings.workDir / "key", settings.cipher);
+  std::ofstream conf(settings.workDir / "encloned.conf");
+  for (const string &line : settings.conf) {
+    conf << line << endl;
+  }
+  conf.close();
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (chdir(settings.workDir.c_str()) != 0) {
+      _exit(127);
+    }
+    int log = open("encloned.log", O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (log >= 0) {
+      dup2(log, STDOUT_FILENO);
+      dup2(log, STDERR_FILENO);
+      close(log);
+    }
+    execl(settings.encloned.c_str(), settings.encloned.c_str(), (char *)NULL);
+    _exit(127);
+  }
+  if (pid < 0) {
+    throw std::runtime_error("can't start encloned");
+  }
+  // up once the socket accepts connections
+  for (;;) {
+    if (waitpid(pid, NULL, WNOHANG) != 0) {
+      throw std::runtime_error("encloned exited on start - see " +
+                               (settings.workDir / "encloned.log").string());
+    }
+    if (socketOpen()) {
+      return pid;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+}
+
+void stopDaemon(pid_t pid) {
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+}
+
+// waits until every file has been uploaded - the last upload is taken to be
+// the last time the count went up, as the index backup is counted as well.
+// Returns the seconds from started to then
+double waitForUploads(const Settings &settings, pid_t pid, uint64_t files,
+                      std::chrono::steady_clock::time_point started) {
+  using clock = std::chrono::steady_clock;
+  auto interval = std::chrono::duration<double>(settings.poll);
+  uint64_t uploaded = 0;
+  auto lastChange = clock::now();
+  auto lastUpload = lastChange;
+  for (;;) {
+    std::this_thread::sleep_for(interval);
+    if (waitpid(pid, NULL, WNOHANG) != 0) {
+      throw std::runtime_error("encloned exited - see " +
+                               (settings.workDir / "encloned.log").string());
+    }
+    uint64_t count = stats(false)["upload"].count;
+    auto now = clock::now();
+    if (count != uploaded) {
+      uploaded = count;
+      lastChange = now;
+      lastUpload = now;
+      if (settings.format == "text") {
+        std::cerr << "uploaded " << uploaded << " of " << files << " files"
+                  << endl;
+      }
+    }
+    double quiet = std::chrono::duration<double>(now - lastChange).count();
+    // encloned uploads every 5s, so a pass has surely started by then
+    if (uploaded >= files && quiet >= std::max(10.0, 2 * settings.poll)) {
+      break;
+    }
+    if (quiet >= settings.stallTimeout) {
+      throw std::runtime_error(
+          "no upload for " + std::to_string((int)quiet) + "s, " +
+          std::to_string(uploaded) + " of " + std::to_string(files) +
+          " files uploaded - see `enclone --failed show`");
+    }
+  }
+  return std::chrono::duration<double>(lastUpload - started).count();
+}
+
+// every file restored, with the same size - contents were verified against
+// the file hash by encloned itself
+void verifyRestore(const fs::path &tree, const fs::path &restored) {
+  uint64_t missing = 0;
+  for (const auto &entry : fs::recursive_directory_iterator(tree)) {
+    if (!entry.is_regular_file()) {
+      continue;
+    }
+    // restored to target + the full original path
+    fs::path copy = restored / fs::absolute(entry.path()).relative_path();
+    std::error_code ec;
+    if (fs::file_size(copy, ec) != entry.file_size() || ec) {
+      if (missing++ < 10) {
+        std::cerr << "not restored: " << entry.path() << endl;
+      }
+    }
+  }
+  if (missing != 0) {
+    throw std::runtime_error(std::to_string(missing) +
+                             " files not restored correctly");
+  }
+}
+
+class Output {
+ public:
+  explicit Output(const string &format) : format(format) {
+    if (format == "csv") {
+      cout << "name,files,bytes,seconds,files_per_s,mb_per_s,p50_ms,p90_ms,"
+              "p99_ms,max_ms,peak_rss_mb"
+           << endl;
+    } else if (format == "text") {
+      printf("%-10s %10s %10s %9s %10s %9s %9s %9s %9s %9s %9s\n", "name",
+             "files", "MB", "seconds", "files/s", "MB/s", "p50 ms",
+             "p90 ms", "p99 ms", "max ms", "RSS MB");
+    }
+  }
+
+  void write(const Result &r) {
+    double mb = r.bytes / (1024.0 * 1024);
+    double filess = r.seconds > 0 ? r.files / r.seconds : 0;
+    double mbs = r.seconds > 0 ? mb / r.seconds : 0;
+    double rss = r.peakRssKB / 1024.0;
+    const Stage &l = r.latency;
+    if (format == "csv") {
+      printf("%s,%llu,%llu,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g\n",
+             r.name.c_str(), (unsigned long long)r.files,
+             (unsigned long long)r.bytes, r.seconds, filess, mbs,
+             l.p50 / 1000.0, l.p90 / 1000.0, l.p99 / 1000.0, l.max / 1000.0,
+             rss);
+    } else if (format == "jsonl") {
+      printf(
+          "{\"name\":\"%s\",\"files\":%llu,\"bytes\":%llu,\"seconds\":%.6g,"
+          "\"files_per_s\":%.6g,\"mb_per_s\":%.6g,\"p50_ms\":%.6g,"
+          "\"p90_ms\":%.6g,\"p99_ms\":%.6g,\"max_ms\":%.6g,"
+          "\"peak_rss_mb\":%.6g}\n",
+          r.name.c_str(), (unsigned long long)r.files,
+          (unsigned long long)r.bytes, r.seconds, filess, mbs,
+          l.p50 / 1000.0, l.p90 / 1000.0, l.p99 / 1000.0, l.max / 1000.0,
+          rss);
+    } else {
+      printf("%-10s %10llu %10.1f %9.2f %10.1f %9.1f %9.2f %9.2f %9.2f "
+             "%9.2f %9.1f\n",
+             r.name.c_str(), (unsigned long long)r.files, mb, r.seconds,
+             filess, mbs, l.p50 / 1000.0, l.p90 / 1000.0, l.p99 / 1000.0,
+             l.max / 1000.0, rss);
+    }
+    fflush(stdout);
+  }
+
+ private:
+  string format;
+};
+
+// a row per stage of names that ran, from the daemon's stats
+void writeStages(const std::map<string, Stage> &stages,
+                 const std::vector<string> &names, Output &out) {
+  for (const string &name : names) {
+    auto it = stages.find(name);
+    if (it == stages.end() || it->second.count == 0) {
+      continue;
+    }
+    Result r;
+    r.name = name;
+    r.files = it->second.count;
+    r.bytes = it->second.bytes;
+    r.latency = it->second;
+    out.write(r);
+  }
+}
+
+void run(const Settings &settings) {
+  using clock = std::chrono::steady_clock;
+  if (settings.generate) {
+    generateTree(settings);
+  }
+  auto [files, bytes] = treeSize(settings.tree);
+  if (files == 0) {
+    throw std::runtime_error("no files in " + settings.tree.string());
+  }
+  if (settings.format == "text") {
+    cout << files << " files, " << bytes / (1024 * 1024) << " MB in "
+         << settings.tree.string() << endl;
+  }
+
+  Output out(settings.format);
+  pid_t pid = startDaemon(settings);
+  try {
+    // watch, hash, encrypt and upload
+    stats(true);
+    auto started = clock::now();
+    request("addr|" + fs::absolute(settings.tree).string());
+    Result backup;
+    backup.name = "backup";
+    backup.files = files;
+    backup.bytes = bytes;
+    backup.seconds = waitForUploads(settings, pid, files, started);
+    backup.peakRssKB = peakRssKB(pid);
+    auto backupStages = stats(true);
+    backup.latency = backupStages["upload"];
+    out.write(backup);
+
+    // download, decrypt, verify and write
+    clearPeakRss(pid);
+    fs::path restored = settings.workDir / "restore";
+    fs::create_directories(restored);
+    started = clock::now();
+    request("restoreAll|" + restored.string());
+    Result restore;
+    restore.name = "restore";
+    restore.files = files;
+    restore.bytes = bytes;
+    restore.seconds =
+        std::chrono::duration<double>(clock::now() - started).count();
+    restore.peakRssKB = peakRssKB(pid);
+    auto restoreStages = stats(false);
+    restore.latency = restoreStages["download"];
+    out.write(restore);
+    if (settings.verify) {
+      verifyRestore(settings.tree, restored);
+    }
+
+    writeStages(backupStages, {"scan", "hash", "encrypt", "upload"}, out);
+    writeStages(restoreStages, {"download"}, out);
+  } catch (...) {
+    stopDaemon(pid);
+    throw;
+  }
+  stopDaemon(pid);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  Settings settings;
+  string mix, backend, endpoint, bucket, localPath, tree, workDir;
+  std::vector<string> sets;
+
+  po::options_description desc("enclone_e2e options");
+  desc.add_options()("help,h", "display this help message")(
+      "files", po::value<uint64_t>(&settings.files)->default_value(10000),
+      "number of files to generate")(
+      "mix",
+      po::value<string>(&mix)->default_value("4K:60,64K:30,1M:9,32M:1"),
+      "file sizes and their weights, each size +-50%")(
+      "files-per-dir",
+      po::value<uint64_t>(&settings.filesPerDir)->default_value(1000),
+      "files in each generated directory")(
+      "data", po::value<string>(&settings.data)->default_value("random"),
+      "file contents: random (incompressible) or text")(
+      "tree", po::value<string>(&tree),
+      "an existing tree to back up instead of generating one")(
+      "work-dir", po::value<string>(&workDir),
+      "directory for encloned's key, config, index and log, the generated "
+      "tree and the restore - default a new directory in /tmp")(
+      "encloned", po::value<string>()->default_value("./encloned"),
+      "the encloned to run")(
+      "backend", po::value<string>(&backend)->default_value("s3"),
+      "s3 or local")(
+      "endpoint", po::value<string>(&endpoint),
+      "URL of an S3-compatible store, e.g. http://127.0.0.1:9000 - "
+      "credentials are read from the environment as usual")(
+      "bucket", po::value<string>(&bucket)->default_value("enclone"),
+      "bucket to store objects in - use an empty one")(
+      "local-path", po::value<string>(&localPath),
+      "local_path for --backend local, default <work-dir>/objects")(
+      "set", po::value<std::vector<string>>(&sets)->composing(),
+      "other encloned.conf settings, e.g. --set packing=true")(
+      "cipher",
+      po::value<string>(&settings.cipher)->default_value("xchacha20poly1305"),
+      "xchacha20poly1305 or aes256gcm")(
+      "poll", po::value<double>(&settings.poll)->default_value(1.0),
+      "seconds between checks for finished uploads")(
+      "stall-timeout",
+      po::value<double>(&settings.stallTimeout)->default_value(600),
+      "give up after this many seconds without an upload")(
+      "no-verify", "don't check that every file was restored")(
+      "keep", "keep the work directory")(
+      "format", po::value<string>(&settings.format)->default_value("text"),
+      "text, csv or jsonl");
+
+  try {
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+    if (vm.count("help")) {
+      cout << desc << endl;
+      return 0;
+    }
+    settings.mix = parseMix(mix);
+    settings.filesPerDir = std::max<uint64_t>(settings.filesPerDir, 1);
+    settings.encloned = fs::absolute(vm["encloned"].as<string>());
+    settings.verify = vm.count("no-verify") == 0;
+    settings.keep = vm.count("keep") != 0;
+    settings.workDir =
+        workDir.empty() ? fs::temp_directory_path() /
+                              ("enclone_e2e." + std::to_string(getpid()))
+                        : fs::absolute(workDir);
+    settings.generate = tree.empty();
+    settings.tree =
+        tree.empty() ? settings.workDir / "tree" : fs::absolute(tree);
+    if (settings.data != "random" && settings.data != "text") {
+      throw std::invalid_argument("--data must be random or text");
+    }
+    if (settings.cipher != "xchacha20poly1305" &&
+        settings.cipher != "aes256gcm") {
+      throw std::invalid_argument("unknown --cipher " + settings.cipher);
+    }
+    if (settings.format != "text" && settings.format != "csv" &&
+        settings.format != "jsonl") {
+      throw std::invalid_argument("--format must be text, csv or jsonl");
+    }
+    if (!fs::exists(settings.encloned)) {
+      throw std::invalid_argument(settings.encloned.string() +
+                                  " not found - see --encloned");
+    }
+    if (backend == "s3") {
+      settings.conf.push_back("backend = s3");
+      settings.conf.push_back("s3_bucket = " + bucket);
+      if (!endpoint.empty()) {
+        settings.conf.push_back("s3_endpoint = " + endpoint);
+      }
+    } else if (backend == "local") {
+      settings.conf.push_back("backend = local");
+      settings.conf.push_back(
+          "local_path = " +
+          (localPath.empty() ? (settings.workDir / "objects").string()
+                             : fs::absolute(localPath).string()));
+    } else {
+      throw std::invalid_argument("--backend must be s3 or local");
+    }
+    for (const string &set : sets) {
+      if (set.find('=') == string::npos) {
+        throw std::invalid_argument("--set needs setting=value: " + set);
+      }
+      settings.conf.push_back(set);
+    }
+  } catch (std::exception &e) {
+    std::cerr << "error: " << e.what() << endl;
+    return 1;
+  }
+
+  if (sodium_init() < 0) {
+    std::cerr << "error: can't initialise libsodium" << endl;
+    return 1;
+  }
+  if (socketOpen()) {
+    std::cerr << "error: encloned is already running - stop it first, as "
+                 "both would use "
+              << SOCKET_FILE << endl;
+    return 1;
+  }
+  std::error_code ec;
+  if (fs::exists(settings.workDir / "index.db", ec)) {
+    std::cerr << "error: " << settings.workDir.string()
+              << " has an index already - use an empty --work-dir" << endl;
+    return 1;
+  }
+  fs::create_directories(settings.workDir);
+
+  int status = 0;
+  try {
+    run(settings);
+  } catch (std::exception &e) {
+    std::cerr << "error: " << e.what() << endl;
+    status = 1;
+  }
+  if (settings.keep || status != 0) {
+    std::cerr << "work directory kept in " << settings.workDir.string()
+              << endl;
+  } else {
+    fs::remove_all(settings.workDir, ec);
+  }
+  return status;
+}
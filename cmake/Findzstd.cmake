@@ -0,0 +1,44 @@
+# Find the zstd compression library
+#
+# Once done the following variables will be defined:
+#
+#   zstd_FOUND
+#   zstd_INCLUDE_DIRS
+#   zstd_LIBRARIES
+#   zstd_VERSION
+#
+# and an imported "zstd::zstd" target is created.
+
+find_path(zstd_INCLUDE_DIR NAMES zstd.h)
+mark_as_advanced(zstd_INCLUDE_DIR)
+
+find_library(zstd_LIBRARY NAMES zstd libzstd)
+mark_as_advanced(zstd_LIBRARY)
+
+# extract version information from the header file
+if(zstd_INCLUDE_DIR)
+    foreach(_part MAJOR MINOR RELEASE)
+        file(STRINGS ${zstd_INCLUDE_DIR}/zstd.h _ver_line
+             REGEX "^#define ZSTD_VERSION_${_part} +[0-9]+"
+             LIMIT_COUNT 1)
+        string(REGEX MATCH "[0-9]+$" _ver_${_part} "${_ver_line}")
+    endforeach()
+    set(zstd_VERSION "${_ver_MAJOR}.${_ver_MINOR}.${_ver_RELEASE}")
+    unset(_ver_line)
+endif()
+
+include(${CMAKE_CURRENT_LIST_DIR}/FindPackageHandleStandardArgs.cmake)
+find_package_handle_standard_args(zstd
+    REQUIRED_VARS zstd_INCLUDE_DIR zstd_LIBRARY
+    VERSION_VAR zstd_VERSION)
+
+if(zstd_FOUND)
+    set(zstd_INCLUDE_DIRS ${zstd_INCLUDE_DIR})
+    set(zstd_LIBRARIES ${zstd_LIBRARY})
+    if(NOT TARGET zstd::zstd)
+        add_library(zstd::zstd UNKNOWN IMPORTED)
+        set_target_properties(zstd::zstd PROPERTIES
+            IMPORTED_LOCATION             "${zstd_LIBRARY}"
+            INTERFACE_INCLUDE_DIRECTORIES "${zstd_INCLUDE_DIR}")
+    endif()
+endif()
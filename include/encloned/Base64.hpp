@@ -0,0 +1,35 @@
+#ifndef BASE64_H
+#define BASE64_H
+
+#include <cstddef>
+#include <string>
+
+// URL-safe base64 ('-' and '_' in place of '+' and '/'), used for object
+// names and key material. Whole blocks are encoded/decoded with SSSE3 or AVX2
+// where the CPU supports them, chosen once at runtime - every implementation
+// produces the same output
+class Base64 {
+ public:
+  virtual ~Base64() = 0;  // pure virtual - class is abstract
+
+  static constexpr char ALPHABET[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+  // in order of preference
+  enum Implementation { SCALAR = 0, SSSE3 = 1, AVX2 = 2 };
+  // fastest implementation this CPU supports
+  static Implementation best();
+  static bool supported(Implementation impl);
+
+  // pad with '=' to a multiple of 4 characters if pad is set
+  static std::string encode(const unsigned char *in, size_t len, bool pad,
+                            Implementation impl = best());
+  // decodes up to the first character that is not in ALPHABET, e.g. padding
+  static std::string decode(const std::string &in,
+                            Implementation impl = best());
+
+ private:
+  static Implementation detect();
+};
+
+#endif
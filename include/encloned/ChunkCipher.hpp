@@ -0,0 +1,77 @@
+#ifndef CHUNKCIPHER_H
+#define CHUNKCIPHER_H
+
+#include <sodium.h>
+
+#include <cstddef>
+#include <cstdint>
+
+// a stream of authenticated chunks, framed the same way as libsodium's
+// secretstream for every cipher suite - a HEADERBYTES header, then chunks of
+// ABYTES more than their plaintext, the last tagged TAG_FINAL - so object
+// layouts don't depend on the suite.
+//
+// XCHACHA20POLY1305 is secretstream itself. AES256GCM uses libsodium's
+// AES-256-GCM, which needs AES-NI (or the ARMv8 crypto extensions), under a
+// key derived from the master key and the random header, with the chunk
+// number as nonce. Each chunk is its tag (1), then the AES-GCM ciphertext and
+// MAC (16) of the plaintext, with the tag as additional data
+class ChunkCipher {
+ public:
+  // recorded in ObjectHeader::cipher
+  static const uint8_t XCHACHA20POLY1305 = 0;
+  static const uint8_t AES256GCM = 1;
+
+  static const int KEYBYTES = crypto_secretstream_xchacha20poly1305_KEYBYTES;
+  static const int HEADERBYTES =
+      crypto_secretstream_xchacha20poly1305_HEADERBYTES;
+  static const int ABYTES = crypto_secretstream_xchacha20poly1305_ABYTES;
+  static const unsigned char TAG_FINAL =
+      crypto_secretstream_xchacha20poly1305_TAG_FINAL;
+
+  // false for unknown suites, or AES256GCM on a CPU without AES instructions
+  static bool available(uint8_t cipher);
+  static const char *name(uint8_t cipher);
+
+  ChunkCipher() = default;
+  ~ChunkCipher();
+
+  ChunkCipher(const ChunkCipher &) = delete;
+  ChunkCipher &operator=(const ChunkCipher &) = delete;
+
+  // start a new stream, writing its header - -1 if cipher is not available
+  int initPush(uint8_t cipher, unsigned char header[HEADERBYTES],
+               const unsigned char key[KEYBYTES]);
+  // c must have room for mlen + ABYTES bytes
+  void push(unsigned char *c, unsigned long long *clen, const unsigned char *m,
+            size_t mlen, const unsigned char *ad, size_t adlen,
+            unsigned char tag);
+
+  // -1 if cipher is not available, or the header is invalid
+  int initPull(uint8_t cipher, const unsigned char header[HEADERBYTES],
+               const unsigned char key[KEYBYTES]);
+  // -1 if the chunk is corrupted or out of order
+  int pull(unsigned char *m, unsigned long long *mlen, unsigned char *tag,
+           const unsigned char *c, size_t clen, const unsigned char *ad,
+           size_t adlen);
+
+ private:
+  static constexpr unsigned char AES_KEY_PERSONAL[16] = {
+      'e', 'n', 'c', 'l', 'o', 'n', 'e', '-',
+      'a', 'e', 's', 'g', 'c', 'm', 'K', 'Y'};
+  // longest additional data passed with a chunk, plus the tag
+  static const size_t MAX_ADBYTES = 128;
+
+  uint8_t cipher = XCHACHA20POLY1305;
+  crypto_secretstream_xchacha20poly1305_state st;
+  crypto_aead_aes256gcm_state gcm;
+  uint64_t counter = 0;  // AES256GCM chunks so far
+
+  int initAES(const unsigned char header[HEADERBYTES],
+              const unsigned char key[KEYBYTES]);
+  void nextNonce(unsigned char npub[crypto_aead_aes256gcm_NPUBBYTES]);
+  static size_t chunkAd(unsigned char out[MAX_ADBYTES + 1], unsigned char tag,
+                        const unsigned char *ad, size_t adlen);
+};
+
+#endif
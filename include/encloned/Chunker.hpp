@@ -0,0 +1,42 @@
+#ifndef CHUNKER_H
+#define CHUNKER_H
+
+#include <cstddef>
+#include <cstdint>
+
+// content defined chunking (FastCDC, with normalised chunking) - cut points
+// depend only on the bytes around them, so an insertion or deletion only
+// changes the chunks it touches, and the rest of the file still deduplicates
+// against earlier versions. Chunks are between averageSize / 4 and
+// averageSize * 4 bytes, apart from a shorter last chunk.
+//
+// A gear hash is rolled over each byte from the minimum size on, and a cut is
+// made where its top bits are all zero - before the average size more bits
+// must be zero than after it, which keeps chunk sizes close to the average
+class Chunker {
+ public:
+  static const size_t DEFAULT_AVERAGE_SIZE = 1024 * 1024;
+  static const size_t MIN_AVERAGE_SIZE = 64 * 1024;
+  // chunks are uploaded as single objects of up to 4 x the average size
+  static const size_t MAX_AVERAGE_SIZE = 1024 * 1024;
+
+  // averageSize must be validSize()
+  explicit Chunker(size_t averageSize = DEFAULT_AVERAGE_SIZE);
+
+  // a power of two between MIN_AVERAGE_SIZE and MAX_AVERAGE_SIZE
+  static bool validSize(size_t averageSize);
+
+  size_t minSize() const { return averageSize / 4; }
+  size_t maxSize() const { return averageSize * 4; }
+
+  // length of the chunk starting at data - len must be at least maxSize(),
+  // unless data holds the rest of the file
+  size_t cut(const unsigned char *data, size_t len) const;
+
+ private:
+  size_t averageSize;
+  uint64_t maskSmall;  // before averageSize, harder to match
+  uint64_t maskLarge;  // after averageSize, easier to match
+};
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <encloned/Dictionaries.hpp>
+#include <encloned/FileHasher.hpp>
+#include <zstd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+// optional zstd compression of file contents ahead of encryption. Objects
+// with ObjectHeader::FLAG_COMPRESSED hold a zstd stream in place of the
+// plaintext (or, for segmented objects, one zstd frame per segment). Small
+// files may be compressed with a trained Dictionary
+class Compression {
+ public:
+  virtual ~Compression() = 0;  // pure virtual - class is abstract
+
+  static const int DEFAULT_LEVEL = 3;
+
+  // compress a few samples of the file at a fast level, false if the whole
+  // file is unlikely to shrink much, e.g. media and archives that are
+  // already compressed
+  static bool worthCompressing(FILE *fp, uint64_t fileSize,
+                               const Dictionary *dictionary = NULL);
+
+  static std::vector<unsigned char> compress(const unsigned char *in,
+                                             size_t len, int level);
+  // returns false unless in decompresses to exactly outlen bytes
+  static bool decompress(const unsigned char *in, size_t len,
+                         unsigned char *out, size_t outlen);
+  static size_t compressBound(size_t len);
+
+ private:
+  static const size_t SAMPLE_SIZE = 64 * 1024;
+  static const int SAMPLES = 4;
+  static const int SAMPLE_LEVEL = 1;
+  // compressed samples must be below this percentage of their original size
+  static const int MAX_SAMPLE_RATIO = 90;
+  // smaller files don't save enough to cover the zstd frame overhead, unless
+  // a dictionary is used
+  static const uint64_t MIN_FILE_SIZE = 128;
+};
+
+// compresses a file on demand, in pieces of whatever size the caller asks for.
+// If hasher is provided, it is updated with the file contents as they are read
+class CompressStream {
+ public:
+  CompressStream(FILE *fp_s, int level, const Dictionary *dictionary = NULL,
+                 FileHasher *hasher = NULL);
+  ~CompressStream();
+
+  CompressStream(const CompressStream &) = delete;
+  CompressStream &operator=(const CompressStream &) = delete;
+
+  // fill buf with up to len bytes of compressed data - less than len only
+  // once the stream is finished. Throws on read or compression errors
+  size_t read(unsigned char *buf, size_t len);
+  bool eof() const { return finished; }
+
+ private:
+  FILE *fp_s;
+  FileHasher *hasher;
+  ZSTD_CCtx *cctx;
+  std::vector<unsigned char> buf_in;
+  ZSTD_inBuffer input = {NULL, 0, 0};
+  bool sourceEof = false;
+  bool finished = false;
+};
+
+// decompresses a zstd stream fed in arbitrary sized pieces, passing the
+// output to a callback as it is produced. Streams compressed with a dictionary
+// need it to be available from dictionaries
+class DecompressStream {
+ public:
+  using Output = std::function<void(const unsigned char *, size_t)>;
+
+  explicit DecompressStream(Output output, Dictionaries *dictionaries = NULL);
+  ~DecompressStream();
+
+  DecompressStream(const DecompressStream &) = delete;
+  DecompressStream &operator=(const DecompressStream &) = delete;
+
+  // returns false if the data is not a valid zstd stream, or its dictionary
+  // is not available
+  bool write(const unsigned char *in, size_t len);
+  // true if the stream ended on a complete frame
+  bool finished() const { return frameComplete; }
+
+ private:
+  ZSTD_DCtx *dctx;
+  Output output;
+  std::vector<unsigned char> buf_out;
+  Dictionaries *dictionaries;
+  std::shared_ptr<const Dictionary> dictionary;  // in use by dctx
+  bool started = false;
+  bool frameComplete = false;
+
+  bool loadDictionary(const unsigned char *in, size_t len);
+};
+
+#endif
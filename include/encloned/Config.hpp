@@ -0,0 +1,36 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+using std::cout;
+using std::endl;
+using std::string;
+
+// daemon settings, read from "key = value" lines in encloned.conf - any
+// setting not present in the file uses the default given by the caller
+class Config {
+ private:
+  const char* CONFIG_LOCATION = "encloned.conf";
+
+  std::unordered_map<string, string> values;
+
+  std::mutex mtx;
+
+ public:
+  Config();
+
+  void load();
+
+  string getString(const string key, const string defaultValue);
+  long long getInt(const string key, long long defaultValue);
+  bool getBool(const string key, bool defaultValue);
+
+  void set(const string key, const string value);  // change a setting live
+};
+
+#endif
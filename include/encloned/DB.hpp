@@ -5,6 +5,7 @@
 
 #include <filesystem>
 #include <iostream>
+#include <sstream>
 
 // concurrency/multi-threading
 #include <atomic>
@@ -25,6 +26,9 @@ class DB {
   std::mutex mtx;
 
   void initialiseTables();  // initialise tables on first run
+  // add a column to a table created by an earlier version, if it is missing
+  void addColumn(const char table[], const char column[],
+                 const char definition[]);
   void backupProgress(int leftToCopy, int totalToCopy);
 
  public:
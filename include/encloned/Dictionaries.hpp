@@ -0,0 +1,84 @@
+#ifndef DICTIONARIES_H
+#define DICTIONARIES_H
+
+#include <zstd.h>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// a trained zstd dictionary. Frames compressed with it record its id in the
+// zstd frame header, which is encrypted along with the rest of the object, so
+// the decompressor can find it again without any change to the object format
+class Dictionary {
+ public:
+  // throws std::invalid_argument if data is not a zstd dictionary
+  explicit Dictionary(std::vector<unsigned char> data);
+  ~Dictionary();
+
+  Dictionary(const Dictionary &) = delete;
+  Dictionary &operator=(const Dictionary &) = delete;
+
+  uint32_t id() const { return dictId; }
+  const std::vector<unsigned char> &bytes() const { return data; }
+  // digested forms of the dictionary, created once and shared between threads
+  const ZSTD_CDict *cdict(int level) const;
+  const ZSTD_DDict *ddict() const { return ddictPtr; }
+
+ private:
+  std::vector<unsigned char> data;
+  uint32_t dictId;
+  ZSTD_DDict *ddictPtr;
+  mutable std::map<int, ZSTD_CDict *> cdicts;  // by compression level
+  mutable std::mutex mtx;
+};
+
+// dictionaries trained from the small files of each watch root, kept in a
+// local cache under DICTIONARY_LOCATION/<id>. Uploading them, and choosing
+// which one is current for each root, is handled by Watch - a dictionary
+// must never be deleted while objects compressed with it may still exist
+class Dictionaries {
+ public:
+  static constexpr char DICTIONARY_LOCATION[] = "dictionaries";
+  // only files up to this size are compressed with (or train) a dictionary
+  static const uint64_t DEFAULT_MAX_FILE_SIZE = 16 * 1024;
+
+  explicit Dictionaries(uint64_t maxFileSize = DEFAULT_MAX_FILE_SIZE);
+
+  Dictionaries(const Dictionaries &) = delete;
+  Dictionaries &operator=(const Dictionaries &) = delete;
+
+  static std::string location(uint32_t id);  // local path of dictionary id
+
+  // train a dictionary from up to MAX_SAMPLES of the small files in paths and
+  // save it to the local cache, returns its id - 0 if training failed, e.g.
+  // there were too few samples
+  uint32_t train(const std::vector<std::string> &paths);
+  // load a dictionary from the local cache, NULL if it is not available
+  std::shared_ptr<const Dictionary> get(uint32_t id);
+
+  // compress new files under root with dictionary id (0 for none)
+  void setCurrent(const std::string &root, uint32_t id);
+  // dictionary to compress a new file with, NULL if the file is too large or
+  // none has been trained for its watch root
+  std::shared_ptr<const Dictionary> forFile(const std::string &path);
+
+ private:
+  static const size_t DICTIONARY_SIZE = 32 * 1024;
+  static const size_t MIN_SAMPLES = 64;
+  static const size_t MAX_SAMPLES = 4000;
+  // zstd recommends around 100x the dictionary size in samples
+  static const size_t MAX_SAMPLE_BYTES = 100 * DICTIONARY_SIZE;
+
+  uint64_t maxFileSize;
+  std::unordered_map<uint32_t, std::shared_ptr<const Dictionary>> loaded;
+  std::map<std::string, uint32_t> current;  // watch root -> dictionary id
+
+  std::mutex mtx;
+};
+
+#endif
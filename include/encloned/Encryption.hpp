@@ -1,8 +1,12 @@
 #ifndef ENCRYPTION_H
 #define ENCRYPTION_H
 
+#include <encloned/Base64.hpp>
+#include <encloned/EncryptionStream.hpp>
+#include <encloned/FileHasher.hpp>
 #include <sodium.h>
 
+#include <algorithm>
 #include <cstring>
 #include <fstream>
 #include <iomanip>
@@ -10,6 +14,8 @@
 #include <random>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 
 using std::cout;
 using std::endl;
@@ -22,29 +28,33 @@ class Encryption {
 
   // creates a random remote filename
   static string hashPath(const string path);
-  // hash entire file contents for integrity checks
-  static string hashFile(const string path);
+  // hash entire file contents for integrity checks, see FileHasher
+  static string hashFile(
+      const string path,
+      FileHasher::Algorithm algorithm = FileHasher::DEFAULT_ALGORITHM,
+      unsigned int threads = 0);
 
   static int encryptFile(
       const char *target_file, const char *source_file,
-      const unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES]);
+      const unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES],
+      const EncryptOptions &options = EncryptOptions());
+  // segmented objects are decrypted using up to threads cores (0 for all)
   static int decryptFile(
       const char *target_file, const char *source_file,
-      const unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES]);
+      const unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES],
+      unsigned int threads = 0, Dictionaries *dictionaries = NULL);
+  // read part of a segmented object without decrypting the whole file
+  static int decryptRange(
+      const char *source_file,
+      const unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES],
+      uint64_t offset, size_t length, std::vector<unsigned char> &out);
 
-  // base64 URL variants
+  // base64 URL variants, see Base64 - the string version is unpadded
   static std::string base64_encode(const std::string &in);
   static std::string base64_encode(unsigned char const *bytes_to_encode,
                                    unsigned int in_len);
   static std::string base64_decode(const std::string &in);
 
-  static constexpr char base64_url_alphabet[64] = {
-      'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M',
-      'N', 'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z',
-      'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm',
-      'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z',
-      '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '-', '_'};
-
   static string deriveKey(
       string password);  // derive a key from a password (subkey in b64 used as
                          // password), using a random salt
@@ -56,20 +66,40 @@ class Encryption {
       string saltedKey_b64);  // verify if a provided saltedKey was created with
                               // provided password
 
+  // index backup names - a keyed BLAKE2b tag of a random salt, followed by the
+  // salt (88 chars, like every other object name). Unlike deriveKey, checking
+  // a name costs one hash, so every remote object can be checked
+  static string deriveIndexName(string subKey_b64);
+  static bool verifyIndexName(string subKey_b64, string name);
+
+  // object names for deduplication - a keyed BLAKE2b hash of a file hash (88
+  // chars), so files with the same contents share a name, but names can't be
+  // linked to contents without the key
+  static string contentName(
+      const unsigned char key[crypto_generichash_KEYBYTES],
+      const string &fileHash, FileHasher::Algorithm algorithm);
+
   static const int getRandomFilenameLength();
 
  private:
-  // encryption/decryption constants
-  static const int CHUNK_SIZE = 4096;
+  // encryption/decryption file read/write size
+  static const int IO_BUFFER_SIZE = 64 * 1024;
 
   // random path/filename constants
   static const int RANDOM_FILENAME_LENGTH = 88;
 
-  // file hash constants
-  static const int BUFFER_SIZE = 512;
-  static const int FILE_HASH_SIZE = 64;
-
   static string randomString(std::size_t length);
+
+  static const int INDEX_NAME_SALT_BYTES = crypto_pwhash_SALTBYTES + 2;
+  static const int INDEX_NAME_TAG_BYTES = 48;
+  static constexpr unsigned char INDEX_NAME_PERSONAL[16] = {
+      'e', 'n', 'c', 'l', 'o', 'n', 'e', '-',
+      'i', 'n', 'd', 'e', 'x', 'T', 'A', 'G'};
+  static string indexNameTag(const string &subKey_b64, const string &salt);
+
+  static constexpr unsigned char CONTENT_NAME_PERSONAL[16] = {
+      'e', 'n', 'c', 'l', 'o', 'n', 'e', '-',
+      'c', 'o', 'n', 't', 'e', 'n', 't', 'N'};
 };
 
 #endif
@@ -0,0 +1,295 @@
+#ifndef ENCRYPTIONSTREAM_H
+#define ENCRYPTIONSTREAM_H
+
+#include <encloned/ChunkCipher.hpp>
+#include <encloned/Compression.hpp>
+#include <encloned/FileHasher.hpp>
+#include <encloned/Segment.hpp>
+#include <sodium.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+// header at the start of every encrypted object, followed by the ChunkCipher
+// stream header and chunks. The header is authenticated as additional data of
+// the first chunk. Objects without it are legacy objects using 4KB chunks.
+// Segmented objects (FLAG_SEGMENTED) are laid out as described in Segment.hpp,
+// compressed objects (FLAG_COMPRESSED) encrypt zstd output in place of the file
+//
+//   0  magic "ENCLONE\0"
+//   8  format version
+//   9  flags
+//  10  cipher suite (CIPHER_*)
+//  11  reserved (0)
+//  12  plaintext chunk size, uint32 little-endian
+struct ObjectHeader {
+  static const int BYTES = 16;
+  static const uint8_t VERSION = 1;
+  static constexpr unsigned char MAGIC[8] = {'E', 'N', 'C', 'L',
+                                             'O', 'N', 'E', '\0'};
+
+  static const uint8_t FLAG_SEGMENTED = 0x01;
+  static const uint8_t FLAG_COMPRESSED = 0x02;
+  static const uint8_t KNOWN_FLAGS = FLAG_SEGMENTED | FLAG_COMPRESSED;
+
+  static const uint8_t CIPHER_XCHACHA20POLY1305 =
+      ChunkCipher::XCHACHA20POLY1305;
+  static const uint8_t CIPHER_AES256GCM = ChunkCipher::AES256GCM;
+
+  static const uint32_t LEGACY_CHUNK_SIZE = 4096;
+  static const uint32_t MIN_CHUNK_SIZE = 4 * 1024;
+  static const uint32_t MAX_CHUNK_SIZE = 4 * 1024 * 1024;
+
+  uint8_t version = VERSION;
+  uint8_t flags = 0;
+  uint8_t cipher = CIPHER_XCHACHA20POLY1305;
+  uint32_t chunkSize = LEGACY_CHUNK_SIZE;
+
+  void serialise(unsigned char out[BYTES]) const;
+  // returns false if in does not start with MAGIC (i.e. a legacy object)
+  bool parse(const unsigned char in[BYTES]);
+  // header fields are supported by this version of encloned
+  bool valid() const;
+};
+
+// where the ciphertext of a segmented object had got to, so a stream of the
+// same, unchanged file can carry on from there - e.g. an upload interrupted
+// by a restart. headers hold the salt and layout the object was started with,
+// and offsets the offset of each segment from firstSegment on
+struct EncryptResume {
+  std::vector<unsigned char> headers;  // object header + segment header
+  uint64_t firstSegment = 0;
+  std::vector<uint64_t> offsets;
+  uint64_t end = 0;  // offset of the segment after them
+};
+
+// how new objects are written
+struct EncryptOptions {
+  static const uint32_t DEFAULT_CHUNK_SIZE = 64 * 1024;
+
+  uint32_t chunkSize = DEFAULT_CHUNK_SIZE;
+  // ObjectHeader::CIPHER_* - must be ChunkCipher::available()
+  uint8_t cipher = ObjectHeader::CIPHER_XCHACHA20POLY1305;
+  // files larger than this are written as segmented objects, 0 for never
+  uint64_t segmentSize = 0;
+  unsigned int threads = 1;  // segments encrypted in parallel
+  int compressionLevel = 0;  // 0 to never compress
+  // compress with a trained dictionary - unsegmented objects only
+  std::shared_ptr<const Dictionary> dictionary;
+  // updated with the file contents as they are encrypted, so a new file
+  // version is read once to both hash and upload it
+  FileHasher *hasher = NULL;
+  // carry on after the segments of a resume point from segment 0, which are
+  // only read to hash them - ignored unless it matches the file, see resumed()
+  const EncryptResume *resume = NULL;
+};
+
+// produces ChunkCipher ciphertext for a file on demand, so encrypted data can
+// be handed straight to a remote from memory instead of via a temporary file.
+// Files larger than options.segmentSize are written as segmented objects, with
+// up to options.threads segments encrypted in parallel ahead of read(). If
+// options.compressionLevel is non-zero, files that sample as compressible are
+// zstd compressed before encryption. options.hasher is complete once eof().
+// Segmented objects can be cut between segments and resumed from there
+class EncryptStream {
+ public:
+  EncryptStream(
+      const char *source_file,
+      const unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES],
+      const EncryptOptions &options = EncryptOptions());
+  // encrypt len bytes of memory, e.g. one chunk of a file, as a whole object.
+  // Never segmented or compressed with a dictionary - data must outlive the
+  // stream
+  EncryptStream(
+      const unsigned char *data, size_t len,
+      const unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES],
+      const EncryptOptions &options = EncryptOptions());
+  ~EncryptStream();
+
+  EncryptStream(const EncryptStream &) = delete;
+  EncryptStream &operator=(const EncryptStream &) = delete;
+
+  bool is_open() const;
+  // true once all ciphertext has been returned by read()
+  bool eof() const;
+  // copy up to len bytes of ciphertext to buf, returns the number of bytes
+  // written - 0 once the stream is finished
+  size_t read(unsigned char *buf, size_t len);
+  // bytes of ciphertext returned by read() so far, including any before
+  // the resume point
+  uint64_t bytesRead() const { return totalRead; }
+
+  bool resumable() const { return segmented; }
+  // started from options.resume
+  bool resumed() const { return resumedFrom; }
+  // true if the ciphertext read so far ends with a whole segment
+  bool atSegmentEnd() const;
+  // ciphertext of the current segment (or header or table) not yet read
+  size_t buffered() const { return pending.size() - pendingPos; }
+  // where the ciphertext read so far ends, with the segments from
+  // firstSegment - only at a segment end
+  EncryptResume resumePoint(uint64_t firstSegment = 0) const;
+
+ private:
+  FILE *fp_s;
+  ChunkCipher st;
+  ObjectHeader header;
+  unsigned char headerBytes[ObjectHeader::BYTES];
+  std::vector<unsigned char> buf_in;
+  int compressionLevel = 0;
+  std::shared_ptr<const Dictionary> dictionary;
+  std::unique_ptr<CompressStream> compressor;
+  FileHasher *hasher = NULL;
+  uint64_t totalRead = 0;
+
+  // segmented objects
+  struct EncryptedSegment {
+    uint64_t index;
+    std::vector<unsigned char> ciphertext;
+    // for the hasher - leaf hashes if segments are whole leaves, otherwise
+    // the plaintext, hashed in order as each segment is handed out
+    std::vector<unsigned char> leaves;
+    std::vector<unsigned char> plaintext;
+  };
+  bool segmented = false;
+  bool hashLeaves = false;  // segment workers hash their own leaves
+  SegmentHeader segmentHeader;
+  unsigned char ad[ObjectHeader::BYTES + SegmentHeader::BYTES];
+  unsigned char objectKey[Segment::KEYBYTES];
+  unsigned int threads;
+  uint64_t segmentsQueued = 0;
+  std::deque<std::future<EncryptedSegment>> segments;
+  std::vector<uint64_t> offsets;  // of each segment handed out so far
+  uint64_t offset = 0;
+  // segments before the resume point, read only to hash them
+  uint64_t skipSegments = 0;
+  bool resumedFrom = false;
+
+  // ciphertext produced but not yet returned to the caller
+  std::vector<unsigned char> pending;
+  size_t pendingPos = 0;
+  bool firstChunk = true;
+  bool finalPushed = false;
+
+  // throws if options are unsupported, before the source is opened
+  void checkOptions(const EncryptOptions &options);
+  void start(
+      const unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES],
+      const EncryptOptions &options);
+  // false if from is not a resume point of an object of fileSize bytes
+  bool resume(
+      const unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES],
+      const EncryptResume &from, uint64_t fileSize, int level);
+  void nextChunk();  // encrypt the next chunkSize block of the source file
+  void nextSegment();
+  EncryptedSegment encryptSegment(uint64_t index) const;
+};
+
+// consumes ciphertext in arbitrary sized pieces (e.g. as it arrives from a
+// remote) and writes the plaintext to fp_t - if hasher is provided, it is
+// updated with the plaintext as it is written. Handles current, segmented and
+// legacy objects. Objects compressed with a dictionary need dictionaries
+class DecryptStream {
+ public:
+  DecryptStream(
+      FILE *fp_t,
+      const unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES],
+      FileHasher *hasher = NULL, Dictionaries *dictionaries = NULL);
+  ~DecryptStream();
+
+  DecryptStream(const DecryptStream &) = delete;
+  DecryptStream &operator=(const DecryptStream &) = delete;
+
+  // returns false once the stream is corrupted - further input is ignored
+  bool write(const unsigned char *buf, size_t len);
+  // call once all ciphertext has been written, returns 0 if the stream was
+  // complete and authenticated
+  int finish();
+
+ private:
+  enum class Stage {
+    OBJECT_HEADER,
+    SEGMENT_HEADER,
+    SEGMENT_LENGTH,
+    STREAM_HEADER,
+    CHUNKS,
+    SEGMENT_TABLE,
+    DONE
+  };
+
+  FILE *fp_t;
+  const unsigned char *key;
+  FileHasher *hasher;
+  Dictionaries *dictionaries;
+  ChunkCipher st;
+  ObjectHeader header;
+  unsigned char headerBytes[ObjectHeader::BYTES];
+  bool legacy = false;
+  std::vector<unsigned char> buf_out;
+  bool compressed = false;
+  std::unique_ptr<DecompressStream> decompressor;
+
+  // segmented objects - each segment is its own ChunkCipher stream
+  bool segmented = false;
+  SegmentHeader segmentHeader;
+  unsigned char ad[ObjectHeader::BYTES + SegmentHeader::BYTES];
+  unsigned char objectKey[Segment::KEYBYTES];
+  uint64_t segmentIndex = 0;
+  uint64_t segmentRemaining = 0;  // ciphertext left in the current segment
+  std::vector<unsigned char> segmentBuf;  // compressed segment plaintext
+  std::vector<uint64_t> offsets;          // checked against the table
+  uint64_t offset = 0;
+
+  // ciphertext received but not yet decrypted
+  std::vector<unsigned char> pending;
+  Stage stage = Stage::OBJECT_HEADER;
+  bool firstChunk = true;
+  bool finalPulled = false;
+  bool failed = false;
+
+  size_t wanted() const;  // bytes required to complete the current stage
+  void consume(const unsigned char *in, size_t len);
+  bool pullChunk(const unsigned char *in, size_t len);
+  void output(const unsigned char *buf, size_t len);  // write and hash
+};
+
+// std::streambuf adapter around DecryptStream, so a download can be decrypted
+// and hashed as it is received, in a single pass
+class DecryptStreamBuf : public std::streambuf {
+ public:
+  DecryptStreamBuf(
+      const std::string &target_file,
+      const unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES],
+      Dictionaries *dictionaries = NULL,
+      FileHasher::Algorithm hashAlgorithm = FileHasher::DEFAULT_ALGORITHM);
+  ~DecryptStreamBuf();
+
+  // discard any output and start again, e.g. when a request is retried
+  void reset();
+  // returns 0 if the full stream was decrypted and authenticated, and sets
+  // fileHash to the hashAlgorithm hash of the plaintext
+  int finish(std::string &fileHash);
+
+ protected:
+  std::streamsize xsputn(const char *s, std::streamsize n) override;
+  int_type overflow(int_type c) override;
+
+ private:
+  std::string target_file;
+  const unsigned char *key;
+  Dictionaries *dictionaries;
+  FileHasher::Algorithm hashAlgorithm;
+  FILE *fp_t = NULL;
+  FileHasher hasher;
+  std::unique_ptr<DecryptStream> stream;
+  bool failed = false;
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef FILEHASHER_H
+#define FILEHASHER_H
+
+#include <sodium.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// hashes file contents for integrity checks, as a 64 byte BLAKE2b hash in hex.
+// BLAKE2B hashes the file as a single stream, as earlier versions of encloned
+// did. TREE hashes each LEAF_SIZE leaf of the file separately, then the leaf
+// hashes and file size together, so large files can be hashed on several
+// cores - the result is the same however the file is read:
+//
+//   leaf i  BLAKE2b(leaf, salt = i (u64 little-endian), personal = LEAF)
+//   root    BLAKE2b(leaf 0 || ... || leaf n-1 || size (u64), personal = ROOT)
+//
+// The algorithm used is stored with each file version
+class FileHasher {
+ public:
+  enum Algorithm { BLAKE2B = 0, TREE = 1 };
+  static const Algorithm DEFAULT_ALGORITHM = TREE;
+
+  static const size_t LEAF_SIZE = 1024 * 1024;
+  static const int HASH_BYTES = 64;
+
+  explicit FileHasher(Algorithm algorithm = DEFAULT_ALGORITHM);
+
+  Algorithm getAlgorithm() const { return algorithm; }
+
+  // incremental hashing, e.g. of data as it is downloaded
+  void update(const unsigned char *buf, size_t len);
+  std::string final();
+
+  // TREE only - hash data, which starts at leaf firstLeaf of a file, as
+  // HASH_BYTES per leaf. Lets leaves be hashed on whichever thread already
+  // has them in memory, then added in order with updateLeaves
+  static std::vector<unsigned char> hashLeaves(const unsigned char *data,
+                                               size_t len, uint64_t firstLeaf);
+  // add the next len bytes of the file as leaves from hashLeaves. Only valid
+  // at a leaf boundary, and len must be whole leaves unless it ends the file
+  void updateLeaves(const std::vector<unsigned char> &hashes, uint64_t len);
+
+  // hash a whole file, TREE hashes large files using up to threads cores (0
+  // for all)
+  static std::string hashFile(const std::string &path,
+                              Algorithm algorithm = DEFAULT_ALGORITHM,
+                              unsigned int threads = 0);
+
+ private:
+  static constexpr unsigned char LEAF_PERSONAL[16] = {
+      'e', 'n', 'c', 'l', 'o', 'n', 'e', '-',
+      't', 'r', 'e', 'e', 'L', 'E', 'A', 'F'};
+  static constexpr unsigned char ROOT_PERSONAL[16] = {
+      'e', 'n', 'c', 'l', 'o', 'n', 'e', '-',
+      't', 'r', 'e', 'e', 'R', 'O', 'O', 'T'};
+  static const size_t IO_BUFFER_SIZE = 256 * 1024;
+
+  Algorithm algorithm;
+  crypto_generichash_state state;  // whole file, or the root of the tree
+  crypto_generichash_state leaf;
+  uint64_t leafIndex = 0;
+  size_t leafFill = 0;
+  uint64_t size = 0;
+
+  void finishLeaf();
+  static void hashLeaf(const unsigned char *data, size_t len, uint64_t index,
+                       unsigned char out[HASH_BYTES]);
+  static void initLeaf(crypto_generichash_state *leaf, uint64_t index);
+  static std::string finalRoot(crypto_generichash_state *root, uint64_t size);
+  // hash the leaves of fp in parallel, false if the file could not be read
+  static bool hashTree(FILE *fp, uint64_t fileSize, unsigned int threads,
+                       std::string &out);
+};
+
+#endif
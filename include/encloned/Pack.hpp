@@ -0,0 +1,31 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+
+// packing - small files are uploaded together in pack objects, rather than
+// one request each. A pack is the objects one after another, each encrypted
+// on its own as if it were stored alone, followed by an encrypted index of
+// them ("objectName offset length" lines) and the length of the encrypted
+// index as 8 bytes, little endian. Objects are read with a ranged GET
+
+// where a packed object is - its bytes in pack
+struct PackedObject {
+  std::string pack;
+  uint64_t offset;
+  uint64_t length;
+};
+
+// a pack object, repacked once less than half of the objects packed in it
+// are still referenced
+struct Pack {
+  uint64_t size = 0;
+  uint64_t packedBytes = 0;  // of objects, when the pack was uploaded
+  uint64_t liveBytes = 0;    // of objects still referenced
+  uint64_t objects = 0;
+  std::time_t created;
+};
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef SEGMENT_H
+#define SEGMENT_H
+
+#include <encloned/ChunkCipher.hpp>
+#include <sodium.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Segmented objects split the file into fixed size segments, each encrypted
+// as its own ChunkCipher stream, in the object's cipher suite, under a key
+// derived from a random per-object salt and the segment index. Segments can
+// therefore be encrypted and decrypted in parallel, and read individually.
+// After the ObjectHeader:
+//
+//   segment header  salt (32), segment size (u64), plaintext size (u64)
+//   segments        length (u64), then a stream header + chunks with
+//                   the final tag on the last chunk. All but the last segment
+//                   hold exactly segment size bytes of the file, each zstd
+//                   compressed first if the object is compressed
+//   segment table   nonce (24) + AEAD(plaintext size, segment count, offset
+//                   of each segment), authenticating the layout as a whole -
+//                   always XChaCha20-Poly1305, it is tiny
+//
+// The object and segment headers are additional data for the first chunk of
+// every segment, and for the segment table.
+struct SegmentHeader {
+  static const int BYTES = 48;
+  static const int SALTBYTES = 32;
+
+  static const uint64_t DEFAULT_SEGMENT_SIZE = 8 * 1024 * 1024;
+  static const uint64_t MAX_SEGMENT_SIZE = 1024 * 1024 * 1024;
+
+  unsigned char salt[SALTBYTES];
+  uint64_t segmentSize = 0;
+  uint64_t plaintextSize = 0;
+
+  void serialise(unsigned char out[BYTES]) const;
+  void parse(const unsigned char in[BYTES]);
+
+  uint64_t segmentCount() const;
+  uint64_t segmentPlaintextSize(uint64_t index) const;
+};
+
+class Segment {
+ public:
+  static const int KEYBYTES = crypto_kdf_KEYBYTES;
+  static const int LENGTHBYTES = 8;  // length prefix of each segment
+
+  // per object key from the master key and salt, per segment keys from that
+  static void deriveObjectKey(
+      unsigned char out[KEYBYTES], const unsigned char key[KEYBYTES],
+      const unsigned char salt[SegmentHeader::SALTBYTES]);
+  static void deriveSegmentKey(unsigned char out[KEYBYTES],
+                               const unsigned char objectKey[KEYBYTES],
+                               uint64_t index);
+
+  // pread until len bytes are read, false on error or end of file
+  static bool readAt(int fd, unsigned char *buf, size_t len, uint64_t offset);
+
+  // segments must be whole chunks, up to MAX_SEGMENT_SIZE
+  static bool validSize(uint64_t segmentSize, uint32_t chunkSize);
+  // size of a stream holding plaintextSize bytes, and the reverse -
+  // false if no plaintext size encrypts to len bytes
+  static uint64_t encryptedSize(uint64_t plaintextSize, uint32_t chunkSize);
+  static bool plaintextSize(uint64_t len, uint32_t chunkSize, uint64_t &out);
+  // largest possible segment (including its length) for rawSize bytes
+  static uint64_t maxStoredSize(uint64_t rawSize, uint32_t chunkSize,
+                                bool compressed);
+  static uint64_t tableSize(uint64_t segmentCount);
+
+  // returns the segment as stored, length prefix followed by the stream
+  static std::vector<unsigned char> encrypt(
+      const unsigned char *in, size_t len,
+      const unsigned char segmentKey[KEYBYTES], uint8_t cipher,
+      uint32_t chunkSize, const unsigned char *ad, size_t adlen);
+  // decrypt a segment's stream (after the length prefix) to out, returns
+  // false if the segment is corrupted or incomplete
+  static bool decrypt(const unsigned char *in, size_t len,
+                      std::vector<unsigned char> &out,
+                      const unsigned char segmentKey[KEYBYTES],
+                      uint8_t cipher, uint32_t chunkSize,
+                      const unsigned char *ad, size_t adlen);
+
+  static std::vector<unsigned char> encryptTable(
+      const SegmentHeader &segmentHeader, const std::vector<uint64_t> &offsets,
+      const unsigned char objectKey[KEYBYTES], const unsigned char *ad,
+      size_t adlen);
+  // authenticate the table and check it is consistent with segmentHeader,
+  // offsets are relative to the end of the segment header
+  static bool decryptTable(const unsigned char *in, size_t len,
+                           const SegmentHeader &segmentHeader,
+                           const unsigned char objectKey[KEYBYTES],
+                           const unsigned char *ad, size_t adlen,
+                           std::vector<uint64_t> &offsets);
+
+  // decrypt a whole segmented object, using up to threads segments at a time
+  static int decryptFile(
+      FILE *fp_t, FILE *fp_s,
+      const unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES],
+      unsigned int threads);
+  // decrypt length bytes of plaintext starting at offset, reading and
+  // decrypting only the segments that cover the range
+  static int decryptRange(
+      FILE *fp_s,
+      const unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES],
+      uint64_t offset, size_t length, std::vector<unsigned char> &out);
+
+ private:
+  static constexpr char SEGMENT_CONTEXT[] = "SEGMENT_";
+  static constexpr char TABLE_CONTEXT[] = "SEGTABLE";
+
+  struct Layout;  // headers, keys and table read from an object
+  static bool readLayout(FILE *fp_s, const unsigned char *key, Layout &layout);
+  // read, decrypt and decompress segment index of the file
+  static bool readSegment(int fd, const Layout &layout, uint64_t index,
+                          std::vector<unsigned char> &out);
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+// latency of each stage of the pipeline, per file (or per pass for scan),
+// for the stats command and bench/enclone_e2e. Latencies are counted in
+// buckets of 1/8 of a power of two, so memory doesn't grow with the number
+// of files and percentiles are within 12.5%
+class Stats {
+ public:
+  enum Stage {
+    SCAN,      // a pass of Watch over every tracked file
+    HASH,      // content hash of a file, for deduplication
+    ENCRYPT,   // reading, compressing and encrypting a file
+    UPLOAD,    // a file from leaving the queue until it is stored
+    DOWNLOAD,  // download, decryption and verification of a file
+    STAGES
+  };
+  static const char* name(Stage stage);
+
+  void record(Stage stage, long long microseconds, uint64_t bytes);
+  void record(Stage stage, std::chrono::steady_clock::time_point started,
+              uint64_t bytes);
+  void reset();
+
+  // a line per stage - count, bytes and p50/p90/p99/max in microseconds
+  std::string report();
+
+ private:
+  static const int SUB_BUCKETS = 8;
+  static const int BUCKETS = 64 * SUB_BUCKETS;
+
+  struct Histogram {
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+    long long max = 0;
+    std::array<uint64_t, BUCKETS> buckets{};
+  };
+  std::array<Histogram, STAGES> stages;
+  std::mutex mtx;
+
+  static int bucket(long long microseconds);
+  // the largest latency counted in bucket
+  static long long upperBound(int bucket);
+  static long long percentile(const Histogram& histogram, double fraction);
+};
+
+#endif
@@ -9,6 +9,8 @@
 //#include <sys/inotify.h>
 #include <algorithm>
 #include <chrono>
+#include <map>
+#include <optional>
 #include <tuple>
 #include <unordered_map>
 #include <unordered_set>
@@ -17,6 +19,9 @@
 // concurrency/multi-threading
 #include <encloned/DB.hpp>
 #include <encloned/Encryption.hpp>
+#include <encloned/Pack.hpp>
+#include <encloned/Stats.hpp>
+#include <encloned/remote/Inventory.hpp>
 #include <encloned/remote/Remote.hpp>
 
 #include <atomic>
@@ -39,6 +44,39 @@ struct FileVersion {
   bool localExists = true;  // false if file has been deleted from local fs
   bool remoteExists = false;   // set flag once successfully uploaded to remote
   std::string remoteLocation;  // remote locations the file exists
+  FileHasher::Algorithm hashAlgorithm = FileHasher::BLAKE2B;  // of fileHash
+  // set if the contents are stored in an object shared with other versions
+  // (deduplication), rather than under pathHash
+  std::string objectName;
+  // set if stored as content defined chunks (cdc), see Watch::chunkList
+  uint64_t chunks = 0;
+
+  const std::string& remoteName() const {
+    return objectName.empty() ? pathHash : objectName;
+  }
+};
+
+// an object named by its contents - a whole file, or a chunk of one -
+// referenced by every file version with those contents. Deleted from remotes
+// along with its last reference
+struct StoredObject {
+  std::string fileHash;
+  FileHasher::Algorithm hashAlgorithm;
+  bool remoteExists = false;
+  std::unordered_map<std::string, std::string> refs;  // pathHash -> path
+  bool chunk = false;
+  uint64_t size = 0;  // chunks only
+};
+
+// a dictionary trained for the small files under a watch root, uploaded like
+// any other file. Only used for new files once it exists remotely
+struct DictionaryVersion {
+  uint32_t id;
+  std::string root;
+  std::string objectName;
+  std::string fileHash;
+  std::time_t created;
+  bool remoteExists = false;
 };
 
 class Watch {
@@ -73,10 +111,83 @@ class Watch {
   std::pair<string, std::time_t> resolvePathHash(string pathHash);
   // check a hash matches the stored filehash in fileIndex
   bool verifyHash(string pathHash, string fileHash) const;
-  // update the index if a file was successfully uploaded
-  void uploadSuccess(std::string path, std::string objectName, int remoteID);
+  // algorithm the stored filehash was computed with
+  FileHasher::Algorithm hashAlgorithm(string pathHash) const;
+  // dictionaries are restored before the files compressed with them
+  bool isDictionary(const string& objectName) const;
+  // update the index if a file was successfully uploaded, fileHash is the
+  // hash of the contents as they were uploaded
+  void uploadSuccess(std::string path, std::string objectName, int remoteID,
+                     std::string fileHash);
+  // deduplication - true if a version is to be uploaded under a name derived
+  // from its contents, rather than its pathHash
+  bool namedByContent(const string& pathHash) const;
+  // reference the object holding a version's contents before uploading it,
+  // true if the object is already stored and need not be uploaded again
+  bool addObjectReference(const string& pathHash, const string& objectName,
+                          const string& fileHash,
+                          FileHasher::Algorithm hashAlgorithm);
+  // content defined chunking - reference each chunk of a version as it is
+  // read, true if it is already stored. Once every chunk is stored, record
+  // the version as the list of its chunks
+  bool addChunkReference(const string& pathHash, const string& objectName,
+                         const string& chunkHash, uint64_t size);
+  void chunksUploaded(const string& pathHash,
+                      const std::vector<string>& chunks,
+                      const string& fileHash,
+                      FileHasher::Algorithm hashAlgorithm);
+  // chunk object names and sizes of a chunked version, in order - empty if
+  // the version is a single object
+  std::vector<std::pair<string, uint64_t>> chunkList(
+      const string& pathHash) const;
+  // packing - true if a version waiting for upload may be stored in a pack
+  // with other small files, rather than as an object of its own
+  bool packable(const string& pathHash) const;
+  // record a pack once uploaded, with the location of each object in it -
+  // returns the number of objects still tracked
+  size_t packUploaded(
+      const string& pack, uint64_t size,
+      const std::vector<std::pair<string, PackedObject>>& objects);
+  // false if the object is not stored in a pack
+  bool packedLocation(const string& objectName, PackedObject& location) const;
+  // packs less than half of which is still referenced
+  std::vector<string> packsToRepack() const;
+  // objects still referenced in a pack, by offset
+  std::vector<std::pair<string, PackedObject>> packContents(
+      const string& pack) const;
+  // move objects to the pack replacing oldPack, skipping any released since
+  // packContents - returns the number moved
+  size_t packRepacked(
+      const string& oldPack, const string& pack, uint64_t size,
+      const std::vector<std::pair<string, PackedObject>>& objects);
   string restoreIndex(string arg);
 
+  // remote inventory - record objects as they are uploaded and deleted
+  void inventoryStored(const RemoteObject& object);
+  void inventoryDeleted(const string& objectName);
+  // replace the inventory with a full listing started at listed - objects
+  // stored since then are kept
+  void inventoryListed(const std::vector<RemoteObject>& objects,
+                       std::time_t listed);
+  // by name
+  std::vector<RemoteObject> getInventory() const;
+  // time of the last full listing, 0 if the remote has never been listed
+  std::time_t inventoryListedAt() const;
+
+  // multipart uploads in progress, by the pathHash of the version - written
+  // to the DB straight away rather than through sqlQueue, so a restart only
+  // loses the parts in flight
+  void uploadStarted(const PartialUpload& upload);
+  void partUploaded(const string& pathHash, int number,
+                    const PartialUpload::Part& part);
+  // forget the parts from number on
+  void partsDiscarded(const string& pathHash, int number);
+  // completed or aborted
+  void uploadFinished(const string& pathHash);
+  // false if no upload of the version is in progress
+  bool partialUpload(const string& pathHash, PartialUpload& upload) const;
+  std::vector<PartialUpload> getPartialUploads() const;
+
   // helper functions
   string displayTime(std::time_t modtime) const;
   time_t fsLastMod(string path);  // get last mod time from file system
@@ -99,6 +210,29 @@ class Watch {
 
   // concurrency/multi-threading
   std::mutex mtx;
+  // the upload threads can't take mtx - the Watch thread holds it while it
+  // queues uploads, and the Remote thread holds Remote's lock while it waits
+  // for them. Their changes to fileIndex are queued in uploadUpdates, and
+  // their SQL in uploadSql, under uploadMtx, and applied by the Watch thread
+  // before it next scans, deletes or writes to the DB
+  struct VersionUpdate {
+    string path;
+    string pathHash;
+    std::optional<string> objectName;
+    std::optional<string> fileHash;
+    std::optional<FileHasher::Algorithm> hashAlgorithm;
+    std::optional<uint64_t> chunks;
+    std::optional<bool> remoteExists;
+  };
+  std::vector<VersionUpdate> uploadUpdates;
+  std::stringstream uploadSql;
+  std::mutex uploadMtx;
+  // with mtx held
+  void applyUploadUpdates();
+  // fileIndex and pathHashIndex are only changed with mtx held, but the
+  // download threads read the hashes of versions without it - held while
+  // either is changed, and never while calling out of Watch
+  mutable std::mutex indexMtx;
   std::atomic_bool* runThreads;  // ptr to flag indicating if execThread should
                                  // loop or close down
 
@@ -112,9 +246,67 @@ class Watch {
 
   std::time_t getLastModFromIdx(std::string path);
 
+  // zstd dictionaries, retrained for each watch root every retrainInterval
+  static const int DEFAULT_RETRAIN_DAYS = 7;
+  // retry sooner if a root had too few small files to train from
+  static const std::time_t TRAINING_RETRY_INTERVAL = 60 * 60;
+  std::vector<DictionaryVersion> dictionaryIndex;
+  std::unordered_map<string, std::time_t> nextTraining;  // by watch root
+  mutable std::mutex dictMtx;  // dictionaryIndex is also updated on upload
+  bool dictionariesEnabled;
+  std::time_t retrainInterval;
+  bool isWatchRoot(const string& path) const;
+  void trainDictionaries();
+  // files compressed with a dictionary cannot be restored without it
+  void queueDictionaryDownloads();
+  // with uploadMtx held
+  bool dictionaryUploaded(const string& objectName);
+  void setCurrentDictionary(const string& root);
+
+  // deduplication, cdc and packing - new versions wait in pendingVersions
+  // until they are uploaded, when they may be named by their contents, split
+  // into chunks or packed. Also updated from the upload thread, so guarded by
+  // objectMtx
+  bool deduplication;
+  bool packing;
+  std::unordered_map<string, StoredObject> objectIndex;  // by object name
+  std::unordered_map<string, string> objectNames;  // pathHash -> object name
+  // pathHash -> chunk object names, in order
+  std::unordered_map<string, std::vector<string>> versionChunks;
+  std::unordered_map<string, string> pendingVersions;  // pathHash -> path
+  mutable std::mutex objectMtx;
+  bool objectUploaded(const string& objectName);  // with uploadMtx held
+  // drop a deleted version's references, returning the objects to delete
+  // from remotes
+  std::vector<string> releaseObjects(const string& pathHash);
+  std::unordered_map<string, PackedObject> packedObjects;  // by object name
+  std::unordered_map<string, Pack> packs;                  // by pack name
+  // with uploadMtx held
+  void addPack(const string& pack, uint64_t size,
+               const std::vector<std::pair<string, PackedObject>>& objects);
+  // drop released objects from their packs, returning the rest of names and
+  // any packs left empty - objectMtx must be held
+  std::vector<string> releasePacked(const std::vector<string>& names);
+
+  // remote inventory, by name - updated from upload threads, so guarded by
+  // inventoryMtx and written to the DB through inventorySql rather than
+  // sqlQueue
+  std::map<string, RemoteObject> inventory;
+  std::time_t inventoryListTime = 0;
+  std::stringstream inventorySql;
+  mutable std::mutex inventoryMtx;
+
+  // multipart uploads in progress, by pathHash - updated from upload threads
+  std::unordered_map<string, PartialUpload> partialUploads;
+  mutable std::mutex partialMtx;
+
   // backup index to remote storage methods
   string indexBackupName;
   std::time_t indexLastMod;
+  // name used before index backup names could be verified cheaply, deleted
+  // once a backup has been uploaded under the new name
+  string legacyIndexBackupName;
+  std::atomic_bool indexBackupUploaded = false;
   void deriveIdxBackupName();
   void indexBackup();
 
@@ -123,6 +315,12 @@ class Watch {
   void restoreFileIdx();
   void restoreDirIdx();
   void restoreIdxBackupName();
+  void restoreDictionaries();
+  void restoreChunks();
+  void restorePacks();
+  void restoreInventory();
+  // and queue the versions they were uploading again
+  void restorePartialUploads();
 };
 
 #endif
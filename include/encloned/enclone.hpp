@@ -1,6 +1,7 @@
 #ifndef ENCLONE_H
 #define ENCLONE_H
 
+#include <encloned/ChunkCipher.hpp>
 #include <sodium.h>
 
 #include <boost/asio.hpp>             // unix domain local sockets
@@ -43,13 +44,17 @@ class enclone {
   bool addWatch(string path, bool recursive);
   bool delWatch(string path, bool recursive);
   bool listLocal();
-  bool listRemote();
+  bool listRemote(bool refresh);
   bool restoreFiles(string targetPath);
   bool restoreFiles(string targetPath, string pathOrHash);
   bool restoreIndex(string arg);
   bool cleanRemote();
+  bool failedItems(string arg);
+  bool stats(string arg);
+  bool limit(string direction, string rate);
 
-  void generateKey();  // generate encryption key to file
+  // generate encryption key to file, for ChunkCipher suite cipher
+  void generateKey(uint8_t cipher);
 
   // handle multiple arguments provided in one command
   std::vector<string> toAdd{};      // paths to watch
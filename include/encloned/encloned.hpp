@@ -15,8 +15,12 @@
 #include <thread>
 
 // get path of this executable
+#include <encloned/ChunkCipher.hpp>
+#include <encloned/Config.hpp>
 #include <encloned/DB.hpp>
+#include <encloned/Dictionaries.hpp>
 #include <encloned/Socket.hpp>
+#include <encloned/Stats.hpp>
 #include <encloned/Watch.hpp>
 #include <encloned/remote/Remote.hpp>
 #include <libgen.h>        // dirname
@@ -33,10 +37,15 @@ class Remote;
 
 class encloned {
  private:
+  std::shared_ptr<Config> config;  // settings from encloned.conf
   std::shared_ptr<DB> db;          // database handle
   std::shared_ptr<Watch> watch;    // watch file/directory class
   std::shared_ptr<Socket> socket;  // local unix domain socket for enclone
   std::shared_ptr<Remote> remote;  // remote backend handler
+  // zstd dictionaries trained for the small files in each watch root
+  std::shared_ptr<Dictionaries> dictionaries;
+  // latency of each stage of the pipeline, see the stats command
+  std::shared_ptr<Stats> stats;
 
   std::atomic<bool> runThreads;  // flag to indicate whether detached threads
                                  // should continue to run
@@ -44,8 +53,12 @@ class encloned {
 
   // file encryption master key
   unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES];
+  // ChunkCipher suite for new objects, chosen when the key was generated
+  uint8_t cipher = ChunkCipher::XCHACHA20POLY1305;
   unsigned char subKey[64];  // derived subKey for index backup name encryption
   string subKey_b64;
+  // derived subKey for object names derived from file contents (deduplication)
+  unsigned char contentKey[crypto_generichash_KEYBYTES];
   int loadEncryptionKey();
   int deriveSubKey();
 
@@ -53,15 +66,20 @@ class encloned {
   encloned();
   ~encloned();
   string daemonPath;
-  static constexpr char TEMP_FILE_LOCATION[] =
-      "/tmp/enclone/";  // path to store temporary encrypted files before
-                        // upload, and downloaded files before decryption
+  static constexpr char PARTIAL_DOWNLOAD_SUFFIX[] =
+      ".enclone-partial";  // downloads are decrypted to path + suffix, and
+                           // renamed once the file hash is verified
 
   std::mutex* daemonMtxPtr;
 
   int execLoop();
   unsigned char* const getKey();
+  uint8_t getCipher();
+  unsigned char* const getContentKey();
   string const getSubKey_b64();
+  std::shared_ptr<Config> getConfig();
+  std::shared_ptr<Dictionaries> getDictionaries();
+  std::shared_ptr<Stats> getStats();
 
   void addWatch(string path, bool recursive);  // needs mutex support
   void displayWatches();
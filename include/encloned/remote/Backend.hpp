@@ -0,0 +1,101 @@
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <encloned/remote/Inventory.hpp>
+#include <encloned/remote/RemoteError.hpp>
+
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// object storage that Transfer uploads to and restores from - an S3 bucket,
+// or a local directory. Every call blocks until it is done, and may be made
+// from several threads at once. Failures throw RemoteError, marked as
+// retryable or not
+class Backend {
+ public:
+  // a single object uploaded in numbered parts (from 1), which may be put
+  // concurrently and in any order. Parts may be of different sizes, and a
+  // part put again replaces the earlier one
+  class Upload {
+   public:
+    virtual ~Upload() = default;
+
+    // to resume the upload with, e.g. after a restart
+    virtual std::string id() const = 0;
+    // the parts stored so far, with their ETags - throws a RemoteError that
+    // is not retryable if the upload no longer exists
+    virtual std::vector<std::pair<int, std::string>> parts() = 0;
+
+    // returns the ETag of the part
+    virtual std::string putPart(int number,
+                                std::shared_ptr<std::iostream> body) = 0;
+    // assemble the parts into the object, returning its ETag
+    virtual std::string complete(
+        const std::vector<std::pair<int, std::string>>& parts) = 0;
+    // discard the parts put so far - never throws
+    virtual void abort() = 0;
+  };
+
+  // an upload started but neither completed nor aborted
+  struct PendingUpload {
+    std::string objectName;
+    std::string id;
+    std::time_t started;
+  };
+
+  // length bytes of an object from offset, for a ranged GET
+  struct Range {
+    uint64_t offset;
+    uint64_t length;
+  };
+
+  virtual ~Backend() = default;
+
+  // for log messages, e.g. "S3 bucket enclone"
+  virtual std::string name() const = 0;
+
+  // parts of an Upload are at least partSize() bytes but the last, and up
+  // to partsInFlight() parts (or chunks) of a single file are transferred at
+  // once
+  virtual size_t partSize() const = 0;
+  virtual size_t partsInFlight() const = 0;
+  // key ranges listed at once when a listing is more than a page
+  virtual size_t listRanges() const = 0;
+  // the most object names in a single remove()
+  virtual size_t deleteBatchSize() const = 0;
+
+  // store body as objectName, replacing any object of that name - returns
+  // its ETag
+  virtual std::string put(const std::string& objectName,
+                          std::shared_ptr<std::iostream> body) = 0;
+  virtual std::unique_ptr<Upload> startUpload(
+      const std::string& objectName) = 0;
+  // an upload started earlier, by id - checked by its first call
+  virtual std::unique_ptr<Upload> resumeUpload(const std::string& objectName,
+                                               const std::string& id) = 0;
+  // every upload in progress, including any abandoned by an earlier run
+  virtual std::vector<PendingUpload> listUploads() = 0;
+  // write an object, or range of it, to the buffer returned by sink as it is
+  // read. sink is called again if the read is retried, and must start from
+  // scratch
+  virtual void get(const std::string& objectName,
+                   const std::function<std::streambuf*()>& sink,
+                   const Range* range = NULL) = 0;
+  // objects named after after, up to and including upTo (to the end if
+  // empty), in name order - false if there were more than maxPages pages
+  virtual bool list(const std::string& after, const std::string& upTo,
+                    std::vector<RemoteObject>& objects,
+                    size_t maxPages = SIZE_MAX) = 0;
+  // objects that don't exist count as deleted - returns the names that could
+  // not be deleted, each with its error
+  virtual std::vector<std::pair<std::string, RemoteError>> remove(
+      const std::vector<std::string>& objectNames) = 0;
+};
+
+#endif
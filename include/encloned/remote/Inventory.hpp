@@ -0,0 +1,45 @@
+#ifndef INVENTORY_H
+#define INVENTORY_H
+
+#include <cstdint>
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+
+// remote inventory - every object stored on a remote, kept in the index so
+// listing commands don't need to list the bucket. Updated as objects are
+// uploaded and deleted, and replaced by a full listing every
+// inventory_refresh_hours, see Watch::inventoryListed
+struct RemoteObject {
+  std::string name;
+  uint64_t size = 0;
+  std::string etag;
+  std::time_t lastModified = 0;
+};
+
+// a multipart upload of a file version in progress, with the parts stored so
+// far - kept in the index so an upload interrupted by a restart carries on
+// after its last stored part, see Transfer::resumeUpload
+struct PartialUpload {
+  std::string pathHash;  // of the version
+  std::string path;
+  std::time_t modtime = 0;
+  uint64_t size = 0;  // of the file, unchanged if the upload can be resumed
+  std::string objectName;
+  std::string uploadID;
+  // base64 object and segment headers the object was started with
+  std::string headers;
+  std::time_t started = 0;
+
+  // the segments of the object in a part - see EncryptResume
+  struct Part {
+    std::string etag;
+    uint64_t firstSegment = 0;
+    std::vector<uint64_t> offsets;
+    uint64_t end = 0;
+  };
+  std::map<int, Part> parts;  // by number
+};
+
+#endif
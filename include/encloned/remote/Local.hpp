@@ -0,0 +1,74 @@
+#ifndef LOCAL_H
+#define LOCAL_H
+
+#include <encloned/remote/Backend.hpp>
+#include <encloned/remote/RateLimiter.hpp>
+
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+namespace fs = std::filesystem;
+using std::cout;
+using std::endl;
+using std::string;
+
+// objects stored as files in a local directory (e.g. a disk or NAS close by,
+// for fast restores), with the same semantics as a bucket - an object only
+// appears once it has been written in full. Also used to measure the whole
+// pipeline at local disk speed, without a network
+class Local : public Backend {
+ private:
+  fs::path root;
+  // temporary files, and the parts of unfinished uploads, each in a
+  // directory named by its id with a file holding its object name - never
+  // listed, as object names don't start with a '.'
+  fs::path staging;
+  static constexpr char NAME_FILE[] = "name";
+  // bytes are written to and read from the directory no faster than these
+  // allow, as if it were a remote
+  RateLimiter* uploadLimit;
+  RateLimiter* downloadLimit;
+
+  static const size_t PART_SIZE = 8 * 1024 * 1024;
+  static const size_t PARTS_IN_FLIGHT = 4;
+  static const size_t DELETE_BATCH_SIZE = 1000;
+
+  class MultipartUpload;
+
+  // copy body to a temporary file, renamed to path once written - returns
+  // its ETag
+  string write(const fs::path& path, std::istream& body);
+  // size and modification time, changed by every write
+  static string etag(const fs::path& path);
+
+ public:
+  Local(const string& root, RateLimiter* uploadLimit,
+        RateLimiter* downloadLimit);
+
+  string name() const override;
+  size_t partSize() const override { return PART_SIZE; }
+  size_t partsInFlight() const override { return PARTS_IN_FLIGHT; }
+  size_t listRanges() const override { return 1; }
+  size_t deleteBatchSize() const override { return DELETE_BATCH_SIZE; }
+
+  string put(const string& objectName,
+             std::shared_ptr<std::iostream> body) override;
+  std::unique_ptr<Upload> startUpload(const string& objectName) override;
+  std::unique_ptr<Upload> resumeUpload(const string& objectName,
+                                       const string& id) override;
+  std::vector<PendingUpload> listUploads() override;
+  void get(const string& objectName,
+           const std::function<std::streambuf*()>& sink,
+           const Range* range = NULL) override;
+  // a directory is listed in a single page
+  bool list(const string& after, const string& upTo,
+            std::vector<RemoteObject>& objects,
+            size_t maxPages = SIZE_MAX) override;
+  std::vector<std::pair<string, RemoteError>> remove(
+      const std::vector<string>& objectNames) override;
+};
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef RATELIMITER_H
+#define RATELIMITER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+using std::string;
+
+// a token bucket shared by every transfer in one direction, so the limit is
+// on their total rate. The rate is limit outside the schedule's windows,
+// the window's rate inside one, or whatever was set live with the limit
+// command until that is cleared again
+class RateLimiter {
+ public:
+  // bytes taken from the bucket at a time - small enough that concurrent
+  // transfers interleave, and that a changed rate applies within a slice
+  static constexpr size_t SLICE = 64 * 1024;
+
+  // a time of day in minutes, local time - end < start spans midnight
+  struct Window {
+    int start;
+    int end;
+    uint64_t rate;
+  };
+
+  RateLimiter(const string& direction) : direction(direction) {}
+
+  RateLimiter(const RateLimiter&) = delete;
+  RateLimiter& operator=(const RateLimiter&) = delete;
+
+  // bytes per second from encloned.conf, 0 for unlimited
+  void configure(uint64_t limit, const std::vector<Window>& schedule);
+  // set live, until cleared with std::nullopt
+  void setOverride(std::optional<uint64_t> rate);
+  uint64_t currentRate();
+  string describe();
+
+  // blocks until up to SLICE bytes may be sent or received
+  void acquire(size_t bytes);
+
+  // "08:00-18:00=1M,18:00-22:00=4M" - returns false if s is invalid
+  static bool parseSchedule(const string& s, std::vector<Window>& schedule);
+  // "512K", "1M" etc. in bytes per second
+  static bool parseRate(const string& s, uint64_t& rate);
+  static string formatRate(uint64_t rate);
+
+ private:
+  string direction;
+  uint64_t limit = 0;
+  std::vector<Window> schedule;
+  std::optional<uint64_t> override;
+
+  std::mutex mtx;
+  std::condition_variable changed;
+  uint64_t rate = 0;  // in effect, checked against the schedule every second
+  std::chrono::steady_clock::time_point rateChecked;
+  double tokens = 0;
+  std::chrono::steady_clock::time_point refilled;
+
+  // with mtx held
+  uint64_t scheduledRate();
+  void refill();
+  double burst() const;
+};
+
+// a sink written to target no faster than limiter allows - the local
+// backend's uploads and downloads. S3 is limited by its HTTP client, see
+// S3.cpp
+class LimitedSink : public std::streambuf {
+ public:
+  LimitedSink(std::streambuf* target, RateLimiter* limiter)
+      : target(target), limiter(limiter) {}
+
+ protected:
+  std::streamsize xsputn(const char* s, std::streamsize n) override;
+  int_type overflow(int_type c) override;
+
+ private:
+  std::streambuf* target;
+  RateLimiter* limiter;
+};
+
+#endif
@@ -3,14 +3,14 @@
 
 #include <encloned/Watch.hpp>
 #include <encloned/encloned.hpp>
-#include <encloned/remote/S3.hpp>
+#include <encloned/remote/Transfer.hpp>
 
 #include <chrono>
 #include <iostream>
 #include <memory>
 #include <string>
 
-class S3;
+class Transfer;
 class Watch;
 class encloned;
 
@@ -20,8 +20,8 @@ class Remote {
   encloned* daemon;  // ptr to main daemon class that spawned this
   std::shared_ptr<Watch> watch;
 
-  // available remotes
-  std::shared_ptr<S3> s3;
+  // available remotes - stored on the backend chosen in encloned.conf
+  std::shared_ptr<Transfer> transfer;
 
   // concurrency/multi-threading
   std::mutex mtx;
@@ -45,17 +45,34 @@ class Remote {
   void uploadRemotes();
   string uploadNow(string path, string pathHash);
   void uploadSuccess(
-      std::string path, std::string objectName,
-      int remoteID);  // update fileIndex if upload to remote is succesfull,
-                      // returns the remoteID it was succesfully uploaded to
+      std::string path, std::string objectName, int remoteID,
+      std::string fileHash);  // update fileIndex if upload to remote is
+                              // succesfull, with the remoteID it was
+                              // succesfully uploaded to and the file hash
   string downloadRemotes();
   string downloadNow(string pathHash, string target);
+  // failed downloads, once due to be retried
+  void retryDownloads();
   void deleteRemotes();
+  // list remotes again once their inventory is older than
+  // inventory_refresh_hours
+  void refreshRemotes();
+  // abort abandoned multipart uploads in the background, once the index is
+  // restored
+  void cleanUpUploads();
 
-  string listObjects();
-  std::vector<string> getObjects();
+  // from the remote inventory, listed again first if refresh
+  string listObjects(bool refresh = false);
+  std::vector<RemoteObject> getObjects();
   std::unordered_map<string, string> getObjectMap();
   string cleanRemote();
+  // uploads, downloads and deletes that failed for good, queued again if
+  // retry
+  string failedItems(bool retry);
+  // latency of each stage since the daemon started, or since the last reset
+  string stats(bool reset);
+  // the upload and download limits, see Transfer::limit
+  string limit(const string& direction, const string& rate);
 };
 
 #endif
@@ -0,0 +1,27 @@
+#ifndef REMOTE_ERROR_H
+#define REMOTE_ERROR_H
+
+#include <stdexcept>
+#include <string>
+
+// an upload, download or delete that failed - permanent errors (e.g. a
+// missing object or local file, access denied, or an object that fails to
+// decrypt) are not worth retrying. Other exceptions are assumed to be
+// transient
+class RemoteError : public std::runtime_error {
+ public:
+  RemoteError(const std::string& what, bool retryable)
+      : std::runtime_error(what), retry(retryable) {}
+
+  bool retryable() const { return retry; }
+
+  static bool retryable(const std::exception& error) {
+    auto remoteError = dynamic_cast<const RemoteError*>(&error);
+    return remoteError == nullptr || remoteError->retryable();
+  }
+
+ private:
+  bool retry;
+};
+
+#endif
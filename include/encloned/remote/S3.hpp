@@ -1,105 +1,100 @@
 #ifndef S3_H
 #define S3_H
 
-#include <chrono>
-#include <filesystem>
-#include <fstream>
-#include <memory>
-#include <string>
-
-// concurrency/multi-threading
 #include <aws/core/Aws.h>
+#include <aws/core/auth/AWSAuthSigner.h>
+#include <aws/core/client/ClientConfiguration.h>
+#include <aws/core/http/Scheme.h>
+#include <aws/core/utils/ratelimiter/RateLimiterInterface.h>
 #include <aws/s3/S3Client.h>
-#include <aws/s3/model/Bucket.h>
-#include <aws/s3/model/DeleteObjectRequest.h>
+#include <aws/s3/model/AbortMultipartUploadRequest.h>
+#include <aws/s3/model/CompleteMultipartUploadRequest.h>
+#include <aws/s3/model/CompletedMultipartUpload.h>
+#include <aws/s3/model/CompletedPart.h>
+#include <aws/s3/model/CreateMultipartUploadRequest.h>
+#include <aws/s3/model/DeleteObjectsRequest.h>
 #include <aws/s3/model/GetObjectRequest.h>
-#include <aws/s3/model/ListObjectsRequest.h>
+#include <aws/s3/model/ListMultipartUploadsRequest.h>
+#include <aws/s3/model/ListObjectsV2Request.h>
+#include <aws/s3/model/ListPartsRequest.h>
+#include <aws/s3/model/MultipartUpload.h>
 #include <aws/s3/model/Object.h>
+#include <aws/s3/model/Part.h>
 #include <aws/s3/model/PutObjectRequest.h>
-#include <aws/transfer/TransferManager.h>
-#include <encloned/Encryption.hpp>
-#include <encloned/remote/Queue.hpp>
-#include <encloned/remote/Remote.hpp>
+#include <aws/s3/model/UploadPartRequest.h>
+#include <encloned/remote/Backend.hpp>
+#include <encloned/remote/RateLimiter.hpp>
 
-#include <atomic>
-#include <mutex>
-#include <thread>
+#include <memory>
+#include <sstream>
+#include <string>
 
-namespace fs = std::filesystem;
 using std::cout;
 using std::endl;
 using std::string;
 
-class Remote;
-class encloned;
-
-class S3 : public Queue {
+// example API calls -
+// https://docs.aws.amazon.com/sdk-for-cpp/v1/developer-guide/examples-s3-objects.html
+class S3 : public Backend {
  private:
-  int remoteID = 1;  // each remote has a unique remoteID
-
-  // ptr to class instance of Remote that spawned this S3 instance
-  Remote* remote;
-  encloned* daemon;
-
-  std::vector<string> remoteObjects;
-  // also stores last mod time in readable string format
-  std::unordered_map<string, string> remoteObjectMap;
-
   Aws::SDKOptions options;
-  const Aws::String BUCKET_NAME = "enclone";
+  Aws::String bucketName;
+  string endpoint;  // empty for AWS itself
 
-  // concurrency/multi-threading
-  std::mutex mtx;
-  std::atomic_bool* runThreads;  // ptr to flag indicating if execThread should
-                                 // loop or close down
+  // S3 requires all parts except the last to be >= 5MB
+  static const size_t PART_SIZE = 8 * 1024 * 1024;
+  static const size_t MAX_PARTS_IN_FLIGHT = 4;
+  // large buckets are listed in this many key ranges at once
+  static const size_t LIST_RANGES = 16;
+  // DeleteObjects deletes up to 1000 keys per request
+  static const size_t DELETE_BATCH_SIZE = 1000;
 
-  // S3 specific
-  void uploadFromQueue(
-      std::shared_ptr<Aws::Transfer::TransferManager> transferManager);
-  string downloadFromQueue(
-      std::shared_ptr<Aws::Transfer::TransferManager> transferManager);
-  string deleteFromQueue(std::shared_ptr<Aws::S3::S3Client> s3_client);
+  // created once with the SDK, and shared by every call
+  std::shared_ptr<Aws::S3::S3Client> s3Client;
 
-  bool listBuckets(std::shared_ptr<Aws::S3::S3Client> s3_client);
-  string listObjects(std::shared_ptr<Aws::S3::S3Client> s3_client);
+  class MultipartUpload;
 
-  bool uploadObject(
-      std::shared_ptr<Aws::Transfer::TransferManager> transferManager,
-      const Aws::String& bucketName, const std::string& path,
-      const std::string& objectName);
-  // download, restore modtime and verify hashes
-  string downloadObject(
-      std::shared_ptr<Aws::Transfer::TransferManager> transferManager,
-      const Aws::String& bucketName, const std::string& writeToPath,
-      const std::string& objectName, std::time_t& originalModTime,
-      std::string& targetPath);
-  // do not verify, do not restore modtime - used for index backup only
-  string downloadObject(
-      std::shared_ptr<Aws::Transfer::TransferManager> transferManager,
-      const Aws::String& bucketName, const std::string& writeToPath,
-      const std::string& objectName);
-  string deleteObject(std::shared_ptr<Aws::S3::S3Client> s3_client,
-                      const Aws::String& objectName,
-                      const Aws::String& fromBucket);
-
-  int encryptionQueueTime;
-  int decryptionQueueTime;
-  // bool put_s3_object(const Aws::String& s3_bucket_name, const std::string&
-  // path, const Aws::String& s3_object_name); bool get_s3_object(const
-  // Aws::String& objectName, const Aws::String& fromBucket);
+  // throttling, 5xx and network errors - not e.g. NoSuchKey or AccessDenied
+  static bool retryable(const Aws::S3::S3Error& error);
+  // the same, for the per-key error codes of DeleteObjects
+  static bool retryable(const Aws::String& code);
 
  public:
-  S3(std::atomic_bool* runThreads, Remote* remote);
+  static constexpr char DEFAULT_BUCKET_NAME[] = "enclone";
+
+  // connections for up to transfers uploads or restores at once, each with
+  // MAX_PARTS_IN_FLIGHT parts in flight, sending and receiving no faster
+  // than uploadLimit and downloadLimit allow. endpoint is the URL of an
+  // S3-compatible store (e.g. MinIO) to use instead of AWS, addressed
+  // path-style as these rarely have a DNS name per bucket
+  S3(size_t transfers, RateLimiter* uploadLimit, RateLimiter* downloadLimit,
+     const string& bucketName = DEFAULT_BUCKET_NAME,
+     const string& endpoint = "");
   ~S3();
 
   S3(const S3&) = delete;
   S3& operator=(const S3&) = delete;
 
-  void execThread();
-  string callAPI(string arg);
-
-  std::vector<string> getObjects();
-  std::unordered_map<string, string> getObjectMap();
+  string name() const override;
+  size_t partSize() const override { return PART_SIZE; }
+  size_t partsInFlight() const override { return MAX_PARTS_IN_FLIGHT; }
+  size_t listRanges() const override { return LIST_RANGES; }
+  size_t deleteBatchSize() const override { return DELETE_BATCH_SIZE; }
+
+  string put(const string& objectName,
+             std::shared_ptr<std::iostream> body) override;
+  std::unique_ptr<Upload> startUpload(const string& objectName) override;
+  std::unique_ptr<Upload> resumeUpload(const string& objectName,
+                                       const string& id) override;
+  std::vector<PendingUpload> listUploads() override;
+  void get(const string& objectName,
+           const std::function<std::streambuf*()>& sink,
+           const Range* range = NULL) override;
+  bool list(const string& after, const string& upTo,
+            std::vector<RemoteObject>& objects,
+            size_t maxPages = SIZE_MAX) override;
+  std::vector<std::pair<string, RemoteError>> remove(
+      const std::vector<string>& objectNames) override;
 };
 
 #endif
@@ -0,0 +1,310 @@
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include <encloned/Chunker.hpp>
+#include <encloned/Encryption.hpp>
+#include <encloned/Pack.hpp>
+#include <encloned/Stats.hpp>
+#include <encloned/remote/Backend.hpp>
+#include <encloned/remote/Inventory.hpp>
+#include <encloned/remote/Queue.hpp>
+#include <encloned/remote/RateLimiter.hpp>
+#include <encloned/remote/Remote.hpp>
+#include <encloned/remote/RemoteError.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <thread>
+#include <tuple>
+#include <unordered_set>
+
+namespace fs = std::filesystem;
+using std::cout;
+using std::endl;
+using std::string;
+
+class Remote;
+class encloned;
+
+// uploads, restores and deletes the queued objects of a remote - encrypting,
+// packing, chunking and retrying them - on a Backend that stores them
+class Transfer : public Queue {
+ private:
+  int remoteID = 1;  // each remote has a unique remoteID
+
+  // ptr to class instance of Remote that spawned this Transfer instance
+  Remote* remote;
+  encloned* daemon;
+
+  // where objects are stored, chosen by the backend setting - created once,
+  // and shared by every call
+  std::shared_ptr<Backend> backend;
+
+  // deleteFromQueue - batches of up to backend->deleteBatchSize() keys
+  static const size_t DELETE_BATCHES_IN_FLIGHT = 4;
+
+  // files uploaded at once by uploadFromQueue, and the most bytes of them in
+  // flight - a single larger file is still uploaded, on its own
+  static const size_t DEFAULT_UPLOAD_CONCURRENCY = 4;
+  static const size_t DEFAULT_UPLOAD_WINDOW = 256 * 1024 * 1024;
+  size_t uploadConcurrency;
+  uint64_t uploadWindow;
+  // objects restored at once by downloadFromQueue
+  static const size_t DEFAULT_DOWNLOAD_CONCURRENCY = 8;
+  size_t downloadConcurrency;
+  // the remote inventory is listed again every inventoryRefresh seconds (0
+  // to only list on request), backend->listRanges() ranges at once
+  static const int DEFAULT_INVENTORY_REFRESH_HOURS = 24;
+  std::time_t inventoryRefresh;
+  // the total rate of every upload, and of every download, from
+  // upload_limit/download_limit and their schedules, or set live
+  RateLimiter uploadLimit{"upload"};
+  RateLimiter downloadLimit{"download"};
+  void configureLimit(RateLimiter& limiter, const string& direction);
+  // failed uploads, and items of packs that failed, queued again after each
+  // pass
+  std::vector<std::tuple<string, string, std::time_t>> uploadRetries;
+
+  // failed uploads, downloads and deletes are retried after an exponential
+  // backoff with jitter - items not yet due are skipped by each pass. Items
+  // that fail permanently, or MAX_ATTEMPTS times, are moved to deadLetters,
+  // shown by enclone --failed
+  static const int MAX_ATTEMPTS = 10;
+  static const std::time_t RETRY_BASE_DELAY = 5;
+  static const std::time_t RETRY_MAX_DELAY = 60 * 60;
+  static const size_t MAX_DEAD_LETTERS = 1000;
+  struct Retry {
+    int attempts = 0;
+    std::time_t due = 0;
+  };
+  std::unordered_map<string, Retry> retries;  // by operation|objectName
+  struct FailedItem {
+    FailedItem(const string& operation, const string& path,
+               const string& objectName, std::time_t modtime = 0,
+               const string& targetPath = "")
+        : operation(operation),
+          path(path),
+          objectName(objectName),
+          modtime(modtime),
+          targetPath(targetPath) {}
+    string operation;  // upload, download or delete
+    string path;       // empty for deletes
+    string objectName;
+    std::time_t modtime = 0;
+    string targetPath;  // downloads
+    string error;
+    int attempts = 0;
+    std::time_t failed = 0;
+  };
+  std::deque<FailedItem> deadLetters;
+  std::mutex retryMtx;  // also used by upload and download threads
+  // false if not due yet, or if retriesOnly and the item hasn't failed
+  bool retryDue(const string& operation, const string& objectName,
+                bool retriesOnly = false);
+  // record a failed attempt - false if the item is not to be queued again,
+  // when it is moved to deadLetters
+  bool retryLater(FailedItem item, const std::exception& error);
+  void retryReset(const string& operation, const string& objectName);
+  static const string& queuedName(const string& objectName) {
+    return objectName;
+  }
+  template <typename Item>
+  static const string& queuedName(const Item& item) {
+    return std::get<1>(item);
+  }
+  // true if an item of queue is due to be tried
+  template <typename Item>
+  bool anyDue(const string& operation, const std::deque<Item>& queue,
+              bool retriesOnly = false) {
+    for (const auto& item : queue) {
+      if (retryDue(operation, queuedName(item), retriesOnly)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // chunk_size, segment_size, encryption_threads and compression settings
+  // from config, for every object uploaded
+  EncryptOptions encryptOptions;
+  // content defined chunking of large files (cdc), NULL if disabled
+  std::unique_ptr<Chunker> chunker;
+  // since start, to report the dedup ratio
+  std::atomic<uint64_t> chunkedBytes = 0;
+  std::atomic<uint64_t> chunkedBytesUploaded = 0;
+
+  // packing of small files - versions up to packMaxFileSize are encrypted
+  // into packBuffer, which is uploaded as a single object once it reaches
+  // packSize (0 if packing is disabled)
+  static const size_t DEFAULT_PACK_SIZE = 32 * 1024 * 1024;
+  static const size_t DEFAULT_PACK_MAX_FILE_SIZE = 256 * 1024;
+  uint64_t packSize = 0;
+  uint64_t packMaxFileSize = 0;
+  struct PackItem {
+    string path;
+    string pathHash;
+    std::time_t modtime;
+    string objectName;  // pathHash, or the name of its contents
+    string fileHash;
+    PackedObject location;
+    std::chrono::steady_clock::time_point started;  // for Stats::UPLOAD
+  };
+  string packBuffer;
+  std::vector<PackItem> packItems;
+  std::unordered_set<string> packNames;  // object names in packBuffer
+
+
+  // concurrency/multi-threading
+  std::mutex mtx;
+  std::atomic_bool* runThreads;  // ptr to flag indicating if execThread should
+                                 // loop or close down
+
+  void uploadFromQueue();
+  // retriesOnly leaves items that have not failed yet to a restore in
+  // progress
+  string downloadFromQueue(bool retriesOnly = false);
+  string deleteFromQueue();
+
+  // add an object just uploaded to the inventory
+  void objectStored(const std::string& objectName, uint64_t size,
+                    const std::string& etag);
+
+  // encrypt and upload in a single pass, without a temporary file
+  bool uploadObject(const std::string& path, const std::string& objectName);
+  // split into content defined chunks, uploading only those not already
+  // stored
+  bool uploadChunks(const std::string& path, const std::string& pathHash);
+  // multipart uploads - larger files have larger parts, so even the largest
+  // stay well within the backend's limit on parts, and a file uploaded on its
+  // own (larger than upload_window) has as many parts in flight as
+  // upload_window holds, up to the connections of every upload slot
+  static const uint64_t TARGET_PARTS = 4096;
+  static const size_t MAX_PART_SIZE = 1024 * 1024 * 1024;
+  static const size_t MAX_PARTS_IN_FLIGHT = 16;
+  struct PartPlan {
+    size_t partSize;
+    size_t partsInFlight;
+  };
+  PartPlan planParts(uint64_t fileSize) const;
+  // returns the ETag of the completed object. Carries on with upload after
+  // the parts in record if given, otherwise starts one. Uploads are recorded
+  // in the index, and the parts of segmented objects as they are stored, so
+  // an upload interrupted by a restart or a transient failure is resumed
+  // after its last stored part
+  string uploadMultipart(PartialUpload& record, EncryptStream& stream,
+                         const PartPlan& plan,
+                         std::unique_ptr<Backend::Upload> upload,
+                         std::shared_ptr<std::iostream> firstPart,
+                         long long& encryptionTime);
+  // the recorded upload of record's version, and the point its stream
+  // carries on from - false if there is none, or it can't be resumed (when
+  // it is aborted)
+  bool resumeUpload(PartialUpload& record,
+                    std::unique_ptr<Backend::Upload>& upload,
+                    EncryptResume& resume);
+  // abort a recorded upload and forget it
+  void discardUpload(const PartialUpload& record, const string& reason);
+  // uploads started before this run that are no longer recorded, or whose
+  // file has changed since, are aborted in the background once the index is
+  // restored - their parts are billed as storage
+  std::time_t runStarted;
+  std::future<void> uploadCleanup;
+  void abortOrphanedUploads();
+  // encrypt a small file into packBuffer, uploading the pack once full
+  void addToPack(const std::string& path, const std::string& pathHash,
+                 std::time_t modtime);
+  // upload packBuffer - its items are retried in the next pass on failure
+  void uploadPack();
+  // append an encrypted index of the objects in a pack and upload it,
+  // returning the size of the pack object
+  uint64_t putPack(
+      const std::string& packName, std::string& data,
+      const std::vector<std::pair<std::string, PackedObject>>& objects);
+  // copy the objects still referenced in mostly unused packs to new packs
+  void repackObjects();
+  // all of the remaining ciphertext of stream
+  void appendStream(EncryptStream& stream, std::string& data);
+  // encrypt the next partSize bytes of ciphertext into a body - to the end
+  // of a segment for resumable streams
+  std::shared_ptr<std::iostream> readPart(EncryptStream& stream,
+                                          size_t partSize,
+                                          long long& encryptionTime);
+  // download, restore modtime and verify hashes
+  string downloadObject(const std::string& writeToPath,
+                        const std::string& objectName,
+                        std::time_t& originalModTime, std::string& targetPath);
+  // directory and path that writeToPath is restored to under targetPath
+  static std::pair<string, string> restorePath(string targetPath,
+                                               const string& writeToPath);
+  // do not verify, do not restore modtime - used for index backup only
+  string downloadObject(const std::string& writeToPath,
+                        const std::string& objectName);
+  // GET an object, decrypting and hashing the body as it arrives - throws if
+  // the download or decryption fails. Packed objects are read with a ranged
+  // GET of the pack
+  void getObjectDecrypted(const std::string& objectName,
+                          const std::string& writeToPath,
+                          std::string& fileHash,
+                          FileHasher::Algorithm hashAlgorithm,
+                          const PackedObject* packed = NULL);
+  // fetch up to backend->partsInFlight() chunks at a time, each written at
+  // its offset in writeToPath once decrypted and verified
+  void getChunksDecrypted(
+      const std::vector<std::pair<std::string, uint64_t>>& chunks,
+      const std::string& writeToPath, std::string& fileHash,
+      FileHasher::Algorithm hashAlgorithm);
+  // the whole of a small object, e.g. a pack to repack
+  string getObject(const std::string& objectName);
+  string deleteObject(const std::string& objectName);
+
+  // totals for a pass, added to by concurrent uploads/downloads
+  std::atomic<long long> encryptionQueueTime;
+  std::atomic<long long> decryptionQueueTime;
+
+ public:
+  Transfer(std::atomic_bool* runThreads, Remote* remote);
+
+  Transfer(const Transfer&) = delete;
+  Transfer& operator=(const Transfer&) = delete;
+
+  // a pass over each queue - items not yet due to be retried are skipped
+  void upload();
+  string download(bool retriesOnly = false);
+  // also repacks mostly unused packs
+  string remove();
+  // list the remote into the inventory
+  string listObjects();
+  // list again once the inventory is older than inventory_refresh_hours
+  void refresh();
+  // a single file, outside of the queues
+  string uploadNow(const string& path, const string& pathHash);
+  // an index backup - not verified against the index
+  string downloadNow(const string& pathHash, const string& target);
+
+  // from the inventory - listed first if refresh, or never listed before
+  std::vector<RemoteObject> getObjects(bool refresh = false);
+  // object name -> last modified, for display
+  std::unordered_map<string, string> getObjectMap();
+  // uploads, downloads and deletes that have failed for good - queued again
+  // if retry
+  string failedItems(bool retry);
+  // once the index is restored - see abortOrphanedUploads
+  void cleanUpUploads();
+  // show both limits if direction is empty, or set the upload or download
+  // limit to rate until the daemon restarts - "schedule" to go back to
+  // encloned.conf
+  string limit(const string& direction, const string& rate);
+};
+
+#endif
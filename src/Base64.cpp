@@ -0,0 +1,315 @@
+#include <encloned/Base64.hpp>
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BASE64_X86
+#endif
+
+namespace {
+
+// 0xFF for characters outside the alphabet
+struct DecodeTable {
+  unsigned char value[256];
+  constexpr DecodeTable() : value() {
+    for (int i = 0; i < 256; i++) {
+      value[i] = 0xFF;
+    }
+    for (int i = 0; i < 64; i++) {
+      value[(unsigned char)Base64::ALPHABET[i]] = i;
+    }
+  }
+};
+constexpr DecodeTable DECODE;
+
+// encode everything left from in, returns the number of characters written
+size_t encodeScalar(const unsigned char *in, size_t len, char *out, bool pad) {
+  const char *alphabet = Base64::ALPHABET;
+  size_t i = 0, o = 0;
+  for (; i + 3 <= len; i += 3) {
+    uint32_t v = (in[i] << 16) | (in[i + 1] << 8) | in[i + 2];
+    out[o++] = alphabet[v >> 18];
+    out[o++] = alphabet[(v >> 12) & 0x3F];
+    out[o++] = alphabet[(v >> 6) & 0x3F];
+    out[o++] = alphabet[v & 0x3F];
+  }
+  if (i < len) {
+    uint32_t v = in[i] << 16;
+    if (i + 1 < len) {
+      v |= in[i + 1] << 8;
+    }
+    out[o++] = alphabet[v >> 18];
+    out[o++] = alphabet[(v >> 12) & 0x3F];
+    if (i + 1 < len) {
+      out[o++] = alphabet[(v >> 6) & 0x3F];
+    } else if (pad) {
+      out[o++] = '=';
+    }
+    if (pad) {
+      out[o++] = '=';
+    }
+  }
+  return o;
+}
+
+// decode up to the first invalid character, returns the bytes written. A
+// trailing partial byte is dropped
+size_t decodeScalar(const char *in, size_t len, unsigned char *out) {
+  size_t i = 0, o = 0;
+  for (; i + 4 <= len; i += 4) {
+    uint32_t a = DECODE.value[(unsigned char)in[i]];
+    uint32_t b = DECODE.value[(unsigned char)in[i + 1]];
+    uint32_t c = DECODE.value[(unsigned char)in[i + 2]];
+    uint32_t d = DECODE.value[(unsigned char)in[i + 3]];
+    if ((a | b | c | d) & 0x80) {
+      break;  // finish this block a character at a time
+    }
+    uint32_t v = (a << 18) | (b << 12) | (c << 6) | d;
+    out[o++] = v >> 16;
+    out[o++] = (v >> 8) & 0xFF;
+    out[o++] = v & 0xFF;
+  }
+  uint32_t val = 0;
+  int valb = -8;
+  for (; i < len; i++) {
+    unsigned char d = DECODE.value[(unsigned char)in[i]];
+    if (d == 0xFF) {
+      break;
+    }
+    val = (val << 6) | d;
+    valb += 6;
+    if (valb >= 0) {
+      out[o++] = (val >> valb) & 0xFF;
+      valb -= 8;
+    }
+  }
+  return o;
+}
+
+#ifdef BASE64_X86
+
+// SIMD versions handle whole blocks only and return the input consumed - 12
+// bytes become 16 characters per 128 bit lane, as in Muła and Lemire, "Faster
+// Base64 Encoding and Decoding using AVX2 Instructions"
+
+// spread 3 bytes over the low 6 bits of 4 bytes, in each 32 bit lane
+__attribute__((target("ssse3"))) __m128i encodeSplit(__m128i in) {
+  in = _mm_shuffle_epi8(
+      in, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+  __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+  __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+  __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+  __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+  return _mm_or_si128(t1, t3);
+}
+
+// 6 bit values to characters, by adding an offset for the range each is in
+__attribute__((target("ssse3"))) __m128i encodeTranslate(__m128i in) {
+  const __m128i offsets =
+      _mm_setr_epi8('A', 'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                    '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                    '-' - 62, '_' - 63, 0, 0);
+  __m128i range = _mm_subs_epu8(in, _mm_set1_epi8(51));
+  range = _mm_sub_epi8(range, _mm_cmpgt_epi8(in, _mm_set1_epi8(25)));
+  return _mm_add_epi8(in, _mm_shuffle_epi8(offsets, range));
+}
+
+__attribute__((target("ssse3"))) size_t encodeSSSE3(const unsigned char *in,
+                                                    size_t len, char *out) {
+  size_t i = 0;
+  // each load reads 16 bytes, of which 12 are used
+  for (; i + 16 <= len; i += 12) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+    v = encodeTranslate(encodeSplit(v));
+    _mm_storeu_si128((__m128i *)(out + i / 3 * 4), v);
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) size_t encodeAVX2(const unsigned char *in,
+                                                  size_t len, char *out) {
+  const __m256i shuffle = _mm256_setr_epi8(
+      1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10, 1, 0, 2, 1, 4, 3, 5,
+      4, 7, 6, 8, 7, 10, 9, 11, 10);
+  const __m256i offsets = _mm256_setr_epi8(
+      'A', 'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '-' - 62, '_' - 63, 0,
+      0, 'A', 'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '-' - 62, '_' - 63, 0,
+      0);
+  size_t i = 0;
+  // 12 bytes in each lane, the second load reads up to in + i + 28
+  for (; i + 28 <= len; i += 24) {
+    __m256i v = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(in + i))),
+        _mm_loadu_si128((const __m128i *)(in + i + 12)), 1);
+    v = _mm256_shuffle_epi8(v, shuffle);
+    __m256i t0 = _mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00));
+    __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+    __m256i t2 = _mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0));
+    __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+    v = _mm256_or_si256(t1, t3);
+    __m256i range = _mm256_subs_epu8(v, _mm256_set1_epi8(51));
+    range = _mm256_sub_epi8(range, _mm256_cmpgt_epi8(v, _mm256_set1_epi8(25)));
+    v = _mm256_add_epi8(v, _mm256_shuffle_epi8(offsets, range));
+    _mm256_storeu_si256((__m256i *)(out + i / 3 * 4), v);
+  }
+  _mm256_zeroupper();  // avoid an AVX to SSE transition penalty
+  return i + encodeSSSE3(in + i, len - i, out + i / 3 * 4);
+}
+
+// characters to 6 bit values, false if any character is outside the alphabet
+__attribute__((target("ssse3"))) bool decodeTranslate(__m128i in,
+                                                      __m128i &out) {
+  // bytes above 0x7F compare as negative, so fall outside every range
+  __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('A' - 1)),
+                                _mm_cmplt_epi8(in, _mm_set1_epi8('Z' + 1)));
+  __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('a' - 1)),
+                                _mm_cmplt_epi8(in, _mm_set1_epi8('z' + 1)));
+  __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('0' - 1)),
+                                _mm_cmplt_epi8(in, _mm_set1_epi8('9' + 1)));
+  __m128i dash = _mm_cmpeq_epi8(in, _mm_set1_epi8('-'));
+  __m128i underscore = _mm_cmpeq_epi8(in, _mm_set1_epi8('_'));
+  __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower),
+                               _mm_or_si128(_mm_or_si128(digit, dash),
+                                            underscore));
+  if (_mm_movemask_epi8(valid) != 0xFFFF) {
+    return false;
+  }
+  __m128i offset = _mm_or_si128(
+      _mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-'A')),
+                   _mm_and_si128(lower, _mm_set1_epi8(26 - 'a'))),
+      _mm_or_si128(
+          _mm_or_si128(_mm_and_si128(digit, _mm_set1_epi8(52 - '0')),
+                       _mm_and_si128(dash, _mm_set1_epi8(62 - '-'))),
+          _mm_and_si128(underscore, _mm_set1_epi8(63 - '_'))));
+  out = _mm_add_epi8(in, offset);
+  return true;
+}
+
+// pack 4 x 6 bit values into 3 bytes, in the low 12 bytes of each lane
+__attribute__((target("ssse3"))) __m128i decodePack(__m128i in) {
+  __m128i pairs = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+  __m128i packed = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+  return _mm_shuffle_epi8(packed, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14,
+                                                13, 12, -1, -1, -1, -1));
+}
+
+// writes 16 bytes for every 12 decoded, out needs 4 bytes to spare
+__attribute__((target("ssse3"))) size_t decodeSSSE3(const char *in, size_t len,
+                                                    unsigned char *out) {
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+    if (!decodeTranslate(v, v)) {
+      break;  // the scalar version finds where decoding stops
+    }
+    _mm_storeu_si128((__m128i *)(out + i / 4 * 3), decodePack(v));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) size_t decodeAVX2(const char *in, size_t len,
+                                                  unsigned char *out) {
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+    __m256i upper = _mm256_and_si256(
+        _mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1)),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), v));
+    __m256i lower = _mm256_and_si256(
+        _mm256_cmpgt_epi8(v, _mm256_set1_epi8('a' - 1)),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), v));
+    __m256i digit = _mm256_and_si256(
+        _mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+    __m256i dash = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('-'));
+    __m256i underscore = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'));
+    __m256i valid = _mm256_or_si256(
+        _mm256_or_si256(upper, lower),
+        _mm256_or_si256(_mm256_or_si256(digit, dash), underscore));
+    if (_mm256_movemask_epi8(valid) != -1) {
+      break;
+    }
+    __m256i offset = _mm256_or_si256(
+        _mm256_or_si256(_mm256_and_si256(upper, _mm256_set1_epi8(-'A')),
+                        _mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a'))),
+        _mm256_or_si256(
+            _mm256_or_si256(
+                _mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')),
+                _mm256_and_si256(dash, _mm256_set1_epi8(62 - '-'))),
+            _mm256_and_si256(underscore, _mm256_set1_epi8(63 - '_'))));
+    v = _mm256_add_epi8(v, offset);
+    __m256i pairs = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+    v = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+    v = _mm256_shuffle_epi8(
+        v, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1,
+                            -1, 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1,
+                            -1, -1));
+    // the second lane overwrites the unused end of the first
+    unsigned char *o = out + i / 4 * 3;
+    _mm_storeu_si128((__m128i *)o, _mm256_castsi256_si128(v));
+    _mm_storeu_si128((__m128i *)(o + 12), _mm256_extracti128_si256(v, 1));
+  }
+  _mm256_zeroupper();
+  return i + decodeSSSE3(in + i, len - i, out + i / 4 * 3);
+}
+
+#endif
+
+}  // namespace
+
+Base64::Implementation Base64::detect() {
+#ifdef BASE64_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return AVX2;
+  }
+  if (__builtin_cpu_supports("ssse3")) {
+    return SSSE3;
+  }
+#endif
+  return SCALAR;
+}
+
+Base64::Implementation Base64::best() {
+  static const Implementation impl = detect();
+  return impl;
+}
+
+bool Base64::supported(Implementation impl) { return impl <= best(); }
+
+std::string Base64::encode(const unsigned char *in, size_t len, bool pad,
+                           Implementation impl) {
+  std::string out(pad ? (len + 2) / 3 * 4 : (len * 4 + 2) / 3, '\0');
+  size_t done = 0;
+#ifdef BASE64_X86
+  if (impl == AVX2) {
+    done = encodeAVX2(in, len, out.data());
+  } else if (impl == SSSE3) {
+    done = encodeSSSE3(in, len, out.data());
+  }
+#endif
+  encodeScalar(in + done, len - done, out.data() + done / 3 * 4, pad);
+  return out;
+}
+
+std::string Base64::decode(const std::string &in, Implementation impl) {
+  // room for the SIMD versions to write a whole lane
+  std::string out(in.size() / 4 * 3 + 3 + 16, '\0');
+  unsigned char *buf = (unsigned char *)out.data();
+  size_t done = 0;
+#ifdef BASE64_X86
+  if (impl == AVX2) {
+    done = decodeAVX2(in.data(), in.size(), buf);
+  } else if (impl == SSSE3) {
+    done = decodeSSSE3(in.data(), in.size(), buf);
+  }
+#endif
+  size_t len = done / 4 * 3 +
+               decodeScalar(in.data() + done, in.size() - done,
+                            buf + done / 4 * 3);
+  out.resize(len);
+  return out;
+}
@@ -0,0 +1,128 @@
+#include <encloned/ChunkCipher.hpp>
+
+#include <cstring>
+#include <stdexcept>
+
+bool ChunkCipher::available(uint8_t cipher) {
+  if (cipher == XCHACHA20POLY1305) {
+    return true;
+  }
+  return cipher == AES256GCM && crypto_aead_aes256gcm_is_available();
+}
+
+const char *ChunkCipher::name(uint8_t cipher) {
+  switch (cipher) {
+    case XCHACHA20POLY1305:
+      return "xchacha20poly1305";
+    case AES256GCM:
+      return "aes256gcm";
+    default:
+      return "unknown";
+  }
+}
+
+ChunkCipher::~ChunkCipher() {
+  sodium_memzero(&st, sizeof st);
+  sodium_memzero(&gcm, sizeof gcm);
+}
+
+int ChunkCipher::initPush(uint8_t cipher, unsigned char header[HEADERBYTES],
+                          const unsigned char key[KEYBYTES]) {
+  this->cipher = cipher;
+  if (cipher == XCHACHA20POLY1305) {
+    return crypto_secretstream_xchacha20poly1305_init_push(&st, header, key);
+  }
+  randombytes_buf(header, HEADERBYTES);
+  return initAES(header, key);
+}
+
+int ChunkCipher::initPull(uint8_t cipher,
+                          const unsigned char header[HEADERBYTES],
+                          const unsigned char key[KEYBYTES]) {
+  this->cipher = cipher;
+  if (cipher == XCHACHA20POLY1305) {
+    return crypto_secretstream_xchacha20poly1305_init_pull(&st, header, key);
+  }
+  return initAES(header, key);
+}
+
+int ChunkCipher::initAES(const unsigned char header[HEADERBYTES],
+                         const unsigned char key[KEYBYTES]) {
+  if (!available(cipher)) {
+    return -1;
+  }
+  // a fresh key for every stream, so the nonce can simply count chunks
+  unsigned char streamKey[crypto_aead_aes256gcm_KEYBYTES];
+  crypto_generichash_blake2b_salt_personal(streamKey, sizeof streamKey, header,
+                                           HEADERBYTES, key, KEYBYTES, NULL,
+                                           AES_KEY_PERSONAL);
+  int ret = crypto_aead_aes256gcm_beforenm(&gcm, streamKey);
+  sodium_memzero(streamKey, sizeof streamKey);
+  counter = 0;
+  return ret;
+}
+
+void ChunkCipher::nextNonce(
+    unsigned char npub[crypto_aead_aes256gcm_NPUBBYTES]) {
+  memset(npub, 0, crypto_aead_aes256gcm_NPUBBYTES);
+  for (int i = 0; i < 8; i++) {
+    npub[i] = (counter >> (8 * i)) & 0xFF;
+  }
+  counter++;
+}
+
+size_t ChunkCipher::chunkAd(unsigned char out[MAX_ADBYTES + 1],
+                            unsigned char tag, const unsigned char *ad,
+                            size_t adlen) {
+  if (adlen > MAX_ADBYTES) {
+    throw std::invalid_argument("ChunkCipher: additional data too long");
+  }
+  out[0] = tag;
+  if (adlen > 0) {
+    memcpy(out + 1, ad, adlen);
+  }
+  return adlen + 1;
+}
+
+void ChunkCipher::push(unsigned char *c, unsigned long long *clen,
+                       const unsigned char *m, size_t mlen,
+                       const unsigned char *ad, size_t adlen,
+                       unsigned char tag) {
+  if (cipher == XCHACHA20POLY1305) {
+    crypto_secretstream_xchacha20poly1305_push(&st, c, clen, m, mlen, ad,
+                                               adlen, tag);
+    return;
+  }
+  unsigned char npub[crypto_aead_aes256gcm_NPUBBYTES];
+  unsigned char fullAd[MAX_ADBYTES + 1];
+  size_t fullAdlen = chunkAd(fullAd, tag, ad, adlen);
+  unsigned long long len;
+  nextNonce(npub);
+  c[0] = tag;
+  crypto_aead_aes256gcm_encrypt_afternm(c + 1, &len, m, mlen, fullAd,
+                                        fullAdlen, NULL, npub, &gcm);
+  *clen = len + 1;
+}
+
+int ChunkCipher::pull(unsigned char *m, unsigned long long *mlen,
+                      unsigned char *tag, const unsigned char *c, size_t clen,
+                      const unsigned char *ad, size_t adlen) {
+  if (cipher == XCHACHA20POLY1305) {
+    return crypto_secretstream_xchacha20poly1305_pull(&st, m, mlen, tag, c,
+                                                      clen, ad, adlen);
+  }
+  if (clen < (size_t)ABYTES) {
+    return -1;
+  }
+  unsigned char npub[crypto_aead_aes256gcm_NPUBBYTES];
+  unsigned char fullAd[MAX_ADBYTES + 1];
+  size_t fullAdlen = chunkAd(fullAd, c[0], ad, adlen);
+  nextNonce(npub);
+  if (crypto_aead_aes256gcm_decrypt_afternm(m, mlen, NULL, c + 1, clen - 1,
+                                            fullAd, fullAdlen, npub,
+                                            &gcm) != 0) {
+    return -1;
+  }
+  *tag = c[0];
+  return 0;
+}
@@ -0,0 +1,72 @@
+#include <encloned/Chunker.hpp>
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+// random values for each byte, from a fixed seed - cut points (and so which
+// chunks deduplicate) must not change between versions of encloned
+constexpr std::array<uint64_t, 256> gearTable() {
+  std::array<uint64_t, 256> table{};
+  uint64_t state = 0x656e636c6f6e6543;  // splitmix64
+  for (auto &value : table) {
+    uint64_t z = (state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    value = z ^ (z >> 31);
+  }
+  return table;
+}
+
+constexpr std::array<uint64_t, 256> GEAR = gearTable();
+
+// the top bits of the gear hash depend on the most recent bytes
+uint64_t topBits(int bits) { return ~0ULL << (64 - bits); }
+
+}  // namespace
+
+Chunker::Chunker(size_t averageSize) {
+  if (!validSize(averageSize)) {
+    throw std::invalid_argument("Chunker: unsupported average size " +
+                                std::to_string(averageSize));
+  }
+  this->averageSize = averageSize;
+  int bits = 0;
+  while (((size_t)1 << bits) < averageSize) {
+    bits++;
+  }
+  // normalisation level 2, as recommended by the FastCDC paper
+  maskSmall = topBits(bits + 2);
+  maskLarge = topBits(bits - 2);
+}
+
+bool Chunker::validSize(size_t averageSize) {
+  return averageSize >= MIN_AVERAGE_SIZE && averageSize <= MAX_AVERAGE_SIZE &&
+         (averageSize & (averageSize - 1)) == 0;
+}
+
+size_t Chunker::cut(const unsigned char *data, size_t len) const {
+  if (len <= minSize()) {
+    return len;
+  }
+  size_t end = std::min(len, maxSize());
+  size_t normal = std::min(end, averageSize);
+  uint64_t hash = 0;
+  size_t i = minSize();  // no cut can be made before this, so skip it
+  for (; i < normal; i++) {
+    hash = (hash << 1) + GEAR[data[i]];
+    if ((hash & maskSmall) == 0) {
+      return i + 1;
+    }
+  }
+  for (; i < end; i++) {
+    hash = (hash << 1) + GEAR[data[i]];
+    if ((hash & maskLarge) == 0) {
+      return i + 1;
+    }
+  }
+  return end;
+}
@@ -0,0 +1,176 @@
+#include <encloned/Compression.hpp>
+#include <unistd.h>
+
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+bool Compression::worthCompressing(FILE *fp, uint64_t fileSize,
+                                   const Dictionary *dictionary) {
+  if (fileSize == 0 || (fileSize < MIN_FILE_SIZE && dictionary == NULL)) {
+    return false;
+  }
+  std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx *)> cctx(ZSTD_createCCtx(),
+                                                           ZSTD_freeCCtx);
+  if (cctx == NULL) {
+    throw std::bad_alloc();
+  }
+  // samples spread evenly through the file, so e.g. a text header on a
+  // compressed archive doesn't decide for the whole file
+  std::vector<unsigned char> sample(SAMPLE_SIZE);
+  std::vector<unsigned char> out(ZSTD_compressBound(SAMPLE_SIZE));
+  uint64_t sampled = 0, compressed = 0;
+  int fd = fileno(fp);  // -1 for memory streams, read with fread and rewound
+  for (int i = 0; i < SAMPLES; i++) {
+    uint64_t offset = (fileSize / SAMPLES) * i;
+    ssize_t n = -1;
+    if (fd >= 0) {
+      n = pread(fd, sample.data(), sample.size(), (off_t)offset);
+    } else if (fseeko(fp, (off_t)offset, SEEK_SET) == 0) {
+      n = fread(sample.data(), 1, sample.size(), fp);
+    }
+    if (n <= 0) {
+      break;
+    }
+    size_t clen =
+        dictionary == NULL
+            ? ZSTD_compressCCtx(cctx.get(), out.data(), out.size(),
+                                sample.data(), n, SAMPLE_LEVEL)
+            : ZSTD_compress_usingCDict(cctx.get(), out.data(), out.size(),
+                                       sample.data(), n,
+                                       dictionary->cdict(SAMPLE_LEVEL));
+    if (ZSTD_isError(clen)) {
+      sampled = 0;
+      break;
+    }
+    sampled += n;
+    compressed += clen;
+    if (offset + n >= fileSize) {
+      break;  // the whole file has been sampled
+    }
+  }
+  if (fd < 0) {
+    rewind(fp);
+  }
+  return sampled > 0 && compressed * 100 < sampled * MAX_SAMPLE_RATIO;
+}
+
+std::vector<unsigned char> Compression::compress(const unsigned char *in,
+                                                 size_t len, int level) {
+  std::vector<unsigned char> out(ZSTD_compressBound(len));
+  size_t clen = ZSTD_compress(out.data(), out.size(), in, len, level);
+  if (ZSTD_isError(clen)) {
+    throw std::runtime_error(std::string("Compression: ") +
+                             ZSTD_getErrorName(clen));
+  }
+  out.resize(clen);
+  return out;
+}
+
+bool Compression::decompress(const unsigned char *in, size_t len,
+                             unsigned char *out, size_t outlen) {
+  size_t dlen = ZSTD_decompress(out, outlen, in, len);
+  return !ZSTD_isError(dlen) && dlen == outlen;
+}
+
+size_t Compression::compressBound(size_t len) {
+  return ZSTD_compressBound(len);
+}
+
+CompressStream::CompressStream(FILE *fp_s, int level,
+                               const Dictionary *dictionary,
+                               FileHasher *hasher) {
+  this->fp_s = fp_s;
+  this->hasher = hasher;
+  cctx = ZSTD_createCCtx();
+  if (cctx == NULL) {
+    throw std::bad_alloc();
+  }
+  ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+  if (dictionary != NULL) {
+    ZSTD_CCtx_refCDict(cctx, dictionary->cdict(level));
+  }
+  buf_in.resize(ZSTD_CStreamInSize());
+}
+
+CompressStream::~CompressStream() { ZSTD_freeCCtx(cctx); }
+
+size_t CompressStream::read(unsigned char *buf, size_t len) {
+  ZSTD_outBuffer output = {buf, len, 0};
+  while (output.pos < output.size && !finished) {
+    if (input.pos == input.size && !sourceEof) {
+      size_t rlen = fread(buf_in.data(), 1, buf_in.size(), fp_s);
+      if (ferror(fp_s)) {
+        throw std::runtime_error("CompressStream: error reading source file");
+      }
+      sourceEof = feof(fp_s);
+      if (hasher != NULL) {
+        hasher->update(buf_in.data(), rlen);
+      }
+      input = {buf_in.data(), rlen, 0};
+    }
+    // once the source is exhausted, flush everything and close the frame
+    size_t ret = ZSTD_compressStream2(cctx, &output, &input,
+                                      sourceEof ? ZSTD_e_end : ZSTD_e_continue);
+    if (ZSTD_isError(ret)) {
+      throw std::runtime_error(std::string("CompressStream: ") +
+                               ZSTD_getErrorName(ret));
+    }
+    finished = sourceEof && ret == 0;
+  }
+  return output.pos;
+}
+
+DecompressStream::DecompressStream(Output output,
+                                   Dictionaries *dictionaries) {
+  this->output = output;
+  this->dictionaries = dictionaries;
+  dctx = ZSTD_createDCtx();
+  if (dctx == NULL) {
+    throw std::bad_alloc();
+  }
+  buf_out.resize(ZSTD_DStreamOutSize());
+}
+
+DecompressStream::~DecompressStream() { ZSTD_freeDCtx(dctx); }
+
+bool DecompressStream::loadDictionary(const unsigned char *in, size_t len) {
+  // the first write holds the whole frame header - it is at least a full
+  // chunk, or the entire stream
+  uint32_t id = ZSTD_getDictID_fromFrame(in, len);
+  if (id == 0) {
+    return true;  // no dictionary needed
+  }
+  if (dictionaries != NULL) {
+    dictionary = dictionaries->get(id);
+  }
+  if (dictionary == NULL) {
+    std::cout << "DecompressStream: dictionary " << id << " is not available"
+              << std::endl;
+    return false;
+  }
+  return !ZSTD_isError(ZSTD_DCtx_refDDict(dctx, dictionary->ddict()));
+}
+
+bool DecompressStream::write(const unsigned char *in, size_t len) {
+  if (!started && len > 0) {
+    started = true;
+    if (!loadDictionary(in, len)) {
+      return false;
+    }
+  }
+  ZSTD_inBuffer input = {in, len, 0};
+  ZSTD_outBuffer out;
+  do {
+    out = {buf_out.data(), buf_out.size(), 0};
+    size_t ret = ZSTD_decompressStream(dctx, &out, &input);
+    if (ZSTD_isError(ret)) {
+      return false;
+    }
+    frameComplete = (ret == 0);
+    output(buf_out.data(), out.pos);
+    // a full output buffer may mean more is held back inside zstd
+  } while (input.pos < input.size || out.pos == out.size);
+  return true;
+}
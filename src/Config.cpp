@@ -0,0 +1,85 @@
+#include <encloned/Config.hpp>
+
+Config::Config() { load(); }
+
+void Config::load() {
+  std::scoped_lock<std::mutex> guard(mtx);
+  std::ifstream file(CONFIG_LOCATION);
+  if (!file.is_open()) {
+    cout << "Config: no " << CONFIG_LOCATION << " found - using defaults"
+         << endl;
+    return;
+  }
+
+  string line;
+  int lineNumber = 0;
+  while (std::getline(file, line)) {
+    lineNumber++;
+    line = line.substr(0, line.find('#'));  // strip comments
+    auto delimPos = line.find('=');
+    if (delimPos == string::npos) {
+      if (line.find_first_not_of(" \t\r") != string::npos) {
+        cout << "Config: ignoring invalid line " << lineNumber << " in "
+             << CONFIG_LOCATION << endl;
+      }
+      continue;
+    }
+    auto trim = [](string s) {
+      auto first = s.find_first_not_of(" \t\r");
+      auto last = s.find_last_not_of(" \t\r");
+      return first == string::npos ? "" : s.substr(first, last - first + 1);
+    };
+    values[trim(line.substr(0, delimPos))] = trim(line.substr(delimPos + 1));
+  }
+  cout << "Config: loaded " << values.size() << " setting/s from "
+       << CONFIG_LOCATION << endl;
+}
+
+string Config::getString(const string key, const string defaultValue) {
+  std::scoped_lock<std::mutex> guard(mtx);
+  auto it = values.find(key);
+  return it == values.end() ? defaultValue : it->second;
+}
+
+long long Config::getInt(const string key, long long defaultValue) {
+  string value = getString(key, "");
+  if (value.empty()) {
+    return defaultValue;
+  }
+  try {
+    // allow sizes to be given with a K/M/G suffix, e.g. chunk_size = 64K
+    size_t end;
+    long long result = std::stoll(value, &end);
+    switch (end < value.size() ? toupper(value[end]) : 0) {
+      case 'G':
+        result *= 1024;
+        [[fallthrough]];
+      case 'M':
+        result *= 1024;
+        [[fallthrough]];
+      case 'K':
+        result *= 1024;
+    }
+    return result;
+  } catch (const std::exception& e) {
+    cout << "Config: invalid value for " << key << ": " << value
+         << " - using default " << defaultValue << endl;
+    return defaultValue;
+  }
+}
+
+bool Config::getBool(const string key, bool defaultValue) {
+  string value = getString(key, "");
+  if (value == "true" || value == "1" || value == "yes" || value == "on") {
+    return true;
+  } else if (value == "false" || value == "0" || value == "no" ||
+             value == "off") {
+    return false;
+  }
+  return defaultValue;
+}
+
+void Config::set(const string key, const string value) {
+  std::scoped_lock<std::mutex> guard(mtx);
+  values[key] = value;
+}
@@ -68,7 +68,8 @@ void DB::initialiseTables() {
       "PATHHASH       TEXT,"
       "FILEHASH       TEXT,"
       "LOCALEXISTS    BOOLEAN,"
-      "REMOTEEXISTS   BOOLEAN);";
+      "REMOTEEXISTS   BOOLEAN,"
+      "HASHALGO       INTEGER NOT NULL    DEFAULT 0);";
 
   const char indexBackup[] =
       "CREATE TABLE IF NOT EXISTS indexBackup ("
@@ -76,9 +77,112 @@ void DB::initialiseTables() {
       "IDXNAME    TEXT    NOT NULL,"
       "MODTIME    INTEGER);";
 
+  // zstd dictionaries and the watch root each was trained from
+  const char dictionaries[] =
+      "CREATE TABLE IF NOT EXISTS dictionaries ("
+      "ID         INTEGER NOT NULL    UNIQUE,"
+      "ROOT       TEXT    NOT NULL,"
+      "OBJECTNAME TEXT    NOT NULL,"
+      "FILEHASH   TEXT    NOT NULL,"
+      "CREATED    INTEGER NOT NULL,"
+      "REMOTEEXISTS   BOOLEAN);";
+
+  // file versions stored as content defined chunks, in order - a chunk is an
+  // object shared by every version containing it
+  const char fileChunks[] =
+      "CREATE TABLE IF NOT EXISTS fileChunks ("
+      "PATHHASH   TEXT    NOT NULL,"
+      "SEQ        INTEGER NOT NULL,"
+      "OBJECTNAME TEXT    NOT NULL,"
+      "CHUNKHASH  TEXT    NOT NULL,"
+      "SIZE       INTEGER NOT NULL);";
+
+  // small objects uploaded together in pack objects, and where each one is
+  const char packs[] =
+      "CREATE TABLE IF NOT EXISTS packs ("
+      "PACKNAME   TEXT    NOT NULL    UNIQUE,"
+      "SIZE       INTEGER NOT NULL,"
+      "PACKEDBYTES    INTEGER NOT NULL,"
+      "CREATED    INTEGER NOT NULL);";
+
+  const char packEntries[] =
+      "CREATE TABLE IF NOT EXISTS packEntries ("
+      "OBJECTNAME TEXT    NOT NULL    UNIQUE,"
+      "PACKNAME   TEXT    NOT NULL,"
+      "OFFSET     INTEGER NOT NULL,"
+      "LENGTH     INTEGER NOT NULL);";
+
+  // every object on the remote, from uploads, deletes and full listings -
+  // remoteListing holds the time of the last full listing
+  const char remoteInventory[] =
+      "CREATE TABLE IF NOT EXISTS remoteInventory ("
+      "OBJECTNAME TEXT    NOT NULL    UNIQUE,"
+      "SIZE       INTEGER NOT NULL,"
+      "ETAG       TEXT,"
+      "LASTMODIFIED   INTEGER NOT NULL);";
+
+  const char remoteListing[] =
+      "CREATE TABLE IF NOT EXISTS remoteListing ("
+      "LISTED     INTEGER NOT NULL);";
+
+  // multipart uploads in progress, and the parts of each stored so far with
+  // the offsets of their segments (space separated), so they can be resumed
+  // after a restart
+  const char partialUploads[] =
+      "CREATE TABLE IF NOT EXISTS partialUploads ("
+      "PATHHASH   TEXT    NOT NULL    UNIQUE,"
+      "PATH       TEXT    NOT NULL,"
+      "MODTIME    INTEGER NOT NULL,"
+      "SIZE       INTEGER NOT NULL,"
+      "OBJECTNAME TEXT    NOT NULL,"
+      "UPLOADID   TEXT    NOT NULL,"
+      "HEADERS    TEXT    NOT NULL,"
+      "STARTED    INTEGER NOT NULL);";
+
+  const char partialUploadParts[] =
+      "CREATE TABLE IF NOT EXISTS partialUploadParts ("
+      "PATHHASH   TEXT    NOT NULL,"
+      "PARTNUMBER INTEGER NOT NULL,"
+      "ETAG       TEXT    NOT NULL,"
+      "FIRSTSEGMENT   INTEGER NOT NULL,"
+      "OFFSETS    TEXT    NOT NULL,"
+      "END        INTEGER NOT NULL,"
+      "UNIQUE (PATHHASH, PARTNUMBER));";
+
   execSQL(dirIndex);
   execSQL(fileIndex);
   execSQL(indexBackup);
+  execSQL(dictionaries);
+  execSQL(fileChunks);
+  execSQL(packs);
+  execSQL(packEntries);
+  execSQL(remoteInventory);
+  execSQL(remoteListing);
+  execSQL(partialUploads);
+  execSQL(partialUploadParts);
+
+  // indexes created before file hashes could use other algorithms hold only
+  // BLAKE2b hashes (0)
+  addColumn("fileIndex", "HASHALGO", "INTEGER NOT NULL DEFAULT 0");
+  // versions sharing an object named by their contents (deduplication)
+  addColumn("fileIndex", "OBJECTNAME", "TEXT");
+  // number of rows in fileChunks, 0 if the version is a single object
+  addColumn("fileIndex", "CHUNKS", "INTEGER NOT NULL DEFAULT 0");
+}
+
+void DB::addColumn(const char table[], const char column[],
+                   const char definition[]) {
+  std::stringstream ss;
+  ss << "SELECT " << column << " FROM " << table << " LIMIT 0;";
+  sqlite3_stmt* stmt;
+  if (sqlite3_prepare_v2(db, ss.str().c_str(), -1, &stmt, NULL) == SQLITE_OK) {
+    sqlite3_finalize(stmt);
+    return;  // column already exists
+  }
+  ss.str("");
+  ss << "ALTER TABLE " << table << " ADD COLUMN " << column << " "
+     << definition << ";";
+  execSQL(ss.str().c_str());
 }
 
 void DB::backupProgress(int leftToCopy, int totalToCopy) {
@@ -0,0 +1,183 @@
+#include <encloned/Dictionaries.hpp>
+#include <zdict.h>
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+using std::cout;
+using std::endl;
+
+Dictionary::Dictionary(std::vector<unsigned char> data) {
+  this->data = std::move(data);
+  dictId = ZSTD_getDictID_fromDict(this->data.data(), this->data.size());
+  if (dictId == 0) {
+    throw std::invalid_argument("Dictionary: not a zstd dictionary");
+  }
+  ddictPtr = ZSTD_createDDict(this->data.data(), this->data.size());
+  if (ddictPtr == NULL) {
+    throw std::bad_alloc();
+  }
+}
+
+Dictionary::~Dictionary() {
+  for (auto elem : cdicts) {
+    ZSTD_freeCDict(elem.second);
+  }
+  ZSTD_freeDDict(ddictPtr);
+}
+
+const ZSTD_CDict *Dictionary::cdict(int level) const {
+  std::scoped_lock<std::mutex> guard(mtx);
+  auto it = cdicts.find(level);
+  if (it != cdicts.end()) {
+    return it->second;
+  }
+  ZSTD_CDict *cdict = ZSTD_createCDict(data.data(), data.size(), level);
+  if (cdict == NULL) {
+    throw std::bad_alloc();
+  }
+  cdicts.emplace(level, cdict);
+  return cdict;
+}
+
+Dictionaries::Dictionaries(uint64_t maxFileSize) {
+  this->maxFileSize = maxFileSize;
+  // dictionaries are built from file contents - keep them as private as the
+  // index
+  fs::create_directories(DICTIONARY_LOCATION);
+  fs::permissions(DICTIONARY_LOCATION, fs::perms::owner_all);
+}
+
+std::string Dictionaries::location(uint32_t id) {
+  return std::string(DICTIONARY_LOCATION) + "/" + std::to_string(id);
+}
+
+uint32_t Dictionaries::train(const std::vector<std::string> &paths) {
+  std::vector<unsigned char> samples;
+  std::vector<size_t> sampleSizes;
+  for (const auto &path : paths) {
+    if (sampleSizes.size() == MAX_SAMPLES) {
+      break;
+    }
+    std::error_code ec;
+    uint64_t size = fs::file_size(path, ec);
+    if (ec || size == 0 || size > maxFileSize ||
+        samples.size() + size > MAX_SAMPLE_BYTES) {
+      continue;
+    }
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    size_t start = samples.size();
+    samples.resize(start + size);
+    if (!file.read((char *)samples.data() + start, size)) {
+      samples.resize(start);  // changed or removed since it was listed
+      continue;
+    }
+    sampleSizes.push_back(size);
+  }
+  if (sampleSizes.size() < MIN_SAMPLES) {
+    return 0;
+  }
+
+  std::vector<unsigned char> data(DICTIONARY_SIZE);
+  size_t len = ZDICT_trainFromBuffer(data.data(), data.size(), samples.data(),
+                                     sampleSizes.data(), sampleSizes.size());
+  if (ZDICT_isError(len)) {
+    cout << "Dictionaries: training failed: " << ZDICT_getErrorName(len)
+         << endl;
+    return 0;
+  }
+  data.resize(len);
+  auto dictionary = std::make_shared<const Dictionary>(std::move(data));
+
+  // write to a temporary file first, a partial dictionary must never be used.
+  // An existing copy may be queued for upload, so leave it untouched
+  std::string path = location(dictionary->id());
+  if (!fs::exists(path)) {
+    std::string tmpPath = path + ".tmp";
+    std::ofstream file(tmpPath, std::ios::out | std::ios::binary);
+    file.write((const char *)dictionary->bytes().data(),
+               dictionary->bytes().size());
+    file.close();
+    if (!file) {
+      cout << "Dictionaries: unable to write " << tmpPath << endl;
+      fs::remove(tmpPath);
+      return 0;
+    }
+    fs::rename(tmpPath, path);
+  }
+
+  cout << "Dictionaries: trained dictionary " << dictionary->id() << " ("
+       << dictionary->bytes().size() << " bytes) from " << sampleSizes.size()
+       << " files" << endl;
+  std::scoped_lock<std::mutex> guard(mtx);
+  loaded[dictionary->id()] = dictionary;
+  return dictionary->id();
+}
+
+std::shared_ptr<const Dictionary> Dictionaries::get(uint32_t id) {
+  std::scoped_lock<std::mutex> guard(mtx);
+  auto it = loaded.find(id);
+  if (it != loaded.end()) {
+    return it->second;
+  }
+  std::ifstream file(location(id),
+                     std::ios::in | std::ios::binary | std::ios::ate);
+  if (!file.is_open()) {
+    return NULL;
+  }
+  std::vector<unsigned char> data(file.tellg());
+  file.seekg(0, std::ios::beg);
+  if (!file.read((char *)data.data(), data.size())) {
+    return NULL;
+  }
+  std::shared_ptr<const Dictionary> dictionary;
+  try {
+    dictionary = std::make_shared<const Dictionary>(std::move(data));
+  } catch (const std::invalid_argument &e) {
+    cout << "Dictionaries: " << location(id) << " is corrupted" << endl;
+    return NULL;
+  }
+  if (dictionary->id() != id) {
+    cout << "Dictionaries: " << location(id) << " has the wrong id" << endl;
+    return NULL;
+  }
+  loaded.emplace(id, dictionary);
+  return dictionary;
+}
+
+void Dictionaries::setCurrent(const std::string &root, uint32_t id) {
+  std::scoped_lock<std::mutex> guard(mtx);
+  if (id == 0) {
+    current.erase(root);
+  } else {
+    current[root] = id;
+  }
+}
+
+std::shared_ptr<const Dictionary> Dictionaries::forFile(
+    const std::string &path) {
+  std::error_code ec;
+  uint64_t size = fs::file_size(path, ec);
+  if (ec || size > maxFileSize) {
+    return NULL;
+  }
+  uint32_t id = 0;
+  {
+    std::scoped_lock<std::mutex> guard(mtx);
+    // the innermost root containing path, if watches are nested
+    size_t matched = 0;
+    for (auto elem : current) {
+      const std::string &root = elem.first;
+      if (root.size() > matched && path.size() > root.size() &&
+          path.compare(0, root.size(), root) == 0 &&
+          (root.back() == '/' || path[root.size()] == '/')) {
+        id = elem.second;
+        matched = root.size();
+      }
+    }
+  }
+  return id == 0 ? NULL : get(id);
+}
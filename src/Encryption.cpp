@@ -10,80 +10,95 @@ void Encryption::initSodium() {
 
 int Encryption::encryptFile(
     const char *target_file, const char *source_file,
-    const unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES]) {
-  unsigned char buf_in[CHUNK_SIZE];
-  unsigned char
-      buf_out[CHUNK_SIZE + crypto_secretstream_xchacha20poly1305_ABYTES];
-  unsigned char header[crypto_secretstream_xchacha20poly1305_HEADERBYTES];
-  crypto_secretstream_xchacha20poly1305_state st;
-  FILE *fp_t, *fp_s;
-  unsigned long long out_len;
-  size_t rlen;
-  int eof;
-  unsigned char tag;
-
-  fp_s = fopen(source_file, "rb");
+    const unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES],
+    const EncryptOptions &options) {
+  std::vector<unsigned char> buf(IO_BUFFER_SIZE);
+  FILE *fp_t;
+  size_t len;
+  int ret = 0;
+
+  EncryptStream stream(source_file, key, options);
+  if (!stream.is_open()) {
+    return -1;
+  }
   fp_t = fopen(target_file, "wb");
-  crypto_secretstream_xchacha20poly1305_init_push(&st, header, key);
-  fwrite(header, 1, sizeof header, fp_t);
-
-  do {
-    rlen = fread(buf_in, 1, sizeof buf_in, fp_s);
-    eof = feof(fp_s);
-    tag = eof ? crypto_secretstream_xchacha20poly1305_TAG_FINAL : 0;
-    crypto_secretstream_xchacha20poly1305_push(&st, buf_out, &out_len, buf_in,
-                                               rlen, NULL, 0, tag);
-    fwrite(buf_out, 1, (size_t)out_len, fp_t);
-  } while (!eof);
-
+  if (fp_t == NULL) {
+    return -1;
+  }
+  try {
+    while ((len = stream.read(buf.data(), buf.size())) > 0) {
+      fwrite(buf.data(), 1, len, fp_t);
+    }
+  } catch (const std::exception &e) {
+    cout << "Encryption: " << e.what() << endl;
+    ret = -1;
+  }
   fclose(fp_t);
-  fclose(fp_s);
-
-  return 0;
+  return ret;
 }
 
 int Encryption::decryptFile(
     const char *target_file, const char *source_file,
-    const unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES]) {
-  unsigned char
-      buf_in[CHUNK_SIZE + crypto_secretstream_xchacha20poly1305_ABYTES];
-  unsigned char buf_out[CHUNK_SIZE];
-  unsigned char header[crypto_secretstream_xchacha20poly1305_HEADERBYTES];
-  crypto_secretstream_xchacha20poly1305_state st;
+    const unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES],
+    unsigned int threads, Dictionaries *dictionaries) {
+  std::vector<unsigned char> buf(IO_BUFFER_SIZE);
   FILE *fp_t, *fp_s;
-  unsigned long long out_len;
   size_t rlen;
-  int eof;
-  int ret = -1;
-  unsigned char tag;
+  int ret;
+  ObjectHeader header;
 
   fp_s = fopen(source_file, "rb");
+  if (fp_s == NULL) {
+    return -1;
+  }
   fp_t = fopen(target_file, "wb");
-  fread(header, 1, sizeof header, fp_s);
-  if (crypto_secretstream_xchacha20poly1305_init_pull(&st, header, key) != 0) {
-    goto ret;  // incomplete header
+  if (fp_t == NULL) {
+    fclose(fp_s);
+    return -1;
   }
-  do {
-    rlen = fread(buf_in, 1, sizeof buf_in, fp_s);
-    eof = feof(fp_s);
-    if (crypto_secretstream_xchacha20poly1305_pull(
-            &st, buf_out, &out_len, &tag, buf_in, rlen, NULL, 0) != 0) {
-      goto ret;  // corrupted chunk
+
+  // segmented objects can be decrypted in parallel, everything else in order
+  rlen = fread(buf.data(), 1, ObjectHeader::BYTES, fp_s);
+  if (rlen == ObjectHeader::BYTES && header.parse(buf.data()) &&
+      (header.flags & ObjectHeader::FLAG_SEGMENTED)) {
+    if (threads == 0) {
+      threads = std::thread::hardware_concurrency();
     }
-    if (tag == crypto_secretstream_xchacha20poly1305_TAG_FINAL && !eof) {
-      goto ret;  // premature end (end of file reached before the end of the
-                 // stream)
+    ret = Segment::decryptFile(fp_t, fp_s, key, threads);
+    if (fclose(fp_t) != 0) {
+      ret = -1;
     }
-    fwrite(buf_out, 1, (size_t)out_len, fp_t);
-  } while (!eof);
+    fclose(fp_s);
+    return ret;
+  }
+  rewind(fp_s);
+
+  DecryptStream stream(fp_t, key, NULL, dictionaries);
+  while ((rlen = fread(buf.data(), 1, buf.size(), fp_s)) > 0) {
+    if (!stream.write(buf.data(), rlen)) {
+      break;  // corrupted chunk
+    }
+  }
+  ret = stream.finish();
 
-  ret = 0;
-ret:
   fclose(fp_t);
   fclose(fp_s);
   return ret;
 }
 
+int Encryption::decryptRange(
+    const char *source_file,
+    const unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES],
+    uint64_t offset, size_t length, std::vector<unsigned char> &out) {
+  FILE *fp_s = fopen(source_file, "rb");
+  if (fp_s == NULL) {
+    return -1;
+  }
+  int ret = Segment::decryptRange(fp_s, key, offset, length, out);
+  fclose(fp_s);
+  return ret;
+}
+
 string Encryption::randomString(std::size_t length) {
   const std::string CHARACTERS =
       "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz-"
@@ -107,114 +122,22 @@ const int Encryption::getRandomFilenameLength() {
   return RANDOM_FILENAME_LENGTH;
 }
 
-// hash a file in chunks of BUFFER_SIZE
-string Encryption::hashFile(const string path) {
-  unsigned char out[FILE_HASH_SIZE];
-  unsigned char buf[BUFFER_SIZE];
-  char hex[(FILE_HASH_SIZE * 2) + 1];
-  size_t read;
-
-  crypto_generichash_state state;
-  crypto_generichash_init(&state, NULL, 0, FILE_HASH_SIZE);
-
-  std::ifstream inputFile(path, std::ios::binary);
-
-  if (!inputFile.is_open()) {
-    std::cout << "Encryption: failed to open path for file hashing: " << path
-              << endl;
-  } else {
-    while (inputFile) {
-      inputFile.read((char *)buf, BUFFER_SIZE);
-      read = inputFile.gcount();  // # of bytes read
-      if (!read) {
-        break;
-      }
-      crypto_generichash_update(&state, buf, read);
-    }
-  }
-  crypto_generichash_final(&state, out, FILE_HASH_SIZE);
-  sodium_bin2hex(hex, sizeof hex, out, FILE_HASH_SIZE);
-  return hex;
+string Encryption::hashFile(const string path, FileHasher::Algorithm algorithm,
+                            unsigned int threads) {
+  return FileHasher::hashFile(path, algorithm, threads);
 }
 
 std::string Encryption::base64_encode(const std::string &in) {
-  std::string out;
-  int val = 0, valb = -6;
-  size_t len = in.length();
-  unsigned int i = 0;
-  for (i = 0; i < len; i++) {
-    unsigned char c = in[i];
-    val = (val << 8) + c;
-    valb += 8;
-    while (valb >= 0) {
-      out.push_back(base64_url_alphabet[(val >> valb) & 0x3F]);
-      valb -= 6;
-    }
-  }
-  if (valb > -6) {
-    out.push_back(base64_url_alphabet[((val << 8) >> (valb + 8)) & 0x3F]);
-  }
-  return out;
+  return Base64::encode((const unsigned char *)in.data(), in.size(), false);
 }
 
 std::string Encryption::base64_encode(unsigned char const *bytes_to_encode,
                                       unsigned int in_len) {
-  std::string ret;
-  int i = 0;
-  int j = 0;
-  unsigned char char_array_3[3];
-  unsigned char char_array_4[4];
-
-  while (in_len--) {
-    char_array_3[i++] = *(bytes_to_encode++);
-    if (i == 3) {
-      char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-      char_array_4[1] =
-          ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-      char_array_4[2] =
-          ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-      char_array_4[3] = char_array_3[2] & 0x3f;
-
-      for (i = 0; (i < 4); i++) ret += base64_url_alphabet[char_array_4[i]];
-      i = 0;
-    }
-  }
-
-  if (i) {
-    for (j = i; j < 3; j++) char_array_3[j] = '\0';
-
-    char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-    char_array_4[1] =
-        ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-    char_array_4[2] =
-        ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-    char_array_4[3] = char_array_3[2] & 0x3f;
-
-    for (j = 0; (j < i + 1); j++) ret += base64_url_alphabet[char_array_4[j]];
-
-    while ((i++ < 3)) ret += '=';
-  }
-  return ret;
+  return Base64::encode(bytes_to_encode, in_len, true);
 }
 
 std::string Encryption::base64_decode(const std::string &in) {
-  std::string out;
-  std::vector<int> T(256, -1);
-  unsigned int i;
-  for (i = 0; i < 64; i++) T[base64_url_alphabet[i]] = i;
-
-  int val = 0, valb = -8;
-  for (i = 0; i < in.length(); i++) {
-    unsigned char c = in[i];
-    if (T[c] == -1) break;
-    val = (val << 6) + T[c];
-    valb += 6;
-    if (valb >= 0) {
-      out.push_back(char((val >> valb) & 0xFF));
-      valb -= 8;
-    }
-  }
-  return out;
+  return Base64::decode(in);
 }
 
 string Encryption::deriveKey(string password) {  // with a random salt
@@ -249,6 +172,57 @@ string Encryption::deriveKey(string password, string salt_b64) {
   return newKey_b64 + salt_b64;
 }
 
+string Encryption::deriveIndexName(string subKey_b64) {
+  unsigned char salt[INDEX_NAME_SALT_BYTES];
+  randombytes_buf(salt, sizeof salt);
+  string saltStr((const char *)salt, sizeof salt);
+  return indexNameTag(subKey_b64, saltStr) + base64_encode(salt, sizeof salt);
+}
+
+bool Encryption::verifyIndexName(string subKey_b64, string name) {
+  size_t tagLength = (INDEX_NAME_TAG_BYTES / 3) * 4;
+  if (name.length() != tagLength + (INDEX_NAME_SALT_BYTES / 3) * 4) {
+    return false;
+  }
+  string salt = base64_decode(name.substr(tagLength));
+  if (salt.length() != INDEX_NAME_SALT_BYTES) {
+    return false;
+  }
+  string tag = indexNameTag(subKey_b64, salt);
+  return sodium_memcmp(tag.data(), name.data(), tagLength) == 0;
+}
+
+string Encryption::indexNameTag(const string &subKey_b64, const string &salt) {
+  string subKey = base64_decode(subKey_b64);
+  unsigned char tag[INDEX_NAME_TAG_BYTES];
+  crypto_generichash_blake2b_salt_personal(
+      tag, sizeof tag, (const unsigned char *)salt.data(), salt.length(),
+      (const unsigned char *)subKey.data(),
+      std::min<size_t>(subKey.length(), crypto_generichash_KEYBYTES_MAX), NULL,
+      INDEX_NAME_PERSONAL);
+  sodium_memzero(subKey.data(), subKey.length());
+  return base64_encode(tag, sizeof tag);
+}
+
+string Encryption::contentName(
+    const unsigned char key[crypto_generichash_KEYBYTES],
+    const string &fileHash, FileHasher::Algorithm algorithm) {
+  // 66 bytes, as two 33 byte blocks salted with their block number - BLAKE2b
+  // outputs at most 64
+  const size_t blockBytes = (RANDOM_FILENAME_LENGTH / 4) * 3 / 2;
+  string in = (char)algorithm + fileHash;
+  unsigned char name[2 * blockBytes];
+  for (int block = 0; block < 2; block++) {
+    unsigned char salt[crypto_generichash_blake2b_SALTBYTES] = {0};
+    salt[0] = block;
+    crypto_generichash_blake2b_salt_personal(
+        name + block * blockBytes, blockBytes,
+        (const unsigned char *)in.data(), in.length(), key,
+        crypto_generichash_KEYBYTES, salt, CONTENT_NAME_PERSONAL);
+  }
+  return base64_encode(name, sizeof name);
+}
+
 bool Encryption::verifyKey(string password, string saltedKey_b64) {
   string key = saltedKey_b64.substr(0, 64);
   string salt = saltedKey_b64.substr(64);
@@ -0,0 +1,651 @@
+#include <encloned/Encryption.hpp>
+#include <encloned/EncryptionStream.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+void ObjectHeader::serialise(unsigned char out[BYTES]) const {
+  memcpy(out, MAGIC, sizeof MAGIC);
+  out[8] = version;
+  out[9] = flags;
+  out[10] = cipher;
+  out[11] = 0;
+  for (int i = 0; i < 4; i++) {
+    out[12 + i] = (chunkSize >> (8 * i)) & 0xFF;
+  }
+}
+
+bool ObjectHeader::parse(const unsigned char in[BYTES]) {
+  if (memcmp(in, MAGIC, sizeof MAGIC) != 0) {
+    return false;
+  }
+  version = in[8];
+  flags = in[9];
+  cipher = in[10];
+  chunkSize = 0;
+  for (int i = 0; i < 4; i++) {
+    chunkSize |= (uint32_t)in[12 + i] << (8 * i);
+  }
+  return true;
+}
+
+bool ObjectHeader::valid() const {
+  return version == VERSION && (flags & ~KNOWN_FLAGS) == 0 &&
+         (cipher == CIPHER_XCHACHA20POLY1305 || cipher == CIPHER_AES256GCM) &&
+         chunkSize >= MIN_CHUNK_SIZE && chunkSize <= MAX_CHUNK_SIZE;
+}
+
+EncryptStream::EncryptStream(
+    const char *source_file,
+    const unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES],
+    const EncryptOptions &options) {
+  checkOptions(options);
+  fp_s = fopen(source_file, "rb");
+  if (fp_s == NULL) {
+    return;
+  }
+  start(key, options);
+}
+
+EncryptStream::EncryptStream(
+    const unsigned char *data, size_t len,
+    const unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES],
+    const EncryptOptions &options) {
+  EncryptOptions bufferOptions = options;
+  bufferOptions.segmentSize = 0;
+  bufferOptions.dictionary.reset();
+  bufferOptions.resume = NULL;
+  checkOptions(bufferOptions);
+  // read through a memory stream, so the rest is the same as for a file
+  fp_s = len == 0 ? NULL : fmemopen((void *)data, len, "rb");
+  if (fp_s == NULL) {
+    return;
+  }
+  start(key, bufferOptions);
+}
+
+void EncryptStream::checkOptions(const EncryptOptions &options) {
+  uint32_t chunkSize = options.chunkSize;
+  uint64_t segmentSize = options.segmentSize;
+  header.chunkSize = chunkSize;
+  header.cipher = options.cipher;
+  if (!header.valid()) {
+    throw std::invalid_argument("EncryptStream: unsupported chunk size " +
+                                std::to_string(chunkSize));
+  }
+  if (!ChunkCipher::available(header.cipher)) {
+    throw std::invalid_argument(
+        std::string("EncryptStream: cipher suite not supported on this CPU: ") +
+        ChunkCipher::name(header.cipher));
+  }
+  if (segmentSize != 0 && !Segment::validSize(segmentSize, chunkSize)) {
+    throw std::invalid_argument("EncryptStream: unsupported segment size " +
+                                std::to_string(segmentSize));
+  }
+  threads = std::max(options.threads, 1u);
+  hasher = options.hasher;
+}
+
+void EncryptStream::start(
+    const unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES],
+    const EncryptOptions &options) {
+  uint64_t segmentSize = options.segmentSize;
+  uint64_t fileSize = 0;
+  if (fseeko(fp_s, 0, SEEK_END) == 0) {
+    fileSize = ftello(fp_s);
+    rewind(fp_s);
+  }
+  if (options.resume != NULL &&
+      resume(key, *options.resume, fileSize, options.compressionLevel)) {
+    return;
+  }
+  bool segment = segmentSize != 0 && fileSize > segmentSize;
+  if (!segment) {
+    dictionary = options.dictionary;  // segments are compressed separately
+  }
+  if (options.compressionLevel != 0 &&
+      Compression::worthCompressing(fp_s, fileSize, dictionary.get())) {
+    compressionLevel = options.compressionLevel;
+    header.flags |= ObjectHeader::FLAG_COMPRESSED;
+  }
+  if (segment) {
+    // split into segments - the sizes are fixed up front so the layout is
+    // known to readers before the segment table arrives
+    segmented = true;
+    header.flags |= ObjectHeader::FLAG_SEGMENTED;
+    randombytes_buf(segmentHeader.salt, sizeof segmentHeader.salt);
+    segmentHeader.segmentSize = segmentSize;
+    segmentHeader.plaintextSize = fileSize;
+    header.serialise(ad);
+    segmentHeader.serialise(ad + ObjectHeader::BYTES);
+    Segment::deriveObjectKey(objectKey, key, segmentHeader.salt);
+    hashLeaves = hasher != NULL && hasher->getAlgorithm() == FileHasher::TREE &&
+                 segmentSize % FileHasher::LEAF_SIZE == 0;
+    pending.assign(ad, ad + sizeof ad);
+    return;
+  }
+  buf_in.resize(header.chunkSize);
+  if (compressionLevel != 0) {
+    compressor = std::make_unique<CompressStream>(fp_s, compressionLevel,
+                                                  dictionary.get(), hasher);
+  }
+
+  // the object header and stream header are the first pieces of ciphertext
+  // handed out
+  header.serialise(headerBytes);
+  pending.resize(ObjectHeader::BYTES + ChunkCipher::HEADERBYTES);
+  memcpy(pending.data(), headerBytes, sizeof headerBytes);
+  st.initPush(header.cipher, pending.data() + ObjectHeader::BYTES, key);
+}
+
+bool EncryptStream::resume(
+    const unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES],
+    const EncryptResume &from, uint64_t fileSize, int level) {
+  // the layout is taken from the headers, whatever the options are now
+  ObjectHeader resumedHeader;
+  SegmentHeader resumedSegments;
+  if (from.headers.size() != sizeof ad || from.firstSegment != 0 ||
+      !resumedHeader.parse(from.headers.data()) || !resumedHeader.valid() ||
+      !(resumedHeader.flags & ObjectHeader::FLAG_SEGMENTED) ||
+      !ChunkCipher::available(resumedHeader.cipher)) {
+    return false;
+  }
+  resumedSegments.parse(from.headers.data() + ObjectHeader::BYTES);
+  if (!Segment::validSize(resumedSegments.segmentSize,
+                          resumedHeader.chunkSize) ||
+      resumedSegments.plaintextSize != fileSize ||
+      from.offsets.size() > resumedSegments.segmentCount() ||
+      (!from.offsets.empty() &&
+       (from.offsets.front() != 0 || from.offsets.back() >= from.end))) {
+    return false;
+  }
+  header = resumedHeader;
+  segmentHeader = resumedSegments;
+  segmented = true;
+  if (header.flags & ObjectHeader::FLAG_COMPRESSED) {
+    // any level decompresses the same way
+    compressionLevel = level != 0 ? level : Compression::DEFAULT_LEVEL;
+  }
+  memcpy(ad, from.headers.data(), sizeof ad);
+  Segment::deriveObjectKey(objectKey, key, segmentHeader.salt);
+  hashLeaves = hasher != NULL && hasher->getAlgorithm() == FileHasher::TREE &&
+               segmentHeader.segmentSize % FileHasher::LEAF_SIZE == 0;
+  offsets = from.offsets;
+  offset = from.end;
+  skipSegments = offsets.size();
+  // without a hasher the earlier segments aren't read at all
+  segmentsQueued = hasher == NULL ? skipSegments : 0;
+  totalRead = sizeof ad + offset;
+  resumedFrom = true;
+  return true;
+}
+
+EncryptStream::~EncryptStream() {
+  segments.clear();  // wait for workers still reading the source file
+  compressor.reset();
+  if (fp_s != NULL) {
+    fclose(fp_s);
+  }
+  sodium_memzero(objectKey, sizeof objectKey);
+}
+
+bool EncryptStream::is_open() const { return fp_s != NULL; }
+
+bool EncryptStream::eof() const {
+  return fp_s == NULL || (finalPushed && pendingPos == pending.size());
+}
+
+bool EncryptStream::atSegmentEnd() const {
+  return segmented && pendingPos == pending.size();
+}
+
+EncryptResume EncryptStream::resumePoint(uint64_t firstSegment) const {
+  EncryptResume point;
+  point.headers.assign(ad, ad + sizeof ad);
+  point.firstSegment = std::min(firstSegment, (uint64_t)offsets.size());
+  point.offsets.assign(offsets.begin() + point.firstSegment, offsets.end());
+  point.end = offset;
+  return point;
+}
+
+size_t EncryptStream::read(unsigned char *buf, size_t len) {
+  size_t written = 0;
+  while (written < len) {
+    if (pendingPos == pending.size()) {
+      if (finalPushed || fp_s == NULL) {
+        break;  // nothing left to encrypt
+      }
+      nextChunk();
+    }
+    size_t n = std::min(len - written, pending.size() - pendingPos);
+    memcpy(buf + written, pending.data() + pendingPos, n);
+    pendingPos += n;
+    written += n;
+  }
+  totalRead += written;
+  return written;
+}
+
+void EncryptStream::nextChunk() {
+  if (segmented) {
+    nextSegment();
+    return;
+  }
+  unsigned long long out_len;
+  size_t rlen;
+  bool eof;
+  if (compressor) {
+    rlen = compressor->read(buf_in.data(), buf_in.size());
+    eof = compressor->eof();
+  } else {
+    rlen = fread(buf_in.data(), 1, buf_in.size(), fp_s);
+    if (ferror(fp_s)) {
+      // do not push a final tag - a truncated object would still authenticate
+      throw std::runtime_error("EncryptStream: error reading source file");
+    }
+    eof = feof(fp_s);
+    if (hasher != NULL) {
+      hasher->update(buf_in.data(), rlen);
+    }
+  }
+  unsigned char tag = eof ? ChunkCipher::TAG_FINAL : 0;
+
+  // authenticate the object header along with the first chunk
+  pending.resize(buf_in.size() + ChunkCipher::ABYTES);
+  st.push(pending.data(), &out_len, buf_in.data(), rlen,
+          firstChunk ? headerBytes : NULL, firstChunk ? sizeof headerBytes : 0,
+          tag);
+  pending.resize((size_t)out_len);
+  pendingPos = 0;
+  firstChunk = false;
+  finalPushed = eof;
+}
+
+void EncryptStream::nextSegment() {
+  // keep up to threads segments encrypting ahead of the caller
+  auto queue = [this]() {
+    while (segments.size() < threads &&
+           segmentsQueued < segmentHeader.segmentCount()) {
+      segments.push_back(std::async(std::launch::async,
+                                    &EncryptStream::encryptSegment, this,
+                                    segmentsQueued++));
+    }
+  };
+  queue();
+  pendingPos = 0;
+  if (segments.empty()) {
+    // all segments handed out, finish with the segment table
+    pending =
+        Segment::encryptTable(segmentHeader, offsets, objectKey, ad, sizeof ad);
+    finalPushed = true;
+    return;
+  }
+  EncryptedSegment segment = segments.front().get();  // rethrows read errors
+  segments.pop_front();
+  if (hasher != NULL) {
+    if (hashLeaves) {
+      hasher->updateLeaves(segment.leaves,
+                           segmentHeader.segmentPlaintextSize(segment.index));
+    } else {
+      hasher->update(segment.plaintext.data(), segment.plaintext.size());
+    }
+  }
+  if (segment.index < skipSegments) {
+    pending.clear();  // stored before the stream was resumed
+    queue();
+    return;
+  }
+  pending = std::move(segment.ciphertext);
+  offsets.push_back(offset);
+  offset += pending.size();
+  queue();
+}
+
+EncryptStream::EncryptedSegment EncryptStream::encryptSegment(
+    uint64_t index) const {
+  std::vector<unsigned char> in(segmentHeader.segmentPlaintextSize(index));
+  unsigned char segmentKey[Segment::KEYBYTES];
+  EncryptedSegment out;
+  out.index = index;
+
+  if (!Segment::readAt(fileno(fp_s), in.data(), in.size(),
+                       index * segmentHeader.segmentSize)) {
+    // the file shrank or could not be read - the layout no longer matches
+    throw std::runtime_error("EncryptStream: error reading source file");
+  }
+  if (hashLeaves) {
+    out.leaves = FileHasher::hashLeaves(
+        in.data(), in.size(),
+        index * segmentHeader.segmentSize / FileHasher::LEAF_SIZE);
+  } else if (hasher != NULL) {
+    out.plaintext = in;
+  }
+  if (index < skipSegments) {
+    return out;  // only read to be hashed
+  }
+  if (compressionLevel != 0) {
+    in = Compression::compress(in.data(), in.size(), compressionLevel);
+  }
+  Segment::deriveSegmentKey(segmentKey, objectKey, index);
+  out.ciphertext = Segment::encrypt(in.data(), in.size(), segmentKey,
+                                    header.cipher, header.chunkSize, ad,
+                                    sizeof ad);
+  sodium_memzero(segmentKey, sizeof segmentKey);
+  return out;
+}
+
+DecryptStream::DecryptStream(
+    FILE *fp_t,
+    const unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES],
+    FileHasher *hasher, Dictionaries *dictionaries) {
+  this->fp_t = fp_t;
+  this->key = key;
+  this->hasher = hasher;
+  this->dictionaries = dictionaries;
+}
+
+DecryptStream::~DecryptStream() {
+  sodium_memzero(objectKey, sizeof objectKey);
+}
+
+size_t DecryptStream::wanted() const {
+  switch (stage) {
+    case Stage::OBJECT_HEADER:
+      return ObjectHeader::BYTES;
+    case Stage::SEGMENT_HEADER:
+      return SegmentHeader::BYTES;
+    case Stage::SEGMENT_LENGTH:
+      return Segment::LENGTHBYTES;
+    case Stage::STREAM_HEADER:
+      return ChunkCipher::HEADERBYTES;
+    case Stage::CHUNKS:
+      if (segmented) {
+        // chunks never span segments, so the last one in each may be shorter
+        return std::min((uint64_t)header.chunkSize + ChunkCipher::ABYTES,
+                        segmentRemaining);
+      }
+      return header.chunkSize + ChunkCipher::ABYTES;
+    case Stage::SEGMENT_TABLE:
+      return Segment::tableSize(segmentHeader.segmentCount());
+    default:
+      return 1;  // any data after the segment table is an error
+  }
+}
+
+bool DecryptStream::write(const unsigned char *buf, size_t len) {
+  size_t pos = 0;
+  while (pos < len && !failed) {
+    size_t need = wanted();
+    if (pending.empty() && len - pos >= need) {
+      // a whole piece is available, decrypt it in place
+      pos += need;
+      consume(buf + pos - need, need);
+      continue;
+    }
+    // buffer partial pieces until the rest arrives
+    size_t n = std::min(need - pending.size(), len - pos);
+    pending.insert(pending.end(), buf + pos, buf + pos + n);
+    pos += n;
+    if (pending.size() == need) {
+      std::vector<unsigned char> piece;
+      piece.swap(pending);
+      consume(piece.data(), piece.size());
+      if (pending.empty()) {
+        piece.clear();
+        pending.swap(piece);  // keep the allocated capacity
+      }
+    }
+  }
+  return !failed;
+}
+
+void DecryptStream::consume(const unsigned char *in, size_t len) {
+  switch (stage) {
+    case Stage::OBJECT_HEADER:
+      if (header.parse(in)) {
+        if (!header.valid()) {
+          failed = true;  // unsupported version or corrupted header
+          return;
+        }
+        if (!ChunkCipher::available(header.cipher)) {
+          std::cout << "DecryptStream: " << ChunkCipher::name(header.cipher)
+                    << " objects can not be decrypted on this CPU" << std::endl;
+          failed = true;
+          return;
+        }
+        memcpy(headerBytes, in, sizeof headerBytes);
+        segmented = header.flags & ObjectHeader::FLAG_SEGMENTED;
+        compressed = header.flags & ObjectHeader::FLAG_COMPRESSED;
+      } else {
+        // legacy object - these bytes are the start of the secretstream header
+        legacy = true;
+        header = ObjectHeader();
+        pending.assign(in, in + len);
+      }
+      buf_out.resize(header.chunkSize);
+      if (compressed && !segmented) {
+        decompressor = std::make_unique<DecompressStream>(
+            [this](const unsigned char *buf, size_t len) { output(buf, len); },
+            dictionaries);
+      }
+      stage = segmented ? Stage::SEGMENT_HEADER : Stage::STREAM_HEADER;
+      break;
+    case Stage::SEGMENT_HEADER:
+      segmentHeader.parse(in);
+      if (!Segment::validSize(segmentHeader.segmentSize, header.chunkSize)) {
+        failed = true;
+        return;
+      }
+      memcpy(ad, headerBytes, sizeof headerBytes);
+      memcpy(ad + ObjectHeader::BYTES, in, len);
+      Segment::deriveObjectKey(objectKey, key, segmentHeader.salt);
+      stage = Stage::SEGMENT_LENGTH;
+      break;
+    case Stage::SEGMENT_LENGTH: {
+      uint64_t rawSize = segmentHeader.segmentPlaintextSize(segmentIndex);
+      uint64_t maxLength =
+          Segment::maxStoredSize(rawSize, header.chunkSize, compressed) -
+          Segment::LENGTHBYTES;
+      segmentRemaining = 0;
+      for (int i = 0; i < Segment::LENGTHBYTES; i++) {
+        segmentRemaining |= (uint64_t)in[i] << (8 * i);
+      }
+      // uncompressed segments have a known size, compressed ones a limit
+      if (segmentRemaining > maxLength ||
+          segmentRemaining < Segment::encryptedSize(0, header.chunkSize) ||
+          (!compressed && segmentRemaining != maxLength)) {
+        failed = true;
+        return;
+      }
+      offsets.push_back(offset);
+      offset += Segment::LENGTHBYTES + segmentRemaining;
+      stage = Stage::STREAM_HEADER;
+      break;
+    }
+    case Stage::STREAM_HEADER:
+      if (segmented) {
+        unsigned char segmentKey[Segment::KEYBYTES];
+        Segment::deriveSegmentKey(segmentKey, objectKey, segmentIndex);
+        failed = st.initPull(header.cipher, in, segmentKey) != 0;
+        sodium_memzero(segmentKey, sizeof segmentKey);
+        segmentRemaining -= len;
+        segmentBuf.clear();
+        firstChunk = true;
+      } else if (st.initPull(header.cipher, in, key) != 0) {
+        failed = true;  // incomplete header
+      }
+      stage = Stage::CHUNKS;
+      break;
+    case Stage::CHUNKS:
+      pullChunk(in, len);
+      break;
+    case Stage::SEGMENT_TABLE: {
+      std::vector<uint64_t> tableOffsets;
+      if (!Segment::decryptTable(in, len, segmentHeader, objectKey, ad,
+                                 sizeof ad, tableOffsets) ||
+          tableOffsets != offsets) {
+        failed = true;
+      }
+      stage = Stage::DONE;
+      break;
+    }
+    case Stage::DONE:
+      failed = true;  // data after the end of the object
+      break;
+  }
+}
+
+int DecryptStream::finish() {
+  if (segmented) {
+    return (!failed && stage == Stage::DONE) ? 0 : -1;
+  }
+  if (!failed && stage == Stage::CHUNKS && !pending.empty()) {
+    pullChunk(pending.data(), pending.size());  // last, shorter chunk
+    pending.clear();
+  }
+  if (failed || stage != Stage::CHUNKS || !finalPulled) {
+    return -1;  // corrupted, or stream ended before the final tag
+  }
+  if (decompressor && !decompressor->finished()) {
+    return -1;  // zstd stream cut short
+  }
+  return 0;
+}
+
+bool DecryptStream::pullChunk(const unsigned char *in, size_t len) {
+  unsigned long long out_len;
+  unsigned char tag;
+  if (finalPulled) {
+    failed = true;  // data after the end of the stream
+    return false;
+  }
+  // the object (and segment) header is authenticated along with the first
+  // chunk of the stream/each segment
+  const unsigned char *chunkAd = NULL;
+  size_t adlen = 0;
+  if (firstChunk && segmented) {
+    chunkAd = ad;
+    adlen = sizeof ad;
+  } else if (firstChunk && !legacy) {
+    chunkAd = headerBytes;
+    adlen = sizeof headerBytes;
+  }
+  if (st.pull(buf_out.data(), &out_len, &tag, in, len, chunkAd, adlen) != 0) {
+    failed = true;  // corrupted chunk, or object header has been tampered with
+    return false;
+  }
+  firstChunk = false;
+  finalPulled = (tag == ChunkCipher::TAG_FINAL);
+  if (!segmented) {
+    if (!decompressor) {
+      output(buf_out.data(), out_len);
+    } else if (!decompressor->write(buf_out.data(), out_len)) {
+      failed = true;  // not a valid zstd stream
+      return false;
+    }
+    return true;
+  }
+
+  // each segment must end with the final tag exactly where its length says
+  segmentRemaining -= len;
+  if (finalPulled != (segmentRemaining == 0) || (!finalPulled && tag != 0)) {
+    failed = true;
+    return false;
+  }
+  if (!compressed) {
+    output(buf_out.data(), out_len);
+  } else {
+    segmentBuf.insert(segmentBuf.end(), buf_out.data(),
+                      buf_out.data() + out_len);
+  }
+  if (finalPulled) {
+    if (compressed) {
+      // segments are compressed independently, so decompress it whole
+      std::vector<unsigned char> raw(
+          segmentHeader.segmentPlaintextSize(segmentIndex));
+      if (!Compression::decompress(segmentBuf.data(), segmentBuf.size(),
+                                   raw.data(), raw.size())) {
+        failed = true;
+        return false;
+      }
+      output(raw.data(), raw.size());
+    }
+    finalPulled = false;
+    segmentIndex++;
+    stage = (segmentIndex == segmentHeader.segmentCount())
+                ? Stage::SEGMENT_TABLE
+                : Stage::SEGMENT_LENGTH;
+  }
+  return true;
+}
+
+void DecryptStream::output(const unsigned char *buf, size_t len) {
+  fwrite(buf, 1, len, fp_t);
+  if (hasher != NULL) {
+    hasher->update(buf, len);
+  }
+}
+
+DecryptStreamBuf::DecryptStreamBuf(
+    const std::string &target_file,
+    const unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES],
+    Dictionaries *dictionaries, FileHasher::Algorithm hashAlgorithm) {
+  this->target_file = target_file;
+  this->key = key;
+  this->dictionaries = dictionaries;
+  this->hashAlgorithm = hashAlgorithm;
+  reset();
+}
+
+DecryptStreamBuf::~DecryptStreamBuf() {
+  stream.reset();
+  if (fp_t != NULL) {
+    fclose(fp_t);
+  }
+}
+
+void DecryptStreamBuf::reset() {
+  stream.reset();
+  if (fp_t != NULL) {
+    fclose(fp_t);
+  }
+  fp_t = fopen(target_file.c_str(), "wb");
+  failed = (fp_t == NULL);
+  hasher = FileHasher(hashAlgorithm);
+  if (!failed) {
+    stream = std::make_unique<DecryptStream>(fp_t, key, &hasher, dictionaries);
+  }
+}
+
+int DecryptStreamBuf::finish(std::string &fileHash) {
+  int ret = -1;
+  if (!failed) {
+    ret = stream->finish();
+  }
+  fileHash = hasher.final();
+  if (fp_t != NULL) {
+    if (fclose(fp_t) != 0) {
+      ret = -1;  // plaintext may not have been fully written to disk
+    }
+    fp_t = NULL;
+  }
+  stream.reset();
+  return ret;
+}
+
+std::streamsize DecryptStreamBuf::xsputn(const char *s, std::streamsize n) {
+  if (failed || !stream->write((const unsigned char *)s, n)) {
+    failed = true;
+    return 0;  // signals an error to the writer
+  }
+  return n;
+}
+
+DecryptStreamBuf::int_type DecryptStreamBuf::overflow(int_type c) {
+  if (traits_type::eq_int_type(c, traits_type::eof())) {
+    return traits_type::not_eof(c);
+  }
+  char ch = traits_type::to_char_type(c);
+  return xsputn(&ch, 1) == 1 ? c : traits_type::eof();
+}
@@ -0,0 +1,195 @@
+#include <encloned/FileHasher.hpp>
+#include <encloned/Segment.hpp>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <future>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+
+std::string toHex(const unsigned char hash[FileHasher::HASH_BYTES]) {
+  char hex[(FileHasher::HASH_BYTES * 2) + 1];
+  sodium_bin2hex(hex, sizeof hex, hash, FileHasher::HASH_BYTES);
+  return hex;
+}
+
+}  // namespace
+
+FileHasher::FileHasher(Algorithm algorithm) {
+  this->algorithm = algorithm;
+  if (algorithm == TREE) {
+    crypto_generichash_blake2b_init_salt_personal(&state, NULL, 0, HASH_BYTES,
+                                                  NULL, ROOT_PERSONAL);
+    initLeaf(&leaf, 0);
+  } else {
+    crypto_generichash_init(&state, NULL, 0, HASH_BYTES);
+  }
+}
+
+void FileHasher::update(const unsigned char *buf, size_t len) {
+  if (algorithm != TREE) {
+    crypto_generichash_update(&state, buf, len);
+    return;
+  }
+  size += len;
+  while (len > 0) {
+    size_t n = std::min(len, LEAF_SIZE - leafFill);
+    crypto_generichash_update(&leaf, buf, n);
+    leafFill += n;
+    buf += n;
+    len -= n;
+    if (leafFill == LEAF_SIZE) {
+      finishLeaf();
+    }
+  }
+}
+
+std::string FileHasher::final() {
+  if (algorithm != TREE) {
+    unsigned char hash[HASH_BYTES];
+    crypto_generichash_final(&state, hash, sizeof hash);
+    return toHex(hash);
+  }
+  if (leafFill > 0) {
+    finishLeaf();  // last, shorter leaf
+  }
+  return finalRoot(&state, size);
+}
+
+std::vector<unsigned char> FileHasher::hashLeaves(const unsigned char *data,
+                                                  size_t len,
+                                                  uint64_t firstLeaf) {
+  uint64_t leaves = (len + LEAF_SIZE - 1) / LEAF_SIZE;
+  std::vector<unsigned char> hashes(leaves * HASH_BYTES);
+  for (uint64_t i = 0; i < leaves; i++) {
+    size_t n = std::min<uint64_t>(LEAF_SIZE, len - i * LEAF_SIZE);
+    hashLeaf(data + i * LEAF_SIZE, n, firstLeaf + i, &hashes[i * HASH_BYTES]);
+  }
+  return hashes;
+}
+
+void FileHasher::updateLeaves(const std::vector<unsigned char> &hashes,
+                              uint64_t len) {
+  uint64_t leaves = (len + LEAF_SIZE - 1) / LEAF_SIZE;
+  if (algorithm != TREE || leafFill != 0 || size % LEAF_SIZE != 0 ||
+      hashes.size() != leaves * HASH_BYTES) {
+    throw std::logic_error("FileHasher: leaves added out of order");
+  }
+  crypto_generichash_update(&state, hashes.data(), hashes.size());
+  leafIndex += leaves;
+  size += len;
+  initLeaf(&leaf, leafIndex);
+}
+
+void FileHasher::finishLeaf() {
+  unsigned char hash[HASH_BYTES];
+  crypto_generichash_final(&leaf, hash, sizeof hash);
+  crypto_generichash_update(&state, hash, sizeof hash);
+  initLeaf(&leaf, ++leafIndex);
+  leafFill = 0;
+}
+
+void FileHasher::hashLeaf(const unsigned char *data, size_t len,
+                          uint64_t index, unsigned char out[HASH_BYTES]) {
+  crypto_generichash_state leaf;
+  initLeaf(&leaf, index);
+  crypto_generichash_update(&leaf, data, len);
+  crypto_generichash_final(&leaf, out, HASH_BYTES);
+}
+
+void FileHasher::initLeaf(crypto_generichash_state *leaf, uint64_t index) {
+  unsigned char salt[crypto_generichash_blake2b_SALTBYTES] = {0};
+  for (int i = 0; i < 8; i++) {
+    salt[i] = (index >> (8 * i)) & 0xFF;
+  }
+  crypto_generichash_blake2b_init_salt_personal(leaf, NULL, 0, HASH_BYTES,
+                                                salt, LEAF_PERSONAL);
+}
+
+std::string FileHasher::finalRoot(crypto_generichash_state *root,
+                                  uint64_t size) {
+  unsigned char sizeBytes[8];
+  for (int i = 0; i < 8; i++) {
+    sizeBytes[i] = (size >> (8 * i)) & 0xFF;
+  }
+  unsigned char hash[HASH_BYTES];
+  crypto_generichash_update(root, sizeBytes, sizeof sizeBytes);
+  crypto_generichash_final(root, hash, sizeof hash);
+  return toHex(hash);
+}
+
+std::string FileHasher::hashFile(const std::string &path, Algorithm algorithm,
+                                 unsigned int threads) {
+  FileHasher hasher(algorithm);
+  FILE *fp = fopen(path.c_str(), "rb");
+  if (fp == NULL) {
+    std::cout << "FileHasher: failed to open path for file hashing: " << path
+              << std::endl;
+    return hasher.final();
+  }
+
+  std::string hash;
+  struct stat st;
+  if (algorithm == TREE && fstat(fileno(fp), &st) == 0 &&
+      (uint64_t)st.st_size > LEAF_SIZE &&
+      hashTree(fp, st.st_size, threads, hash)) {
+    fclose(fp);
+    return hash;
+  }
+
+  // small files, or a file that shrank while its leaves were being hashed
+  std::vector<unsigned char> buf(IO_BUFFER_SIZE);
+  size_t len;
+  while ((len = fread(buf.data(), 1, buf.size(), fp)) > 0) {
+    hasher.update(buf.data(), len);
+  }
+  fclose(fp);
+  return hasher.final();
+}
+
+bool FileHasher::hashTree(FILE *fp, uint64_t fileSize, unsigned int threads,
+                          std::string &out) {
+  uint64_t leaves = (fileSize + LEAF_SIZE - 1) / LEAF_SIZE;
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  uint64_t workers = std::min<uint64_t>(threads, leaves);
+  std::vector<unsigned char> hashes(leaves * HASH_BYTES);
+
+  // each worker hashes a contiguous run of leaves, so reads stay sequential
+  auto hashRange = [&](uint64_t first, uint64_t last) {
+    std::vector<unsigned char> buf(LEAF_SIZE);
+    for (uint64_t i = first; i < last; i++) {
+      size_t len = std::min<uint64_t>(LEAF_SIZE, fileSize - i * LEAF_SIZE);
+      if (!Segment::readAt(fileno(fp), buf.data(), len, i * LEAF_SIZE)) {
+        return false;
+      }
+      hashLeaf(buf.data(), len, i, &hashes[i * HASH_BYTES]);
+    }
+    return true;
+  };
+  std::vector<std::future<bool>> results;
+  for (uint64_t w = 0; w < workers; w++) {
+    results.push_back(std::async(std::launch::async, hashRange,
+                                 leaves * w / workers,
+                                 leaves * (w + 1) / workers));
+  }
+  bool success = true;
+  for (auto &result : results) {
+    success = result.get() && success;
+  }
+  if (!success) {
+    return false;
+  }
+
+  crypto_generichash_state root;
+  crypto_generichash_blake2b_init_salt_personal(&root, NULL, 0, HASH_BYTES,
+                                                NULL, ROOT_PERSONAL);
+  crypto_generichash_update(&root, hashes.data(), hashes.size());
+  out = finalRoot(&root, fileSize);
+  return true;
+}
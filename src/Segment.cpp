@@ -0,0 +1,427 @@
+#include <encloned/Compression.hpp>
+#include <encloned/EncryptionStream.hpp>
+#include <encloned/Segment.hpp>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <future>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+void putU64(unsigned char *out, uint64_t v) {
+  for (int i = 0; i < 8; i++) {
+    out[i] = (v >> (8 * i)) & 0xFF;
+  }
+}
+
+uint64_t getU64(const unsigned char *in) {
+  uint64_t v = 0;
+  for (int i = 0; i < 8; i++) {
+    v |= (uint64_t)in[i] << (8 * i);
+  }
+  return v;
+}
+
+bool writeAt(int fd, const unsigned char *buf, size_t len, uint64_t offset) {
+  while (len > 0) {
+    ssize_t n = pwrite(fd, buf, len, (off_t)offset);
+    if (n <= 0) {
+      return false;
+    }
+    buf += n;
+    len -= n;
+    offset += n;
+  }
+  return true;
+}
+
+// plaintext of the segment table
+std::vector<unsigned char> tablePlaintext(
+    const SegmentHeader &segmentHeader, const std::vector<uint64_t> &offsets) {
+  std::vector<unsigned char> out(16 + 8 * offsets.size());
+  putU64(out.data(), segmentHeader.plaintextSize);
+  putU64(out.data() + 8, offsets.size());
+  for (size_t i = 0; i < offsets.size(); i++) {
+    putU64(out.data() + 16 + 8 * i, offsets[i]);
+  }
+  return out;
+}
+
+}  // namespace
+
+bool Segment::readAt(int fd, unsigned char *buf, size_t len,
+                     uint64_t offset) {
+  while (len > 0) {
+    ssize_t n = pread(fd, buf, len, (off_t)offset);
+    if (n <= 0) {
+      return false;
+    }
+    buf += n;
+    len -= n;
+    offset += n;
+  }
+  return true;
+}
+
+void SegmentHeader::serialise(unsigned char out[BYTES]) const {
+  memcpy(out, salt, SALTBYTES);
+  putU64(out + SALTBYTES, segmentSize);
+  putU64(out + SALTBYTES + 8, plaintextSize);
+}
+
+void SegmentHeader::parse(const unsigned char in[BYTES]) {
+  memcpy(salt, in, SALTBYTES);
+  segmentSize = getU64(in + SALTBYTES);
+  plaintextSize = getU64(in + SALTBYTES + 8);
+}
+
+uint64_t SegmentHeader::segmentCount() const {
+  if (plaintextSize == 0) {
+    return 1;  // a single empty segment
+  }
+  return (plaintextSize - 1) / segmentSize + 1;
+}
+
+uint64_t SegmentHeader::segmentPlaintextSize(uint64_t index) const {
+  if (index + 1 < segmentCount()) {
+    return segmentSize;
+  }
+  return plaintextSize - index * segmentSize;
+}
+
+struct Segment::Layout {
+  ObjectHeader header;
+  SegmentHeader segmentHeader;
+  // additional data for the first chunk of each segment and the table
+  unsigned char ad[ObjectHeader::BYTES + SegmentHeader::BYTES];
+  unsigned char objectKey[KEYBYTES];
+  bool compressed;
+  std::vector<uint64_t> offsets;
+  uint64_t tableOffset;
+
+  static const uint64_t DATA_OFFSET = sizeof ad;  // start of segment 0
+
+  ~Layout() { sodium_memzero(objectKey, sizeof objectKey); }
+};
+
+void Segment::deriveObjectKey(
+    unsigned char out[KEYBYTES], const unsigned char key[KEYBYTES],
+    const unsigned char salt[SegmentHeader::SALTBYTES]) {
+  crypto_generichash(out, KEYBYTES, salt, SegmentHeader::SALTBYTES, key,
+                     KEYBYTES);
+}
+
+void Segment::deriveSegmentKey(unsigned char out[KEYBYTES],
+                               const unsigned char objectKey[KEYBYTES],
+                               uint64_t index) {
+  crypto_kdf_derive_from_key(out, KEYBYTES, index, SEGMENT_CONTEXT, objectKey);
+}
+
+bool Segment::validSize(uint64_t segmentSize, uint32_t chunkSize) {
+  return segmentSize >= chunkSize &&
+         segmentSize <= SegmentHeader::MAX_SEGMENT_SIZE &&
+         segmentSize % chunkSize == 0;
+}
+
+uint64_t Segment::encryptedSize(uint64_t plaintextSize, uint32_t chunkSize) {
+  uint64_t chunks =
+      (plaintextSize == 0) ? 1 : (plaintextSize - 1) / chunkSize + 1;
+  return ChunkCipher::HEADERBYTES + plaintextSize +
+         chunks * ChunkCipher::ABYTES;
+}
+
+uint64_t Segment::tableSize(uint64_t segmentCount) {
+  return crypto_aead_xchacha20poly1305_ietf_NPUBBYTES + 16 + 8 * segmentCount +
+         crypto_aead_xchacha20poly1305_ietf_ABYTES;
+}
+
+bool Segment::plaintextSize(uint64_t len, uint32_t chunkSize, uint64_t &out) {
+  uint64_t chunk = chunkSize + ChunkCipher::ABYTES;
+  if (len < encryptedSize(0, chunkSize)) {
+    return false;
+  }
+  len -= ChunkCipher::HEADERBYTES;
+  // full chunks, then a shorter final chunk unless it was also full
+  uint64_t rem = len % chunk;
+  if (rem == 0) {
+    out = (len / chunk) * chunkSize;
+    return true;
+  }
+  if (rem < ChunkCipher::ABYTES) {
+    return false;
+  }
+  out = (len / chunk) * chunkSize + rem - ChunkCipher::ABYTES;
+  return true;
+}
+
+uint64_t Segment::maxStoredSize(uint64_t rawSize, uint32_t chunkSize,
+                                bool compressed) {
+  if (compressed) {
+    rawSize = Compression::compressBound(rawSize);
+  }
+  return LENGTHBYTES + encryptedSize(rawSize, chunkSize);
+}
+
+std::vector<unsigned char> Segment::encrypt(
+    const unsigned char *in, size_t len,
+    const unsigned char segmentKey[KEYBYTES], uint8_t cipher,
+    uint32_t chunkSize, const unsigned char *ad, size_t adlen) {
+  ChunkCipher st;
+  std::vector<unsigned char> out(LENGTHBYTES + encryptedSize(len, chunkSize));
+  unsigned char *c = out.data() + LENGTHBYTES + ChunkCipher::HEADERBYTES;
+  unsigned long long out_len;
+  size_t pos = 0;
+
+  putU64(out.data(), out.size() - LENGTHBYTES);
+  if (st.initPush(cipher, out.data() + LENGTHBYTES, segmentKey) != 0) {
+    throw std::invalid_argument("Segment: cipher suite not available");
+  }
+  do {
+    size_t n = std::min((size_t)chunkSize, len - pos);
+    bool last = (pos + n == len);
+    st.push(c, &out_len, in + pos, n, pos == 0 ? ad : NULL,
+            pos == 0 ? adlen : 0, last ? ChunkCipher::TAG_FINAL : 0);
+    c += out_len;
+    pos += n;
+  } while (pos < len);
+  return out;
+}
+
+bool Segment::decrypt(const unsigned char *in, size_t len,
+                      std::vector<unsigned char> &out,
+                      const unsigned char segmentKey[KEYBYTES],
+                      uint8_t cipher, uint32_t chunkSize,
+                      const unsigned char *ad, size_t adlen) {
+  ChunkCipher st;
+  unsigned long long out_len;
+  unsigned char tag;
+  uint64_t outlen;
+  size_t pos = 0;
+
+  if (!plaintextSize(len, chunkSize, outlen) ||
+      st.initPull(cipher, in, segmentKey) != 0) {
+    return false;
+  }
+  out.resize(outlen);
+  in += ChunkCipher::HEADERBYTES;
+  do {
+    size_t n = std::min((uint64_t)chunkSize, outlen - pos);
+    bool last = (pos + n == outlen);
+    if (st.pull(out.data() + pos, &out_len, &tag, in, n + ChunkCipher::ABYTES,
+                pos == 0 ? ad : NULL, pos == 0 ? adlen : 0) != 0 ||
+        tag != (last ? ChunkCipher::TAG_FINAL : 0)) {
+      return false;  // corrupted, reordered or truncated chunk
+    }
+    in += n + ChunkCipher::ABYTES;
+    pos += n;
+  } while (pos < outlen);
+  return true;
+}
+
+std::vector<unsigned char> Segment::encryptTable(
+    const SegmentHeader &segmentHeader, const std::vector<uint64_t> &offsets,
+    const unsigned char objectKey[KEYBYTES], const unsigned char *ad,
+    size_t adlen) {
+  unsigned char tableKey[KEYBYTES];
+  unsigned long long clen;
+  std::vector<unsigned char> plain = tablePlaintext(segmentHeader, offsets);
+  std::vector<unsigned char> out(tableSize(segmentHeader.segmentCount()));
+
+  crypto_kdf_derive_from_key(tableKey, sizeof tableKey, 0, TABLE_CONTEXT,
+                             objectKey);
+  randombytes_buf(out.data(), crypto_aead_xchacha20poly1305_ietf_NPUBBYTES);
+  crypto_aead_xchacha20poly1305_ietf_encrypt(
+      out.data() + crypto_aead_xchacha20poly1305_ietf_NPUBBYTES, &clen,
+      plain.data(), plain.size(), ad, adlen, NULL, out.data(), tableKey);
+  sodium_memzero(tableKey, sizeof tableKey);
+  return out;
+}
+
+bool Segment::decryptTable(const unsigned char *in, size_t len,
+                           const SegmentHeader &segmentHeader,
+                           const unsigned char objectKey[KEYBYTES],
+                           const unsigned char *ad, size_t adlen,
+                           std::vector<uint64_t> &offsets) {
+  unsigned char tableKey[KEYBYTES];
+  unsigned long long mlen;
+  uint64_t count = segmentHeader.segmentCount();
+  std::vector<unsigned char> plain(16 + 8 * count);
+
+  if (len != tableSize(count)) {
+    return false;
+  }
+  crypto_kdf_derive_from_key(tableKey, sizeof tableKey, 0, TABLE_CONTEXT,
+                             objectKey);
+  int ret = crypto_aead_xchacha20poly1305_ietf_decrypt(
+      plain.data(), &mlen, NULL,
+      in + crypto_aead_xchacha20poly1305_ietf_NPUBBYTES,
+      len - crypto_aead_xchacha20poly1305_ietf_NPUBBYTES, ad, adlen, in,
+      tableKey);
+  sodium_memzero(tableKey, sizeof tableKey);
+  if (ret != 0 || mlen != plain.size() ||
+      getU64(plain.data()) != segmentHeader.plaintextSize ||
+      getU64(plain.data() + 8) != count) {
+    return false;
+  }
+  offsets.resize(count);
+  for (uint64_t i = 0; i < count; i++) {
+    offsets[i] = getU64(plain.data() + 16 + 8 * i);
+    if ((i == 0 && offsets[i] != 0) ||
+        (i > 0 && offsets[i] <= offsets[i - 1])) {
+      return false;  // segments must be in order
+    }
+  }
+  return true;
+}
+
+bool Segment::readLayout(FILE *fp_s, const unsigned char *key,
+                         Layout &layout) {
+  int fd = fileno(fp_s);
+  if (!readAt(fd, layout.ad, sizeof layout.ad, 0) ||
+      !layout.header.parse(layout.ad) || !layout.header.valid() ||
+      !(layout.header.flags & ObjectHeader::FLAG_SEGMENTED)) {
+    return false;  // not a segmented object
+  }
+  if (!ChunkCipher::available(layout.header.cipher)) {
+    std::cout << "Segment: " << ChunkCipher::name(layout.header.cipher)
+              << " objects can not be decrypted on this CPU" << std::endl;
+    return false;
+  }
+  layout.segmentHeader.parse(layout.ad + ObjectHeader::BYTES);
+  layout.compressed = layout.header.flags & ObjectHeader::FLAG_COMPRESSED;
+  const SegmentHeader &segmentHeader = layout.segmentHeader;
+  uint32_t chunkSize = layout.header.chunkSize;
+  if (!validSize(segmentHeader.segmentSize, chunkSize)) {
+    return false;
+  }
+  // every segment takes at least a length, header and one tag, so a
+  // corrupted plaintext size can't make the table absurdly large
+  struct stat st;
+  uint64_t count = segmentHeader.segmentCount();
+  if (fstat(fd, &st) != 0 ||
+      count > (uint64_t)st.st_size / maxStoredSize(0, chunkSize, false) ||
+      (uint64_t)st.st_size < Layout::DATA_OFFSET + tableSize(count)) {
+    return false;
+  }
+  deriveObjectKey(layout.objectKey, key, segmentHeader.salt);
+
+  // the segment table is at the end of the object
+  layout.tableOffset = st.st_size - tableSize(count);
+  std::vector<unsigned char> table(tableSize(count));
+  return readAt(fd, table.data(), table.size(), layout.tableOffset) &&
+         decryptTable(table.data(), table.size(), segmentHeader,
+                      layout.objectKey, layout.ad, sizeof layout.ad,
+                      layout.offsets) &&
+         Layout::DATA_OFFSET + layout.offsets.back() < layout.tableOffset;
+}
+
+bool Segment::readSegment(int fd, const Layout &layout, uint64_t index,
+                          std::vector<unsigned char> &out) {
+  uint64_t start = Layout::DATA_OFFSET + layout.offsets[index];
+  uint64_t end = (index + 1 < layout.offsets.size())
+                     ? Layout::DATA_OFFSET + layout.offsets[index + 1]
+                     : layout.tableOffset;
+  uint64_t rawSize = layout.segmentHeader.segmentPlaintextSize(index);
+  uint32_t chunkSize = layout.header.chunkSize;
+  if (end - start < LENGTHBYTES ||
+      end - start > maxStoredSize(rawSize, chunkSize, layout.compressed)) {
+    return false;
+  }
+
+  std::vector<unsigned char> in(end - start), plain;
+  unsigned char segmentKey[KEYBYTES];
+  if (!readAt(fd, in.data(), in.size(), start) ||
+      getU64(in.data()) != in.size() - LENGTHBYTES) {
+    return false;
+  }
+  deriveSegmentKey(segmentKey, layout.objectKey, index);
+  bool ok = decrypt(in.data() + LENGTHBYTES, in.size() - LENGTHBYTES, plain,
+                    segmentKey, layout.header.cipher, chunkSize, layout.ad,
+                    sizeof layout.ad);
+  sodium_memzero(segmentKey, sizeof segmentKey);
+  if (ok && layout.compressed) {
+    out.resize(rawSize);
+    ok = Compression::decompress(plain.data(), plain.size(), out.data(),
+                                 out.size());
+  } else if (ok) {
+    ok = (plain.size() == rawSize);
+    out.swap(plain);
+  }
+  return ok;
+}
+
+int Segment::decryptFile(
+    FILE *fp_t, FILE *fp_s,
+    const unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES],
+    unsigned int threads) {
+  Layout layout;
+  if (!readLayout(fp_s, key, layout)) {
+    return -1;
+  }
+  int fd_s = fileno(fp_s);
+  int fd_t = fileno(fp_t);
+
+  // each worker reads, decrypts and writes one whole segment
+  auto work = [&](uint64_t i) {
+    std::vector<unsigned char> out;
+    return readSegment(fd_s, layout, i, out) &&
+           writeAt(fd_t, out.data(), out.size(),
+                   i * layout.segmentHeader.segmentSize);
+  };
+
+  std::deque<std::future<bool>> inFlight;
+  bool ok = true;
+  threads = std::max(threads, 1u);
+  for (uint64_t i = 0; i < layout.offsets.size() && ok; i++) {
+    if (inFlight.size() >= threads) {
+      ok = inFlight.front().get();
+      inFlight.pop_front();
+    }
+    inFlight.push_back(std::async(std::launch::async, work, i));
+  }
+  while (!inFlight.empty()) {
+    bool done = inFlight.front().get();
+    ok = ok && done;
+    inFlight.pop_front();
+  }
+  return ok ? 0 : -1;
+}
+
+int Segment::decryptRange(
+    FILE *fp_s,
+    const unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES],
+    uint64_t offset, size_t length, std::vector<unsigned char> &out) {
+  Layout layout;
+  if (!readLayout(fp_s, key, layout)) {
+    return -1;
+  }
+  const SegmentHeader &segmentHeader = layout.segmentHeader;
+  if (offset > segmentHeader.plaintextSize) {
+    return -1;
+  }
+  length = std::min((uint64_t)length, segmentHeader.plaintextSize - offset);
+  out.resize(length);
+  if (length == 0) {
+    return 0;
+  }
+
+  std::vector<unsigned char> plain;
+  uint64_t first = offset / segmentHeader.segmentSize;
+  uint64_t last = (offset + length - 1) / segmentHeader.segmentSize;
+  for (uint64_t i = first; i <= last; i++) {
+    if (!readSegment(fileno(fp_s), layout, i, plain)) {
+      return -1;
+    }
+    // copy the part of this segment that overlaps the range
+    uint64_t segmentStart = i * segmentHeader.segmentSize;
+    uint64_t from = std::max(offset, segmentStart);
+    uint64_t to = std::min(offset + length, segmentStart + plain.size());
+    memcpy(out.data() + (from - offset), plain.data() + (from - segmentStart),
+           to - from);
+  }
+  return 0;
+}
@@ -84,7 +84,7 @@ void Session::handle_read(const boost::system::error_code& error,
     } else if (cmd == "listLocal") {
       response = watch->listLocal() + ";";
     } else if (cmd == "listRemote") {
-      response = remote->listObjects() + ";";
+      response = remote->listObjects(arg1 == "refresh") + ";";
     } else if (cmd == "restoreAll") {
       response = watch->downloadFiles(arg1) + ";";
     } else if (cmd == "restore") {
@@ -94,6 +94,12 @@ void Session::handle_read(const boost::system::error_code& error,
       response = remote->cleanRemote() + ";";
     } else if (cmd == "restoreIndex") {
       response = watch->restoreIndex(arg1) + ";";
+    } else if (cmd == "failed") {
+      response = remote->failedItems(arg1 == "retry") + ";";
+    } else if (cmd == "stats") {
+      response = remote->stats(arg1 == "reset") + ";";
+    } else if (cmd == "limit") {
+      response = remote->limit(arg1, arg2) + ";";  // direction, rate
     }
 
     cout << "Socket: Sending response to socket: \"" << response.substr(0, 20)
@@ -0,0 +1,98 @@
+#include <encloned/Stats.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <sstream>
+
+const char* Stats::name(Stage stage) {
+  switch (stage) {
+    case SCAN:
+      return "scan";
+    case HASH:
+      return "hash";
+    case ENCRYPT:
+      return "encrypt";
+    case UPLOAD:
+      return "upload";
+    case DOWNLOAD:
+      return "download";
+    default:
+      return "unknown";
+  }
+}
+
+void Stats::record(Stage stage, long long microseconds, uint64_t bytes) {
+  microseconds = std::max(microseconds, 0LL);
+  std::scoped_lock<std::mutex> guard(mtx);
+  Histogram& histogram = stages[stage];
+  histogram.count++;
+  histogram.bytes += bytes;
+  histogram.max = std::max(histogram.max, microseconds);
+  histogram.buckets[bucket(microseconds)]++;
+}
+
+void Stats::record(Stage stage, std::chrono::steady_clock::time_point started,
+                   uint64_t bytes) {
+  record(stage,
+         std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - started)
+             .count(),
+         bytes);
+}
+
+void Stats::reset() {
+  std::scoped_lock<std::mutex> guard(mtx);
+  stages.fill(Histogram());
+}
+
+std::string Stats::report() {
+  std::scoped_lock<std::mutex> guard(mtx);
+  std::ostringstream ss;
+  ss << "stage count bytes p50_us p90_us p99_us max_us" << std::endl;
+  for (int stage = 0; stage < STAGES; stage++) {
+    const Histogram& histogram = stages[stage];
+    ss << name((Stage)stage) << " " << histogram.count << " "
+       << histogram.bytes << " " << percentile(histogram, 0.5) << " "
+       << percentile(histogram, 0.9) << " " << percentile(histogram, 0.99)
+       << " " << histogram.max << std::endl;
+  }
+  return ss.str();
+}
+
+int Stats::bucket(long long microseconds) {
+  uint64_t value = microseconds;
+  if (value < SUB_BUCKETS) {
+    return value;  // exact
+  }
+  // the power of two, then the 3 bits below the leading one
+  int exponent = std::bit_width(value) - 1;
+  int sub = (value >> (exponent - 3)) & (SUB_BUCKETS - 1);
+  return (exponent - 2) * SUB_BUCKETS + sub;
+}
+
+long long Stats::upperBound(int bucket) {
+  if (bucket < SUB_BUCKETS) {
+    return bucket;
+  }
+  int exponent = bucket / SUB_BUCKETS + 2;
+  uint64_t lower = (uint64_t)(SUB_BUCKETS + bucket % SUB_BUCKETS)
+                   << (exponent - 3);
+  return lower + ((uint64_t)1 << (exponent - 3)) - 1;
+}
+
+long long Stats::percentile(const Histogram& histogram, double fraction) {
+  if (histogram.count == 0) {
+    return 0;
+  }
+  uint64_t rank = std::ceil(fraction * histogram.count);
+  rank = std::max(rank, (uint64_t)1);
+  uint64_t seen = 0;
+  for (int i = 0; i < BUCKETS; i++) {
+    seen += histogram.buckets[i];
+    if (seen >= rank) {
+      return std::min(upperBound(i), histogram.max);
+    }
+  }
+  return histogram.max;
+}
@@ -5,6 +5,19 @@ Watch::Watch(std::shared_ptr<DB> db, std::atomic_bool *runThreads,
   this->db = db;
   this->runThreads = runThreads;
   this->daemon = daemon;
+
+  // small files are compressed with a dictionary trained on their watch root
+  dictionariesEnabled = daemon->getConfig()->getBool("dictionaries", true);
+  retrainInterval = daemon->getConfig()->getInt("dictionary_retrain_days",
+                                                DEFAULT_RETRAIN_DAYS) *
+                    24 * 60 * 60;
+
+  // name new versions by their contents, so identical files are stored once -
+  // content defined chunking does the same for the chunks of large files
+  deduplication = daemon->getConfig()->getBool("deduplication", false) ||
+                  daemon->getConfig()->getBool("cdc", false);
+  // small files are uploaded together, in pack objects
+  packing = daemon->getConfig()->getBool("packing", false);
 }
 
 Watch::~Watch() {
@@ -19,7 +32,9 @@ void Watch::execThread() {
     for (int i = 0; i < 5; i++) {    // takes 5x2s before next = 10s
       for (int i = 0; i < 5; i++) {  // takes 5x1s before next = 5s
         // cout << "Watch: Scanning for file changes..." << endl; cout.flush();
+        auto started = std::chrono::steady_clock::now();
         scanFileChange();
+        daemon->getStats()->record(Stats::SCAN, started, 0);
         std::this_thread::sleep_for(std::chrono::seconds(1));
       }
       execQueuedSQL();
@@ -27,6 +42,7 @@ void Watch::execThread() {
     }
     std::this_thread::sleep_for(std::chrono::seconds(1));
     indexBackup();
+    trainDictionaries();
   }
 }
 
@@ -87,8 +103,16 @@ string Watch::addFileWatch(string path) {
   if (fs::path(path).extension() == ".swp") {
     return "ignored .swp file";
   }
+  // restores in progress to a watched directory
+  if (fs::path(path).extension() == encloned::PARTIAL_DOWNLOAD_SUFFIX) {
+    return "ignored partially downloaded file";
+  }
 
-  auto result = fileIndex.insert({path, std::vector<FileVersion>()});
+  std::pair<decltype(fileIndex)::iterator, bool> result;
+  {
+    std::scoped_lock<std::mutex> indexGuard(indexMtx);
+    result = fileIndex.insert({path, std::vector<FileVersion>()});
+  }
   std::stringstream response;
 
   // check if insertion was successful i.e. result.second = true
@@ -105,35 +129,44 @@ string Watch::addFileWatch(string path) {
 }
 
 void Watch::addFileVersion(std::string path) {
-  auto fileVector = &fileIndex[path];
   std::time_t modtime = fsLastMod(path);
   // compute unique filename hash for file
   string pathHash = Encryption::hashPath(path);
-  // compute a hash of the file contents
-  string fileHash = Encryption::hashFile(path);
+  // the file contents are hashed as they are encrypted for upload, so the file
+  // is only read once - the hash is filled in by uploadSuccess
+  FileHasher::Algorithm hashAlgorithm = FileHasher::DEFAULT_ALGORITHM;
+  string fileHash;
   // create new FileVersion struct object and push to back of vector
-  fileVector->push_back(FileVersion{modtime, pathHash, fileHash});
-
-  pathHashIndex.insert(std::make_pair(
-      pathHash, std::make_pair(path, modtime)));  // hash file path
+  FileVersion version{modtime, pathHash, fileHash};
+  version.hashAlgorithm = hashAlgorithm;
+  {
+    std::scoped_lock<std::mutex> indexGuard(indexMtx);
+    fileIndex[path].push_back(version);
+    pathHashIndex.insert(std::make_pair(
+        pathHash, std::make_pair(path, modtime)));  // hash file path
+  }
+  if (deduplication || packing) {
+    std::scoped_lock<std::mutex> objectGuard(objectMtx);
+    pendingVersions.insert({pathHash, path});
+  }
 
   cout << "Watch: "
        << "Added file version: " << path
        << " with filename hash: " << pathHash.substr(0, 10) << "..."
-       << " modtime: " << modtime << " file hash: " << fileHash.substr(0, 10)
-       << "..." << endl;
+       << " modtime: " << modtime << endl;
 
   // queue for upload on remote and insertion into DB
   sqlQueue << "INSERT or IGNORE INTO fileIndex (PATH, MODTIME, PATHHASH, "
-              "FILEHASH, LOCALEXISTS) VALUES ('"
+              "FILEHASH, LOCALEXISTS, HASHALGO) VALUES ('"
            << path << "'," << modtime << ",'" << pathHash << "','" << fileHash
-           << "',TRUE"
+           << "',TRUE," << hashAlgorithm
            << ");";  // if successful, queue an SQL insert into DB
   remote->queueForUpload(path, pathHash, modtime);
 }
 
 string Watch::delWatch(string path, bool recursive) {
   std::scoped_lock<std::mutex> guard(mtx);
+  applyUploadUpdates();  // before the versions they update are deleted
   std::stringstream response;
   fs::file_status s = fs::status(path);
   if (!fs::exists(s)) {  // file/directory does not exist
@@ -174,12 +207,27 @@ string Watch::delDirWatch(string path, bool recursive) {
 
 string Watch::delFileWatch(string path) {
   std::stringstream response;
-  auto fileVersions = fileIndex[path];
-  for (auto elem : fileVersions) {
-    remote->queueForDelete(elem.pathHash);  // queue for remote deletion
-    pathHashIndex.erase(elem.pathHash);
+  std::vector<FileVersion> fileVersions;
+  {
+    std::scoped_lock<std::mutex> indexGuard(indexMtx);
+    auto versions = fileIndex.find(path);
+    if (versions != fileIndex.end()) {
+      fileVersions = std::move(versions->second);
+      fileIndex.erase(versions);
+    }
+    for (const auto &elem : fileVersions) {
+      pathHashIndex.erase(elem.pathHash);
+    }
+  }
+  for (const auto &elem : fileVersions) {
+    // objects shared with other versions are kept until their last reference
+    for (const auto &objectName : releaseObjects(elem.pathHash)) {
+      remote->queueForDelete(objectName);  // queue for remote deletion
+    }
   }
-  fileIndex.erase(path);
+  sqlQueue << "DELETE FROM fileChunks WHERE PATHHASH IN (SELECT PATHHASH FROM "
+              "fileIndex WHERE PATH=\'"
+           << path << "\');";
   sqlQueue << "DELETE FROM fileIndex WHERE PATH=\'" << path
            << "\';";
   response << "Watch: Deleted watch from file " << path
@@ -190,6 +238,7 @@ string Watch::delFileWatch(string path) {
 
 void Watch::scanFileChange() {
   std::scoped_lock<std::mutex> guard(mtx);
+  applyUploadUpdates();
   // existing files that are being watched
   for (auto elem : fileIndex) {
     string path = elem.first;
@@ -263,11 +312,62 @@ std::time_t Watch::getLastModFromIdx(std::string path) {
 
 void Watch::execQueuedSQL() {
   std::scoped_lock<std::mutex> guard(mtx);
+  applyUploadUpdates();
   if (sqlQueue.rdbuf()->in_avail() != 0) {  // if queue is not empty
     db->execSQL(sqlQueue.str().c_str());
     sqlQueue.str("");  // empty bucket
     sqlQueue.clear();  // clear error codes
   }
+  string inventoryQueue;
+  {
+    std::scoped_lock<std::mutex> inventoryGuard(inventoryMtx);
+    inventoryQueue = inventorySql.str();
+    inventorySql.str("");
+    inventorySql.clear();
+  }
+  if (!inventoryQueue.empty()) {
+    db->execSQL(inventoryQueue.c_str());
+  }
+}
+
+void Watch::applyUploadUpdates() {
+  std::vector<VersionUpdate> updates;
+  {
+    std::scoped_lock<std::mutex> uploadGuard(uploadMtx);
+    updates.swap(uploadUpdates);
+    if (uploadSql.rdbuf()->in_avail() != 0) {
+      sqlQueue << uploadSql.str();
+      uploadSql.str("");
+      uploadSql.clear();
+    }
+  }
+  std::scoped_lock<std::mutex> indexGuard(indexMtx);
+  for (const auto &update : updates) {
+    auto versions = fileIndex.find(update.path);
+    if (versions == fileIndex.end()) {
+      continue;  // deleted while it was uploading
+    }
+    for (auto &version : versions->second) {
+      if (version.pathHash != update.pathHash) {
+        continue;
+      }
+      if (update.objectName) {
+        version.objectName = *update.objectName;
+      }
+      if (update.fileHash) {
+        version.fileHash = *update.fileHash;
+      }
+      if (update.hashAlgorithm) {
+        version.hashAlgorithm = *update.hashAlgorithm;
+      }
+      if (update.chunks) {
+        version.chunks = *update.chunks;
+      }
+      if (update.remoteExists) {
+        version.remoteExists = *update.remoteExists;
+      }
+    }
+  }
 }
 
 void Watch::displayWatchDirs() {
@@ -353,6 +453,46 @@ std::pair<string, std::time_t> Watch::resolvePathHash(string pathHash) {
     if (pathHash == indexBackupName) {
       return std::make_pair("index backup", indexLastMod);
     }
+    if (!legacyIndexBackupName.empty() && pathHash == legacyIndexBackupName) {
+      return std::make_pair("index backup (old name)", indexLastMod);
+    }
+    {
+      std::scoped_lock<std::mutex> dictGuard(dictMtx);
+      for (const auto &dict : dictionaryIndex) {
+        if (dict.objectName == pathHash) {
+          return std::make_pair("dictionary for " + dict.root, dict.created);
+        }
+      }
+    }
+    {
+      std::scoped_lock<std::mutex> objectGuard(objectMtx);
+      auto it = objectIndex.find(pathHash);
+      if (it != objectIndex.end() && !it->second.refs.empty()) {
+        // shared by several versions - show the most recent
+        std::pair<string, std::time_t> newest;
+        for (const auto &ref : it->second.refs) {
+          auto version = pathHashIndex.find(ref.first);
+          if (version != pathHashIndex.end() &&
+              version->second.second >= newest.second) {
+            newest = version->second;
+          }
+        }
+        if (it->second.chunk) {
+          newest.first = "chunk of " + newest.first;
+        }
+        if (it->second.refs.size() > 1) {
+          newest.first += " (+" + std::to_string(it->second.refs.size() - 1) +
+                          " other versions)";
+        }
+        return newest;
+      }
+      auto pack = packs.find(pathHash);
+      if (pack != packs.end()) {
+        return std::make_pair(
+            "pack of " + std::to_string(pack->second.objects) + " objects",
+            pack->second.created);
+      }
+    }
     cout << "Watch: Error: Unable to find path associated to hash " + pathHash
          << endl;
     throw;
@@ -361,8 +501,9 @@ std::pair<string, std::time_t> Watch::resolvePathHash(string pathHash) {
 }
 
 string Watch::downloadFiles(string targetPath) {  // download all files
+  queueDictionaryDownloads();
   for (auto elem : fileIndex) {
-    remote->queueForDownload(elem.first, elem.second.back().pathHash,
+    remote->queueForDownload(elem.first, elem.second.back().remoteName(),
                              elem.second.back().modtime, targetPath);
   }
   return remote->downloadRemotes();
@@ -373,13 +514,16 @@ string Watch::downloadFiles(string targetPath, string pathOrHash) {
   // determine if 2nd parameter is a hash or a path - CLI argument does not
   // distinguish between the two
   // random path hashes are 88 chars long, so if we have a path or hash this
-  // size, check if file with this hash exists, otherwise it's a path
+  // size, check if file with this hash exists, otherwise it's a path. Objects
+  // named by their contents are also 88 chars, and restore every version
+  // sharing them
   if (pathOrHash.length() == Encryption::getRandomFilenameLength()) {
-    for (auto elem : fileIndex) {              // unordered_map
-      for (auto version : elem.second) {       // vector<FileVersion>
-        if (version.pathHash == pathOrHash) {  // found matching hash
+    for (auto elem : fileIndex) {         // unordered_map
+      for (auto version : elem.second) {  // vector<FileVersion>
+        if (version.pathHash == pathOrHash ||
+            version.objectName == pathOrHash) {  // found matching hash
           foundPathOrHash = true;
-          remote->queueForDownload(elem.first, version.pathHash,
+          remote->queueForDownload(elem.first, version.remoteName(),
                                    version.modtime, targetPath);
         }
       }
@@ -388,7 +532,7 @@ string Watch::downloadFiles(string targetPath, string pathOrHash) {
     for (auto elem : fileIndex) {
       if (pathOrHash == elem.first) {  // found matching path
         foundPathOrHash = true;
-        remote->queueForDownload(elem.first, elem.second.back().pathHash,
+        remote->queueForDownload(elem.first, elem.second.back().remoteName(),
                                  elem.second.back().modtime, targetPath);
       }
     }
@@ -396,13 +540,29 @@ string Watch::downloadFiles(string targetPath, string pathOrHash) {
   if (!foundPathOrHash) {
     return "error: unable to find file with matching path or hash\n";
   }
+  queueDictionaryDownloads();
   return remote->downloadRemotes();
 }
 
 bool Watch::verifyHash(string pathHash, string fileHash) const {
+  {
+    std::scoped_lock<std::mutex> guard(dictMtx);
+    for (const auto &dict : dictionaryIndex) {
+      if (dict.objectName == pathHash) {
+        return dict.fileHash == fileHash;
+      }
+    }
+  }
+  {
+    std::scoped_lock<std::mutex> guard(objectMtx);
+    auto it = objectIndex.find(pathHash);
+    if (it != objectIndex.end()) {
+      return it->second.fileHash == fileHash;
+    }
+  }
+  std::scoped_lock<std::mutex> indexGuard(indexMtx);
   auto result = pathHashIndex.at(pathHash);
-  auto versions = fileIndex.at(std::get<0>(result));
-  for (auto elem : versions) {
+  for (const auto &elem : fileIndex.at(std::get<0>(result))) {
     if (elem.pathHash == pathHash) {
       if (elem.fileHash == fileHash) {
         return true;
@@ -412,42 +572,606 @@ bool Watch::verifyHash(string pathHash, string fileHash) const {
   return false;
 }
 
+FileHasher::Algorithm Watch::hashAlgorithm(string pathHash) const {
+  {
+    std::scoped_lock<std::mutex> guard(dictMtx);
+    for (const auto &dict : dictionaryIndex) {
+      if (dict.objectName == pathHash) {
+        return FileHasher::BLAKE2B;
+      }
+    }
+  }
+  {
+    std::scoped_lock<std::mutex> guard(objectMtx);
+    auto it = objectIndex.find(pathHash);
+    if (it != objectIndex.end()) {
+      return it->second.hashAlgorithm;
+    }
+  }
+  std::scoped_lock<std::mutex> indexGuard(indexMtx);
+  auto result = pathHashIndex.at(pathHash);
+  for (const auto &elem : fileIndex.at(std::get<0>(result))) {
+    if (elem.pathHash == pathHash) {
+      return elem.hashAlgorithm;
+    }
+  }
+  throw std::out_of_range("Watch: no file version with hash " + pathHash);
+}
+
+bool Watch::isDictionary(const string &objectName) const {
+  std::scoped_lock<std::mutex> guard(dictMtx);
+  for (const auto &dict : dictionaryIndex) {
+    if (dict.objectName == objectName) {
+      return true;
+    }
+  }
+  return false;
+}
+
 void Watch::uploadSuccess(std::string path, std::string objectName,
-                          int remoteID) {
+                          int remoteID, std::string fileHash) {
+  std::scoped_lock<std::mutex> uploadGuard(uploadMtx);
   // if we've uploaded a backup of the index, we don't need to run this function
   if (objectName == indexBackupName) {
+    indexBackupUploaded = true;
     return;
   }
-  try {
-    auto fileVersionVector = &fileIndex.at(path);
-    // set the remoteExists flag for correct entry in fileIndex
-    // iterate in reverse, most likely the last entry is the one we're looking for
-    for (auto it = fileVersionVector->rbegin(); it != fileVersionVector->rend();
-         ++it) {
-      if (it->pathHash == objectName) {
-        it->remoteExists = true;
-        // also add remoteID to list of remotes it's been uploaded to e.g.
-        // remoteLocation
-      }
-    }
-    sqlQueue << "UPDATE fileIndex SET REMOTEEXISTS = TRUE WHERE PATHHASH ='"
-             << objectName << "';";
-  } catch (const std::out_of_range &e) {
-    throw;
+  if (dictionaryUploaded(objectName)) {
+    return;
+  }
+  if (objectUploaded(objectName)) {
+    return;
+  }
+  {
+    std::scoped_lock<std::mutex> guard(objectMtx);
+    pendingVersions.erase(objectName);
+  }
+  // set the remoteExists flag for correct entry in fileIndex - also add
+  // remoteID to list of remotes it's been uploaded to e.g. remoteLocation
+  VersionUpdate update{path, objectName};
+  update.fileHash = fileHash;
+  update.remoteExists = true;
+  uploadUpdates.push_back(update);
+  uploadSql << "UPDATE fileIndex SET REMOTEEXISTS = TRUE, FILEHASH = '"
+            << fileHash << "' WHERE PATHHASH ='" << objectName << "';";
+}
+
+bool Watch::namedByContent(const string &pathHash) const {
+  std::scoped_lock<std::mutex> guard(objectMtx);
+  return deduplication && pendingVersions.count(pathHash) != 0;
+}
+
+bool Watch::addObjectReference(const string &pathHash,
+                               const string &objectName,
+                               const string &fileHash,
+                               FileHasher::Algorithm hashAlgorithm) {
+  std::scoped_lock<std::mutex> uploadGuard(uploadMtx);
+  string path;
+  bool stored;
+  {
+    std::scoped_lock<std::mutex> guard(objectMtx);
+    auto pending = pendingVersions.find(pathHash);
+    if (pending == pendingVersions.end()) {
+      throw std::out_of_range("Watch: no file version waiting for upload " +
+                              pathHash);
+    }
+    path = pending->second;
+    // a retried upload, if the contents changed since the failed attempt -
+    // the earlier object can't have been stored, or this version would be too
+    auto previous = objectNames.find(pathHash);
+    if (previous != objectNames.end() && previous->second != objectName) {
+      auto it = objectIndex.find(previous->second);
+      it->second.refs.erase(pathHash);
+      if (it->second.refs.empty()) {
+        objectIndex.erase(it);
+      }
+    }
+    auto [it, inserted] = objectIndex.try_emplace(objectName);
+    if (inserted) {
+      it->second.fileHash = fileHash;
+      it->second.hashAlgorithm = hashAlgorithm;
+    }
+    it->second.refs[pathHash] = path;
+    objectNames[pathHash] = objectName;
+    stored = it->second.remoteExists;
+    if (stored) {
+      pendingVersions.erase(pending);
+    }
+  }
+
+  VersionUpdate update{path, pathHash};
+  update.objectName = objectName;
+  update.fileHash = fileHash;
+  update.hashAlgorithm = hashAlgorithm;
+  update.remoteExists = stored;
+  uploadUpdates.push_back(update);
+  uploadSql << "UPDATE fileIndex SET OBJECTNAME = '" << objectName
+            << "', FILEHASH = '" << fileHash << "', HASHALGO = "
+            << hashAlgorithm << ", REMOTEEXISTS = "
+            << (stored ? "TRUE" : "FALSE") << " WHERE PATHHASH ='" << pathHash
+            << "';";
+  if (stored) {
+    cout << "Watch: contents of " << path << " are already stored as "
+         << objectName.substr(0, 10) << "..." << endl;
+  }
+  return stored;
+}
+
+bool Watch::objectUploaded(const string &objectName) {
+  std::unordered_map<string, string> refs;
+  {
+    std::scoped_lock<std::mutex> guard(objectMtx);
+    auto it = objectIndex.find(objectName);
+    if (it == objectIndex.end()) {
+      return false;
+    }
+    it->second.remoteExists = true;
+    if (it->second.chunk) {
+      return true;  // recorded with the rest of the version, see chunksUploaded
+    }
+    refs = it->second.refs;
+    for (const auto &ref : refs) {
+      pendingVersions.erase(ref.first);
+    }
+  }
+  // every version with these contents is now stored
+  for (const auto &[pathHash, path] : refs) {
+    VersionUpdate update{path, pathHash};
+    update.remoteExists = true;
+    uploadUpdates.push_back(update);
+  }
+  uploadSql << "UPDATE fileIndex SET REMOTEEXISTS = TRUE WHERE OBJECTNAME ='"
+            << objectName << "';";
+  return true;
+}
+
+bool Watch::addChunkReference(const string &pathHash,
+                              const string &objectName,
+                              const string &chunkHash, uint64_t size) {
+  std::scoped_lock<std::mutex> guard(objectMtx);
+  auto pending = pendingVersions.find(pathHash);
+  if (pending == pendingVersions.end()) {
+    throw std::out_of_range("Watch: no file version waiting for upload " +
+                            pathHash);
+  }
+  auto [it, inserted] = objectIndex.try_emplace(objectName);
+  if (inserted) {
+    it->second.fileHash = chunkHash;
+    it->second.hashAlgorithm = FileHasher::BLAKE2B;
+    it->second.chunk = true;
+    it->second.size = size;
+  }
+  // referenced straight away, so the chunk can't be deleted along with
+  // another version while this one is uploading
+  it->second.refs[pathHash] = pending->second;
+  versionChunks[pathHash].push_back(objectName);
+  return it->second.remoteExists;
+}
+
+void Watch::chunksUploaded(const string &pathHash,
+                           const std::vector<string> &chunks,
+                           const string &fileHash,
+                           FileHasher::Algorithm hashAlgorithm) {
+  std::scoped_lock<std::mutex> uploadGuard(uploadMtx);
+  string path;
+  std::stringstream rows;
+  {
+    std::scoped_lock<std::mutex> guard(objectMtx);
+    auto pending = pendingVersions.find(pathHash);
+    if (pending == pendingVersions.end()) {
+      throw std::out_of_range("Watch: no file version waiting for upload " +
+                              pathHash);
+    }
+    path = pending->second;
+    pendingVersions.erase(pending);
+    // drop references taken by earlier attempts, if the file has changed
+    // since - any chunks left unreferenced are removed by --clean-up
+    std::unordered_set<string> current(chunks.begin(), chunks.end());
+    for (const auto &objectName : versionChunks[pathHash]) {
+      auto it = objectIndex.find(objectName);
+      if (current.count(objectName) == 0 && it != objectIndex.end()) {
+        it->second.refs.erase(pathHash);
+      }
+    }
+    versionChunks[pathHash] = chunks;
+
+    // one statement per batch of rows, rather than a transaction per row
+    for (size_t i = 0; i < chunks.size(); i++) {
+      const StoredObject &chunk = objectIndex.at(chunks[i]);
+      rows << (i % 500 == 0 ? (i == 0 ? "" : ";") : ",");
+      if (i % 500 == 0) {
+        rows << "INSERT INTO fileChunks (PATHHASH, SEQ, OBJECTNAME, "
+                "CHUNKHASH, SIZE) VALUES ";
+      }
+      rows << "('" << pathHash << "'," << i << ",'" << chunks[i] << "','"
+           << chunk.fileHash << "'," << chunk.size << ")";
+    }
+    rows << ";";
+  }
+
+  VersionUpdate update{path, pathHash};
+  update.chunks = chunks.size();
+  update.fileHash = fileHash;
+  update.hashAlgorithm = hashAlgorithm;
+  update.remoteExists = true;
+  uploadUpdates.push_back(update);
+  uploadSql << "DELETE FROM fileChunks WHERE PATHHASH ='" << pathHash << "';"
+            << rows.str();
+  uploadSql << "UPDATE fileIndex SET CHUNKS = " << chunks.size()
+            << ", FILEHASH = '" << fileHash << "', HASHALGO = "
+            << hashAlgorithm << ", REMOTEEXISTS = TRUE WHERE PATHHASH ='"
+            << pathHash << "';";
+}
+
+std::vector<std::pair<string, uint64_t>> Watch::chunkList(
+    const string &pathHash) const {
+  std::scoped_lock<std::mutex> guard(objectMtx);
+  std::vector<std::pair<string, uint64_t>> chunks;
+  auto names = versionChunks.find(pathHash);
+  if (names != versionChunks.end()) {
+    for (const auto &objectName : names->second) {
+      chunks.emplace_back(objectName, objectIndex.at(objectName).size);
+    }
+  }
+  return chunks;
+}
+
+std::vector<string> Watch::releaseObjects(const string &pathHash) {
+  std::scoped_lock<std::mutex> guard(objectMtx);
+  bool pending = pendingVersions.erase(pathHash) != 0;
+  std::vector<string> names;
+  auto name = objectNames.find(pathHash);
+  if (name != objectNames.end()) {
+    names.push_back(name->second);
+    objectNames.erase(name);
+  }
+  auto chunks = versionChunks.find(pathHash);
+  if (chunks != versionChunks.end()) {
+    names.insert(names.end(), chunks->second.begin(), chunks->second.end());
+    versionChunks.erase(chunks);
+  }
+  if (names.empty()) {
+    // stored under its own pathHash, unless it was still waiting to be uploaded
+    return pending ? std::vector<string>() : releasePacked({pathHash});
+  }
+
+  std::vector<string> unused;
+  int shared = 0;
+  for (const auto &objectName : names) {
+    auto it = objectIndex.find(objectName);
+    if (it == objectIndex.end() || it->second.refs.erase(pathHash) == 0) {
+      continue;  // already released, e.g. a chunk repeated within the file
+    }
+    if (!it->second.refs.empty()) {
+      shared++;
+      continue;
+    }
+    if (it->second.remoteExists) {
+      unused.push_back(objectName);
+    }
+    objectIndex.erase(it);
+  }
+  if (shared > 0) {
+    cout << "Watch: " << shared << " object(s) of " << pathHash.substr(0, 10)
+         << "... still used by other file versions" << endl;
+  }
+  return releasePacked(unused);
+}
+
+bool Watch::packable(const string &pathHash) const {
+  std::scoped_lock<std::mutex> guard(objectMtx);
+  return packing && pendingVersions.count(pathHash) != 0;
+}
+
+size_t Watch::packUploaded(
+    const string &pack, uint64_t size,
+    const std::vector<std::pair<string, PackedObject>> &objects) {
+  std::scoped_lock<std::mutex> uploadGuard(uploadMtx);
+  // versions deleted while their pack was uploading are no longer pending,
+  // and objects named by their contents lose their last reference
+  std::vector<std::pair<string, PackedObject>> tracked;
+  {
+    std::scoped_lock<std::mutex> guard(objectMtx);
+    for (const auto &object : objects) {
+      if (pendingVersions.count(object.first) != 0 ||
+          objectIndex.count(object.first) != 0) {
+        tracked.push_back(object);
+      }
+    }
+  }
+  if (!tracked.empty()) {
+    addPack(pack, size, tracked);
+  }
+  return tracked.size();
+}
+
+void Watch::addPack(
+    const string &pack, uint64_t size,
+    const std::vector<std::pair<string, PackedObject>> &objects) {
+  Pack stored{size, 0, 0, objects.size(), std::time(nullptr)};
+  std::stringstream rows;
+  {
+    std::scoped_lock<std::mutex> guard(objectMtx);
+    for (size_t i = 0; i < objects.size(); i++) {
+      const auto &[objectName, location] = objects[i];
+      packedObjects[objectName] = location;
+      stored.packedBytes += location.length;
+      rows << (i % 500 == 0 ? (i == 0 ? "" : ";") : ",");
+      if (i % 500 == 0) {
+        rows << "INSERT or REPLACE INTO packEntries (OBJECTNAME, PACKNAME, "
+                "OFFSET, LENGTH) VALUES ";
+      }
+      rows << "('" << objectName << "','" << pack << "'," << location.offset
+           << "," << location.length << ")";
+    }
+    rows << ";";
+    stored.liveBytes = stored.packedBytes;
+    packs[pack] = stored;
+  }
+  uploadSql << "INSERT or REPLACE INTO packs (PACKNAME, SIZE, PACKEDBYTES, "
+               "CREATED) VALUES ('"
+            << pack << "'," << size << "," << stored.packedBytes << ","
+            << stored.created << ");" << rows.str();
+}
+
+bool Watch::packedLocation(const string &objectName,
+                           PackedObject &location) const {
+  std::scoped_lock<std::mutex> guard(objectMtx);
+  auto it = packedObjects.find(objectName);
+  if (it == packedObjects.end()) {
+    return false;
+  }
+  location = it->second;
+  return true;
+}
+
+std::vector<string> Watch::packsToRepack() const {
+  std::scoped_lock<std::mutex> guard(objectMtx);
+  std::vector<string> names;
+  for (const auto &[name, pack] : packs) {
+    if (pack.liveBytes * 2 < pack.packedBytes) {
+      names.push_back(name);
+    }
+  }
+  return names;
+}
+
+std::vector<std::pair<string, PackedObject>> Watch::packContents(
+    const string &pack) const {
+  std::scoped_lock<std::mutex> guard(objectMtx);
+  std::vector<std::pair<string, PackedObject>> objects;
+  for (const auto &object : packedObjects) {
+    if (object.second.pack == pack) {
+      objects.push_back(object);
+    }
+  }
+  std::sort(objects.begin(), objects.end(), [](const auto &a, const auto &b) {
+    return a.second.offset < b.second.offset;
+  });
+  return objects;
+}
+
+size_t Watch::packRepacked(
+    const string &oldPack, const string &pack, uint64_t size,
+    const std::vector<std::pair<string, PackedObject>> &objects) {
+  std::scoped_lock<std::mutex> uploadGuard(uploadMtx);
+  std::vector<std::pair<string, PackedObject>> moved;
+  {
+    std::scoped_lock<std::mutex> guard(objectMtx);
+    for (const auto &object : objects) {
+      auto it = packedObjects.find(object.first);
+      if (it != packedObjects.end() && it->second.pack == oldPack) {
+        moved.push_back(object);
+      }
+    }
+    packs.erase(oldPack);
+  }
+  uploadSql << "DELETE FROM packEntries WHERE PACKNAME ='" << oldPack << "';"
+            << "DELETE FROM packs WHERE PACKNAME ='" << oldPack << "';";
+  if (!moved.empty()) {
+    addPack(pack, size, moved);
+  }
+  return moved.size();
+}
+
+std::vector<string> Watch::releasePacked(const std::vector<string> &names) {
+  std::vector<string> unused;
+  for (const auto &objectName : names) {
+    auto it = packedObjects.find(objectName);
+    if (it == packedObjects.end()) {
+      unused.push_back(objectName);
+      continue;
+    }
+    sqlQueue << "DELETE FROM packEntries WHERE OBJECTNAME ='" << objectName
+             << "';";
+    auto pack = packs.find(it->second.pack);
+    if (pack != packs.end()) {
+      pack->second.liveBytes -= it->second.length;
+      if (--pack->second.objects == 0) {
+        unused.push_back(pack->first);
+        sqlQueue << "DELETE FROM packs WHERE PACKNAME ='" << pack->first
+                 << "';";
+        packs.erase(pack);
+      }
+    }
+    packedObjects.erase(it);
   }
+  return unused;
+}
+
+namespace {
+
+// object names are base64, but a bucket may also hold objects named elsewhere
+string sqlText(const string &text) {
+  string quoted = "'";
+  for (char c : text) {
+    quoted += c;
+    if (c == '\'') {
+      quoted += c;
+    }
+  }
+  return quoted + "'";
+}
+
+}  // namespace
+
+void Watch::inventoryStored(const RemoteObject &object) {
+  std::scoped_lock<std::mutex> guard(inventoryMtx);
+  inventory[object.name] = object;
+  inventorySql << "INSERT or REPLACE INTO remoteInventory (OBJECTNAME, SIZE, "
+                  "ETAG, LASTMODIFIED) VALUES ("
+               << sqlText(object.name) << "," << object.size << ","
+               << sqlText(object.etag) << "," << object.lastModified << ");";
+}
+
+void Watch::inventoryDeleted(const string &objectName) {
+  std::scoped_lock<std::mutex> guard(inventoryMtx);
+  inventory.erase(objectName);
+  inventorySql << "DELETE FROM remoteInventory WHERE OBJECTNAME ="
+               << sqlText(objectName) << ";";
+}
+
+void Watch::inventoryListed(const std::vector<RemoteObject> &objects,
+                            std::time_t listed) {
+  std::scoped_lock<std::mutex> guard(inventoryMtx);
+  // objects missing from the listing are gone, unless they were stored after
+  // it started
+  for (auto it = inventory.begin(); it != inventory.end();) {
+    if (it->second.lastModified < listed) {
+      it = inventory.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  inventorySql << "DELETE FROM remoteInventory WHERE LASTMODIFIED < " << listed
+               << ";";
+  for (size_t i = 0; i < objects.size(); i++) {
+    const RemoteObject &object = objects[i];
+    inventory[object.name] = object;
+    inventorySql << (i % 500 == 0 ? (i == 0 ? "" : ";") : ",");
+    if (i % 500 == 0) {
+      inventorySql << "INSERT or REPLACE INTO remoteInventory (OBJECTNAME, "
+                      "SIZE, ETAG, LASTMODIFIED) VALUES ";
+    }
+    inventorySql << "(" << sqlText(object.name) << "," << object.size << ","
+                 << sqlText(object.etag) << "," << object.lastModified << ")";
+  }
+  if (!objects.empty()) {
+    inventorySql << ";";
+  }
+  inventoryListTime = listed;
+  inventorySql << "DELETE FROM remoteListing;"
+               << "INSERT INTO remoteListing (LISTED) VALUES (" << listed
+               << ");";
+}
+
+std::vector<RemoteObject> Watch::getInventory() const {
+  std::scoped_lock<std::mutex> guard(inventoryMtx);
+  std::vector<RemoteObject> objects;
+  objects.reserve(inventory.size());
+  for (const auto &object : inventory) {
+    objects.push_back(object.second);
+  }
+  return objects;
+}
+
+std::time_t Watch::inventoryListedAt() const {
+  std::scoped_lock<std::mutex> guard(inventoryMtx);
+  return inventoryListTime;
+}
+
+void Watch::uploadStarted(const PartialUpload &upload) {
+  std::ostringstream sql;
+  sql << "DELETE FROM partialUploadParts WHERE PATHHASH ="
+      << sqlText(upload.pathHash) << ";"
+      << "INSERT or REPLACE INTO partialUploads (PATHHASH, PATH, MODTIME, "
+         "SIZE, OBJECTNAME, UPLOADID, HEADERS, STARTED) VALUES ("
+      << sqlText(upload.pathHash) << "," << sqlText(upload.path) << ","
+      << upload.modtime << "," << upload.size << ","
+      << sqlText(upload.objectName) << "," << sqlText(upload.uploadID) << ","
+      << sqlText(upload.headers) << "," << upload.started << ");";
+  std::scoped_lock<std::mutex> guard(partialMtx);
+  partialUploads[upload.pathHash] = upload;
+  db->execSQL(sql.str().c_str());
+}
+
+void Watch::partUploaded(const string &pathHash, int number,
+                         const PartialUpload::Part &part) {
+  std::ostringstream offsets;
+  for (size_t i = 0; i < part.offsets.size(); i++) {
+    offsets << (i == 0 ? "" : " ") << part.offsets[i];
+  }
+  std::ostringstream sql;
+  sql << "INSERT or REPLACE INTO partialUploadParts (PATHHASH, PARTNUMBER, "
+         "ETAG, FIRSTSEGMENT, OFFSETS, END) VALUES ("
+      << sqlText(pathHash) << "," << number << "," << sqlText(part.etag) << ","
+      << part.firstSegment << ",'" << offsets.str() << "'," << part.end
+      << ");";
+  std::scoped_lock<std::mutex> guard(partialMtx);
+  auto upload = partialUploads.find(pathHash);
+  if (upload == partialUploads.end()) {
+    return;  // aborted while the part was in flight
+  }
+  upload->second.parts[number] = part;
+  db->execSQL(sql.str().c_str());
+}
+
+void Watch::partsDiscarded(const string &pathHash, int number) {
+  std::ostringstream sql;
+  sql << "DELETE FROM partialUploadParts WHERE PATHHASH =" << sqlText(pathHash)
+      << " AND PARTNUMBER >= " << number << ";";
+  std::scoped_lock<std::mutex> guard(partialMtx);
+  auto upload = partialUploads.find(pathHash);
+  if (upload != partialUploads.end()) {
+    auto &parts = upload->second.parts;
+    parts.erase(parts.lower_bound(number), parts.end());
+  }
+  db->execSQL(sql.str().c_str());
+}
+
+void Watch::uploadFinished(const string &pathHash) {
+  std::ostringstream sql;
+  sql << "DELETE FROM partialUploadParts WHERE PATHHASH =" << sqlText(pathHash)
+      << ";"
+      << "DELETE FROM partialUploads WHERE PATHHASH =" << sqlText(pathHash)
+      << ";";
+  std::scoped_lock<std::mutex> guard(partialMtx);
+  if (partialUploads.erase(pathHash) != 0) {
+    db->execSQL(sql.str().c_str());
+  }
+}
+
+bool Watch::partialUpload(const string &pathHash,
+                          PartialUpload &upload) const {
+  std::scoped_lock<std::mutex> guard(partialMtx);
+  auto it = partialUploads.find(pathHash);
+  if (it == partialUploads.end()) {
+    return false;
+  }
+  upload = it->second;
+  return true;
+}
+
+std::vector<PartialUpload> Watch::getPartialUploads() const {
+  std::scoped_lock<std::mutex> guard(partialMtx);
+  std::vector<PartialUpload> uploads;
+  for (const auto &upload : partialUploads) {
+    uploads.push_back(upload.second);
+  }
+  return uploads;
 }
 
 void Watch::deriveIdxBackupName() {
   std::scoped_lock<std::mutex> guard(mtx);
 
-  // derive a b64 encoding key + random salt using the subkey as a password
-  indexBackupName = Encryption::deriveKey(daemon->getSubKey_b64());
+  // a random salt, tagged with a MAC keyed by the subkey
+  indexBackupName = Encryption::deriveIndexName(daemon->getSubKey_b64());
   cout << "Used subkey to derive filename to use for index file backup: "
        << indexBackupName << " length: " << indexBackupName.length() << endl;
 
-  // update db
+  // update db, replacing any legacy name
   std::stringstream ss;
-  ss << "INSERT or IGNORE INTO indexBackup (PATH, IDXNAME) VALUES ('"
+  ss << "INSERT or REPLACE INTO indexBackup (PATH, IDXNAME) VALUES ('"
      << db->getDbLocation() << "','" << indexBackupName << "');";
   int errorcode = db->execSQL(ss.str().c_str());
 }
@@ -455,6 +1179,13 @@ void Watch::deriveIdxBackupName() {
 void Watch::indexBackup() {
   std::scoped_lock<std::mutex> guard(mtx);
 
+  // the backup under the legacy name is out of date once one has been
+  // uploaded under the new name
+  if (!legacyIndexBackupName.empty() && indexBackupUploaded) {
+    remote->queueForDelete(legacyIndexBackupName);
+    legacyIndexBackupName.clear();
+  }
+
   // do not backup an empty database to avoid providing a possible
   // known-plaintext pair available on the cloud
   if (dirIndex.empty() && fileIndex.empty()) {
@@ -494,16 +1225,145 @@ void Watch::indexBackup() {
   }
 }
 
+bool Watch::isWatchRoot(const string &path) const {
+  // directories added by a recursive watch belong to the root above them
+  fs::path dir = fs::path(path).lexically_normal();
+  if (!dir.has_filename()) {
+    dir = dir.parent_path();  // trailing slash
+  }
+  while (dir.has_relative_path()) {
+    dir = dir.parent_path();
+    for (const string &parent : {dir.string(), dir.string() + "/"}) {
+      auto it = dirIndex.find(parent);
+      if (it != dirIndex.end() && it->second) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void Watch::trainDictionaries() {
+  if (!dictionariesEnabled) {
+    return;
+  }
+  std::time_t now = std::time(nullptr);
+  string root;
+  std::vector<string> paths;
+  {
+    std::scoped_lock<std::mutex> guard(mtx);
+    // one root at a time, training reads up to a few MB of samples
+    for (auto elem : dirIndex) {
+      if (now >= nextTraining[elem.first] && isWatchRoot(elem.first)) {
+        root = elem.first;
+        break;
+      }
+    }
+    if (root.empty()) {
+      return;
+    }
+    nextTraining[root] = now + TRAINING_RETRY_INTERVAL;
+    string prefix = root.back() == '/' ? root : root + "/";
+    for (const auto &elem : fileIndex) {
+      if (elem.first.compare(0, prefix.size(), prefix) == 0 &&
+          elem.second.back().localExists) {
+        paths.push_back(elem.first);
+      }
+    }
+  }
+
+  // do not hold up scanning for file changes while training
+  uint32_t id = daemon->getDictionaries()->train(paths);
+  if (id == 0) {
+    return;
+  }
+  string location = Dictionaries::location(id);
+  DictionaryVersion version{
+      id, root, Encryption::hashPath(location),
+      Encryption::hashFile(location, FileHasher::BLAKE2B), now};
+
+  std::scoped_lock<std::mutex> guard(mtx);
+  nextTraining[root] = now + retrainInterval;
+  {
+    std::scoped_lock<std::mutex> dictGuard(dictMtx);
+    for (const auto &dict : dictionaryIndex) {
+      if (dict.id == id) {
+        return;  // nothing has changed since the last training
+      }
+    }
+    dictionaryIndex.push_back(version);
+  }
+  cout << "Watch: trained dictionary " << id << " for " << root << endl;
+  sqlQueue << "INSERT or IGNORE INTO dictionaries (ID, ROOT, OBJECTNAME, "
+              "FILEHASH, CREATED, REMOTEEXISTS) VALUES ("
+           << id << ",'" << root << "','" << version.objectName << "','"
+           << version.fileHash << "'," << now << ",FALSE);";
+  // the dictionary is only used for new files once it has been uploaded
+  remote->queueForUpload(location, version.objectName, fsLastMod(location));
+}
+
+void Watch::queueDictionaryDownloads() {
+  std::vector<DictionaryVersion> missing;
+  {
+    std::scoped_lock<std::mutex> guard(dictMtx);
+    for (const auto &dict : dictionaryIndex) {
+      if (dict.remoteExists && !fs::exists(Dictionaries::location(dict.id))) {
+        missing.push_back(dict);
+      }
+    }
+  }
+  // queued ahead of the files, so they are downloaded first
+  for (const auto &dict : missing) {
+    remote->queueForDownload(Dictionaries::location(dict.id), dict.objectName,
+                             dict.created, ".");
+  }
+}
+
+bool Watch::dictionaryUploaded(const string &objectName) {
+  string root;
+  {
+    std::scoped_lock<std::mutex> guard(dictMtx);
+    auto it = std::find_if(dictionaryIndex.begin(), dictionaryIndex.end(),
+                           [&objectName](const DictionaryVersion &dict) {
+                             return dict.objectName == objectName;
+                           });
+    if (it == dictionaryIndex.end()) {
+      return false;
+    }
+    it->remoteExists = true;
+    root = it->root;
+  }
+  uploadSql << "UPDATE dictionaries SET REMOTEEXISTS = TRUE WHERE OBJECTNAME ='"
+            << objectName << "';";
+  setCurrentDictionary(root);
+  return true;
+}
+
+void Watch::setCurrentDictionary(const string &root) {
+  // the newest dictionary for root that has been uploaded
+  std::scoped_lock<std::mutex> guard(dictMtx);
+  uint32_t id = 0;
+  std::time_t created = 0;
+  for (const auto &dict : dictionaryIndex) {
+    if (dict.root == root && dict.remoteExists && dict.created >= created) {
+      id = dict.id;
+      created = dict.created;
+    }
+  }
+  daemon->getDictionaries()->setCurrent(root, id);
+}
+
 string Watch::restoreIndex(string arg) {
   /*
       - list remote objects and save filenames to vector
       - compute same subkey as above from master key (use same CONTEXT string as
         parameter - "INDEX___")
       - base64 encode subkey
-      - use Encryption::verifyKey(subkey, filename) on all files to check if
-        file is a valid index backup
-      - some slowness is acceptable since restoring index from remote will only
-        be done very rarely, in the event of loss of local index file.
+      - use Encryption::verifyIndexName(subkey, filename) on all files to check
+        if file is a valid index backup - one keyed hash per object
+      - index backups named by earlier versions need Encryption::verifyKey,
+        which runs Argon2 (around 1s and 256MB per object), so are only
+        searched for with "show-legacy"
    */
   std::stringstream response;
 
@@ -518,21 +1378,31 @@ string Watch::restoreIndex(string arg) {
   }
 
   // try and verify all files on remote, to determine if they are index backups
-  if (arg == "show") {
+  if (arg == "show" || arg == "show-legacy") {
+    int found = 0;
     for (auto item : remoteObjectMap) {
       // verify if filename was computed from the subkey
-      if (Encryption::verifyKey(subKey_b64, item.first)) {
+      if (arg == "show" ? Encryption::verifyIndexName(subKey_b64, item.first)
+                        : Encryption::verifyKey(subKey_b64, item.first)) {
         cout << "Watch: verified index backup: " << item.first << endl;
         response << item.second << " : " << item.first << endl;
+        found++;
       }
     }
+    if (found == 0 && arg == "show") {
+      response << "No index backups found. Backups made by earlier versions of "
+                  "encloned can be searched for with 'show-legacy', which "
+                  "takes around 1s per remote object"
+               << endl;
+    }
   }
 
   else if (arg.length() == 88) {  // hash should be 88 chars long
     if (remoteObjectMap.find(arg) !=
         remoteObjectMap.end()) {  // check if provided hash is in object map
       // verify if filename was computed from the subkey
-      if (Encryption::verifyKey(subKey_b64, arg)) {
+      if (Encryption::verifyIndexName(subKey_b64, arg) ||
+          Encryption::verifyKey(subKey_b64, arg)) {
         response << "Restoring index backup with hash " << arg.substr(0, 10)
                  << "..." << endl;
         // download and decrypt index backup to index.restore
@@ -547,9 +1417,9 @@ string Watch::restoreIndex(string arg) {
     }
   }
 
-  else if (arg != "show") {
-    response << "Unknown argument provided - either 'show' or an 88 character "
-                "hash of an index backup"
+  else {
+    response << "Unknown argument provided - either 'show', 'show-legacy' or an "
+                "88 character hash of an index backup"
              << endl;
   }
 
@@ -560,6 +1430,10 @@ void Watch::restoreDB() {
   cout << "Restoring file index from DB..." << endl;
   cout.flush();
   restoreFileIdx();
+  restoreChunks();
+  restorePacks();
+  restoreInventory();
+  restorePartialUploads();
   cout << listWatchFiles();
   cout << "Restoring directory index from DB..." << endl;
   cout.flush();
@@ -568,6 +1442,20 @@ void Watch::restoreDB() {
   cout << "Restoring index backup name from DB..." << endl;
   cout.flush();
   restoreIdxBackupName();
+  cout << "Restoring dictionaries from DB..." << endl;
+  cout.flush();
+  restoreDictionaries();
+
+  // replace a name from an earlier version, which can only be found again by
+  // running Argon2 on every remote object
+  if (!indexBackupName.empty() &&
+      !Encryption::verifyIndexName(daemon->getSubKey_b64(), indexBackupName)) {
+    cout << "Watch: Renaming index backup " << indexBackupName.substr(0, 10)
+         << "..., the old backup is deleted once the next one is uploaded"
+         << endl;
+    legacyIndexBackupName = indexBackupName;
+    indexBackupName.clear();
+  }
 
   // check we've restored an indexBackupName - if it doesn't exist then we need
   // to derive it
@@ -607,24 +1495,29 @@ void Watch::restoreFileIdx() {
         string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 3)));
     bool localExists = sqlite3_column_int(stmt, 4);
     bool remoteExists = sqlite3_column_int(stmt, 5);
+    FileVersion version{modtime, pathHash, fileHash, localExists,
+                        remoteExists};
+    version.hashAlgorithm = (FileHasher::Algorithm)sqlite3_column_int(stmt, 6);
+    const unsigned char *objectName = sqlite3_column_text(stmt, 7);
+    if (objectName != NULL) {
+      version.objectName = reinterpret_cast<const char *>(objectName);
+    }
+    version.chunks = sqlite3_column_int64(stmt, 8);
 
     mtx.lock();
+    indexMtx.lock();
     if (fileIndex.find(path) ==
         fileIndex.end()) {  // if entry for path does not exist
       // cout << path << " does not exist in fileIndex - adding and init
       // vector.." << endl;
-      fileIndex.insert(
-          {path,
-           std::vector<FileVersion>{
-               // create entry and initialise vector
-               FileVersion{modtime, pathHash, fileHash, localExists,
-                           remoteExists}}});
+      // create entry and initialise vector
+      fileIndex.insert({path, std::vector<FileVersion>{version}});
     } else {
       // cout << path << " exists, attempting to push to vector.." << endl;
       // get a pointer to the vector associated to the path
       auto fileVector = &fileIndex[path];
       // push a FileVersion struct to the back of the vector
-      fileVector->push_back(FileVersion{modtime, pathHash, ""});
+      fileVector->push_back(version);
       // this should retain the correct ordering in the vector of oldest = first
       // in vector, most recent = last in vector
     }
@@ -632,8 +1525,22 @@ void Watch::restoreFileIdx() {
     // also insert into reverse lookup table
     pathHashIndex.insert(std::make_pair(pathHash,
                          std::make_pair(path, modtime)));
+    indexMtx.unlock();
     mtx.unlock();
 
+    // rebuild the references to objects shared by their contents
+    if (!version.objectName.empty()) {
+      std::scoped_lock<std::mutex> objectGuard(objectMtx);
+      auto [it, inserted] = objectIndex.try_emplace(version.objectName);
+      if (inserted) {
+        it->second.fileHash = fileHash;
+        it->second.hashAlgorithm = version.hashAlgorithm;
+      }
+      it->second.remoteExists |= remoteExists;
+      it->second.refs[pathHash] = path;
+      objectNames[pathHash] = version.objectName;
+    }
+
     rc = sqlite3_step(stmt);
   }
 
@@ -706,3 +1613,286 @@ void Watch::restoreIdxBackupName() {
 
   sqlite3_finalize(stmt);
 }
+
+void Watch::restoreDictionaries() {
+  const char getDictionaries[] =
+      "SELECT ID, ROOT, OBJECTNAME, FILEHASH, CREATED, REMOTEEXISTS FROM "
+      "dictionaries;";
+
+  int rc;
+  sqlite3_stmt *stmt;
+  const char *tail;
+  rc = sqlite3_prepare(db->getDbPtr(), getDictionaries, strlen(getDictionaries),
+                       &stmt, &tail);
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "restoreDictionaries: SQL error: %s\n",
+            sqlite3_errmsg(db->getDbPtr()));
+  }
+
+  std::unordered_set<string> roots;
+  std::vector<DictionaryVersion> notUploaded;
+  rc = sqlite3_step(stmt);
+  while (rc == SQLITE_ROW) {
+    DictionaryVersion version{
+        (uint32_t)sqlite3_column_int64(stmt, 0),
+        string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1))),
+        string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 2))),
+        string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 3))),
+        (std::time_t)sqlite3_column_int64(stmt, 4),
+        sqlite3_column_int(stmt, 5) != 0};
+
+    mtx.lock();
+    nextTraining[version.root] = std::max(nextTraining[version.root],
+                                          version.created + retrainInterval);
+    mtx.unlock();
+    dictMtx.lock();
+    dictionaryIndex.push_back(version);
+    dictMtx.unlock();
+    roots.insert(version.root);
+    if (!version.remoteExists &&
+        fs::exists(Dictionaries::location(version.id))) {
+      notUploaded.push_back(version);
+    }
+
+    rc = sqlite3_step(stmt);
+  }
+
+  sqlite3_finalize(stmt);
+
+  for (const auto &root : roots) {
+    setCurrentDictionary(root);
+  }
+  for (const auto &dict : notUploaded) {
+    string location = Dictionaries::location(dict.id);
+    remote->queueForUpload(location, dict.objectName, fsLastMod(location));
+  }
+}
+
+void Watch::restoreChunks() {
+  const char getChunks[] =
+      "SELECT PATHHASH, OBJECTNAME, CHUNKHASH, SIZE FROM fileChunks ORDER BY "
+      "PATHHASH, SEQ;";
+
+  int rc;
+  sqlite3_stmt *stmt;
+  const char *tail;
+  rc = sqlite3_prepare(db->getDbPtr(), getChunks, strlen(getChunks), &stmt,
+                       &tail);
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "restoreChunks: SQL error: %s\n",
+            sqlite3_errmsg(db->getDbPtr()));
+  }
+
+  std::scoped_lock guard(mtx, objectMtx);
+  rc = sqlite3_step(stmt);
+  while (rc == SQLITE_ROW) {
+    string pathHash =
+        string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)));
+    string objectName =
+        string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1)));
+    auto version = pathHashIndex.find(pathHash);
+    if (version != pathHashIndex.end()) {
+      auto [it, inserted] = objectIndex.try_emplace(objectName);
+      if (inserted) {
+        it->second.fileHash = string(
+            reinterpret_cast<const char *>(sqlite3_column_text(stmt, 2)));
+        it->second.hashAlgorithm = FileHasher::BLAKE2B;
+        it->second.chunk = true;
+        it->second.size = sqlite3_column_int64(stmt, 3);
+      }
+      // versions are only recorded once all of their chunks are uploaded
+      it->second.remoteExists = true;
+      it->second.refs[pathHash] = version->second.first;
+      versionChunks[pathHash].push_back(objectName);
+    }
+    rc = sqlite3_step(stmt);
+  }
+
+  sqlite3_finalize(stmt);
+}
+
+void Watch::restorePacks() {
+  const char getPacks[] =
+      "SELECT PACKNAME, SIZE, PACKEDBYTES, CREATED FROM packs;";
+  const char getEntries[] =
+      "SELECT OBJECTNAME, PACKNAME, OFFSET, LENGTH FROM packEntries;";
+
+  int rc;
+  sqlite3_stmt *stmt;
+  const char *tail;
+  rc = sqlite3_prepare(db->getDbPtr(), getPacks, strlen(getPacks), &stmt,
+                       &tail);
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "restorePacks: SQL error: %s\n",
+            sqlite3_errmsg(db->getDbPtr()));
+  }
+
+  std::scoped_lock<std::mutex> guard(objectMtx);
+  rc = sqlite3_step(stmt);
+  while (rc == SQLITE_ROW) {
+    Pack pack;
+    pack.size = sqlite3_column_int64(stmt, 1);
+    pack.packedBytes = sqlite3_column_int64(stmt, 2);
+    pack.created = (std::time_t)sqlite3_column_int64(stmt, 3);
+    packs.emplace(
+        string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0))),
+        pack);
+    rc = sqlite3_step(stmt);
+  }
+  sqlite3_finalize(stmt);
+
+  rc = sqlite3_prepare(db->getDbPtr(), getEntries, strlen(getEntries), &stmt,
+                       &tail);
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "restorePacks: SQL error: %s\n",
+            sqlite3_errmsg(db->getDbPtr()));
+  }
+
+  // live bytes are counted from the objects still in each pack
+  rc = sqlite3_step(stmt);
+  while (rc == SQLITE_ROW) {
+    PackedObject location{
+        string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1))),
+        (uint64_t)sqlite3_column_int64(stmt, 2),
+        (uint64_t)sqlite3_column_int64(stmt, 3)};
+    auto pack = packs.find(location.pack);
+    if (pack != packs.end()) {
+      pack->second.liveBytes += location.length;
+      pack->second.objects++;
+      packedObjects.emplace(
+          string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0))),
+          location);
+    }
+    rc = sqlite3_step(stmt);
+  }
+  sqlite3_finalize(stmt);
+}
+
+void Watch::restoreInventory() {
+  const char getObjects[] =
+      "SELECT OBJECTNAME, SIZE, ETAG, LASTMODIFIED FROM remoteInventory;";
+  const char getListed[] = "SELECT MAX(LISTED) FROM remoteListing;";
+
+  int rc;
+  sqlite3_stmt *stmt;
+  const char *tail;
+  rc = sqlite3_prepare(db->getDbPtr(), getObjects, strlen(getObjects), &stmt,
+                       &tail);
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "restoreInventory: SQL error: %s\n",
+            sqlite3_errmsg(db->getDbPtr()));
+  }
+
+  std::scoped_lock<std::mutex> guard(inventoryMtx);
+  rc = sqlite3_step(stmt);
+  while (rc == SQLITE_ROW) {
+    RemoteObject object;
+    object.name =
+        string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)));
+    object.size = sqlite3_column_int64(stmt, 1);
+    if (sqlite3_column_text(stmt, 2) != NULL) {
+      object.etag =
+          string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 2)));
+    }
+    object.lastModified = (std::time_t)sqlite3_column_int64(stmt, 3);
+    inventory.emplace(object.name, object);
+    rc = sqlite3_step(stmt);
+  }
+  sqlite3_finalize(stmt);
+
+  rc = sqlite3_prepare(db->getDbPtr(), getListed, strlen(getListed), &stmt,
+                       &tail);
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "restoreInventory: SQL error: %s\n",
+            sqlite3_errmsg(db->getDbPtr()));
+  }
+  if (sqlite3_step(stmt) == SQLITE_ROW) {
+    // NULL (0) if the remote has never been listed
+    inventoryListTime = (std::time_t)sqlite3_column_int64(stmt, 0);
+  }
+  sqlite3_finalize(stmt);
+}
+
+void Watch::restorePartialUploads() {
+  const char getUploads[] =
+      "SELECT PATHHASH, PATH, MODTIME, SIZE, OBJECTNAME, UPLOADID, HEADERS, "
+      "STARTED FROM partialUploads;";
+  const char getParts[] =
+      "SELECT PATHHASH, PARTNUMBER, ETAG, FIRSTSEGMENT, OFFSETS, END FROM "
+      "partialUploadParts;";
+
+  int rc;
+  sqlite3_stmt *stmt;
+  const char *tail;
+  rc = sqlite3_prepare(db->getDbPtr(), getUploads, strlen(getUploads), &stmt,
+                       &tail);
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "restorePartialUploads: SQL error: %s\n",
+            sqlite3_errmsg(db->getDbPtr()));
+  }
+
+  // queued below, without partialMtx - uploads hold Remote's lock while they
+  // record parts
+  std::vector<PartialUpload> restored;
+  partialMtx.lock();
+  rc = sqlite3_step(stmt);
+  while (rc == SQLITE_ROW) {
+    PartialUpload upload;
+    upload.pathHash =
+        string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)));
+    upload.path =
+        string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1)));
+    upload.modtime = (std::time_t)sqlite3_column_int64(stmt, 2);
+    upload.size = sqlite3_column_int64(stmt, 3);
+    upload.objectName =
+        string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 4)));
+    upload.uploadID =
+        string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 5)));
+    upload.headers =
+        string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 6)));
+    upload.started = (std::time_t)sqlite3_column_int64(stmt, 7);
+    partialUploads.emplace(upload.pathHash, upload);
+    rc = sqlite3_step(stmt);
+  }
+  sqlite3_finalize(stmt);
+
+  rc = sqlite3_prepare(db->getDbPtr(), getParts, strlen(getParts), &stmt,
+                       &tail);
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "restorePartialUploads: SQL error: %s\n",
+            sqlite3_errmsg(db->getDbPtr()));
+  }
+  rc = sqlite3_step(stmt);
+  while (rc == SQLITE_ROW) {
+    auto upload = partialUploads.find(
+        reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)));
+    if (upload != partialUploads.end()) {
+      PartialUpload::Part part;
+      part.etag =
+          string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 2)));
+      part.firstSegment = sqlite3_column_int64(stmt, 3);
+      std::istringstream offsets(
+          reinterpret_cast<const char *>(sqlite3_column_text(stmt, 4)));
+      uint64_t offset;
+      while (offsets >> offset) {
+        part.offsets.push_back(offset);
+      }
+      part.end = sqlite3_column_int64(stmt, 5);
+      upload->second.parts[sqlite3_column_int(stmt, 1)] = part;
+    }
+    rc = sqlite3_step(stmt);
+  }
+  sqlite3_finalize(stmt);
+  for (const auto &upload : partialUploads) {
+    restored.push_back(upload.second);
+  }
+  partialMtx.unlock();
+
+  // versions waiting for upload aren't otherwise queued again on start
+  for (const auto &upload : restored) {
+    cout << "Watch: Resuming upload of " << upload.path << " ("
+         << upload.parts.size() << " parts stored)" << endl;
+    remote->queueForUpload(upload.path, upload.pathHash, upload.modtime);
+  }
+  remote->cleanUpUploads();
+}
@@ -16,7 +16,8 @@ int enclone::showOptions(const int& argc, char** const argv) {
         "list,l", po::value<string>(),
         "show currently tracked/available files\n\n"
         "   local: \tshow all tracked local files\n"
-        "   remote: \tshow all available remote files\n")(
+        "   remote: \tshow all available remote files\n"
+        "   refresh: \tlist remote storage again, then show as remote\n")(
         "add-watch,a", po::value<std::vector<string>>(&toAdd)->composing(),
         "add a watch to a given path (file or directory)")(
         "add-recursive,A",
@@ -38,11 +39,35 @@ int enclone::showOptions(const int& argc, char** const argv) {
         "restore-index,i", po::value<string>(),
         "restore an index/database from remote storage\n"
         "   show: \tshow all remotely backed up indexes\n"
+        "   show-legacy: \tshow indexes backed up by earlier versions "
+        "(slow)\n"
         "   filehash: \trestore a specific index by giving the encrypted "
         "filename\n")("generate-key,k", "generate an encryption key")(
+        "cipher", po::value<string>()->default_value("xchacha20poly1305"),
+        "cipher suite for files encrypted with a new --generate-key\n"
+        "   xchacha20poly1305: \tfast on any CPU\n"
+        "   aes256gcm: \tfaster on CPUs with AES instructions, others fall "
+        "back to xchacha20poly1305\n")(
         "clean-up,c",
         "remove items from remote S3 which do not have a corresponding entry "
-        "in fileIndex");
+        "in fileIndex")(
+        "failed", po::value<string>(),
+        "uploads, downloads and deletes that failed permanently, or too many "
+        "times\n"
+        "   show: \tshow all failed items and their last error\n"
+        "   retry: \tqueue all failed items again\n")(
+        "stats", po::value<string>(),
+        "latency of each stage of the pipeline, per file\n"
+        "   show: \tcount, bytes and p50/p90/p99/max in microseconds\n"
+        "   reset: \tshow, then start counting again\n")(
+        "limit", po::value<string>(),
+        "total upload or download rate, until encloned restarts\n"
+        "   show: \tshow both limits and their schedules\n"
+        "   upload=rate: \tlimit uploads to rate per second, e.g. 512K, 2M "
+        "or 0 for unlimited\n"
+        "   download=rate: \tthe same for downloads\n"
+        "   upload=schedule: \tgo back to the limit and schedule in "
+        "encloned.conf\n");
 
     // store/parse arguments
     po::variables_map vm;
@@ -72,10 +97,12 @@ int enclone::showOptions(const int& argc, char** const argv) {
       if (arg == "local") {
         listLocal();
       } else if (arg == "remote") {
-        listRemote();
+        listRemote(false);
+      } else if (arg == "refresh") {
+        listRemote(true);
       } else {
-        cout << "Incorrect argument to --list (-l) - enter either local or "
-                "remote";
+        cout << "Incorrect argument to --list (-l) - enter either local, "
+                "remote or refresh";
       }
     }
 
@@ -128,24 +155,66 @@ int enclone::showOptions(const int& argc, char** const argv) {
 
     if (vm.count("restore-index")) {
       string arg = vm["restore-index"].as<string>();
-      if (arg == "latest" || arg == "show" || arg.length() == 88) {
+      if (arg == "latest" || arg == "show" || arg == "show-legacy" ||
+          arg.length() == 88) {
         restoreIndex(arg);
       } else {
-        std::cerr << "error: please enter 'latest', 'show' or an 88 character "
-                     "encrypted index name"
+        std::cerr << "error: please enter 'latest', 'show', 'show-legacy' or "
+                     "an 88 character encrypted index name"
                   << endl;
         return 1;
       }
     }
 
     if (vm.count("generate-key")) {
-      generateKey();
+      string arg = vm["cipher"].as<string>();
+      if (arg == "xchacha20poly1305") {
+        generateKey(ChunkCipher::XCHACHA20POLY1305);
+      } else if (arg == "aes256gcm") {
+        generateKey(ChunkCipher::AES256GCM);
+      } else {
+        std::cerr << "error: --cipher must be either xchacha20poly1305 or "
+                     "aes256gcm"
+                  << endl;
+        return 1;
+      }
     }
 
     if (vm.count("clean-up")) {
       cleanRemote();
     }
 
+    if (vm.count("failed")) {
+      string arg = vm["failed"].as<string>();
+      if (arg == "show" || arg == "retry") {
+        failedItems(arg);
+      } else {
+        cout << "Incorrect argument to --failed - enter either show or retry";
+      }
+    }
+
+    if (vm.count("stats")) {
+      string arg = vm["stats"].as<string>();
+      if (arg == "show" || arg == "reset") {
+        stats(arg);
+      } else {
+        cout << "Incorrect argument to --stats - enter either show or reset";
+      }
+    }
+
+    if (vm.count("limit")) {
+      string arg = vm["limit"].as<string>();
+      auto equals = arg.find('=');
+      if (arg == "show") {
+        limit("", "");
+      } else if (equals != string::npos) {
+        limit(arg.substr(0, equals), arg.substr(equals + 1));
+      } else {
+        cout << "Incorrect argument to --limit - enter show, or upload= or "
+                "download= followed by a rate or schedule";
+      }
+    }
+
   } catch (std::exception& e) {
     std::cerr << "error: " << e.what() << "\n";
     return 1;
@@ -213,8 +282,8 @@ bool enclone::listLocal() {
   return sendRequest(request);
 }
 
-bool enclone::listRemote() {
-  string request = "listRemote|";
+bool enclone::listRemote(bool refresh) {
+  string request = refresh ? "listRemote|refresh" : "listRemote|";
   return sendRequest(request);
 }
 
@@ -223,6 +292,21 @@ bool enclone::cleanRemote() {
   return sendRequest(request);
 }
 
+bool enclone::failedItems(string arg) {
+  string request = "failed|" + arg;
+  return sendRequest(request);
+}
+
+bool enclone::stats(string arg) {
+  string request = "stats|" + arg;
+  return sendRequest(request);
+}
+
+bool enclone::limit(string direction, string rate) {
+  string request = "limit|" + direction + "|" + rate;
+  return sendRequest(request);
+}
+
 bool enclone::restoreFiles(string targetPath) {
   string request = "restoreAll|" + targetPath;
   return sendRequest(request);
@@ -238,7 +322,7 @@ bool enclone::restoreIndex(string arg) {
   return sendRequest(request);
 }
 
-void enclone::generateKey() {
+void enclone::generateKey(uint8_t cipher) {
   if (sodium_init() != 0) {
     cout << "Error initialising libsodium" << endl;
   }
@@ -262,8 +346,19 @@ void enclone::generateKey() {
     file.open("key", std::ios::out | std::ios::trunc | std::ios::binary);
     if (file.is_open()) {
       file.write((char*)key, crypto_secretstream_xchacha20poly1305_KEYBYTES);
+      // keys for the default cipher suite stay 32 bytes, as they always were
+      if (cipher != ChunkCipher::XCHACHA20POLY1305) {
+        file.put((char)cipher);
+      }
     }
     file.close();
+    sodium_memzero(key, sizeof key);
     cout << "Generated encryption key and saved to this directory" << endl;
+    if (cipher == ChunkCipher::AES256GCM &&
+        !crypto_aead_aes256gcm_is_available()) {
+      cout << "Note: this CPU has no AES instructions - encloned will use "
+              "xchacha20poly1305 on it"
+           << endl;
+    }
   }
 }
@@ -7,8 +7,13 @@ int main() {
          << endl;
     return 1;
   }
-  encloned daemon;
-  daemon.execLoop();
+  try {
+    encloned daemon;
+    daemon.execLoop();
+  } catch (const std::exception& e) {
+    cout << "encloned: " << e.what() << endl;
+    return 1;
+  }
 }
 
 encloned::encloned() {
@@ -28,7 +33,24 @@ encloned::encloned() {
     }
   }
 
+  // before anything encrypts or checks which ciphers the CPU supports
+  Encryption::initSodium();
+  // the key chooses the cipher suite Transfer encrypts new objects with, so
+  // it is loaded before Remote is constructed
+  if (loadEncryptionKey()) {
+    throw std::runtime_error("Error loading encryption key from file");
+  }
+  if (deriveSubKey()) {
+    throw std::runtime_error(
+        "Error deriving sub-key from master encryption key");
+  }
+  cout << "Derived sub-key from master encryption key" << endl;
+
+  config = std::make_shared<Config>();
   db = std::make_shared<DB>();
+  dictionaries = std::make_shared<Dictionaries>(config->getInt(
+      "dictionary_max_file_size", Dictionaries::DEFAULT_MAX_FILE_SIZE));
+  stats = std::make_shared<Stats>();
   socket = std::make_shared<Socket>(&runThreads);
   remote = std::make_shared<Remote>(&runThreads, this);
   watch = std::make_shared<Watch>(db, &runThreads, this);
@@ -44,33 +66,11 @@ encloned::encloned() {
   if (count != -1) {
     daemonPath = dirname(result);
   }
-
-  // make tmp directory for encrypted files before upload
-  try {
-    fs::create_directories(TEMP_FILE_LOCATION);
-    cout << "Created directory " << TEMP_FILE_LOCATION << endl;
-  } catch (std::exception& e) {
-    std::cout << e.what() << std::endl;
-  }
-
-  Encryption::initSodium();
 }
 
 encloned::~encloned() {}
 
 int encloned::execLoop() {
-  if (loadEncryptionKey()) {
-    cout << "Error loading encryption key from file" << endl;
-    return 1;
-  }
-
-  if (deriveSubKey()) {
-    cout << "Error deriving sub-key from master encryption key" << endl;
-    return 1;
-  } else {
-    cout << "Derived sub-key from master encryption key" << endl;
-  }
-
   cout << "Starting Watch thread..." << endl;
   cout.flush();
   // start a thread scanning for filesystem changes
@@ -99,10 +99,22 @@ int encloned::execLoop() {
 
 unsigned char* const encloned::getKey() { return key; }
 
+uint8_t encloned::getCipher() { return cipher; }
+
+unsigned char* const encloned::getContentKey() { return contentKey; }
+
 string const encloned::getSubKey_b64() {
   return Encryption::base64_encode(subKey, sizeof subKey);
 }
 
+std::shared_ptr<Config> encloned::getConfig() { return config; }
+
+std::shared_ptr<Dictionaries> encloned::getDictionaries() {
+  return dictionaries;
+}
+
+std::shared_ptr<Stats> encloned::getStats() { return stats; }
+
 void encloned::addWatch(string path, bool recursive) {
   watch->addWatch(path, recursive);
 }
@@ -113,12 +125,15 @@ void encloned::displayWatches() {
 }
 
 int encloned::loadEncryptionKey() {
-  if (fs::file_size("key") != crypto_secretstream_xchacha20poly1305_KEYBYTES) {
+  // the key, followed by the cipher suite unless it is the default
+  uintmax_t keySize = fs::file_size("key");
+  if (keySize != crypto_secretstream_xchacha20poly1305_KEYBYTES &&
+      keySize != crypto_secretstream_xchacha20poly1305_KEYBYTES + 1) {
     cout << "Error loading encryption key - key size is incorrect" << endl;
     return 1;
   }
   std::streampos size;
-  char memblock[crypto_secretstream_xchacha20poly1305_KEYBYTES];
+  char memblock[crypto_secretstream_xchacha20poly1305_KEYBYTES + 1];
 
   std::ifstream file("key", std::ios::in | std::ios::binary | std::ios::ate);
   if (file.is_open()) {
@@ -127,7 +142,16 @@ int encloned::loadEncryptionKey() {
     file.read(memblock, size);
     file.close();
 
-    memcpy(key, memblock, sizeof memblock);
+    memcpy(key, memblock, sizeof key);
+    cipher = (size == (std::streampos)sizeof key)
+                 ? ChunkCipher::XCHACHA20POLY1305
+                 : (uint8_t)memblock[sizeof key];
+    sodium_memzero(memblock, sizeof memblock);
+    if (cipher != ChunkCipher::XCHACHA20POLY1305 &&
+        cipher != ChunkCipher::AES256GCM) {
+      cout << "Error loading encryption key - unknown cipher suite" << endl;
+      return 1;
+    }
     cout << "Successfully loaded encryption key from key file" << endl;
   } else {
     cout << "Error loading encryption key - please check \"key\" and try again"
@@ -137,6 +161,10 @@ int encloned::loadEncryptionKey() {
   return 0;
 }
 
-int encloned::deriveSubKey() {  // derive subkey from master key
-  return crypto_kdf_derive_from_key(subKey, sizeof subKey, 1, "INDEX___", key);
+int encloned::deriveSubKey() {  // derive subkeys from master key
+  if (crypto_kdf_derive_from_key(subKey, sizeof subKey, 1, "INDEX___", key)) {
+    return -1;
+  }
+  return crypto_kdf_derive_from_key(contentKey, sizeof contentKey, 1,
+                                    "CONTENT_", key);
 }
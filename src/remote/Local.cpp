@@ -0,0 +1,313 @@
+#include <encloned/Encryption.hpp>
+#include <encloned/remote/Local.hpp>
+
+#include <algorithm>
+
+namespace {
+
+void copyStream(std::istream& in, std::ostream& out) {
+  char buf[64 * 1024];
+  while (in.read(buf, sizeof buf) || in.gcount() > 0) {
+    out.write(buf, in.gcount());
+  }
+}
+
+}  // namespace
+
+// parts are written to a directory of their own, named by number, and
+// joined by complete
+class Local::MultipartUpload : public Backend::Upload {
+ public:
+  MultipartUpload(Local* local, const fs::path& path, const fs::path& directory)
+      : local(local), path(path), directory(directory) {}
+
+  string id() const override { return directory.filename().string(); }
+
+  std::vector<std::pair<int, string>> parts() override {
+    std::vector<std::pair<int, string>> stored;
+    std::error_code ec;
+    for (auto it = fs::directory_iterator(directory, ec);
+         !ec && it != fs::directory_iterator(); it.increment(ec)) {
+      string name = it->path().filename().string();
+      if (!name.empty() && std::all_of(name.begin(), name.end(), ::isdigit)) {
+        stored.emplace_back(std::stoi(name), etag(it->path()));
+      }
+    }
+    if (ec) {
+      std::ostringstream error;
+      error << "Local: Unable to list parts of the upload of "
+            << path.filename().string() << " (" << ec.message() << ")"
+            << endl;
+      throw RemoteError(error.str(), fs::exists(directory));
+    }
+    return stored;
+  }
+
+  string putPart(int number, std::shared_ptr<std::iostream> body) override {
+    return local->write(directory / std::to_string(number), *body);
+  }
+
+  string complete(
+      const std::vector<std::pair<int, string>>& completed) override {
+    std::vector<int> numbers;
+    for (const auto& [number, etag] : completed) {
+      numbers.push_back(number);
+    }
+    std::sort(numbers.begin(), numbers.end());
+    std::ostringstream error;
+    fs::path partial = directory / "complete";
+    {
+      std::ofstream file(partial, std::ios::binary | std::ios::trunc);
+      for (int number : numbers) {
+        std::ifstream part(directory / std::to_string(number),
+                           std::ios::binary);
+        if (!part.is_open()) {
+          error << "Local: Unable to complete upload of "
+                << path.filename().string() << " - part " << number
+                << " is missing" << endl;
+          throw RemoteError(error.str(), false);
+        }
+        copyStream(part, file);
+      }
+      file.close();
+      if (!file) {
+        error << "Local: Unable to complete upload of "
+              << path.filename().string() << " - write failed" << endl;
+        throw RemoteError(error.str(), true);
+      }
+    }
+    std::error_code ec;
+    fs::rename(partial, path, ec);
+    if (ec) {
+      error << "Local: Unable to complete upload of "
+            << path.filename().string() << " (" << ec.message() << ")"
+            << endl;
+      throw RemoteError(error.str(), true);
+    }
+    abort();  // the parts are no longer needed
+    return etag(path);
+  }
+
+  void abort() override {
+    std::error_code ec;
+    fs::remove_all(directory, ec);
+  }
+
+ private:
+  Local* local;
+  fs::path path;
+  fs::path directory;
+};
+
+Local::Local(const string& root, RateLimiter* uploadLimit,
+             RateLimiter* downloadLimit) {
+  this->root = root;
+  this->uploadLimit = uploadLimit;
+  this->downloadLimit = downloadLimit;
+  staging = this->root / ".uploads";
+  std::error_code ec;
+  fs::create_directories(staging, ec);
+  if (ec) {
+    cout << "Local: Unable to create " << staging << " (" << ec.message()
+         << ")" << endl;
+  }
+  // files left by an earlier run were being written when it stopped - the
+  // directories of unfinished uploads are kept, to be resumed or aborted
+  for (auto it = fs::directory_iterator(staging, ec);
+       !ec && it != fs::directory_iterator(); it.increment(ec)) {
+    std::error_code fileEc;
+    if (!it->is_directory(fileEc)) {
+      fs::remove(it->path(), fileEc);
+    }
+  }
+}
+
+string Local::name() const { return "local directory " + root.string(); }
+
+string Local::write(const fs::path& path, std::istream& body) {
+  fs::path partial = staging / Encryption::hashPath("partial");
+  std::ostringstream error;
+  {
+    std::ofstream file(partial, std::ios::binary | std::ios::trunc);
+    LimitedSink limited(file.rdbuf(), uploadLimit);
+    std::ostream out(&limited);
+    copyStream(body, out);
+    file.close();
+    if (!file || !out || body.bad()) {
+      std::error_code ec;
+      fs::remove(partial, ec);
+      error << "Local: Upload of " << path.filename().string()
+            << " failed - unable to write " << partial << endl;
+      throw RemoteError(error.str(), true);
+    }
+  }
+  std::error_code ec;
+  fs::rename(partial, path, ec);
+  if (ec) {
+    error << "Local: Upload of " << path.filename().string() << " failed ("
+          << ec.message() << ")" << endl;
+    fs::remove(partial, ec);
+    throw RemoteError(error.str(), true);
+  }
+  return etag(path);
+}
+
+string Local::etag(const fs::path& path) {
+  std::error_code ec;
+  uint64_t size = fs::file_size(path, ec);
+  auto modified = fs::last_write_time(path, ec).time_since_epoch().count();
+  std::ostringstream tag;
+  tag << "\"" << std::hex << size << "-" << modified << "\"";
+  return tag.str();
+}
+
+string Local::put(const string& objectName,
+                  std::shared_ptr<std::iostream> body) {
+  return write(root / objectName, *body);
+}
+
+std::unique_ptr<Backend::Upload> Local::startUpload(const string& objectName) {
+  fs::path directory = staging / Encryption::hashPath("upload");
+  std::error_code ec;
+  fs::create_directory(directory, ec);
+  if (!ec) {
+    std::ofstream name(directory / NAME_FILE, std::ios::trunc);
+    name << objectName;
+    name.close();
+    if (!name) {
+      ec = std::make_error_code(std::errc::io_error);
+    }
+  }
+  if (ec) {
+    std::ostringstream error;
+    error << "Local: Unable to start upload of " << objectName << " ("
+          << ec.message() << ")" << endl;
+    fs::remove_all(directory, ec);
+    throw RemoteError(error.str(), true);
+  }
+  return std::make_unique<MultipartUpload>(this, root / objectName,
+                                           directory);
+}
+
+std::unique_ptr<Backend::Upload> Local::resumeUpload(const string& objectName,
+                                                     const string& id) {
+  if (id.empty() || fs::path(id).filename() != id) {
+    std::ostringstream error;
+    error << "Local: Unable to resume upload of " << objectName
+          << " - invalid id " << id << endl;
+    throw RemoteError(error.str(), false);
+  }
+  return std::make_unique<MultipartUpload>(this, root / objectName,
+                                           staging / id);
+}
+
+std::vector<Backend::PendingUpload> Local::listUploads() {
+  std::vector<PendingUpload> uploads;
+  std::error_code ec;
+  for (auto it = fs::directory_iterator(staging, ec);
+       !ec && it != fs::directory_iterator(); it.increment(ec)) {
+    std::error_code fileEc;
+    if (!it->is_directory(fileEc)) {
+      continue;
+    }
+    std::ifstream name(it->path() / NAME_FILE);
+    string objectName;
+    auto modified = fs::last_write_time(it->path() / NAME_FILE, fileEc);
+    if (!std::getline(name, objectName) || fileEc) {
+      continue;  // completed or aborted while it was listed
+    }
+    auto systime = std::chrono::file_clock::to_sys(modified);
+    uploads.push_back({objectName, it->path().filename().string(),
+                       std::chrono::system_clock::to_time_t(systime)});
+  }
+  if (ec) {
+    std::ostringstream error;
+    error << "Local: listUploads error: " << ec.message() << endl;
+    throw RemoteError(error.str(), true);
+  }
+  return uploads;
+}
+
+void Local::get(const string& objectName,
+                const std::function<std::streambuf*()>& sink,
+                const Range* range) {
+  std::ifstream file(root / objectName, std::ios::binary);
+  if (!file.is_open()) {
+    std::ostringstream error;
+    error << "Local: Download of " << objectName
+          << " failed - no such object in " << root << endl;
+    throw RemoteError(error.str(), false);
+  }
+  uint64_t remaining = UINT64_MAX;
+  if (range != NULL) {
+    file.seekg(range->offset);
+    remaining = range->length;
+  }
+  LimitedSink out(sink(), downloadLimit);
+  char buf[64 * 1024];
+  while (remaining > 0 &&
+         (file.read(buf, std::min((uint64_t)sizeof buf, remaining)) ||
+          file.gcount() > 0)) {
+    std::streamsize len = file.gcount();
+    if (out.sputn(buf, len) != len) {
+      break;  // e.g. failed to decrypt - reported by the owner of the sink
+    }
+    remaining -= len;
+  }
+  if (file.bad()) {
+    std::ostringstream error;
+    error << "Local: Download of " << objectName << " failed - read error"
+          << endl;
+    throw RemoteError(error.str(), true);
+  }
+}
+
+bool Local::list(const string& after, const string& upTo,
+                 std::vector<RemoteObject>& objects, size_t /*maxPages*/) {
+  std::vector<RemoteObject> listed;
+  std::error_code ec;
+  for (auto it = fs::directory_iterator(root, ec);
+       !ec && it != fs::directory_iterator(); it.increment(ec)) {
+    string name = it->path().filename().string();
+    std::error_code fileEc;
+    if (name.empty() || name[0] == '.' || !it->is_regular_file(fileEc) ||
+        name <= after || (!upTo.empty() && name > upTo)) {
+      continue;
+    }
+    uint64_t size = fs::file_size(it->path(), fileEc);
+    auto modified = fs::last_write_time(it->path(), fileEc);
+    if (fileEc) {
+      continue;  // deleted while it was listed
+    }
+    auto systime = std::chrono::file_clock::to_sys(modified);
+    listed.push_back({name, size, etag(it->path()),
+                      std::chrono::system_clock::to_time_t(systime)});
+  }
+  if (ec) {
+    std::ostringstream error;
+    error << "Local: listObjects error: " << ec.message() << endl;
+    throw RemoteError(error.str(), true);
+  }
+  std::sort(listed.begin(), listed.end(),
+            [](const RemoteObject& a, const RemoteObject& b) {
+              return a.name < b.name;
+            });
+  objects.insert(objects.end(), listed.begin(), listed.end());
+  return true;
+}
+
+std::vector<std::pair<string, RemoteError>> Local::remove(
+    const std::vector<string>& objectNames) {
+  std::vector<std::pair<string, RemoteError>> failed;
+  for (const auto& objectName : objectNames) {
+    std::error_code ec;
+    fs::remove(root / objectName, ec);
+    if (ec) {
+      std::ostringstream error;
+      error << "Local: Delete of " << objectName << " failed ("
+            << ec.message() << ")" << endl;
+      failed.emplace_back(objectName, RemoteError(error.str(), true));
+    }
+  }
+  return failed;
+}
@@ -0,0 +1,203 @@
+#include <encloned/remote/RateLimiter.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <ctime>
+#include <sstream>
+
+void RateLimiter::configure(uint64_t limit,
+                            const std::vector<Window>& schedule) {
+  std::scoped_lock<std::mutex> guard(mtx);
+  this->limit = limit;
+  this->schedule = schedule;
+  rateChecked = {};  // applies from the next slice
+  changed.notify_all();
+}
+
+void RateLimiter::setOverride(std::optional<uint64_t> rate) {
+  std::scoped_lock<std::mutex> guard(mtx);
+  override = rate;
+  rateChecked = {};
+  changed.notify_all();
+}
+
+uint64_t RateLimiter::currentRate() {
+  std::scoped_lock<std::mutex> guard(mtx);
+  return scheduledRate();
+}
+
+string RateLimiter::describe() {
+  std::scoped_lock<std::mutex> guard(mtx);
+  std::ostringstream ss;
+  ss << "Transfer: " << direction << " limit " << formatRate(scheduledRate());
+  if (override) {
+    ss << " - set live" << std::endl;
+    return ss.str();
+  }
+  ss << " - " << direction << "_limit " << formatRate(limit);
+  for (const Window& window : schedule) {
+    char times[32];
+    snprintf(times, sizeof times, "%02d:%02d-%02d:%02d", window.start / 60,
+             window.start % 60, window.end / 60, window.end % 60);
+    ss << ", " << times << " " << formatRate(window.rate);
+  }
+  ss << std::endl;
+  return ss.str();
+}
+
+void RateLimiter::acquire(size_t bytes) {
+  std::unique_lock<std::mutex> lock(mtx);
+  for (;;) {
+    refill();
+    if (rate == 0) {
+      return;
+    }
+    // a request larger than the bucket waits for a full bucket
+    double needed = std::min((double)bytes, burst());
+    if (tokens >= needed) {
+      tokens -= bytes;
+      return;
+    }
+    // woken early if the rate is changed
+    changed.wait_for(lock,
+                     std::chrono::duration<double>((needed - tokens) / rate));
+  }
+}
+
+uint64_t RateLimiter::scheduledRate() {
+  if (override) {
+    return *override;
+  }
+  if (schedule.empty()) {
+    return limit;
+  }
+  std::time_t now = std::time(nullptr);
+  std::tm local;
+  localtime_r(&now, &local);
+  int minute = local.tm_hour * 60 + local.tm_min;
+  for (const Window& window : schedule) {
+    bool inside = window.start <= window.end
+                      ? minute >= window.start && minute < window.end
+                      : minute >= window.start || minute < window.end;
+    if (inside) {
+      return window.rate;
+    }
+  }
+  return limit;
+}
+
+void RateLimiter::refill() {
+  auto now = std::chrono::steady_clock::now();
+  if (now - rateChecked >= std::chrono::seconds(1)) {
+    rate = scheduledRate();
+    rateChecked = now;
+  }
+  if (rate == 0) {
+    tokens = 0;
+  } else {
+    double elapsed = std::chrono::duration<double>(now - refilled).count();
+    tokens = std::min(burst(), tokens + elapsed * rate);
+  }
+  refilled = now;
+}
+
+double RateLimiter::burst() const {
+  // a quarter of a second at the full rate
+  return std::max((double)SLICE, rate / 4.0);
+}
+
+bool RateLimiter::parseSchedule(const string& s,
+                                std::vector<Window>& schedule) {
+  std::vector<Window> parsed;
+  std::stringstream ss(s);
+  string item;
+  while (std::getline(ss, item, ',')) {
+    int startHour, startMinute, endHour, endMinute, ratePos = 0;
+    if (sscanf(item.c_str(), " %d:%d-%d:%d=%n", &startHour, &startMinute,
+               &endHour, &endMinute, &ratePos) != 4 ||
+        ratePos == 0) {
+      return false;
+    }
+    Window window{startHour * 60 + startMinute, endHour * 60 + endMinute, 0};
+    if (startHour < 0 || startHour > 23 || startMinute < 0 ||
+        startMinute > 59 || endHour < 0 || endMinute < 0 || endMinute > 59 ||
+        window.end > 24 * 60 || window.start == window.end ||
+        !parseRate(item.substr(ratePos), window.rate)) {
+      return false;
+    }
+    parsed.push_back(window);
+  }
+  schedule = parsed;
+  return true;
+}
+
+bool RateLimiter::parseRate(const string& s, uint64_t& rate) {
+  auto first = s.find_first_not_of(" \t");
+  auto last = s.find_last_not_of(" \t");
+  if (first == string::npos || !isdigit(s[first])) {
+    return false;
+  }
+  string value = s.substr(first, last - first + 1);
+  size_t end;
+  try {
+    rate = std::stoull(value, &end);
+  } catch (const std::exception& e) {
+    return false;
+  }
+  if (end == value.size()) {
+    return true;
+  }
+  if (end + 1 != value.size()) {
+    return false;
+  }
+  switch (toupper(value[end])) {
+    case 'G':
+      rate *= 1024;
+      [[fallthrough]];
+    case 'M':
+      rate *= 1024;
+      [[fallthrough]];
+    case 'K':
+      rate *= 1024;
+      return true;
+    default:
+      return false;
+  }
+}
+
+string RateLimiter::formatRate(uint64_t rate) {
+  if (rate == 0) {
+    return "unlimited";
+  }
+  const char* suffix[] = {"", "K", "M", "G"};
+  int i = 0;
+  while (i < 3 && rate % 1024 == 0) {
+    rate /= 1024;
+    i++;
+  }
+  return std::to_string(rate) + suffix[i] + "/s";
+}
+
+std::streamsize LimitedSink::xsputn(const char* s, std::streamsize n) {
+  std::streamsize written = 0;
+  while (written < n) {
+    std::streamsize len =
+        std::min((std::streamsize)RateLimiter::SLICE, n - written);
+    limiter->acquire(len);
+    std::streamsize put = target->sputn(s + written, len);
+    written += put;
+    if (put < len) {
+      break;  // e.g. failed to decrypt - reported by the owner of target
+    }
+  }
+  return written;
+}
+
+LimitedSink::int_type LimitedSink::overflow(int_type c) {
+  if (traits_type::eq_int_type(c, traits_type::eof())) {
+    return traits_type::not_eof(c);
+  }
+  limiter->acquire(1);
+  return target->sputc(traits_type::to_char_type(c));
+}
@@ -3,7 +3,7 @@
 Remote::Remote(std::atomic_bool* runThreads, encloned* daemon) {
   this->runThreads = runThreads;
   this->daemon = daemon;
-  s3 = std::make_shared<S3>(runThreads, this);
+  transfer = std::make_shared<Transfer>(runThreads, this);
 }
 
 void Remote::setPtr(std::shared_ptr<Watch> watch) { this->watch = watch; }
@@ -13,7 +13,9 @@ void Remote::execThread() {
     std::this_thread::sleep_for(std::chrono::seconds(5));
     // cout << "Remote: Calling Remote cloud storage..." << endl; cout.flush();
     uploadRemotes();
+    retryDownloads();
     deleteRemotes();
+    refreshRemotes();
   }
 }
 
@@ -23,72 +25,89 @@ std::shared_ptr<Watch> Remote::getWatch() { return watch; }
 
 void Remote::uploadRemotes() {
   std::scoped_lock<std::mutex> guard(mtx);
-  s3->callAPI("upload");
+  transfer->upload();
 }
 
 string Remote::downloadRemotes() {
   std::scoped_lock<std::mutex> guard(mtx);
-  return s3->callAPI("download");
+  return transfer->download();
+}
+
+void Remote::retryDownloads() {
+  std::scoped_lock<std::mutex> guard(mtx);
+  transfer->download(true);
 }
 
 void Remote::deleteRemotes() {
   std::scoped_lock<std::mutex> guard(mtx);
-  s3->callAPI("delete");
+  transfer->remove();
+}
+
+void Remote::refreshRemotes() {
+  std::scoped_lock<std::mutex> guard(mtx);
+  try {
+    transfer->refresh();
+  } catch (const std::exception& e) {
+    cout << "Remote: unable to refresh remote inventory - " << e.what()
+         << endl;
+  }
 }
 
 bool Remote::queueForUpload(std::string path, std::string objectName,
                             std::time_t modtime) {
   std::scoped_lock<std::mutex> guard(mtx);
   // call remotes
-  return s3->enqueueUpload(path, objectName, modtime);
+  return transfer->enqueueUpload(path, objectName, modtime);
 }
 
 bool Remote::queueForDownload(std::string path, std::string objectName,
                               std::time_t modtime, string targetPath) {
   std::scoped_lock<std::mutex> guard(mtx);
   // call remotes
-  return s3->enqueueDownload(path, objectName, modtime, targetPath);
+  return transfer->enqueueDownload(path, objectName, modtime, targetPath);
 }
 
 bool Remote::queueForDelete(std::string objectName) {
   std::scoped_lock<std::mutex> guard(mtx);
 
   // call remotes
-  return s3->enqueueDelete(objectName);
+  return transfer->enqueueDelete(objectName);
 }
 
 void Remote::uploadSuccess(
-    std::string path, std::string objectName,
-    int remoteID) {  // update fileIndex if upload to remote is succesful
-  watch->uploadSuccess(path, objectName, remoteID);
+    std::string path, std::string objectName, int remoteID,
+    std::string fileHash) {  // update fileIndex if upload to remote is succesful
+  watch->uploadSuccess(path, objectName, remoteID, fileHash);
 }
 
 string Remote::uploadNow(string path, string pathHash) {
-  return s3->callAPI("uploadNow|" + path + "|" + pathHash);
+  return transfer->uploadNow(path, pathHash);
 }
 
+void Remote::cleanUpUploads() { transfer->cleanUpUploads(); }
+
 string Remote::downloadNow(string pathHash, string target) {
-  return s3->callAPI("downloadNow|" + pathHash + "|" + target);
+  return transfer->downloadNow(pathHash, target);
 }
 
-string Remote::listObjects() {
+string Remote::listObjects(bool refresh) {
   std::scoped_lock<std::mutex> guard(mtx);
-  std::vector<string> objects;
+  std::vector<RemoteObject> objects;
   try {
-    objects = s3->getObjects();
+    objects = transfer->getObjects(refresh);
     if (objects.empty()) {
-      return "Remote: no files on remote S3 bucket\n";
+      return "Remote: no files on remote\n";
     }
   } catch (const std::exception& e) {
     return e.what();
   }
   std::ostringstream ss;
   int untrackedCount = 0;
-  for (string pathHash : objects) {
+  for (const auto& object : objects) {
     try {
-      auto pair = watch->resolvePathHash(pathHash);
+      auto pair = watch->resolvePathHash(object.name);
       ss << pair.first << " : " << watch->displayTime(pair.second) << " : "
-         << pathHash << endl;
+         << object.name << endl;
     } catch (std::out_of_range& error) {  // unable to resolve
       untrackedCount++;
       continue;
@@ -104,23 +123,46 @@ string Remote::listObjects() {
     ss << "+ " << untrackedCount
        << " files untracked by index (--clean to remove)" << endl;
   }
+  ss << "Remote: last listed " << watch->displayTime(watch->inventoryListedAt())
+     << " (--list refresh to list again)" << endl;
 
   return ss.str();
 }
 
-std::vector<string> Remote::getObjects() { return s3->getObjects(); }
+std::vector<RemoteObject> Remote::getObjects() {
+  return transfer->getObjects();
+}
 
 std::unordered_map<string, string> Remote::getObjectMap() {
-  return s3->getObjectMap();
+  return transfer->getObjectMap();
+}
+
+string Remote::failedItems(bool retry) {
+  std::scoped_lock<std::mutex> guard(mtx);
+  return transfer->failedItems(retry);
+}
+
+string Remote::stats(bool reset) {
+  // not serialised with the queues, so it answers during a long pass
+  string report = daemon->getStats()->report();
+  if (reset) {
+    daemon->getStats()->reset();
+  }
+  return report;
+}
+
+string Remote::limit(const string& direction, const string& rate) {
+  // not serialised with the queues either - applies to transfers in flight
+  return transfer->limit(direction, rate);
 }
 
 string Remote::cleanRemote() {
   mtx.lock();
-  std::vector<string> objects;
+  std::vector<RemoteObject> objects;
   try {
-    objects = s3->getObjects();
+    objects = transfer->getObjects();
     if (objects.empty()) {
-      return "Remote: no files on remote S3 bucket\n";
+      return "Remote: no files on remote\n";
     }
   } catch (const std::exception& e) {
     return e.what();
@@ -129,12 +171,12 @@ string Remote::cleanRemote() {
   std::ostringstream ss;
   string outputPrefix = "No matches found for the following remote objects: \n";
   ss << outputPrefix;
-  for (string pathHash : objects) {
+  for (const auto& object : objects) {
     try {
-      auto pair = watch->resolvePathHash(pathHash);
+      auto pair = watch->resolvePathHash(object.name);
     } catch (std::out_of_range& error) {  // unable to resolve
-      queueForDelete(pathHash);
-      ss << pathHash << " queued for deletion" << endl;
+      queueForDelete(object.name);
+      ss << object.name << " queued for deletion" << endl;
     }
   }
   if (ss.str().size() == outputPrefix.size()) {
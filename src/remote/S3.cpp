@@ -1,596 +1,344 @@
 #include <encloned/remote/S3.hpp>
 
-// example API calls -
-// https://docs.aws.amazon.com/sdk-for-cpp/v1/developer-guide/examples-s3-objects.html
-
-S3::S3(std::atomic_bool* runThreads, Remote* remote) {
-  this->remote = remote;
-  this->runThreads = runThreads;
-  this->daemon = remote->getDaemon();
-  // S3 logging options
-  options.loggingOptions.logLevel = Aws::Utils::Logging::LogLevel::Info;
-  options.loggingOptions.defaultLogPrefix = "log/aws_sdk_";
-}
-
-S3::~S3() {}
-
-void S3::execThread() {
-  while (*runThreads) {
-    cout << "S3: Calling S3 API..." << endl;
-    cout.flush();
-    // callAPI("transfer");
-    std::this_thread::sleep_for(std::chrono::seconds(10));
-  }
-}
-
-string S3::callAPI(string arg) {
-  if (arg == "upload" && uploadQueue.empty()) {
-    // cout << "S3: uploadQueue is empty" << endl;
-    return "";
-  }
-  if (arg == "download" && downloadQueue.empty()) {
-    // cout << "S3: downloadQueue is empty" << endl;
-    return "";
-  }
-  if (arg == "delete" && deleteQueue.empty()) {
-    // cout << "S3: deleteQueue is empty" << endl;
-    return "";
+#include <algorithm>
+
+namespace {
+
+// a RateLimiter charged by the SDK's HTTP client as bytes are written to or
+// read from the socket - charging bodies as they are read would let the
+// SDK's own reads (e.g. to sign them) take the tokens, and the request go
+// out at full speed
+class SocketLimit : public Aws::Utils::RateLimits::RateLimiterInterface {
+ public:
+  SocketLimit(RateLimiter* limiter) : limiter(limiter) {}
+
+  // blocks rather than returning a delay - the SDK's HTTP clients only call
+  // ApplyAndPayForCost
+  DelayType ApplyCost(int64_t cost) override {
+    while (cost > 0) {
+      size_t bytes = std::min<int64_t>(cost, RateLimiter::SLICE);
+      limiter->acquire(bytes);
+      cost -= bytes;
+    }
+    return DelayType(0);
   }
-  string response;
-  Aws::InitAPI(options);
-  {
-    std::shared_ptr<Aws::S3::S3Client> s3_client =
-        Aws::MakeShared<Aws::S3::S3Client>("S3Client");
-    auto executor =
-        Aws::MakeShared<Aws::Utils::Threading::PooledThreadExecutor>("executor",
-                                                                     25);
-    Aws::Transfer::TransferManagerConfiguration transferConfig(executor.get());
-    transferConfig.s3Client = s3_client;
-    auto transferManager =
-        Aws::Transfer::TransferManager::Create(transferConfig);
-
-    if (arg == "upload") {
-      encryptionQueueTime = 0;
-      auto t1 = std::chrono::high_resolution_clock::now();
-      uploadFromQueue(transferManager);
-      auto t2 = std::chrono::high_resolution_clock::now();
-      auto duration =
-          std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1)
-              .count();
-      cout << "S3: uploadQueue encrypted in : " << encryptionQueueTime / 1000
-           << "ms" << endl;
-      cout << "S3: uploadFromQueue completed in " << duration / 1000 << "ms"
-           << endl;
-    } else if (arg.substr(0, 9) == "uploadNow") {
-      // split the arguments (path|pathHash)
-      auto delimPos = arg.find('|', 10);  // find second delimiter
-      string path = std::string(&arg[10], &arg[delimPos]);
-      string pathHash = arg.substr(delimPos + 1);
-      // cout << "DEBUG: path: " << path << " pathHash: " << pathHash << endl;
-      try {
-        uploadObject(transferManager, BUCKET_NAME, path, pathHash);
-      } catch (const std::exception& e) {
-        response == e.what();
+  void ApplyAndPayForCost(int64_t cost) override { ApplyCost(cost); }
+  // the rate is set by the limit, schedule and limit command instead
+  void SetRate(int64_t, bool) override {}
+
+ private:
+  RateLimiter* limiter;
+};
+
+}  // namespace
+
+// the parts of a multipart upload, put by one thread each
+class S3::MultipartUpload : public Backend::Upload {
+ public:
+  MultipartUpload(std::shared_ptr<Aws::S3::S3Client> s3Client,
+                  const Aws::String& bucketName, const Aws::String& objectName,
+                  const Aws::String& uploadId)
+      : s3Client(s3Client),
+        bucketName(bucketName),
+        objectName(objectName),
+        uploadId(uploadId) {}
+
+  string id() const override { return uploadId.c_str(); }
+
+  std::vector<std::pair<int, string>> parts() override {
+    std::vector<std::pair<int, string>> stored;
+    Aws::S3::Model::ListPartsRequest request;
+    request.WithBucket(bucketName).WithKey(objectName).WithUploadId(uploadId);
+    for (;;) {
+      auto outcome = s3Client->ListParts(request);
+      if (!outcome.IsSuccess()) {
+        // NoSuchUpload once completed or aborted, e.g. by a lifecycle rule
+        std::ostringstream error;
+        error << "S3: Unable to list parts of the upload of " << objectName
+              << " (" << outcome.GetError().GetMessage() << ")" << endl;
+        throw RemoteError(error.str(), retryable(outcome.GetError()));
       }
-    } else if (arg == "download") {
-      decryptionQueueTime = 0;
-      auto t1 = std::chrono::high_resolution_clock::now();
-      response = downloadFromQueue(transferManager);
-      auto t2 = std::chrono::high_resolution_clock::now();
-      auto duration =
-          std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1)
-              .count();
-      cout << "S3: downloadQueue decrypted in : " << decryptionQueueTime / 1000
-           << "ms" << endl;
-      cout << "S3: downloadFromQueue completed in " << duration / 100 << "ms"
-           << endl;
-    } else if (arg.substr(0, 11) == "downloadNow") {
-      // split the arguments (pathHash|target)
-      auto delimPos = arg.find('|', 12);  // find second delimiter
-      string pathHash = std::string(&arg[12], &arg[delimPos]);
-      string target = arg.substr(delimPos + 1);
-      // cout << "DEBUG: pathHash: " << pathHash << " target: " << target <<
-      // endl; calling version of downloadObject that does not check file hash
-      // as this is used for index backup (no file hash stored)
-      try {
-        response =
-            downloadObject(transferManager, BUCKET_NAME, target, pathHash);
-      } catch (const std::exception& e) {
-        response = e.what();
+      const auto& result = outcome.GetResult();
+      for (const auto& part : result.GetParts()) {
+        stored.emplace_back(part.GetPartNumber(), part.GetETag().c_str());
       }
-    } else if (arg == "listObjects") {
-      try {
-        response = listObjects(s3_client);
-      } catch (const std::exception& e) {
-        throw;
+      if (!result.GetIsTruncated()) {
+        return stored;
       }
-    } else if (arg == "delete") {
-      response = deleteFromQueue(s3_client);
-    } else if (arg == "listBuckets") {
-      response = listBuckets(s3_client);
+      request.SetPartNumberMarker(result.GetNextPartNumberMarker());
     }
   }
-  Aws::ShutdownAPI(options);
-  return response;
-}
-
-void S3::uploadFromQueue(
-    std::shared_ptr<Aws::Transfer::TransferManager> transferManager) {
-  std::scoped_lock<std::mutex> guard(mtx);
-  if (uploadQueue.empty()) {
-    return;
-  }
-  for (auto item : uploadQueue) {
-    auto [path, pathHash, modtime] = item;  // get values out of the tuple
 
-    // check file still exists
-    if (!fs::exists(path)) {
-      std::stringstream error;
-      error << "S3: Error: File " << path << " no longer exists" << endl;
-      cout << error.str();
-      dequeueUpload();  // remove from queue
-      continue;         // go to the next item
+  string putPart(int number, std::shared_ptr<std::iostream> body) override {
+    Aws::S3::Model::UploadPartRequest request;
+    request.WithBucket(bucketName)
+        .WithKey(objectName)
+        .WithUploadId(uploadId)
+        .WithPartNumber(number);
+    request.SetBody(body);
+    auto outcome = s3Client->UploadPart(request);
+    if (!outcome.IsSuccess()) {
+      std::ostringstream error;
+      error << "S3: Upload of part " << number << " of " << objectName
+            << " failed (" << outcome.GetError().GetMessage() << ")" << endl;
+      throw RemoteError(error.str(), retryable(outcome.GetError()));
     }
+    return outcome.GetResult().GetETag().c_str();
+  }
 
-    // check that modtime for path is still valid - file may have changed since
-    // added to uploadQueue, or no longer exist
-    try {
-      auto fstime = fs::last_write_time(path);  // get modtime from file
-      auto systime = std::chrono::file_clock::to_sys(fstime);
-      time_t currentModtime = std::chrono::system_clock::to_time_t(systime);
-      if (modtime != currentModtime) {
-        std::stringstream error;
-        error << "S3: Error: File " << path
-              << " has changed - unable to upload version with hash "
-              << pathHash << endl;
-        cout << error.str();
-        dequeueUpload();  // remove from queue
-        continue;         // go to the next item
-      }
-    } catch (const std::exception& ex) {
-      cout << ex.what() << endl;
+  string complete(const std::vector<std::pair<int, string>>& parts) override {
+    Aws::S3::Model::CompletedMultipartUpload completedUpload;
+    for (const auto& [number, etag] : parts) {
+      completedUpload.AddParts(Aws::S3::Model::CompletedPart()
+                                   .WithETag(Aws::String(etag.c_str()))
+                                   .WithPartNumber(number));
     }
-
-    try {
-      uploadObject(transferManager, BUCKET_NAME, path, pathHash);
-    } catch (const std::exception& e) {
-      continue;  // go to the next item, but do not remove failed item from
-                 // queue
+    Aws::S3::Model::CompleteMultipartUploadRequest request;
+    request.WithBucket(bucketName)
+        .WithKey(objectName)
+        .WithUploadId(uploadId)
+        .WithMultipartUpload(completedUpload);
+    auto outcome = s3Client->CompleteMultipartUpload(request);
+    if (!outcome.IsSuccess()) {
+      std::ostringstream error;
+      error << "S3: Unable to complete multipart upload of " << objectName
+            << " (" << outcome.GetError().GetMessage() << ")" << endl;
+      throw RemoteError(error.str(), retryable(outcome.GetError()));
     }
-    dequeueUpload();  // if success, pop the object from the front of the queue
+    return outcome.GetResult().GetETag().c_str();
   }
-  // cout << "S3: uploadQueue is empty" << endl; cout.flush();
-}
 
-string S3::downloadFromQueue(
-    std::shared_ptr<Aws::Transfer::TransferManager> transferManager) {
-  std::ostringstream ss;
-  std::scoped_lock<std::mutex> guard(mtx);
-  if (!downloadQueue.empty()) {
-    for (auto item : downloadQueue) {
-      auto [path, objectName, modtime, targetPath] = item;
-      try {
-        ss << downloadObject(transferManager, BUCKET_NAME, path, objectName,
-                             modtime, targetPath);
-      } catch ( const std::exception& e) {
-        ss << e.what();
-      }
-      dequeueDownload();  // pop the object from the front of the queue whether
-                          // failed or not - we should manually retry
-    }
-    cout << "S3: downloadFromQueue complete" << endl;
-    cout.flush();
-  } else {
-    ss << "S3: downloadQueue is empty" << endl;
-    cout.flush();
+  void abort() override {
+    // do not leave orphaned parts on the remote, they are billed as storage
+    Aws::S3::Model::AbortMultipartUploadRequest request;
+    request.WithBucket(bucketName).WithKey(objectName).WithUploadId(uploadId);
+    s3Client->AbortMultipartUpload(request);
   }
-  return ss.str();
-}
 
-string S3::deleteFromQueue(std::shared_ptr<Aws::S3::S3Client> s3_client) {
-  std::ostringstream ss;
-  std::scoped_lock<std::mutex> guard(mtx);
-  for (auto item : deleteQueue) {
-    Aws::String objectName(item);
-    try {
-      ss << deleteObject(s3_client, objectName, BUCKET_NAME);
-    } catch (const std::exception& e) {
-      ss << e.what();
-      continue;  // go to the next item, but do not remove failed item from
-                 // queue
-    }
-    dequeueDelete();  // if success, pop the object from the front of the queue
+ private:
+  std::shared_ptr<Aws::S3::S3Client> s3Client;
+  Aws::String bucketName;
+  Aws::String objectName;
+  Aws::String uploadId;
+};
+
+S3::S3(size_t transfers, RateLimiter* uploadLimit, RateLimiter* downloadLimit,
+       const string& bucketName, const string& endpoint) {
+  this->bucketName = Aws::String(bucketName.c_str());
+  this->endpoint = endpoint;
+  // S3 logging options
+  options.loggingOptions.logLevel = Aws::Utils::Logging::LogLevel::Info;
+  options.loggingOptions.defaultLogPrefix = "log/aws_sdk_";
+  // initialised once for the lifetime of the daemon, rather than for every
+  // call, see the client below
+  Aws::InitAPI(options);
+
+  // the client keeps its connections open between calls, enough for the
+  // parts or chunks in flight of every concurrent transfer
+  Aws::Client::ClientConfiguration clientConfig;
+  clientConfig.maxConnections = (transfers + 1) * MAX_PARTS_IN_FLIGHT;
+  clientConfig.writeRateLimiter = std::make_shared<SocketLimit>(uploadLimit);
+  clientConfig.readRateLimiter = std::make_shared<SocketLimit>(downloadLimit);
+  if (endpoint.empty()) {
+    s3Client = Aws::MakeShared<Aws::S3::S3Client>("S3Client", clientConfig);
+    return;
   }
-  cout << ss.str();
-  cout.flush();
-  return ss.str();
+  string host = endpoint;
+  if (host.rfind("http://", 0) == 0) {
+    clientConfig.scheme = Aws::Http::Scheme::HTTP;
+    host = host.substr(7);
+  } else if (host.rfind("https://", 0) == 0) {
+    host = host.substr(8);
+  }
+  clientConfig.endpointOverride = Aws::String(host.c_str());
+  s3Client = Aws::MakeShared<Aws::S3::S3Client>(
+      "S3Client", clientConfig,
+      Aws::Client::AWSAuthV4Signer::PayloadSigningPolicy::Never,
+      false);  // path-style - endpoint/bucket/key
 }
 
-bool S3::listBuckets(std::shared_ptr<Aws::S3::S3Client> s3_client) {
-  auto outcome = s3_client->ListBuckets();
-  if (outcome.IsSuccess()) {
-    std::cout << "S3: List of available buckets:" << std::endl;
+S3::~S3() {
+  s3Client.reset();  // before the SDK it was created with
+  Aws::ShutdownAPI(options);
+}
 
-    Aws::Vector<Aws::S3::Model::Bucket> bucket_list =
-        outcome.GetResult().GetBuckets();
+string S3::name() const {
+  string name = string("S3 bucket ") + bucketName.c_str();
+  return endpoint.empty() ? name : name + " at " + endpoint;
+}
 
-    for (auto const& bucket : bucket_list) {
-      std::cout << bucket.GetName() << std::endl;
-    }
-    return true;
-  } else {
-    std::cout << "S3: listBuckets error: "
-              << outcome.GetError().GetExceptionName() << std::endl
-              << outcome.GetError().GetMessage() << std::endl;
-    return false;
+string S3::put(const string& objectName, std::shared_ptr<std::iostream> body) {
+  Aws::S3::Model::PutObjectRequest request;
+  request.SetBucket(bucketName);
+  request.SetKey(Aws::String(objectName.c_str()));
+  request.SetBody(body);
+  auto outcome = s3Client->PutObject(request);
+  if (!outcome.IsSuccess()) {
+    std::ostringstream error;
+    error << "S3: Upload of " << objectName << " failed ("
+          << outcome.GetError().GetExceptionName() << ": "
+          << outcome.GetError().GetMessage() << ")" << endl;
+    throw RemoteError(error.str(), retryable(outcome.GetError()));
   }
+  return outcome.GetResult().GetETag().c_str();
 }
 
-string S3::listObjects(std::shared_ptr<Aws::S3::S3Client> s3_client) {
-  std::ostringstream response;
-  Aws::S3::Model::ListObjectsRequest objects_request;
-  objects_request.WithBucket(BUCKET_NAME);
-
-  auto list_objects_outcome = s3_client->ListObjects(objects_request);
-
-  if (list_objects_outcome.IsSuccess()) {
-    remoteObjects.clear();
-    remoteObjectMap.clear();  // erase old remoteObjects vector/maps
-    Aws::Vector<Aws::S3::Model::Object> object_list =
-        list_objects_outcome.GetResult().GetContents();
-    if (object_list.empty()) {
-      response << "S3: bucket " << BUCKET_NAME << " is empty" << std::endl;
-    } else {
-      response << "S3: Files on S3 bucket " << BUCKET_NAME << ":" << std::endl;
-      for (auto const& s3_object : object_list) {
-        const char customTimeFormat[] =
-            "%dd-%MM-%y %H:%m";  // TODO: does not work - need to figure out how
-                                 // to format this, then put as param to
-                                 // ToLocalTimeString()
-        auto modtime = s3_object.GetLastModified().ToLocalTimeString(
-            Aws::Utils::DateFormat::RFC822);
-        response << s3_object.GetKey() << " : " << modtime << std::endl;
-        remoteObjects.push_back(s3_object.GetKey().c_str());
-        remoteObjectMap.emplace(s3_object.GetKey().c_str(), modtime);
-      }
-    }
-  } else {
-    response << "S3: listObjects error: "
-             << list_objects_outcome.GetError().GetExceptionName() << " "
-             << list_objects_outcome.GetError().GetMessage() << std::endl;
-    throw std::runtime_error(
-        list_objects_outcome.GetError().GetMessage().c_str());
+std::unique_ptr<Backend::Upload> S3::startUpload(const string& objectName) {
+  Aws::String key(objectName.c_str());
+  Aws::S3::Model::CreateMultipartUploadRequest request;
+  request.WithBucket(bucketName).WithKey(key);
+  auto outcome = s3Client->CreateMultipartUpload(request);
+  if (!outcome.IsSuccess()) {
+    std::ostringstream error;
+    error << "S3: Unable to start multipart upload of " << objectName << " ("
+          << outcome.GetError().GetMessage() << ")" << endl;
+    throw RemoteError(error.str(), retryable(outcome.GetError()));
   }
-  cout << response.str();
-  return response.str();
+  return std::make_unique<MultipartUpload>(s3Client, bucketName, key,
+                                           outcome.GetResult().GetUploadId());
 }
 
-std::vector<string> S3::getObjects() {
-  try {
-    // populate remoteObjects vector by calling listObjects via API
-    callAPI("listObjects");
-  } catch (const std::exception& e) {
-    throw;
-  }
-  return remoteObjects;
+std::unique_ptr<Backend::Upload> S3::resumeUpload(const string& objectName,
+                                                  const string& id) {
+  return std::make_unique<MultipartUpload>(s3Client, bucketName,
+                                           Aws::String(objectName.c_str()),
+                                           Aws::String(id.c_str()));
 }
 
-std::unordered_map<string, string> S3::getObjectMap() {
-  try {
-    // populate remoteObjects vector by calling listObjects via API
-    callAPI("listObjects");
-  } catch (const std::exception& e) {
-    throw;
+std::vector<Backend::PendingUpload> S3::listUploads() {
+  std::vector<PendingUpload> uploads;
+  Aws::S3::Model::ListMultipartUploadsRequest request;
+  request.WithBucket(bucketName);
+  for (;;) {
+    auto outcome = s3Client->ListMultipartUploads(request);
+    if (!outcome.IsSuccess()) {
+      std::ostringstream error;
+      error << "S3: listMultipartUploads error: "
+            << outcome.GetError().GetExceptionName() << " "
+            << outcome.GetError().GetMessage() << endl;
+      throw RemoteError(error.str(), retryable(outcome.GetError()));
+    }
+    const auto& result = outcome.GetResult();
+    for (const auto& upload : result.GetUploads()) {
+      uploads.push_back({upload.GetKey().c_str(), upload.GetUploadId().c_str(),
+                         (std::time_t)upload.GetInitiated().Seconds()});
+    }
+    if (!result.GetIsTruncated()) {
+      return uploads;
+    }
+    request.SetKeyMarker(result.GetNextKeyMarker());
+    request.SetUploadIdMarker(result.GetNextUploadIdMarker());
   }
-  return remoteObjectMap;
 }
 
-bool S3::uploadObject(
-    std::shared_ptr<Aws::Transfer::TransferManager> transferManager,
-    const Aws::String& bucketName, const std::string& path,
-    const std::string& objectName) {
-  // encrypt file into temporary object
-  string localEncryptedPath = encloned::TEMP_FILE_LOCATION + objectName;
-  // cout << "localEncryptedPath: " << localEncryptedPath << endl;
-
-  // measure timing of file encryption
-  auto t1 = std::chrono::high_resolution_clock::now();
-  int result = Encryption::encryptFile(localEncryptedPath.c_str(), path.c_str(),
-                                       daemon->getKey());
-  auto t2 = std::chrono::high_resolution_clock::now();
-  auto duration =
-      std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
-  std::cout << "S3: encrypted " << path << " in " << duration << " microseconds"
-            << endl;
-  encryptionQueueTime += duration;
-
-  Aws::String awsPath(localEncryptedPath);
-  Aws::String awsObjectName(objectName);
+void S3::get(const string& objectName,
+             const std::function<std::streambuf*()>& sink,
+             const Range* range) {
+  Aws::S3::Model::GetObjectRequest request;
+  request.SetBucket(bucketName);
+  request.SetKey(Aws::String(objectName.c_str()));
+  if (range != NULL) {
+    request.SetRange(Aws::String(
+        ("bytes=" + std::to_string(range->offset) + "-" +
+         std::to_string(range->offset + range->length - 1))
+            .c_str()));
+  }
+  // the body is written to sink as it is received - the SDK calls the factory
+  // again if it retries the request
+  request.SetResponseStreamFactory(
+      [&sink]() { return Aws::New<Aws::IOStream>("S3", sink()); });
 
-  auto uploadHandle =
-      transferManager->UploadFile(awsPath, bucketName, awsObjectName, "",
-                                  Aws::Map<Aws::String, Aws::String>());
-  uploadHandle->WaitUntilFinished();
-  if (uploadHandle->GetStatus() == Aws::Transfer::TransferStatus::COMPLETED) {
-    cout << "S3: Upload of " << path << " as " << objectName << " successful"
-         << endl;
-    // verify upload expected length of data
-    assert(uploadHandle->GetBytesTotalSize() ==
-           uploadHandle ->GetBytesTransferred());
-    remote->uploadSuccess(path, objectName, remoteID);  // set remoteExists flag
-    // remove temporary encrypted object on local fs
-    fs::remove( localEncryptedPath);
-    return true;
-  } else {
+  auto outcome = s3Client->GetObject(request);
+  if (!outcome.IsSuccess()) {
     std::ostringstream error;
-    error << "S3: Upload of " << path << " as " << objectName
-          << " failed with status: " << uploadHandle->GetStatus() << " ("
-          << uploadHandle->GetLastError().GetMessage() << ")" << endl;
-    cout << error.str();
-    throw std::runtime_error(error.str());
+    error << "S3: Download of " << objectName << " failed with message: "
+          << outcome.GetError().GetExceptionName() << " ("
+          << outcome.GetError().GetMessage() << ")" << endl;
+    throw RemoteError(error.str(), retryable(outcome.GetError()));
   }
-  return false;
 }
 
-string S3::downloadObject(
-    std::shared_ptr<Aws::Transfer::TransferManager> transferManager,
-    const Aws::String& bucketName, const std::string& writeToPath,
-    const std::string& objectName, std::time_t& originalModTime,
-    std::string& targetPath) {
-  std::ostringstream ss;
-
-  // the directory we want to download to
-  if (targetPath.back() != '/') {
-    targetPath.append("/");
-  }  // ensure path is terminated by a trailing slash
-  string downloadDir = targetPath;
-
-  // split path into directory path and filename
-  std::size_t found = writeToPath.find_last_of("/");
-  string dirPath = downloadDir + writeToPath.substr(0, found + 1);
-  string fileName = writeToPath.substr(found + 1);
-  cout << "path is " << dirPath << ", fileName is " << fileName << endl;
-  string downloadPath = dirPath + fileName;
-
-  // need to create the full directory structure at path if it's doesn't already
-  // exist, or download will say successful but not save to disk
-  try {
-    fs::create_directories(dirPath);
-    cout << "Created directories for path: " << dirPath << endl;
-  } catch (std::exception& e) {
-    std::cout << e.what() << std::endl;
+bool S3::list(const string& after, const string& upTo,
+              std::vector<RemoteObject>& objects, size_t maxPages) {
+  Aws::S3::Model::ListObjectsV2Request request;
+  request.WithBucket(bucketName);
+  if (!after.empty()) {
+    request.SetStartAfter(Aws::String(after.c_str()));
   }
-
-  Aws::String awsObjectName(objectName);
-  // set temporary location
-  string localEncryptedPath = encloned::TEMP_FILE_LOCATION + fileName;
-  cout << "localEncryptedPath: " << localEncryptedPath << endl;
-  Aws::String awsWriteToFile(localEncryptedPath);
-
-  auto downloadHandle =
-      transferManager->DownloadFile(bucketName, awsObjectName, awsWriteToFile);
-  downloadHandle->WaitUntilFinished();
-  if (downloadHandle->GetStatus() == Aws::Transfer::TransferStatus::COMPLETED) {
-    if (downloadHandle->GetBytesTotalSize() ==
-        downloadHandle->GetBytesTransferred()) {
-      ss << "S3: Download of " << objectName.substr(0, 10) << "... to "
-         << awsWriteToFile << " successful" << endl;
-
-      // decrypt temporary file to download location and measure timing
-      auto t1 = std::chrono::high_resolution_clock::now();
-      int result = Encryption::decryptFile(
-          downloadPath.c_str(), localEncryptedPath.c_str(), daemon->getKey());
-      auto t2 = std::chrono::high_resolution_clock::now();
-      auto duration =
-          std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1)
-              .count();
-      decryptionQueueTime += duration;
-
-      if (result == 0) {
-        // verify hash
-        string downloadedFileHash = Encryption::hashFile(downloadPath);
-        ss << "S3: Decryption of " << objectName.substr(0, 10) << "... to "
-           << downloadPath;
-        // hash matches stored filehash
-        if (remote->getWatch()->verifyHash(objectName,downloadedFileHash)) {
-          ss << " successful (" << duration
-             << " microseconds) - file hash verified" << endl;
-          // remove temporary object on local fs
-          fs::remove(localEncryptedPath);
-        } else {
-          ss << " failed - unable to verify hash" << endl;
-          // remove temporary object on local fs
-          fs::remove(localEncryptedPath);
-          fs::remove(downloadPath);  // remove decrypted object
-          cout << ss.str();
-          throw std::runtime_error(ss.str());
-        }
-      } else {
-        ss << "S3: Decryption of " << objectName << " to " << downloadPath
-           << " failed" << endl;
-        cout << ss.str();
-        throw std::runtime_error(ss.str());
-      }
-
-      // set the modtime back to the original value
-      fs::path fsPath = downloadPath.c_str();
-      auto systime = std::chrono::system_clock::from_time_t(originalModTime);
-      std::filesystem::file_time_type fsModtime =
-          std::chrono::file_clock::from_sys(systime);
-      fs::last_write_time(fsPath, fsModtime);
-
-      cout << ss.str();
-      return ss.str();
-    } else {
-      ss << "S3: Bytes downloaded did not equal requested number of bytes: "
-         << downloadHandle->GetBytesTotalSize()
-         << downloadHandle->GetBytesTransferred() << std::endl;
-      cout << ss.str();
-      throw std::runtime_error(ss.str());
+  for (size_t page = 0; page < maxPages; page++) {
+    auto outcome = s3Client->ListObjectsV2(request);
+    if (!outcome.IsSuccess()) {
+      std::ostringstream error;
+      error << "S3: listObjects error: "
+            << outcome.GetError().GetExceptionName() << " "
+            << outcome.GetError().GetMessage() << endl;
+      throw RemoteError(error.str(), retryable(outcome.GetError()));
     }
-  } else {
-    ss << "S3: Download of " << objectName << " to " << awsWriteToFile
-       << " failed with message: " << downloadHandle->GetStatus() << " ("
-       << downloadHandle->GetLastError().GetMessage() << ")" << endl;
-    cout << ss.str();
-    throw std::runtime_error(ss.str());
-  }
-
-  /*  RETRY DOWNLOAD CODE
-
-      size_t retries = 0; // retry download if failed (up to 5 times)
-      while (downloadHandle->GetStatus() ==
-     Aws::Transfer::TransferStatus::FAILED && retries++ < 5)
-      {
-          std::cout << "S3: Retrying download again. Attempt " << retries << "
-     of 5" << std::endl; transferManager->RetryDownload(downloadHandle);
-          downloadHandle->WaitUntilFinished();
-      }
-      ss << "S3: Download of " << objectName << " to " << awsWriteToFile << "
-     failed after maximum retry attempts" << std::endl;
-
-  */
-
-  cout << ss.str();
-  return ss.str();
-}
-
-string S3::downloadObject(
-    std::shared_ptr<Aws::Transfer::TransferManager> transferManager,
-    const Aws::String& bucketName, const std::string& writeToPath,
-    const std::string& objectName) {
-  std::ostringstream ss;
-
-  Aws::String awsObjectName(objectName);
-  // set temporary location
-  string localEncryptedPath = encloned::TEMP_FILE_LOCATION + writeToPath;
-  cout << "localEncryptedPath: " << localEncryptedPath << endl;
-  Aws::String awsWriteToFile(localEncryptedPath);
-
-  auto downloadHandle =
-      transferManager->DownloadFile(bucketName, awsObjectName, awsWriteToFile);
-  downloadHandle->WaitUntilFinished();
-  if (downloadHandle->GetStatus() == Aws::Transfer::TransferStatus::COMPLETED) {
-    if (downloadHandle->GetBytesTotalSize() ==
-        downloadHandle->GetBytesTransferred()) {
-      ss << "S3: Download of " << objectName.substr(0, 10) << "... to "
-         << awsWriteToFile << " successful" << endl;
-
-      // decrypt temporary file to download location
-      if (Encryption::decryptFile(writeToPath.c_str(),
-                                  localEncryptedPath.c_str(),
-                                  daemon->getKey()) == 0) {
-        fs::remove(localEncryptedPath);  // remove temporary object on local fs
-      } else {
-        ss << "S3: Decryption of " << objectName << " to " << writeToPath
-           << " failed" << endl;
-        cout << ss.str();
-        throw std::runtime_error(ss.str());
+    const auto& result = outcome.GetResult();
+    for (const auto& object : result.GetContents()) {
+      if (!upTo.empty() && object.GetKey().c_str() > upTo) {
+        return true;  // the start of the next range
       }
-      cout << ss.str();
-      return ss.str();
-    } else {
-      ss << "S3: Bytes downloaded did not equal requested number of bytes: "
-         << downloadHandle->GetBytesTotalSize()
-         << downloadHandle->GetBytesTransferred() << std::endl;
-      cout << ss.str();
-      throw std::runtime_error(ss.str());
+      objects.push_back({object.GetKey().c_str(), (uint64_t)object.GetSize(),
+                         object.GetETag().c_str(),
+                         (std::time_t)object.GetLastModified().Seconds()});
+    }
+    if (!result.GetIsTruncated()) {
+      return true;
     }
-  } else {
-    ss << "S3: Download of " << objectName << " to " << awsWriteToFile
-       << " failed with message: " << downloadHandle->GetStatus() << " ("
-       << downloadHandle->GetLastError().GetMessage() << ")" << endl;
-    cout << ss.str();
-    throw std::runtime_error(ss.str());
+    request.SetContinuationToken(result.GetNextContinuationToken());
   }
-  cout << ss.str();
-  return ss.str();
+  return false;
 }
 
-string S3::deleteObject(std::shared_ptr<Aws::S3::S3Client> s3_client,
-                        const Aws::String& objectName,
-                        const Aws::String& fromBucket) {
-  std::ostringstream ss;
-  Aws::S3::Model::DeleteObjectRequest request;
-
-  request.WithKey(objectName).WithBucket(fromBucket);
-
-  Aws::S3::Model::DeleteObjectOutcome result = s3_client->DeleteObject(request);
-
-  if (!result.IsSuccess()) {
-    auto err = result.GetError();
-    ss << "S3: Delete of " << objectName << " failed ("
-       << err.GetExceptionName() << ": " << err.GetMessage() << ")" << endl;
-    cout << ss.str();
-    throw std::runtime_error(ss.str());
-  } else {
-    ss << "S3: Delete of " << objectName << " successful" << endl;
+std::vector<std::pair<string, RemoteError>> S3::remove(
+    const std::vector<string>& objectNames) {
+  std::vector<std::pair<string, RemoteError>> failed;
+  if (objectNames.empty()) {
+    return failed;
   }
-  return ss.str();
-}
-
-// legacy upload/download below - not using TransferManager
-
-/* bool S3::put_s3_object(const Aws::String& s3_bucketName,
-                       const std::string& path,
-                       const Aws::String& s3_objectName) {
-  // check again that path exists
-  if (!fs::exists(path)) {
-    std::cout << "S3: ERROR: NoSuchFile: The specified file does not exist"
-              << std::endl;
-    return false;
+  // quiet, so only the keys that failed are returned
+  Aws::S3::Model::Delete toDelete;
+  for (const auto& key : objectNames) {
+    toDelete.AddObjects(
+        Aws::S3::Model::ObjectIdentifier().WithKey(Aws::String(key.c_str())));
   }
-
-  Aws::S3::Model::PutObjectRequest object_request;
-
-  object_request.SetBucket(s3_bucketName);
-  object_request.SetKey(s3_objectName);
-  const std::shared_ptr<Aws::IOStream> input_data =
-      Aws::MakeShared<Aws::FStream>("SampleAllocationTag", path.c_str(),
-                                    std::ios_base::in | std::ios_base::binary);
-  object_request.SetBody(input_data);
-
-  // Put the object
-  auto put_object_outcome = s3_client->PutObject(object_request);
-  if (!put_object_outcome.IsSuccess()) {
-    auto error = put_object_outcome.GetError();
-    std::cout << "S3: ERROR: " << error.GetExceptionName() << ": "
-              << error.GetMessage() << std::endl;
-    cout << "S3: Upload of " << path << " as " << s3_objectName << " failed"
-         << endl;
-    return false;
+  toDelete.WithQuiet(true);
+  Aws::S3::Model::DeleteObjectsRequest request;
+  request.WithBucket(bucketName).WithDelete(toDelete);
+  auto outcome = s3Client->DeleteObjects(request);
+  if (!outcome.IsSuccess()) {
+    std::ostringstream error;
+    error << "S3: Delete of " << objectNames.size() << " objects failed ("
+          << outcome.GetError().GetExceptionName() << ": "
+          << outcome.GetError().GetMessage() << ")" << endl;
+    RemoteError failure(error.str(), retryable(outcome.GetError()));
+    for (const auto& key : objectNames) {
+      failed.emplace_back(key, failure);
+    }
+    return failed;
+  }
+  for (const auto& keyError : outcome.GetResult().GetErrors()) {
+    std::ostringstream error;
+    error << "S3: Delete of " << keyError.GetKey() << " failed ("
+          << keyError.GetCode() << ": " << keyError.GetMessage() << ")"
+          << endl;
+    failed.emplace_back(
+        keyError.GetKey().c_str(),
+        RemoteError(error.str(), retryable(keyError.GetCode())));
   }
-  cout << "S3: Upload of " << path << " as " << s3_objectName << " successful"
-       << endl;
-  return true;
+  return failed;
 }
 
-bool S3::get_s3_object(const Aws::String& objectName,
-                       const Aws::String& fromBucket) {
-  // s3_client.getObject(new GetObjectRequest(bucket,key),file)
-
-  Aws::S3::Model::GetObjectRequest objectRequest;
-  objectRequest.SetBucket(fromBucket);
-  objectRequest.SetKey(objectName);
-
-  Aws::S3::Model::GetObjectOutcome getObjectOutcome =
-      s3_client->GetObject(objectRequest);
-
-  if (getObjectOutcome.IsSuccess()) {
-    auto& retrieved_file = getObjectOutcome.GetResultWithOwnership().GetBody();
-
-    // Print a beginning portion of the text file.
-    std::cout << "Beginning of file contents:\n";
-    char file_data[255] = {0};
-    retrieved_file.getline(file_data, 254);
-    std::cout << file_data << std::endl;
-
-    return true;
-  } else {
-    auto err = getObjectOutcome.GetError();
-    std::cout << "Error: GetObject: " << err.GetExceptionName() << ": "
-              << err.GetMessage() << std::endl;
+bool S3::retryable(const Aws::S3::S3Error& error) {
+  // throttling, 5xx and network errors - the SDK has already retried these a
+  // few times itself
+  int code = static_cast<int>(error.GetResponseCode());
+  return error.ShouldRetry() || code == 429 || code >= 500;
+}
 
-    return false;
-  }
-} */
+bool S3::retryable(const Aws::String& code) {
+  return code == "InternalError" || code == "SlowDown" ||
+         code == "ServiceUnavailable" || code == "RequestTimeout" ||
+         code == "OperationAborted";
+}
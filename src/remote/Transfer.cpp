@@ -0,0 +1,1753 @@
+#include <encloned/remote/Local.hpp>
+#include <encloned/remote/S3.hpp>
+#include <encloned/remote/Transfer.hpp>
+
+Transfer::Transfer(std::atomic_bool* runThreads, Remote* remote) {
+  this->remote = remote;
+  this->runThreads = runThreads;
+  this->daemon = remote->getDaemon();
+  runStarted = std::time(nullptr);
+
+  // cipher suite chosen with the key - AES-256-GCM needs AES instructions,
+  // objects record their suite so either can be read back on a capable CPU
+  encryptOptions.cipher = daemon->getCipher();
+  if (!ChunkCipher::available(encryptOptions.cipher)) {
+    cout << "Transfer: " << ChunkCipher::name(encryptOptions.cipher)
+         << " is not supported on this CPU - using xchacha20poly1305" << endl;
+    encryptOptions.cipher = ChunkCipher::XCHACHA20POLY1305;
+  }
+  cout << "Transfer: encrypting new objects with "
+       << ChunkCipher::name(encryptOptions.cipher) << endl;
+
+  // plaintext chunk size for newly encrypted objects - larger chunks mean
+  // fewer cipher calls and less tag overhead per object
+  long long chunkSize = daemon->getConfig()->getInt(
+      "chunk_size", EncryptOptions::DEFAULT_CHUNK_SIZE);
+  if (chunkSize < ObjectHeader::MIN_CHUNK_SIZE ||
+      chunkSize > ObjectHeader::MAX_CHUNK_SIZE) {
+    cout << "Transfer: chunk_size must be between 4K and 4M - using default"
+         << endl;
+    chunkSize = EncryptOptions::DEFAULT_CHUNK_SIZE;
+  }
+  encryptOptions.chunkSize = chunkSize;
+
+  // files larger than segment_size are split into segments encrypted on up to
+  // encryption_threads cores, 0 disables segmenting
+  long long segmentSize = daemon->getConfig()->getInt(
+      "segment_size", SegmentHeader::DEFAULT_SEGMENT_SIZE);
+  if (segmentSize != 0 && !Segment::validSize(segmentSize, chunkSize)) {
+    cout << "Transfer: segment_size must be a multiple of chunk_size up to 1G "
+            "- segmenting disabled"
+         << endl;
+    segmentSize = 0;
+  }
+  encryptOptions.segmentSize = segmentSize;
+  long long encryptionThreads = daemon->getConfig()->getInt(
+      "encryption_threads",
+      std::min(4u, std::max(1u, std::thread::hardware_concurrency())));
+  encryptOptions.threads = std::max(encryptionThreads, 1LL);
+
+  // zstd compress files that sample as compressible before encryption
+  if (daemon->getConfig()->getBool("compression", true)) {
+    long long compressionLevel = daemon->getConfig()->getInt(
+        "compression_level", Compression::DEFAULT_LEVEL);
+    if (compressionLevel < 1 || compressionLevel > 19) {
+      cout << "Transfer: compression_level must be between 1 and 19 - using "
+              "default"
+           << endl;
+      compressionLevel = Compression::DEFAULT_LEVEL;
+    }
+    encryptOptions.compressionLevel = compressionLevel;
+  }
+
+  // large files are split into content defined chunks, each stored once
+  if (daemon->getConfig()->getBool("cdc", false)) {
+    long long averageSize = daemon->getConfig()->getInt(
+        "cdc_average_size", Chunker::DEFAULT_AVERAGE_SIZE);
+    if (averageSize < 0 || !Chunker::validSize(averageSize)) {
+      cout << "Transfer: cdc_average_size must be a power of two between 64K "
+              "and 1M - using default"
+           << endl;
+      averageSize = Chunker::DEFAULT_AVERAGE_SIZE;
+    }
+    chunker = std::make_unique<Chunker>(averageSize);
+  }
+
+  // small files are encrypted into pack objects of around pack_size, so
+  // uploading many of them isn't bound by the number of requests
+  if (daemon->getConfig()->getBool("packing", false)) {
+    long long size =
+        daemon->getConfig()->getInt("pack_size", DEFAULT_PACK_SIZE);
+    if (size < 1024 * 1024 || size > 1024 * 1024 * 1024) {
+      cout << "Transfer: pack_size must be between 1M and 1G - using default"
+           << endl;
+      size = DEFAULT_PACK_SIZE;
+    }
+    long long maxFileSize = daemon->getConfig()->getInt(
+        "pack_max_file_size", DEFAULT_PACK_MAX_FILE_SIZE);
+    if (maxFileSize < 1 || maxFileSize > size) {
+      cout << "Transfer: pack_max_file_size must be no larger than pack_size - "
+              "using default"
+           << endl;
+      maxFileSize = std::min((long long)DEFAULT_PACK_MAX_FILE_SIZE, size);
+    }
+    packSize = size;
+    packMaxFileSize = maxFileSize;
+  }
+
+  // objects restored concurrently, each decrypted as it arrives
+  long long downloads = daemon->getConfig()->getInt(
+      "download_concurrency", DEFAULT_DOWNLOAD_CONCURRENCY);
+  if (downloads < 1 || downloads > 64) {
+    cout << "Transfer: download_concurrency must be between 1 and 64 - using "
+            "default"
+         << endl;
+    downloads = DEFAULT_DOWNLOAD_CONCURRENCY;
+  }
+  downloadConcurrency = downloads;
+
+  // files uploaded concurrently - the encryption of some overlaps the
+  // transfer of others, and small files aren't bound by request latency
+  long long concurrency = daemon->getConfig()->getInt(
+      "upload_concurrency", DEFAULT_UPLOAD_CONCURRENCY);
+  if (concurrency < 1 || concurrency > 64) {
+    cout << "Transfer: upload_concurrency must be between 1 and 64 - using "
+            "default"
+         << endl;
+    concurrency = DEFAULT_UPLOAD_CONCURRENCY;
+  }
+  uploadConcurrency = concurrency;
+  long long window =
+      daemon->getConfig()->getInt("upload_window", DEFAULT_UPLOAD_WINDOW);
+  if (window < 1) {
+    cout << "Transfer: upload_window must be positive - using default" << endl;
+    window = DEFAULT_UPLOAD_WINDOW;
+  }
+  uploadWindow = window;
+
+  // the remote inventory is listed again this often, to pick up objects
+  // stored or deleted other than by this daemon - 0 to only list on request
+  long long refreshHours = daemon->getConfig()->getInt(
+      "inventory_refresh_hours", DEFAULT_INVENTORY_REFRESH_HOURS);
+  if (refreshHours < 0) {
+    cout << "Transfer: inventory_refresh_hours must not be negative - using "
+            "default"
+         << endl;
+    refreshHours = DEFAULT_INVENTORY_REFRESH_HOURS;
+  }
+  inventoryRefresh = refreshHours * 60 * 60;
+
+  // bytes per second of every transfer in each direction together, e.g. to
+  // leave an office uplink free during working hours
+  configureLimit(uploadLimit, "upload");
+  configureLimit(downloadLimit, "download");
+
+  // objects are stored in an S3 bucket, or in a local directory (e.g. a disk
+  // or NAS close by, for fast restores)
+  string backendName = daemon->getConfig()->getString("backend", "s3");
+  string localPath = daemon->getConfig()->getString("local_path", "");
+  if (backendName == "local" && !localPath.empty()) {
+    backend = std::make_shared<Local>(localPath, &uploadLimit, &downloadLimit);
+  } else {
+    if (backendName != "s3") {
+      cout << "Transfer: backend must be s3, or local with a local_path - "
+              "using s3"
+           << endl;
+    }
+    // an S3-compatible store other than AWS, e.g. MinIO for bench/enclone_e2e
+    backend = std::make_shared<S3>(
+        std::max(uploadConcurrency, downloadConcurrency), &uploadLimit,
+        &downloadLimit,
+        daemon->getConfig()->getString("s3_bucket", S3::DEFAULT_BUCKET_NAME),
+        daemon->getConfig()->getString("s3_endpoint", ""));
+  }
+  cout << "Transfer: storing objects in " << backend->name() << endl;
+}
+
+void Transfer::configureLimit(RateLimiter& limiter, const string& direction) {
+  long long limit = daemon->getConfig()->getInt(direction + "_limit", 0);
+  if (limit < 0) {
+    cout << "Transfer: " << direction
+         << "_limit must not be negative - using unlimited" << endl;
+    limit = 0;
+  }
+  std::vector<RateLimiter::Window> schedule;
+  if (!RateLimiter::parseSchedule(
+          daemon->getConfig()->getString(direction + "_schedule", ""),
+          schedule)) {
+    cout << "Transfer: " << direction
+         << "_schedule must be a list of HH:MM-HH:MM=rate - using "
+         << direction << "_limit only" << endl;
+  }
+  limiter.configure(limit, schedule);
+  if (limit != 0 || !schedule.empty()) {
+    cout << limiter.describe();
+  }
+}
+
+string Transfer::limit(const string& direction, const string& rate) {
+  if (direction.empty() || direction == "show") {
+    return uploadLimit.describe() + downloadLimit.describe();
+  }
+  RateLimiter* limiter = direction == "upload"     ? &uploadLimit
+                         : direction == "download" ? &downloadLimit
+                                                   : NULL;
+  if (limiter == NULL) {
+    return "Transfer: limit must be set for upload or download\n";
+  }
+  uint64_t bytes;
+  if (rate == "schedule") {
+    limiter->setOverride(std::nullopt);
+  } else if (RateLimiter::parseRate(rate, bytes)) {
+    limiter->setOverride(bytes);
+  } else {
+    return "Transfer: limit must be a rate such as 512K or 2M, 0 for "
+           "unlimited, or schedule\n";
+  }
+  cout << limiter->describe();
+  return limiter->describe();
+}
+
+void Transfer::upload() {
+  if (!anyDue("upload", uploadQueue)) {
+    return;
+  }
+  encryptionQueueTime = 0;
+  auto t1 = std::chrono::high_resolution_clock::now();
+  uploadFromQueue();
+  auto t2 = std::chrono::high_resolution_clock::now();
+  auto duration =
+      std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
+  cout << "Transfer: uploadQueue encrypted in : " << encryptionQueueTime / 1000
+       << "ms" << endl;
+  cout << "Transfer: uploadFromQueue completed in " << duration / 1000 << "ms"
+       << endl;
+}
+
+string Transfer::download(bool retriesOnly) {
+  if (!anyDue("download", downloadQueue, retriesOnly)) {
+    return "";
+  }
+  decryptionQueueTime = 0;
+  auto t1 = std::chrono::high_resolution_clock::now();
+  string response = downloadFromQueue(retriesOnly);
+  auto t2 = std::chrono::high_resolution_clock::now();
+  auto duration =
+      std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
+  cout << "Transfer: downloadQueue decrypted in : "
+       << decryptionQueueTime / 1000 << "ms" << endl;
+  cout << "Transfer: downloadFromQueue completed in " << duration / 1000
+       << "ms" << endl;
+  return response;
+}
+
+string Transfer::remove() {
+  if (!anyDue("delete", deleteQueue) &&
+      remote->getWatch()->packsToRepack().empty()) {
+    return "";
+  }
+  auto t1 = std::chrono::high_resolution_clock::now();
+  string response = deleteFromQueue();
+  repackObjects();
+  auto t2 = std::chrono::high_resolution_clock::now();
+  cout << "Transfer: delete completed in "
+       << std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1)
+              .count()
+       << " microseconds" << endl;
+  return response;
+}
+
+void Transfer::refresh() {
+  if (inventoryRefresh == 0 ||
+      std::time(nullptr) - remote->getWatch()->inventoryListedAt() <
+          inventoryRefresh) {
+    return;
+  }
+  listObjects();
+}
+
+string Transfer::uploadNow(const string& path, const string& pathHash) {
+  try {
+    uploadObject(path, pathHash);
+  } catch (const std::exception& e) {
+    return e.what();
+  }
+  return "";
+}
+
+string Transfer::downloadNow(const string& pathHash, const string& target) {
+  // calling version of downloadObject that does not check file hash as this
+  // is used for index backup (no file hash stored)
+  try {
+    return downloadObject(target, pathHash);
+  } catch (const std::exception& e) {
+    return e.what();
+  }
+}
+
+void Transfer::uploadFromQueue() {
+  std::scoped_lock<std::mutex> guard(mtx);
+  if (uploadQueue.empty()) {
+    return;
+  }
+  // items that fail are queued again for a later pass, see retryLater
+  std::deque<std::tuple<string, string, std::time_t>> items;
+  items.swap(uploadQueue);
+
+  // up to uploadConcurrency files are uploaded at once, each on its own
+  // thread - the oldest is waited for before another is started
+  struct Upload {
+    std::tuple<string, string, std::time_t> item;
+    uint64_t size;
+    std::future<void> done;
+  };
+  std::deque<Upload> inFlight;
+  uint64_t bytesInFlight = 0;
+  auto waitForUpload = [&]() {
+    Upload upload = std::move(inFlight.front());
+    inFlight.pop_front();
+    bytesInFlight -= upload.size;
+    auto& [path, pathHash, modtime] = upload.item;
+    try {
+      upload.done.get();
+      retryReset("upload", pathHash);
+    } catch (const std::exception& e) {
+      if (retryLater({"upload", path, pathHash, modtime}, e)) {
+        uploadRetries.push_back(upload.item);
+      }
+    }
+  };
+
+  for (const auto& item : items) {
+    auto [path, pathHash, modtime] = item;  // get values out of the tuple
+    if (!retryDue("upload", pathHash)) {
+      uploadRetries.push_back(item);
+      continue;
+    }
+
+    // check file still exists
+    if (!fs::exists(path)) {
+      std::stringstream error;
+      error << "Transfer: Error: File " << path << " no longer exists" << endl;
+      cout << error.str();
+      retryReset("upload", pathHash);
+      continue;  // go to the next item
+    }
+
+    // check that modtime for path is still valid - file may have changed since
+    // added to uploadQueue, or no longer exist
+    try {
+      auto fstime = fs::last_write_time(path);  // get modtime from file
+      auto systime = std::chrono::file_clock::to_sys(fstime);
+      time_t currentModtime = std::chrono::system_clock::to_time_t(systime);
+      if (modtime != currentModtime) {
+        std::stringstream error;
+        error << "Transfer: Error: File " << path
+              << " has changed - unable to upload version with hash "
+              << pathHash << endl;
+        cout << error.str();
+        retryReset("upload", pathHash);
+        continue;  // go to the next item
+      }
+    } catch (const std::exception& ex) {
+      cout << ex.what() << endl;
+    }
+
+    std::error_code ec;
+    uint64_t size = fs::file_size(path, ec);
+    if (ec) {
+      size = 0;
+    }
+    if (packSize != 0 && !ec && size <= packMaxFileSize &&
+        remote->getWatch()->packable(pathHash)) {
+      try {
+        addToPack(path, pathHash, modtime);
+      } catch (const std::exception& e) {
+        if (retryLater({"upload", path, pathHash, modtime}, e)) {
+          uploadRetries.push_back(item);
+        }
+      }
+      continue;
+    }
+
+    while (!inFlight.empty() && (inFlight.size() >= uploadConcurrency ||
+                                 bytesInFlight + size > uploadWindow)) {
+      waitForUpload();
+    }
+    auto upload = [this, path = path, pathHash = pathHash]() {
+      uploadObject(path, pathHash);
+    };
+    inFlight.push_back({item, size, std::async(std::launch::async, upload)});
+    bytesInFlight += size;
+  }
+  while (!inFlight.empty()) {
+    waitForUpload();
+  }
+  // the last, partly filled pack
+  if (!packItems.empty()) {
+    uploadPack();
+  }
+  for (const auto& [path, pathHash, modtime] : uploadRetries) {
+    enqueueUpload(path, pathHash, modtime);
+  }
+  uploadRetries.clear();
+  // cout << "Transfer: uploadQueue is empty" << endl; cout.flush();
+}
+
+string Transfer::downloadFromQueue(bool retriesOnly) {
+  std::ostringstream ss;
+  std::scoped_lock<std::mutex> guard(mtx);
+  if (downloadQueue.empty()) {
+    ss << "Transfer: downloadQueue is empty" << endl;
+    cout.flush();
+    return ss.str();
+  }
+  // items that fail are queued again for a later pass, see retryLater, and
+  // items not yet due are left in the queue
+  std::deque<std::tuple<string, string, std::time_t, string>> queued, items;
+  queued.swap(downloadQueue);
+  for (const auto& item : queued) {
+    if (retryDue("download", std::get<1>(item), retriesOnly)) {
+      items.push_back(item);
+    } else {
+      downloadQueue.push_back(item);
+    }
+  }
+  if (items.empty()) {
+    return "";
+  }
+
+  // every directory is created once, parents first, before any file
+  std::set<string> dirs;
+  for (const auto& [path, objectName, modtime, targetPath] : items) {
+    dirs.insert(restorePath(targetPath, path).first);
+  }
+  for (const auto& dir : dirs) {
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    if (ec) {
+      cout << "Transfer: Unable to create directory " << dir << " ("
+           << ec.message() << ")" << endl;
+    }
+  }
+  cout << "Transfer: Created " << dirs.size() << " directories for "
+       << items.size() << " objects" << endl;
+
+  // files compressed with a dictionary can't be decrypted without it
+  auto firstFile =
+      std::stable_partition(items.begin(), items.end(), [&](const auto& item) {
+        return remote->getWatch()->isDictionary(std::get<1>(item));
+      });
+
+  // up to downloadConcurrency objects are downloaded at once, each decrypted,
+  // hashed and written as it arrives - results are reported in queue order
+  std::deque<std::pair<std::tuple<string, string, std::time_t, string>,
+                       std::future<string>>>
+      inFlight;
+  auto waitForDownload = [&]() {
+    auto [item, done] = std::move(inFlight.front());
+    inFlight.pop_front();
+    auto& [path, objectName, modtime, targetPath] = item;
+    try {
+      ss << done.get();
+      retryReset("download", objectName);
+    } catch (const std::exception& e) {
+      ss << e.what();
+      if (retryLater({"download", path, objectName, modtime, targetPath}, e)) {
+        ss << "Transfer: Download of " << path << " will be retried" << endl;
+        downloadQueue.push_back(item);
+      }
+    }
+  };
+  for (auto it = items.begin(); it != items.end(); ++it) {
+    if (it == firstFile) {
+      while (!inFlight.empty()) {
+        waitForDownload();  // every dictionary is in place
+      }
+    }
+    while (inFlight.size() >= downloadConcurrency) {
+      waitForDownload();
+    }
+    auto download = [this, item = *it]() mutable -> string {
+      auto& [path, objectName, modtime, targetPath] = item;
+      return downloadObject(path, objectName, modtime, targetPath);
+    };
+    inFlight.emplace_back(*it, std::async(std::launch::async, download));
+  }
+  while (!inFlight.empty()) {
+    waitForDownload();
+  }
+  cout << "Transfer: downloadFromQueue complete" << endl;
+  cout.flush();
+  return ss.str();
+}
+
+std::pair<string, string> Transfer::restorePath(string targetPath,
+                                          const string& writeToPath) {
+  // ensure path is terminated by a trailing slash
+  if (targetPath.empty() || targetPath.back() != '/') {
+    targetPath.append("/");
+  }
+  // split path into directory path and filename
+  std::size_t found = writeToPath.find_last_of("/");
+  string dirPath = targetPath + writeToPath.substr(0, found + 1);
+  string fileName = writeToPath.substr(found + 1);
+  return std::make_pair(dirPath, dirPath + fileName);
+}
+
+string Transfer::deleteFromQueue() {
+  std::ostringstream ss;
+  std::scoped_lock<std::mutex> guard(mtx);
+  // keys that fail are queued again for a later pass, see retryLater
+  std::deque<string> items;
+  items.swap(deleteQueue);
+
+  // up to backend->deleteBatchSize() keys per request,
+  // DELETE_BATCHES_IN_FLIGHT requests at once - only the keys that failed
+  // are returned
+  using Failed = std::vector<std::pair<string, RemoteError>>;
+  std::deque<std::pair<std::vector<string>, std::future<Failed>>> inFlight;
+  size_t deleted = 0;
+  auto waitForBatch = [&]() {
+    auto [keys, done] = std::move(inFlight.front());
+    inFlight.pop_front();
+    std::unordered_set<string> failed;
+    for (const auto& [key, error] : done.get()) {
+      ss << error.what();
+      failed.insert(key);
+      if (retryLater({"delete", "", key}, error)) {
+        deleteQueue.push_back(key);
+      }
+    }
+    for (const auto& key : keys) {
+      if (!failed.count(key)) {
+        retryReset("delete", key);
+        remote->getWatch()->inventoryDeleted(key);
+        deleted++;
+      }
+    }
+  };
+
+  std::unordered_set<string> queued;  // cleanRemote may queue a key twice
+  std::vector<string> batch;
+  for (size_t i = 0; i < items.size(); i++) {
+    if (queued.insert(items[i]).second) {
+      if (retryDue("delete", items[i])) {
+        batch.push_back(items[i]);
+      } else {
+        deleteQueue.push_back(items[i]);
+      }
+    }
+    if (batch.size() < backend->deleteBatchSize() && i + 1 < items.size()) {
+      continue;
+    }
+    if (batch.empty()) {
+      break;
+    }
+    auto done = std::async(std::launch::async, &Backend::remove, backend,
+                           batch);
+    inFlight.emplace_back(std::move(batch), std::move(done));
+    batch.clear();
+    if (inFlight.size() >= DELETE_BATCHES_IN_FLIGHT) {
+      waitForBatch();
+    }
+  }
+  while (!inFlight.empty()) {
+    waitForBatch();
+  }
+  if (deleted != 0) {
+    ss << "Transfer: Deleted " << deleted << " objects from "
+       << backend->name() << endl;
+  }
+  cout << ss.str();
+  cout.flush();
+  return ss.str();
+}
+
+string Transfer::listObjects() {
+  std::time_t started = std::time(nullptr);
+  auto t1 = std::chrono::high_resolution_clock::now();
+  std::vector<RemoteObject> objects;
+  // most buckets fit in a single page
+  size_t ranges = backend->listRanges();
+  if (!backend->list("", "", objects, 1)) {
+    // list the rest of the key space in ranges at once, split by the first
+    // character of the base64 object names - each range stops at the start
+    // of the next, so keys named elsewhere are still listed once
+    const string alphabet =
+        "-0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ_abcdefghijklmnopqrstuvwxyz";
+    string last = objects.empty() ? "" : objects.back().name;
+    std::vector<string> bounds{last};
+    for (size_t i = 1; i < ranges; i++) {
+      string bound(1, alphabet[i * alphabet.size() / ranges]);
+      if (bound > last) {
+        bounds.push_back(bound);
+      }
+    }
+    std::vector<std::future<std::vector<RemoteObject>>> listing;
+    for (size_t i = 0; i < bounds.size(); i++) {
+      string upper = i + 1 < bounds.size() ? bounds[i + 1] : "";
+      listing.push_back(std::async(
+          std::launch::async, [this, lower = bounds[i], upper]() {
+            std::vector<RemoteObject> range;
+            backend->list(lower, upper, range);
+            return range;
+          }));
+    }
+    // wait for every range before rethrowing, as they use this
+    std::exception_ptr failed;
+    for (auto& range : listing) {
+      try {
+        auto listed = range.get();
+        objects.insert(objects.end(), listed.begin(), listed.end());
+      } catch (const std::exception& e) {
+        failed = std::current_exception();
+      }
+    }
+    if (failed) {
+      std::rethrow_exception(failed);
+    }
+  }
+  remote->getWatch()->inventoryListed(objects, started);
+  auto t2 = std::chrono::high_resolution_clock::now();
+
+  std::ostringstream response;
+  response << "Transfer: listed " << objects.size() << " objects in "
+           << backend->name() << " in "
+           << std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1)
+                  .count()
+           << "ms" << endl;
+  cout << response.str();
+  return response.str();
+}
+
+void Transfer::objectStored(const std::string& objectName, uint64_t size,
+                            const std::string& etag) {
+  remote->getWatch()->inventoryStored(
+      {objectName, size, etag, std::time(nullptr)});
+}
+
+std::vector<RemoteObject> Transfer::getObjects(bool refresh) {
+  // answered from the inventory, which is only listed from the remote if it
+  // never has been, or on request
+  if (refresh || remote->getWatch()->inventoryListedAt() == 0) {
+    listObjects();
+  }
+  return remote->getWatch()->getInventory();
+}
+
+std::unordered_map<string, string> Transfer::getObjectMap() {
+  std::unordered_map<string, string> objectMap;
+  for (const auto& object : getObjects()) {
+    objectMap.emplace(object.name,
+                      remote->getWatch()->displayTime(object.lastModified));
+  }
+  return objectMap;
+}
+
+bool Transfer::uploadObject(const std::string& path,
+                            const std::string& objectName) {
+  auto started = std::chrono::steady_clock::now();
+  // files that would be more than one chunk
+  std::error_code ec;
+  if (chunker && fs::file_size(path, ec) > chunker->maxSize() && !ec &&
+      remote->getWatch()->namedByContent(objectName)) {
+    return uploadChunks(path, objectName);
+  }
+
+  // encrypt the file on the fly - ciphertext is only ever held in memory, at
+  // most the parts in flight + 1 at a time. The file is hashed for the index
+  // from the same reads
+  FileHasher hasher(FileHasher::DEFAULT_ALGORITHM);
+  EncryptOptions options = encryptOptions;
+  options.hasher = &hasher;
+  if (options.compressionLevel != 0) {
+    // small files share a dictionary trained on the rest of their watch root
+    options.dictionary = daemon->getDictionaries()->forFile(path);
+  }
+  auto unreadable = [&path]() {
+    std::ostringstream error;
+    error << "Transfer: Upload of " << path << " failed - unable to open file"
+          << endl;
+    cout << error.str();
+    return RemoteError(error.str(), false);
+  };
+  // before it is hashed, as a file that can't be read hashes as empty
+  if (!std::ifstream(path, std::ios::binary).is_open()) {
+    throw unreadable();
+  }
+
+  // deduplication - stored under a keyed hash of the contents, and not
+  // uploaded at all if another version with the same contents already is
+  string uploadName = objectName;
+  string contentHash;
+  if (remote->getWatch()->namedByContent(objectName)) {
+    auto hashStarted = std::chrono::steady_clock::now();
+    contentHash = Encryption::hashFile(path, FileHasher::DEFAULT_ALGORITHM,
+                                       encryptOptions.threads);
+    std::error_code sizeEc;
+    uint64_t hashed = fs::file_size(path, sizeEc);
+    daemon->getStats()->record(Stats::HASH, hashStarted, sizeEc ? 0 : hashed);
+    uploadName = Encryption::contentName(
+        daemon->getContentKey(), contentHash, FileHasher::DEFAULT_ALGORITHM);
+    if (remote->getWatch()->addObjectReference(objectName, uploadName,
+                                               contentHash,
+                                               FileHasher::DEFAULT_ALGORITHM)) {
+      cout << "Transfer: Upload of " << path << " skipped - already stored as "
+           << uploadName << endl;
+      daemon->getStats()->record(Stats::UPLOAD, started, 0);
+      return true;
+    }
+  }
+
+  // an upload of this version interrupted by a restart carries on after its
+  // last stored part, if the file hasn't changed since
+  PartialUpload record;
+  record.pathHash = objectName;
+  record.path = path;
+  record.modtime = remote->getWatch()->fsLastMod(path);
+  std::error_code sizeEc;
+  record.size = fs::file_size(path, sizeEc);
+  record.objectName = uploadName;
+  std::unique_ptr<Backend::Upload> upload;
+  EncryptResume resume;
+  if (resumeUpload(record, upload, resume)) {
+    options.resume = &resume;
+  }
+  EncryptStream stream(path.c_str(), daemon->getKey(), options);
+  if (!stream.is_open()) {
+    throw unreadable();
+  }
+  if (upload && !stream.resumed()) {
+    discardUpload(record, "unable to resume its stream");
+    upload.reset();
+  }
+
+  long long encryptionTime = 0;
+  auto t1 = std::chrono::high_resolution_clock::now();
+
+  PartPlan plan = planParts(record.size);
+  string etag;
+  if (upload) {
+    etag = uploadMultipart(record, stream, plan, std::move(upload), NULL,
+                           encryptionTime);
+  } else {
+    std::shared_ptr<std::iostream> body =
+        readPart(stream, plan.partSize, encryptionTime);
+    if (stream.eof()) {
+      // whole object fits in a single part - no need for a multipart upload
+      try {
+        etag = backend->put(uploadName, body);
+      } catch (const RemoteError& e) {
+        cout << "Transfer: Upload of " << path << " as " << uploadName
+             << " failed - " << e.what();
+        throw;
+      }
+    } else {
+      etag = uploadMultipart(record, stream, plan, NULL, body,
+                             encryptionTime);
+    }
+  }
+  objectStored(uploadName, stream.bytesRead(), etag);
+
+  auto t2 = std::chrono::high_resolution_clock::now();
+  auto duration =
+      std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
+  std::cout << "Transfer: encrypted " << path << " in " << encryptionTime
+            << " microseconds, uploaded in " << duration << " microseconds"
+            << endl;
+  encryptionQueueTime += encryptionTime;
+  daemon->getStats()->record(Stats::ENCRYPT, encryptionTime,
+                             stream.bytesRead());
+
+  string fileHash = hasher.final();
+  if (!contentHash.empty() && fileHash != contentHash) {
+    // the file changed while it was read, so the object doesn't hold the
+    // contents it is named after
+    deleteObject(uploadName);
+    std::ostringstream error;
+    error << "Transfer: Upload of " << path
+          << " failed - file changed during upload" << endl;
+    cout << error.str();
+    throw std::runtime_error(error.str());
+  }
+
+  cout << "Transfer: Upload of " << path << " as " << uploadName
+       << " successful" << endl;
+  // set remoteExists flag and file hash
+  remote->uploadSuccess(path, uploadName, remoteID, fileHash);
+  daemon->getStats()->record(Stats::UPLOAD, started, stream.bytesRead());
+  return true;
+}
+
+bool Transfer::uploadChunks(const std::string& path,
+                            const std::string& pathHash) {
+  std::unique_ptr<FILE, int (*)(FILE*)> file(fopen(path.c_str(), "rb"),
+                                             fclose);
+  if (!file) {
+    std::ostringstream error;
+    error << "Transfer: Upload of " << path << " failed - unable to open file"
+          << endl;
+    cout << error.str();
+    throw RemoteError(error.str(), false);
+  }
+
+  // the file is hashed for the index from the same reads
+  FileHasher fileHasher(FileHasher::DEFAULT_ALGORITHM);
+  std::vector<unsigned char> buf(2 * chunker->maxSize());
+  size_t start = 0, end = 0;
+  bool eof = false;
+  std::vector<string> chunks;
+  std::unordered_set<string> uploaded;  // by this call, for repeated chunks
+  uint64_t bytes = 0, newBytes = 0;
+  long long chunkingTime = 0, encryptionTime = 0;
+  auto t1 = std::chrono::high_resolution_clock::now();
+
+  // new chunks are uploaded asynchronously, while the next is read
+  std::deque<std::tuple<string, string, uint64_t, std::future<string>>>
+      inFlight;
+  std::ostringstream error;
+  bool retry = true;
+  auto waitForChunk = [&]() {
+    auto [objectName, chunkHash, size, etag] = std::move(inFlight.front());
+    inFlight.pop_front();
+    try {
+      objectStored(objectName, size, etag.get());
+    } catch (const std::exception& e) {
+      error << "Transfer: Upload of chunk " << objectName << " of " << path
+            << " failed - " << e.what();
+      retry = retry && RemoteError::retryable(e);
+      return false;
+    }
+    remote->uploadSuccess(path, objectName, remoteID, chunkHash);
+    return true;
+  };
+
+  bool success = true;
+  try {
+    while (success) {
+      // keep at least a maximum sized chunk in the buffer
+      if (end - start < chunker->maxSize() && !eof) {
+        memmove(buf.data(), buf.data() + start, end - start);
+        end -= start;
+        start = 0;
+        while (end < buf.size() && !eof) {
+          end += fread(buf.data() + end, 1, buf.size() - end, file.get());
+          if (ferror(file.get())) {
+            throw std::runtime_error("error reading file");
+          }
+          eof = feof(file.get());
+        }
+      }
+      if (start == end) {
+        break;
+      }
+
+      auto c1 = std::chrono::high_resolution_clock::now();
+      const unsigned char* chunk = buf.data() + start;
+      size_t len = chunker->cut(chunk, end - start);
+      auto c2 = std::chrono::high_resolution_clock::now();
+      chunkingTime +=
+          std::chrono::duration_cast<std::chrono::microseconds>(c2 - c1)
+              .count();
+      start += len;
+      bytes += len;
+      fileHasher.update(chunk, len);
+
+      FileHasher chunkHasher(FileHasher::BLAKE2B);
+      chunkHasher.update(chunk, len);
+      string chunkHash = chunkHasher.final();
+      string objectName = Encryption::contentName(
+          daemon->getContentKey(), chunkHash, FileHasher::BLAKE2B);
+      chunks.push_back(objectName);
+      if (remote->getWatch()->addChunkReference(pathHash, objectName,
+                                                chunkHash, len) ||
+          !uploaded.insert(objectName).second) {
+        continue;  // already stored
+      }
+
+      EncryptStream stream(chunk, len, daemon->getKey(), encryptOptions);
+      std::shared_ptr<std::iostream> body =
+          readPart(stream, backend->partSize(), encryptionTime);
+      if (!stream.eof()) {
+        throw std::runtime_error("chunk larger than a single part");
+      }
+      inFlight.emplace_back(objectName, chunkHash, stream.bytesRead(),
+                            std::async(std::launch::async, &Backend::put,
+                                       backend, objectName, body));
+      newBytes += len;
+      if (inFlight.size() >= backend->partsInFlight()) {
+        success = waitForChunk();
+      }
+    }
+  } catch (const std::exception& e) {
+    error << "Transfer: Upload of " << path << " failed (" << e.what() << ")"
+          << endl;
+    success = false;
+  }
+  while (!inFlight.empty()) {
+    success = waitForChunk() && success;  // always drain outstanding chunks
+  }
+  if (!success) {
+    // chunks already uploaded are kept, and reused when the upload is retried
+    cout << error.str();
+    throw RemoteError(error.str(), retry);
+  }
+
+  remote->getWatch()->chunksUploaded(pathHash, chunks, fileHasher.final(),
+                                     FileHasher::DEFAULT_ALGORITHM);
+
+  auto t2 = std::chrono::high_resolution_clock::now();
+  auto duration =
+      std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
+  encryptionQueueTime += encryptionTime;
+  daemon->getStats()->record(Stats::HASH, chunkingTime, bytes);
+  daemon->getStats()->record(Stats::ENCRYPT, encryptionTime, newBytes);
+  daemon->getStats()->record(Stats::UPLOAD, duration, newBytes);
+  chunkedBytes += bytes;
+  chunkedBytesUploaded += newBytes;
+  cout << "Transfer: Upload of " << path << " as " << chunks.size()
+       << " chunks successful - " << uploaded.size() << " uploaded, "
+       << (bytes == 0 ? 0 : 100 - newBytes * 100 / bytes)
+       << "% of bytes already stored. Chunked at "
+       << (chunkingTime == 0 ? 0 : bytes / chunkingTime)
+       << " MB/s, encrypted in " << encryptionTime
+       << " microseconds, uploaded in " << duration
+       << " microseconds. Dedup ratio since start "
+       << (chunkedBytesUploaded == 0
+               ? 0.0
+               : (double)chunkedBytes / chunkedBytesUploaded)
+       << ":1" << endl;
+  return true;
+}
+
+void Transfer::addToPack(const std::string& path, const std::string& pathHash,
+                         std::time_t modtime) {
+  auto started = std::chrono::steady_clock::now();
+  FileHasher hasher(FileHasher::DEFAULT_ALGORITHM);
+  EncryptOptions options = encryptOptions;
+  options.hasher = &hasher;
+  if (options.compressionLevel != 0) {
+    options.dictionary = daemon->getDictionaries()->forFile(path);
+  }
+  EncryptStream stream(path.c_str(), daemon->getKey(), options);
+  if (!stream.is_open()) {
+    std::ostringstream error;
+    error << "Transfer: Upload of " << path << " failed - unable to open file"
+          << endl;
+    cout << error.str();
+    throw RemoteError(error.str(), false);
+  }
+
+  string objectName = pathHash;
+  string contentHash;
+  if (remote->getWatch()->namedByContent(pathHash)) {
+    auto hashStarted = std::chrono::steady_clock::now();
+    contentHash = Encryption::hashFile(path, FileHasher::DEFAULT_ALGORITHM,
+                                       encryptOptions.threads);
+    std::error_code sizeEc;
+    uint64_t hashed = fs::file_size(path, sizeEc);
+    daemon->getStats()->record(Stats::HASH, hashStarted, sizeEc ? 0 : hashed);
+    objectName = Encryption::contentName(
+        daemon->getContentKey(), contentHash, FileHasher::DEFAULT_ALGORITHM);
+    if (remote->getWatch()->addObjectReference(pathHash, objectName,
+                                               contentHash,
+                                               FileHasher::DEFAULT_ALGORITHM)) {
+      cout << "Transfer: Upload of " << path << " skipped - already stored as "
+           << objectName << endl;
+      daemon->getStats()->record(Stats::UPLOAD, started, 0);
+      return;
+    }
+    if (packNames.count(objectName) != 0) {
+      // marked as stored along with the copy already in this pack
+      daemon->getStats()->record(Stats::UPLOAD, started, 0);
+      return;
+    }
+  }
+
+  // each object in a pack is encrypted on its own, so it can be read with a
+  // ranged GET
+  if (packBuffer.empty()) {
+    packBuffer.reserve(packSize + packMaxFileSize);
+  }
+  uint64_t offset = packBuffer.size();
+  auto t1 = std::chrono::high_resolution_clock::now();
+  try {
+    appendStream(stream, packBuffer);
+  } catch (const std::exception& e) {
+    packBuffer.resize(offset);
+    throw;
+  }
+  auto t2 = std::chrono::high_resolution_clock::now();
+  long long encryptionTime =
+      std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
+  encryptionQueueTime += encryptionTime;
+  daemon->getStats()->record(Stats::ENCRYPT, encryptionTime,
+                             stream.bytesRead());
+
+  string fileHash = hasher.final();
+  if (!contentHash.empty() && fileHash != contentHash) {
+    packBuffer.resize(offset);
+    std::ostringstream error;
+    error << "Transfer: Upload of " << path
+          << " failed - file changed during upload" << endl;
+    cout << error.str();
+    throw std::runtime_error(error.str());
+  }
+  packItems.push_back({path, pathHash, modtime, objectName, fileHash,
+                       {"", offset, packBuffer.size() - offset},
+                       started});
+  packNames.insert(objectName);
+
+  if (packBuffer.size() >= packSize) {
+    uploadPack();
+  }
+}
+
+void Transfer::uploadPack() {
+  string packName = Encryption::hashPath("pack");
+  std::vector<std::pair<string, PackedObject>> objects;
+  for (auto& item : packItems) {
+    item.location.pack = packName;
+    objects.emplace_back(item.objectName, item.location);
+  }
+
+  auto t1 = std::chrono::high_resolution_clock::now();
+  try {
+    uint64_t size = putPack(packName, packBuffer, objects);
+    auto t2 = std::chrono::high_resolution_clock::now();
+    auto duration =
+        std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
+    cout << "Transfer: Upload of pack " << packName << " of "
+         << packItems.size() << " files (" << size
+         << " bytes) successful, uploaded in " << duration << " microseconds"
+         << endl;
+
+    // versions deleted while they were packed are left out, their bytes are
+    // reclaimed when the pack is repacked
+    if (remote->getWatch()->packUploaded(packName, size, objects) == 0) {
+      try {
+        deleteObject(packName);
+      } catch (const std::exception& e) {
+        // no longer in the index, so removed by --clean-up
+      }
+    }
+    for (const auto& item : packItems) {
+      retryReset("upload", item.pathHash);
+      daemon->getStats()->record(Stats::UPLOAD, item.started,
+                                 item.location.length);
+      try {
+        remote->uploadSuccess(item.path, item.objectName, remoteID,
+                              item.fileHash);
+      } catch (const std::out_of_range& e) {
+        // no longer tracked
+      }
+    }
+  } catch (const std::exception& e) {
+    for (const auto& item : packItems) {
+      if (retryLater({"upload", item.path, item.pathHash, item.modtime}, e)) {
+        uploadRetries.emplace_back(item.path, item.pathHash, item.modtime);
+      }
+    }
+  }
+  string().swap(packBuffer);  // not held between upload passes
+  packItems.clear();
+  packNames.clear();
+}
+
+uint64_t Transfer::putPack(
+    const std::string& packName, std::string& data,
+    const std::vector<std::pair<std::string, PackedObject>>& objects) {
+  // the pack describes its own contents, see Pack.hpp
+  std::ostringstream index;
+  for (const auto& [objectName, location] : objects) {
+    index << objectName << " " << location.offset << " " << location.length
+          << "\n";
+  }
+  string text = index.str();
+  EncryptStream stream((const unsigned char*)text.data(), text.size(),
+                       daemon->getKey(), encryptOptions);
+  uint64_t indexOffset = data.size();
+  appendStream(stream, data);
+  uint64_t indexLength = data.size() - indexOffset;
+  for (int i = 0; i < 8; i++) {
+    data.push_back((char)(indexLength >> (8 * i)));
+  }
+  uint64_t size = data.size();
+
+  try {
+    objectStored(packName, size,
+                 backend->put(packName, std::make_shared<std::stringstream>(
+                                            std::move(data))));
+  } catch (const RemoteError& e) {
+    cout << "Transfer: Upload of pack " << packName << " failed - "
+         << e.what();
+    throw;
+  }
+  return size;
+}
+
+void Transfer::repackObjects() {
+  std::scoped_lock<std::mutex> guard(mtx);
+  for (const auto& oldPack : remote->getWatch()->packsToRepack()) {
+    auto objects = remote->getWatch()->packContents(oldPack);
+    if (objects.empty()) {
+      continue;
+    }
+
+    // objects are copied as they are, without decrypting them
+    string old;
+    try {
+      old = getObject(oldPack);
+    } catch (const std::exception& e) {
+      cout << "Transfer: Download of pack " << oldPack
+           << " to repack failed - " << e.what();
+      continue;
+    }
+
+    string packName = Encryption::hashPath("pack");
+    string data;
+    bool complete = true;
+    for (auto& [objectName, location] : objects) {
+      if (location.offset + location.length > old.size()) {
+        complete = false;
+        break;
+      }
+      data.append(old, location.offset, location.length);
+      location = {packName, data.size() - location.length, location.length};
+    }
+    if (!complete) {
+      cout << "Transfer: Pack " << oldPack
+           << " is shorter than its index - not repacked" << endl;
+      continue;
+    }
+
+    try {
+      uint64_t size = putPack(packName, data, objects);
+      size_t moved =
+          remote->getWatch()->packRepacked(oldPack, packName, size, objects);
+      cout << "Transfer: Repacked " << moved << " objects from " << oldPack
+           << " into " << packName << ", reclaiming "
+           << (int64_t)(old.size() - size) << " bytes" << endl;
+      if (moved == 0) {
+        deleteObject(packName);
+      }
+      // left for --clean-up if this fails, it's no longer in the index
+      deleteObject(oldPack);
+    } catch (const std::exception& e) {
+      continue;
+    }
+  }
+}
+
+void Transfer::appendStream(EncryptStream& stream, std::string& data) {
+  const size_t readSize = 64 * 1024;
+  while (!stream.eof()) {
+    size_t len = data.size();
+    data.resize(len + readSize);
+    data.resize(len + stream.read((unsigned char*)data.data() + len, readSize));
+  }
+}
+
+Transfer::PartPlan Transfer::planParts(uint64_t fileSize) const {
+  PartPlan plan{backend->partSize(), backend->partsInFlight()};
+  while (fileSize / plan.partSize >= TARGET_PARTS &&
+         plan.partSize < MAX_PART_SIZE) {
+    plan.partSize *= 2;
+  }
+  if (fileSize > uploadWindow) {
+    // uploaded on its own, see uploadFromQueue
+    size_t most = std::max(
+        plan.partsInFlight,
+        std::min(uploadConcurrency * plan.partsInFlight, MAX_PARTS_IN_FLIGHT));
+    plan.partsInFlight = std::clamp<uint64_t>(uploadWindow / plan.partSize,
+                                              plan.partsInFlight, most);
+  }
+  return plan;
+}
+
+string Transfer::uploadMultipart(PartialUpload& record, EncryptStream& stream,
+                                 const PartPlan& plan,
+                                 std::unique_ptr<Backend::Upload> upload,
+                                 std::shared_ptr<std::iostream> firstPart,
+                                 long long& encryptionTime) {
+  const string& objectName = record.objectName;
+  if (!upload) {
+    try {
+      upload = backend->startUpload(objectName);
+    } catch (const RemoteError& e) {
+      cout << e.what();
+      throw;
+    }
+    // without headers, an upload of a stream that can't be resumed is only
+    // recorded to be aborted after a restart
+    record.uploadID = upload->id();
+    record.headers.clear();
+    if (stream.resumable()) {
+      EncryptResume start = stream.resumePoint();
+      record.headers =
+          Encryption::base64_encode(start.headers.data(), start.headers.size());
+    }
+    record.started = std::time(nullptr);
+    record.parts.clear();
+    remote->getWatch()->uploadStarted(record);
+  }
+
+  // parts are uploaded asynchronously, while the next part is encrypted -
+  // each is recorded as soon as it is stored, whatever the order
+  std::deque<std::pair<int, std::future<string>>> inFlight;
+  std::vector<std::pair<int, string>> completed;
+  for (const auto& [number, part] : record.parts) {
+    completed.emplace_back(number, part.etag);
+  }
+  std::ostringstream error;
+  bool retry = true;
+
+  auto waitForPart = [&]() {
+    auto [number, etag] = std::move(inFlight.front());
+    inFlight.pop_front();
+    try {
+      completed.emplace_back(number, etag.get());
+    } catch (const std::exception& e) {
+      error << e.what();
+      retry = retry && RemoteError::retryable(e);
+      return false;
+    }
+    return true;
+  };
+  auto putPart = [this, upload = upload.get(), pathHash = record.pathHash](
+                     int number, std::shared_ptr<std::iostream> body,
+                     std::optional<PartialUpload::Part> part) {
+    string etag = upload->putPart(number, body);
+    if (part) {
+      part->etag = etag;
+      remote->getWatch()->partUploaded(pathHash, number, *part);
+    }
+    return etag;
+  };
+
+  bool success = true;
+  int partNumber = completed.size() + 1;
+  // of the next part
+  uint64_t firstSegment =
+      record.parts.empty() ? 0
+                           : record.parts.rbegin()->second.firstSegment +
+                                 record.parts.rbegin()->second.offsets.size();
+  std::shared_ptr<std::iostream> body = firstPart;
+  try {
+    if (!body) {
+      body = readPart(stream, plan.partSize, encryptionTime);
+    }
+    while (success) {
+      std::optional<PartialUpload::Part> part;
+      if (stream.resumable()) {
+        EncryptResume point = stream.resumePoint(firstSegment);
+        part = {"", point.firstSegment, std::move(point.offsets), point.end};
+        firstSegment = part->firstSegment + part->offsets.size();
+        if (part->offsets.empty() && stream.eof()) {
+          break;  // resumed after the last part
+        }
+      }
+      inFlight.emplace_back(partNumber,
+                            std::async(std::launch::async, putPart,
+                                       partNumber, body, std::move(part)));
+      partNumber++;
+
+      if (inFlight.size() >= plan.partsInFlight) {
+        success = waitForPart();
+      }
+      if (stream.eof()) {
+        break;
+      }
+      body = readPart(stream, plan.partSize, encryptionTime);
+    }
+  } catch (const std::exception& e) {
+    error << "Transfer: Multipart upload of " << objectName << " failed ("
+          << e.what() << ")" << endl;
+    success = false;
+  }
+  while (!inFlight.empty()) {
+    success = waitForPart() && success;  // always drain outstanding parts
+  }
+
+  if (success) {
+    try {
+      string etag = upload->complete(completed);
+      remote->getWatch()->uploadFinished(record.pathHash);
+      return etag;
+    } catch (const std::exception& e) {
+      error << e.what();
+      retry = RemoteError::retryable(e);
+    }
+  }
+
+  cout << error.str();
+  if (retry && stream.resumable()) {
+    // the retry carries on after the parts stored so far
+    throw RemoteError(error.str(), retry);
+  }
+  upload->abort();
+  remote->getWatch()->uploadFinished(record.pathHash);
+  throw RemoteError(error.str(), retry);
+}
+
+bool Transfer::resumeUpload(PartialUpload& record,
+                            std::unique_ptr<Backend::Upload>& upload,
+                            EncryptResume& resume) {
+  PartialUpload stored;
+  if (!remote->getWatch()->partialUpload(record.pathHash, stored)) {
+    return false;
+  }
+  if (stored.path != record.path || stored.modtime != record.modtime ||
+      stored.size != record.size || stored.objectName != record.objectName) {
+    discardUpload(stored, "the file has changed");
+    return false;
+  }
+  std::vector<std::pair<int, string>> listed;
+  try {
+    upload = backend->resumeUpload(stored.objectName, stored.uploadID);
+    listed = upload->parts();
+  } catch (const std::exception& e) {
+    upload.reset();
+    if (RemoteError::retryable(e)) {
+      cout << "Transfer: Unable to resume upload of " << record.path << " - "
+           << e.what();
+      throw;
+    }
+    // e.g. aborted by a lifecycle rule
+    cout << "Transfer: Upload of " << record.path
+         << " no longer exists - starting again" << endl;
+    remote->getWatch()->uploadFinished(stored.pathHash);
+    return false;
+  }
+
+  // the parts from 1 both recorded and stored, up to the first gap - those
+  // after it were in flight alongside a part that wasn't stored, and are put
+  // again
+  std::map<int, string> storedParts(listed.begin(), listed.end());
+  resume.headers.clear();
+  string headers = Encryption::base64_decode(stored.headers);
+  resume.headers.assign(headers.begin(), headers.end());
+  int number = 1;
+  for (const auto& [partNumber, part] : stored.parts) {
+    auto storedPart = storedParts.find(partNumber);
+    if (partNumber != number || storedPart == storedParts.end() ||
+        storedPart->second != part.etag ||
+        part.firstSegment != resume.offsets.size()) {
+      break;
+    }
+    resume.offsets.insert(resume.offsets.end(), part.offsets.begin(),
+                          part.offsets.end());
+    resume.end = part.end;
+    number++;
+  }
+  if (number == 1) {
+    upload.reset();
+    discardUpload(stored, "no parts were stored");
+    return false;
+  }
+  stored.parts.erase(stored.parts.lower_bound(number), stored.parts.end());
+  remote->getWatch()->partsDiscarded(stored.pathHash, number);
+  record = stored;
+  cout << "Transfer: Resuming upload of " << record.path << " as "
+       << record.objectName << " after part " << number - 1 << " ("
+       << (resume.headers.size() + resume.end) / (1024 * 1024)
+       << "MB stored)" << endl;
+  return true;
+}
+
+void Transfer::discardUpload(const PartialUpload& record,
+                             const string& reason) {
+  cout << "Transfer: Aborting interrupted upload of " << record.path << " - "
+       << reason << endl;
+  try {
+    backend->resumeUpload(record.objectName, record.uploadID)->abort();
+  } catch (const std::exception& e) {
+    cout << e.what();
+  }
+  remote->getWatch()->uploadFinished(record.pathHash);
+}
+
+void Transfer::cleanUpUploads() {
+  if (!uploadCleanup.valid()) {
+    uploadCleanup =
+        std::async(std::launch::async, &Transfer::abortOrphanedUploads, this);
+  }
+}
+
+void Transfer::abortOrphanedUploads() {
+  std::vector<Backend::PendingUpload> pending;
+  try {
+    pending = backend->listUploads();
+  } catch (const std::exception& e) {
+    cout << "Transfer: Unable to list uploads in progress - " << e.what();
+    return;
+  }
+  // recorded after the listing, so uploads completed meanwhile aren't taken
+  // for orphans
+  std::vector<PartialUpload> records = remote->getWatch()->getPartialUploads();
+  std::unordered_set<string> recorded;
+  for (const auto& record : records) {
+    recorded.insert(record.uploadID);
+  }
+
+  // uploads this run started are recorded as soon as they are started
+  size_t aborted = 0;
+  std::unordered_set<string> listed;
+  for (const auto& upload : pending) {
+    listed.insert(upload.id);
+    if (upload.started < runStarted && recorded.count(upload.id) == 0) {
+      try {
+        backend->resumeUpload(upload.objectName, upload.id)->abort();
+        aborted++;
+      } catch (const std::exception& e) {
+        cout << e.what();
+      }
+    }
+  }
+  for (const auto& record : records) {
+    if (record.started >= runStarted) {
+      continue;
+    }
+    std::error_code ec;
+    uint64_t size = fs::file_size(record.path, ec);
+    if (listed.count(record.uploadID) == 0) {
+      remote->getWatch()->uploadFinished(record.pathHash);  // gone already
+    } else if (ec || size != record.size ||
+               remote->getWatch()->fsLastMod(record.path) != record.modtime) {
+      discardUpload(record, "the file has changed");
+      aborted++;
+    }
+  }
+  if (aborted > 0) {
+    cout << "Transfer: aborted " << aborted << " abandoned uploads in "
+         << backend->name() << endl;
+  }
+}
+
+std::shared_ptr<std::iostream> Transfer::readPart(EncryptStream& stream,
+                                                  size_t partSize,
+                                                  long long& encryptionTime) {
+  auto t1 = std::chrono::high_resolution_clock::now();
+  string part(partSize, '\0');
+  size_t len = stream.read((unsigned char*)part.data(), part.size());
+  // parts of a resumable stream end with a whole segment, so an upload can
+  // carry on after any of them
+  if (len == part.size() && stream.resumable() && !stream.atSegmentEnd()) {
+    part.resize(len + stream.buffered());
+    len += stream.read((unsigned char*)part.data() + len, part.size() - len);
+  }
+  part.resize(len);
+  auto t2 = std::chrono::high_resolution_clock::now();
+  encryptionTime +=
+      std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
+  return std::make_shared<std::stringstream>(std::move(part));
+}
+
+string Transfer::downloadObject(const std::string& writeToPath,
+                                const std::string& objectName,
+                                std::time_t& originalModTime,
+                                std::string& targetPath) {
+  std::ostringstream ss;
+
+  // directories are created by downloadFromQueue
+  string downloadPath = restorePath(targetPath, writeToPath).second;
+
+  // decrypt into a sibling of the target, so the final rename is atomic and an
+  // unverified file never appears at downloadPath
+  string partialPath = downloadPath + encloned::PARTIAL_DOWNLOAD_SUFFIX;
+  string downloadedFileHash;
+
+  // hash with the algorithm the stored file hash was computed with
+  FileHasher::Algorithm hashAlgorithm = FileHasher::DEFAULT_ALGORITHM;
+  try {
+    hashAlgorithm = remote->getWatch()->hashAlgorithm(objectName);
+  } catch (const std::out_of_range& e) {
+    // object is no longer in the index - it fails verification below
+  }
+
+  auto t1 = std::chrono::high_resolution_clock::now();
+  auto chunks = remote->getWatch()->chunkList(objectName);
+  PackedObject packed;
+  if (remote->getWatch()->packedLocation(objectName, packed)) {
+    getObjectDecrypted(objectName, partialPath, downloadedFileHash,
+                       hashAlgorithm, &packed);
+  } else if (chunks.empty()) {
+    getObjectDecrypted(objectName, partialPath, downloadedFileHash,
+                       hashAlgorithm);
+  } else {
+    getChunksDecrypted(chunks, partialPath, downloadedFileHash,
+                       hashAlgorithm);
+  }
+  auto t2 = std::chrono::high_resolution_clock::now();
+  auto duration =
+      std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
+  decryptionQueueTime += duration;
+
+  ss << "Transfer: Download and decryption of " << objectName.substr(0, 10)
+     << "... to " << downloadPath;
+  // hash matches stored filehash
+  bool verified = false;
+  try {
+    verified = remote->getWatch()->verifyHash(objectName, downloadedFileHash);
+  } catch (const std::out_of_range& e) {
+    // object is no longer in the index - treat as unverified
+  }
+  if (!verified) {
+    ss << " failed - unable to verify hash" << endl;
+    fs::remove(partialPath);  // remove decrypted object
+    cout << ss.str();
+    throw RemoteError(ss.str(), false);
+  }
+  ss << " successful (" << duration << " microseconds) - file hash verified"
+     << endl;
+
+  // set the modtime back to the original value before the file is visible
+  fs::path fsPath = partialPath.c_str();
+  auto systime = std::chrono::system_clock::from_time_t(originalModTime);
+  std::filesystem::file_time_type fsModtime =
+      std::chrono::file_clock::from_sys(systime);
+  fs::last_write_time(fsPath, fsModtime);
+  std::error_code ec;
+  uint64_t size = fs::file_size(fsPath, ec);
+  fs::rename(partialPath, downloadPath);
+  daemon->getStats()->record(Stats::DOWNLOAD, duration, ec ? 0 : size);
+
+  cout << ss.str();
+  return ss.str();
+}
+
+string Transfer::downloadObject(const std::string& writeToPath,
+                                const std::string& objectName) {
+  std::ostringstream ss;
+  string partialPath = writeToPath + encloned::PARTIAL_DOWNLOAD_SUFFIX;
+  string fileHash;  // unused - no hash is stored for index backups
+
+  getObjectDecrypted(objectName, partialPath, fileHash,
+                     FileHasher::DEFAULT_ALGORITHM);
+  fs::rename(partialPath, writeToPath);
+
+  ss << "Transfer: Download and decryption of " << objectName.substr(0, 10)
+     << "... to " << writeToPath << " successful" << endl;
+  cout << ss.str();
+  return ss.str();
+}
+
+void Transfer::getObjectDecrypted(const std::string& objectName,
+                                  const std::string& writeToPath,
+                                  std::string& fileHash,
+                                  FileHasher::Algorithm hashAlgorithm,
+                                  const PackedObject* packed) {
+  std::ostringstream ss;
+  DecryptStreamBuf decryptBuf(writeToPath, daemon->getKey(),
+                              daemon->getDictionaries().get(), hashAlgorithm);
+
+  // the body is decrypted and hashed as it is received, from scratch each
+  // time the backend starts the read again
+  auto sink = [&decryptBuf]() -> std::streambuf* {
+    decryptBuf.reset();
+    return &decryptBuf;
+  };
+  try {
+    if (packed == NULL) {
+      backend->get(objectName, sink);
+    } else {
+      Backend::Range range{packed->offset, packed->length};
+      backend->get(packed->pack, sink, &range);
+    }
+  } catch (const RemoteError& e) {
+    string unused;
+    decryptBuf.finish(unused);
+    fs::remove(writeToPath);
+    cout << e.what();
+    throw;
+  }
+
+  if (decryptBuf.finish(fileHash) != 0) {
+    fs::remove(writeToPath);
+    ss << "Transfer: Decryption of " << objectName << " to " << writeToPath
+       << " failed" << endl;
+    cout << ss.str();
+    throw RemoteError(ss.str(), false);
+  }
+}
+
+void Transfer::getChunksDecrypted(
+    const std::vector<std::pair<std::string, uint64_t>>& chunks,
+    const std::string& writeToPath, std::string& fileHash,
+    FileHasher::Algorithm hashAlgorithm) {
+  std::ostringstream ss;
+  FILE* fp_t = fopen(writeToPath.c_str(), "wb");
+  if (fp_t == NULL) {
+    ss << "Transfer: Unable to open " << writeToPath << " for writing" << endl;
+    cout << ss.str();
+    throw RemoteError(ss.str(), false);
+  }
+  fclose(fp_t);
+
+  // returns an error message, empty if the chunk was written and verified
+  std::atomic_bool retry = true;
+  auto fetch = [&](const string& objectName, uint64_t offset) -> string {
+    string body;
+    try {
+      body = getObject(objectName);
+    } catch (const std::exception& e) {
+      if (!RemoteError::retryable(e)) {
+        retry = false;
+      }
+      return "Transfer: Download of chunk " + objectName + " failed - " +
+             e.what();
+    }
+
+    std::unique_ptr<FILE, int (*)(FILE*)> file(
+        fopen(writeToPath.c_str(), "r+b"), fclose);
+    if (!file || fseeko(file.get(), (off_t)offset, SEEK_SET) != 0) {
+      return "Transfer: Unable to write chunk " + objectName + "\n";
+    }
+    FileHasher chunkHasher(FileHasher::BLAKE2B);
+    DecryptStream stream(file.get(), daemon->getKey(), &chunkHasher,
+                         daemon->getDictionaries().get());
+    stream.write((const unsigned char*)body.data(), body.size());
+    if (stream.finish() != 0 || fflush(file.get()) != 0) {
+      retry = false;
+      return "Transfer: Decryption of chunk " + objectName + " failed\n";
+    }
+    if (!remote->getWatch()->verifyHash(objectName, chunkHasher.final())) {
+      retry = false;
+      return "Transfer: Chunk " + objectName + " failed hash verification\n";
+    }
+    return "";
+  };
+
+  std::deque<std::future<string>> inFlight;
+  string error;
+  uint64_t offset = 0;
+  for (const auto& [objectName, size] : chunks) {
+    if (inFlight.size() >= backend->partsInFlight()) {
+      error += inFlight.front().get();
+      inFlight.pop_front();
+    }
+    if (!error.empty()) {
+      break;
+    }
+    inFlight.push_back(
+        std::async(std::launch::async, fetch, objectName, offset));
+    offset += size;
+  }
+  while (!inFlight.empty()) {
+    error += inFlight.front().get();  // always wait for outstanding chunks
+    inFlight.pop_front();
+  }
+  if (!error.empty()) {
+    fs::remove(writeToPath);
+    cout << error;
+    throw RemoteError(error, retry);
+  }
+
+  // the whole file, to check against the index
+  fileHash = Encryption::hashFile(writeToPath, hashAlgorithm,
+                                  encryptOptions.threads);
+}
+
+string Transfer::getObject(const std::string& objectName) {
+  std::stringstream body;
+  backend->get(objectName, [&body]() {
+    body.str("");
+    return body.rdbuf();
+  });
+  return body.str();
+}
+
+bool Transfer::retryDue(const string& operation, const string& objectName,
+                  bool retriesOnly) {
+  std::scoped_lock<std::mutex> guard(retryMtx);
+  auto it = retries.find(operation + "|" + objectName);
+  if (it == retries.end()) {
+    return !retriesOnly;
+  }
+  return it->second.due <= std::time(nullptr);
+}
+
+bool Transfer::retryLater(FailedItem item, const std::exception& error) {
+  std::scoped_lock<std::mutex> guard(retryMtx);
+  string key = item.operation + "|" + item.objectName;
+  Retry& retry = retries[key];
+  retry.attempts++;
+  if (RemoteError::retryable(error) && retry.attempts < MAX_ATTEMPTS) {
+    // exponential backoff, with jitter so items that failed together (e.g.
+    // during an outage) aren't all retried at once
+    std::time_t delay =
+        std::min(RETRY_MAX_DELAY, RETRY_BASE_DELAY << (retry.attempts - 1));
+    retry.due = std::time(nullptr) + delay / 2 +
+                randombytes_uniform((uint32_t)(delay / 2 + 1));
+    return true;
+  }
+  item.error = error.what();
+  while (!item.error.empty() && item.error.back() == '\n') {
+    item.error.pop_back();
+  }
+  item.attempts = retry.attempts;
+  item.failed = std::time(nullptr);
+  retries.erase(key);
+  cout << "Transfer: " << item.operation << " of "
+       << (item.path.empty() ? item.objectName : item.path) << " failed after "
+       << item.attempts << " attempt/s - see enclone --failed" << endl;
+  deadLetters.push_back(item);
+  if (deadLetters.size() > MAX_DEAD_LETTERS) {
+    deadLetters.pop_front();
+  }
+  return false;
+}
+
+void Transfer::retryReset(const string& operation, const string& objectName) {
+  std::scoped_lock<std::mutex> guard(retryMtx);
+  retries.erase(operation + "|" + objectName);
+}
+
+string Transfer::failedItems(bool retry) {
+  std::deque<FailedItem> items;
+  {
+    std::scoped_lock<std::mutex> guard(retryMtx);
+    if (retry) {
+      items.swap(deadLetters);
+    } else {
+      items = deadLetters;
+    }
+  }
+  if (items.empty()) {
+    return "Transfer: no failed uploads, downloads or deletes\n";
+  }
+  std::ostringstream ss;
+  for (const auto& item : items) {
+    string name = item.path.empty() ? item.objectName : item.path;
+    if (!retry) {
+      ss << item.operation << " : " << name << " : "
+         << remote->getWatch()->displayTime(item.failed) << " : "
+         << item.attempts << " attempt/s : " << item.error << endl;
+      continue;
+    }
+    if (item.operation == "upload") {
+      enqueueUpload(item.path, item.objectName, item.modtime);
+    } else if (item.operation == "download") {
+      enqueueDownload(item.path, item.objectName, item.modtime,
+                      item.targetPath);
+    } else {
+      enqueueDelete(item.objectName);
+    }
+    ss << "Transfer: " << item.operation << " of " << name << " queued again"
+       << endl;
+  }
+  return ss.str();
+}
+
+string Transfer::deleteObject(const std::string& objectName) {
+  std::ostringstream ss;
+  auto failed = backend->remove({objectName});
+  if (!failed.empty()) {
+    cout << failed.front().second.what();
+    throw failed.front().second;
+  }
+  ss << "Transfer: Delete of " << objectName << " successful" << endl;
+  remote->getWatch()->inventoryDeleted(objectName);
+  return ss.str();
+}
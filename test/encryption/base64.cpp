@@ -0,0 +1,137 @@
+#include <encloned/Base64.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// differential test of every Base64 implementation this CPU supports against
+// the original scalar encloned versions, followed by a microbenchmark
+// g++ base64.cpp ../../src/Base64.cpp -I../../include -o base64 -std=c++20 -O2
+
+using namespace std;
+
+static const char alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+// reference: Encryption::base64_encode(const std::string &), unpadded
+string refEncode(const string &in) {
+  string out;
+  int val = 0, valb = -6;
+  for (unsigned char c : in) {
+    val = (val << 8) + c;
+    valb += 8;
+    while (valb >= 0) {
+      out.push_back(alphabet[(val >> valb) & 0x3F]);
+      valb -= 6;
+    }
+  }
+  if (valb > -6) {
+    out.push_back(alphabet[((val << 8) >> (valb + 8)) & 0x3F]);
+  }
+  return out;
+}
+
+// reference: Encryption::base64_encode(unsigned char const *, unsigned int)
+string refEncodePadded(unsigned char const *bytes, unsigned int len) {
+  string ret;
+  int i = 0, j = 0;
+  unsigned char a3[3], a4[4];
+  while (len--) {
+    a3[i++] = *(bytes++);
+    if (i == 3) {
+      a4[0] = (a3[0] & 0xfc) >> 2;
+      a4[1] = ((a3[0] & 0x03) << 4) + ((a3[1] & 0xf0) >> 4);
+      a4[2] = ((a3[1] & 0x0f) << 2) + ((a3[2] & 0xc0) >> 6);
+      a4[3] = a3[2] & 0x3f;
+      for (i = 0; i < 4; i++) ret += alphabet[a4[i]];
+      i = 0;
+    }
+  }
+  if (i) {
+    for (j = i; j < 3; j++) a3[j] = '\0';
+    a4[0] = (a3[0] & 0xfc) >> 2;
+    a4[1] = ((a3[0] & 0x03) << 4) + ((a3[1] & 0xf0) >> 4);
+    a4[2] = ((a3[1] & 0x0f) << 2) + ((a3[2] & 0xc0) >> 6);
+    for (j = 0; j < i + 1; j++) ret += alphabet[a4[j]];
+    while (i++ < 3) ret += '=';
+  }
+  return ret;
+}
+
+// reference: Encryption::base64_decode
+string refDecode(const string &in) {
+  string out;
+  vector<int> T(256, -1);
+  for (int i = 0; i < 64; i++) T[alphabet[i]] = i;
+  int val = 0, valb = -8;
+  for (unsigned char c : in) {
+    if (T[c] == -1) break;
+    val = (val << 6) + T[c];
+    valb += 6;
+    if (valb >= 0) {
+      out.push_back(char((val >> valb) & 0xFF));
+      valb -= 8;
+    }
+  }
+  return out;
+}
+
+const char *name(Base64::Implementation impl) {
+  return impl == Base64::AVX2 ? "avx2" : impl == Base64::SSSE3 ? "ssse3" : "scalar";
+}
+
+int main() {
+  vector<Base64::Implementation> impls;
+  for (auto impl : {Base64::SCALAR, Base64::SSSE3, Base64::AVX2}) {
+    if (Base64::supported(impl)) impls.push_back(impl);
+  }
+
+  mt19937 rng(42);
+  int failures = 0;
+  for (int iter = 0; iter < 200000; iter++) {
+    size_t len = iter < 1000 ? iter % 200 : rng() % 2000;
+    string in(len, '\0');
+    for (auto &c : in) c = (char)rng();
+    string enc = refEncode(in);
+    string encPadded = refEncodePadded((const unsigned char *)in.data(), len);
+
+    // valid input, with invalid characters (or padding) somewhere in some
+    string dec = enc;
+    if (iter % 3 == 1 && !dec.empty()) dec[rng() % dec.size()] = "=+/ \n\x80\xff"[rng() % 7];
+    if (iter % 3 == 2) dec = encPadded;
+
+    for (auto impl : impls) {
+      if (Base64::encode((const unsigned char *)in.data(), len, false, impl) != enc ||
+          Base64::encode((const unsigned char *)in.data(), len, true, impl) != encPadded ||
+          Base64::decode(dec, impl) != refDecode(dec)) {
+        if (failures++ < 10) cout << name(impl) << " mismatch at length " << len << endl;
+      }
+    }
+  }
+  cout << (failures ? "FAILED" : "all implementations match") << endl;
+
+  // object names are base64 of 66 bytes, and derived keys/salts are similar
+  struct Case { const char *what; size_t bytes; int reps; };
+  for (auto c : {Case{"88 char names", 66, 2000000}, Case{"1M buffer", 1 << 20, 200}}) {
+    string in(c.bytes, '\0');
+    for (auto &ch : in) ch = (char)rng();
+    string enc = refEncode(in);
+    for (auto impl : impls) {
+      auto t1 = chrono::high_resolution_clock::now();
+      size_t sink = 0;
+      for (int i = 0; i < c.reps; i++)
+        sink += Base64::encode((const unsigned char *)in.data(), in.size(), false, impl).size();
+      auto t2 = chrono::high_resolution_clock::now();
+      for (int i = 0; i < c.reps; i++) sink += Base64::decode(enc, impl).size();
+      auto t3 = chrono::high_resolution_clock::now();
+      double bytes = (double)c.bytes * c.reps;
+      cout << c.what << " " << name(impl) << ": encode "
+           << bytes / chrono::duration<double, micro>(t2 - t1).count() << " MB/s, decode "
+           << bytes / chrono::duration<double, micro>(t3 - t2).count() << " MB/s"
+           << (sink == 0 ? " " : "") << endl;
+    }
+  }
+  return failures ? 1 : 0;
+}
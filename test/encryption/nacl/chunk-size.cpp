@@ -0,0 +1,71 @@
+#include <sodium.h>
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+// measure secretstream encrypt/decrypt throughput and size overhead for
+// different chunk sizes, entirely in memory (no file IO)
+// g++ chunk-size.cpp -o chunk-size -std=c++17 -O2 -lsodium
+
+const size_t TOTAL_SIZE = 256 * 1024 * 1024;  // plaintext size per run
+
+int main() {
+  if (sodium_init() != 0) {
+    return 1;
+  }
+  unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES];
+  crypto_secretstream_xchacha20poly1305_keygen(key);
+
+  std::vector<unsigned char> plaintext(TOTAL_SIZE);
+  randombytes_buf(plaintext.data(), plaintext.size());
+
+  std::cout << "chunk size, encrypt MB/s, decrypt MB/s, overhead %" << std::endl;
+  for (size_t chunkSize = 4 * 1024; chunkSize <= 4 * 1024 * 1024;
+       chunkSize *= 2) {
+    size_t chunks = TOTAL_SIZE / chunkSize;
+    std::vector<unsigned char> ciphertext(
+        TOTAL_SIZE + chunks * crypto_secretstream_xchacha20poly1305_ABYTES);
+    std::vector<unsigned char> decrypted(chunkSize);
+    unsigned char header[crypto_secretstream_xchacha20poly1305_HEADERBYTES];
+    crypto_secretstream_xchacha20poly1305_state st;
+    unsigned long long out_len;
+    unsigned char tag;
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    crypto_secretstream_xchacha20poly1305_init_push(&st, header, key);
+    unsigned char* out = ciphertext.data();
+    for (size_t i = 0; i < chunks; i++) {
+      tag = (i == chunks - 1) ? crypto_secretstream_xchacha20poly1305_TAG_FINAL
+                              : 0;
+      crypto_secretstream_xchacha20poly1305_push(
+          &st, out, &out_len, plaintext.data() + i * chunkSize, chunkSize,
+          NULL, 0, tag);
+      out += out_len;
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+
+    crypto_secretstream_xchacha20poly1305_init_pull(&st, header, key);
+    const unsigned char* in = ciphertext.data();
+    size_t inChunk = chunkSize + crypto_secretstream_xchacha20poly1305_ABYTES;
+    for (size_t i = 0; i < chunks; i++) {
+      if (crypto_secretstream_xchacha20poly1305_pull(
+              &st, decrypted.data(), &out_len, &tag, in, inChunk, NULL, 0) !=
+          0) {
+        std::cout << "decryption failed" << std::endl;
+        return 1;
+      }
+      in += inChunk;
+    }
+    auto t3 = std::chrono::high_resolution_clock::now();
+
+    double mb = TOTAL_SIZE / (1024.0 * 1024.0);
+    double encryptSecs = std::chrono::duration<double>(t2 - t1).count();
+    double decryptSecs = std::chrono::duration<double>(t3 - t2).count();
+    double overhead =
+        100.0 * (chunks * crypto_secretstream_xchacha20poly1305_ABYTES) /
+        TOTAL_SIZE;
+    std::cout << chunkSize / 1024 << "K, " << mb / encryptSecs << ", "
+              << mb / decryptSecs << ", " << overhead << std::endl;
+  }
+}
@@ -0,0 +1,74 @@
+#include <encloned/ChunkCipher.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+// per-core encrypt/decrypt throughput of each ChunkCipher suite at the chunk
+// sizes allowed by chunk_size, entirely in memory (no file IO). Suites this
+// CPU doesn't support are skipped
+// g++ cipher-suites.cpp ../../../src/ChunkCipher.cpp -I../../../include -o cipher-suites -std=c++17 -O2 -lsodium
+
+const size_t TOTAL_SIZE = 256 * 1024 * 1024;  // plaintext size per run
+
+int main() {
+  if (sodium_init() != 0) {
+    return 1;
+  }
+  unsigned char key[ChunkCipher::KEYBYTES];
+  randombytes_buf(key, sizeof key);
+
+  std::vector<unsigned char> plaintext(TOTAL_SIZE);
+  randombytes_buf(plaintext.data(), plaintext.size());
+
+  std::cout << "cipher, chunk size, encrypt MB/s, decrypt MB/s" << std::endl;
+  for (uint8_t cipher : {ChunkCipher::XCHACHA20POLY1305, ChunkCipher::AES256GCM}) {
+    if (!ChunkCipher::available(cipher)) {
+      std::cout << ChunkCipher::name(cipher) << " not supported on this CPU"
+                << std::endl;
+      continue;
+    }
+    for (size_t chunkSize = 4 * 1024; chunkSize <= 4 * 1024 * 1024;
+         chunkSize *= 4) {
+      size_t chunks = TOTAL_SIZE / chunkSize;
+      std::vector<unsigned char> ciphertext(TOTAL_SIZE +
+                                            chunks * ChunkCipher::ABYTES);
+      std::vector<unsigned char> decrypted(chunkSize);
+      unsigned char header[ChunkCipher::HEADERBYTES];
+      ChunkCipher st;
+      unsigned long long out_len;
+      unsigned char tag;
+
+      auto t1 = std::chrono::high_resolution_clock::now();
+      st.initPush(cipher, header, key);
+      unsigned char* out = ciphertext.data();
+      for (size_t i = 0; i < chunks; i++) {
+        tag = (i == chunks - 1) ? ChunkCipher::TAG_FINAL : 0;
+        st.push(out, &out_len, plaintext.data() + i * chunkSize, chunkSize,
+                NULL, 0, tag);
+        out += out_len;
+      }
+      auto t2 = std::chrono::high_resolution_clock::now();
+
+      st.initPull(cipher, header, key);
+      const unsigned char* in = ciphertext.data();
+      size_t inChunk = chunkSize + ChunkCipher::ABYTES;
+      for (size_t i = 0; i < chunks; i++) {
+        if (st.pull(decrypted.data(), &out_len, &tag, in, inChunk, NULL, 0) !=
+            0) {
+          std::cout << "decryption failed" << std::endl;
+          return 1;
+        }
+        in += inChunk;
+      }
+      auto t3 = std::chrono::high_resolution_clock::now();
+
+      double mb = TOTAL_SIZE / (1024.0 * 1024.0);
+      double encryptSecs = std::chrono::duration<double>(t2 - t1).count();
+      double decryptSecs = std::chrono::duration<double>(t3 - t2).count();
+      std::cout << ChunkCipher::name(cipher) << ", " << chunkSize / 1024
+                << "K, " << mb / encryptSecs << ", " << mb / decryptSecs
+                << std::endl;
+    }
+  }
+}
@@ -0,0 +1,45 @@
+#include <encloned/EncryptionStream.hpp>
+
+#include <iostream>
+
+// new objects must record the cipher suite they were encrypted with in their
+// header - objects in the wrong suite are still readable, so it would go
+// unnoticed. Suites this CPU doesn't support are skipped
+// g++ object-cipher.cpp ../../../src/Encryption.cpp ../../../src/Base64.cpp ../../../src/ChunkCipher.cpp ../../../src/EncryptionStream.cpp ../../../src/Segment.cpp ../../../src/Compression.cpp ../../../src/Dictionaries.cpp ../../../src/FileHasher.cpp -I../../../include -o object-cipher -std=c++20 -lsodium -lzstd -pthread
+
+int main() {
+  if (sodium_init() != 0) {
+    return 1;
+  }
+  unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES];
+  randombytes_buf(key, sizeof key);
+
+  int failed = 0;
+  for (uint8_t cipher : {ChunkCipher::XCHACHA20POLY1305, ChunkCipher::AES256GCM}) {
+    if (!ChunkCipher::available(cipher)) {
+      std::cout << ChunkCipher::name(cipher) << " not supported on this CPU"
+                << std::endl;
+      continue;
+    }
+    EncryptOptions options;
+    options.cipher = cipher;
+    const unsigned char byte = 0;
+    EncryptStream stream(&byte, 1, key, options);
+
+    unsigned char headerBytes[ObjectHeader::BYTES];
+    ObjectHeader header;
+    if (stream.read(headerBytes, sizeof headerBytes) != sizeof headerBytes ||
+        !header.parse(headerBytes) || !header.valid()) {
+      std::cout << ChunkCipher::name(cipher) << ": no object header"
+                << std::endl;
+      failed++;
+    } else if (header.cipher != cipher) {
+      std::cout << ChunkCipher::name(cipher) << ": header records "
+                << ChunkCipher::name(header.cipher) << std::endl;
+      failed++;
+    } else {
+      std::cout << ChunkCipher::name(cipher) << ": ok" << std::endl;
+    }
+  }
+  return failed;
+}